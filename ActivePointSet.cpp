@@ -0,0 +1,155 @@
+#include "ActivePointSet.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <utility>
+
+ActivePointSet::ActivePointSet(): m_synced(false), m_frame(0), m_trackedCount(0) {
+
+}
+
+void ActivePointSet::rebuild(const std::vector<Trajectory> &trajectories, size_t frameNumber,
+                             bool trackOnlyActive, int activePoint) {
+    m_positions.clear();
+    m_ids.clear();
+    m_lostIds.clear();
+    m_slot.assign(trajectories.size(), -1);
+    m_trackedCount = 0;
+
+    for (size_t i = 0; i < trajectories.size(); i++) {
+        const Trajectory &o = trajectories[i];
+        if (!o.hasValuesAtFrame(frameNumber)) {
+            continue;
+        }
+        const InterestPointStatus status = o.getStatus(frameNumber);
+        if (status == InterestPointStatus::Valid || status == InterestPointStatus::Not_Tracked) {
+            const bool tracked = status == InterestPointStatus::Valid &&
+                    (!trackOnlyActive || static_cast<int>(i) == activePoint);
+            insertOrUpdate(i, o.getPosition(frameNumber), tracked);
+        } else if (status == InterestPointStatus::Invalid) {
+            m_lostIds.push_back(i);
+        }
+    }
+
+    m_frame = frameNumber;
+    m_synced = true;
+}
+
+void ActivePointSet::insertOrUpdate(size_t id, cv::Point2f position, bool tracked) {
+    if (id >= m_slot.size()) {
+        m_slot.resize(id + 1, -1);
+    }
+    if (m_slot[id] < 0) {
+        append(id, position);
+    }
+
+    size_t entry = static_cast<size_t>(m_slot[id]);
+    m_positions[entry] = position;
+
+    // move the entry over the border between the tracked and the passive part
+    if (tracked && entry >= m_trackedCount) {
+        swapEntries(entry, m_trackedCount);
+        m_trackedCount++;
+    } else if (!tracked && entry < m_trackedCount) {
+        m_trackedCount--;
+        swapEntries(entry, m_trackedCount);
+    }
+}
+
+void ActivePointSet::remove(size_t id) {
+    if (id < m_slot.size() && m_slot[id] >= 0) {
+        removeEntry(static_cast<size_t>(m_slot[id]));
+    }
+}
+
+void ActivePointSet::addLost(size_t id) {
+    // only single edits get here, the list is short
+    if (std::find(m_lostIds.begin(), m_lostIds.end(), id) == m_lostIds.end()) {
+        m_lostIds.push_back(id);
+    }
+}
+
+bool ActivePointSet::commit(std::vector<Trajectory> &trajectories, size_t frameNumber) {
+    assert(m_nextPositions.size() >= m_trackedCount);
+    assert(m_lkStatus.size() >= m_trackedCount);
+
+    bool somePointsAreInvalid = false;
+    m_lostIds.clear();
+
+    // passive points are carried over as they are
+    for (size_t entry = m_trackedCount; entry < m_positions.size(); entry++) {
+        trajectories[m_ids[entry]].add(frameNumber, m_positions[entry], InterestPointStatus::Not_Tracked);
+    }
+
+    // tracked points: iterate backwards so removing (swapping in the last
+    // tracked entry) does not skip anything
+    for (size_t entry = m_trackedCount; entry-- > 0;) {
+        Trajectory &o = trajectories[m_ids[entry]];
+        if (m_lkStatus[entry]) {
+            m_positions[entry] = m_nextPositions[entry];
+            o.add(frameNumber, m_positions[entry], InterestPointStatus::Valid);
+        } else {
+            o.add(frameNumber, m_nextPositions[entry], InterestPointStatus::Invalid);
+            somePointsAreInvalid = true;
+            m_lostIds.push_back(m_ids[entry]);
+            removeEntry(entry);
+        }
+    }
+
+    m_frame = frameNumber;
+    m_synced = true;
+    return somePointsAreInvalid;
+}
+
+float ActivePointSet::maxDisplacement() const {
+    assert(m_nextPositions.size() >= m_trackedCount);
+    assert(m_lkStatus.size() >= m_trackedCount);
+
+    float largest = 0.f;
+    for (size_t entry = 0; entry < m_trackedCount; entry++) {
+        if (m_lkStatus[entry]) {
+            const cv::Point2f d = m_nextPositions[entry] - m_positions[entry];
+            largest = std::max(largest, d.x * d.x + d.y * d.y);
+        }
+    }
+    return std::sqrt(largest);
+}
+
+cv::Mat ActivePointSet::trackedPositions() {
+    if (m_trackedCount == 0) {
+        return cv::Mat();
+    }
+    return cv::Mat(static_cast<int>(m_trackedCount), 1, CV_32FC2, m_positions.data());
+}
+
+void ActivePointSet::swapEntries(size_t a, size_t b) {
+    if (a == b) {
+        return;
+    }
+    std::swap(m_positions[a], m_positions[b]);
+    std::swap(m_ids[a], m_ids[b]);
+    m_slot[m_ids[a]] = static_cast<int>(a);
+    m_slot[m_ids[b]] = static_cast<int>(b);
+}
+
+void ActivePointSet::append(size_t id, cv::Point2f position) {
+    m_slot[id] = static_cast<int>(m_positions.size());
+    m_positions.push_back(position);
+    m_ids.push_back(id);
+}
+
+void ActivePointSet::removeEntry(size_t entry) {
+    // keep the tracked entries in front: first fill the hole with the last
+    // tracked entry, then that hole with the very last entry
+    if (entry < m_trackedCount) {
+        m_trackedCount--;
+        swapEntries(entry, m_trackedCount);
+        entry = m_trackedCount;
+    }
+    swapEntries(entry, m_positions.size() - 1);
+
+    m_slot[m_ids.back()] = -1;
+    m_positions.pop_back();
+    m_ids.pop_back();
+}
@@ -0,0 +1,145 @@
+#pragma once
+
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include "Trajectory.h"
+
+/**
+ * @brief The ActivePointSet class
+ * The working set of LucasKanadeCore::track(): all points that are alive
+ * (Valid or Not_Tracked) at a single frame, kept between calls so that a
+ * tracking step does not have to scan and copy all trajectories.
+ *
+ * The positions are stored contiguously; the first trackedCount() entries
+ * are handed to the LK tracker, the remaining (passive) ones are carried
+ * over to the next frame as Not_Tracked. ids() maps an entry to its
+ * trajectory id and a per-id slot table answers the reverse question.
+ *
+ * Next to them the set lists the points that were lost (Invalid) at its
+ * frame, so together they are everything the overlay draws of that frame.
+ *
+ * The set is only valid for the frame it is synced to; edits at that frame
+ * have to be forwarded via insertOrUpdate()/remove()/addLost(), everything
+ * else can simply invalidate() it, the next track() will then rebuild it.
+ */
+class ActivePointSet {
+public:
+    ActivePointSet();
+
+    bool isSyncedTo(size_t frameNumber) const {
+        return m_synced && m_frame == frameNumber;
+    }
+
+    void invalidate() {
+        m_synced = false;
+    }
+
+    /**
+     * @brief rebuild
+     * collects all alive points of the given frame from the trajectories
+     * @param activePoint id of the active point (-1 if there is none)
+     */
+    void rebuild(const std::vector<Trajectory> &trajectories, size_t frameNumber,
+                 bool trackOnlyActive, int activePoint);
+
+    /**
+     * @brief insertOrUpdate
+     * adds the point or changes its position/partition
+     * @param tracked true if the point should be tracked, false if it is
+     * just carried over (Not_Tracked)
+     */
+    void insertOrUpdate(size_t id, cv::Point2f position, bool tracked);
+
+    /**
+     * @brief remove
+     * removes the point from the set (if it is part of it)
+     */
+    void remove(size_t id);
+
+    /**
+     * @brief addLost
+     * lists a point that became Invalid at the frame of the set (after
+     * remove())
+     */
+    void addLost(size_t id);
+
+    /**
+     * @brief commit
+     * writes the result of the LK step (nextPositions() and lkStatus() for
+     * the tracked entries) to the trajectories at frameNumber, drops lost
+     * points and syncs the set to frameNumber
+     * @return true if some points became invalid
+     */
+    bool commit(std::vector<Trajectory> &trajectories, size_t frameNumber);
+
+    size_t size() const {
+        return m_positions.size();
+    }
+
+    size_t trackedCount() const {
+        return m_trackedCount;
+    }
+
+    const std::vector<cv::Point2f> &positions() const {
+        return m_positions;
+    }
+
+    const std::vector<size_t> &ids() const {
+        return m_ids;
+    }
+
+    /**
+     * @brief lostIds
+     * @return the points lost at the frame of the set; an id may have been
+     * edited back to life since, so check its status before using it
+     */
+    const std::vector<size_t> &lostIds() const {
+        return m_lostIds;
+    }
+
+    /**
+     * @brief trackedPositions
+     * @return a header (no copy) over the positions of the tracked entries
+     */
+    cv::Mat trackedPositions();
+
+    /**
+     * @brief maxDisplacement
+     * @return the largest distance a tracked entry moved in the last LK step
+     * (entries that were lost are ignored), call before commit()
+     */
+    float maxDisplacement() const;
+
+    // output buffers of the LK step, their capacity is kept between frames
+    std::vector<cv::Point2f> &nextPositions() {
+        return m_nextPositions;
+    }
+
+    std::vector<uchar> &lkStatus() {
+        return m_lkStatus;
+    }
+
+    std::vector<float> &lkError() {
+        return m_lkError;
+    }
+
+private:
+    bool					m_synced;
+    size_t					m_frame;	// the frame the set represents
+
+    std::vector<cv::Point2f> m_positions;
+    std::vector<size_t>		m_ids;		// entry => trajectory id
+    std::vector<int>		m_slot;		// trajectory id => entry (-1 if not alive)
+    std::vector<size_t>		m_lostIds;	// Invalid at m_frame
+    size_t					m_trackedCount;
+
+    std::vector<cv::Point2f> m_nextPositions;
+    std::vector<uchar>		m_lkStatus;
+    std::vector<float>		m_lkError;
+
+    void swapEntries(size_t a, size_t b);
+    void append(size_t id, cv::Point2f position);
+    void removeEntry(size_t entry);
+};
@@ -0,0 +1,453 @@
+#include "BatchScheduler.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+
+#include "LucasKanadeCore.h"
+#include "TrajectoryExporter.h"
+#include "TrajectoryFile.h"
+
+namespace {
+
+const char *const doneState = "done";
+
+const size_t noCheckpoint = static_cast<size_t>(-1);
+
+/**
+ * @brief partialPath
+ * @return the checkpoint file of the job at the given frame; a new one is
+ * written next to the old one, so the state file always names a complete
+ * checkpoint
+ */
+std::string partialPath(const BatchJob &job, size_t frameNumber) {
+    return job.outputPath + ".partial-" + std::to_string(frameNumber) + ".lkt";
+}
+
+/**
+ * @brief addSeeds
+ * adds the seeds of the frame (after it was tracked) and the corners of
+ * the first frame, like the single video mode of the command line tool
+ */
+void addSeeds(const BatchJob &job, LucasKanadeCore &core, size_t frameNumber, const cv::Mat &frame) {
+    auto seedsAtFrame = job.seeds.find(frameNumber);
+    if (seedsAtFrame != job.seeds.end()) {
+        core.resyncPreviousFrame(frameNumber, frame);
+        for (const cv::Point2f &seed : seedsAtFrame->second) {
+            core.tryCreateNewPoint(frameNumber, seed); // seeds too close to a point are dropped
+        }
+    }
+    if (job.autoSeed && frameNumber == job.firstFrame) {
+        core.autoFindInitPoints(frameNumber, frame, job.autoSeedCount);
+    }
+}
+
+} // namespace
+
+/**
+ * @brief The BatchScheduler::Session struct
+ * the state of one running job
+ */
+struct BatchScheduler::Session {
+    size_t				job = 0;
+    LucasKanadeCore		core;
+    cv::VideoCapture	capture;
+    // the core may keep a header over the previous frame, so the frames
+    // alternate between two buffers
+    cv::Mat				frames[2];
+    size_t				nextFrame = 0;
+    size_t				frameCount = 0;		// 0 if unknown
+    size_t				nextCheckpoint = 0;	// frame number
+    size_t				checkpoint = noCheckpoint; // the frame of the last checkpoint file
+};
+
+BatchScheduler::BatchScheduler(const Settings &settings):
+    m_settings(settings),
+    m_workerCount(settings.threadCount),
+    m_maxSessions(settings.maxSessions)
+{
+    if (m_workerCount == 0) {
+        m_workerCount = std::max<size_t>(1, std::thread::hardware_concurrency());
+    }
+    if (m_maxSessions == 0) {
+        m_maxSessions = 2 * m_workerCount;
+    }
+}
+
+bool BatchScheduler::configure(const BatchJob &job, LucasKanadeCore &core, std::string *error) {
+    if (job.winSize > 0) {
+        core.setWinSize(job.winSize);
+    }
+    core.setThreadCount(job.threadCount);
+    core.setUseNativeKernel(job.useNativeKernel);
+    core.setAdaptivePyramid(job.adaptivePyramid);
+    core.setRegionTracking(job.regionTracking);
+    core.setReplenishTarget(job.replenishTarget);
+    core.setMemoryBudget(job.memoryBudget);
+    core.setDownscale(job.downscale);
+    core.setInputFormat(job.inputFormat);
+    // the frames alternate between two buffers
+    core.setStableInput(true);
+    if (!job.arenaPath.empty()) {
+        const cv::Mat arena = cv::imread(job.arenaPath, cv::IMREAD_GRAYSCALE);
+        if (arena.empty()) {
+            if (error) {
+                *error = "cannot read arena mask " + job.arenaPath;
+            }
+            return false;
+        }
+        core.setArenaMask(arena);
+    }
+    return true;
+}
+
+size_t BatchScheduler::run(const std::vector<BatchJob> &jobs, const ProgressCallback &progress) {
+    m_jobs = &jobs;
+    m_progress = &progress;
+    m_nextJob = 0;
+    m_openSessions = 0;
+    m_finishedJobs = 0;
+    m_failedJobs = 0;
+    m_generation = 0;
+    m_state.clear();
+    if (!m_settings.statePath.empty()) {
+        loadState();
+    }
+
+    m_queues.clear();
+    for (size_t i = 0; i < m_workerCount; i++) {
+        m_queues.push_back(std::unique_ptr<Queue>(new Queue()));
+    }
+
+    // the calling thread is worker 0
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < m_workerCount; i++) {
+        workers.push_back(std::thread(&BatchScheduler::workerLoop, this, i));
+    }
+    workerLoop(0);
+    for (std::thread &worker : workers) {
+        worker.join();
+    }
+
+    m_jobs = nullptr;
+    m_progress = nullptr;
+    return m_failedJobs;
+}
+
+void BatchScheduler::workerLoop(size_t index) {
+    for (;;) {
+        uint64_t seenGeneration;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_finishedJobs == m_jobs->size()) {
+                return;
+            }
+            seenGeneration = m_generation;
+        }
+
+        std::unique_ptr<Session> session(takeSession(index));
+        if (!session) {
+            session = openSession();
+        }
+        if (!session) {
+            // all sessions are busy on other workers and no more may be opened
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_changed.wait(lock, [this, seenGeneration]() {
+                return m_generation != seenGeneration || m_finishedJobs == m_jobs->size();
+            });
+            continue;
+        }
+
+        bool more = false;
+        std::string error;
+        try {
+            more = runSlice(*session, &error);
+            if (more && !m_settings.statePath.empty() && m_settings.checkpointFrames > 0 &&
+                    session->nextFrame >= session->nextCheckpoint) {
+                if (!writeCheckpoint(*session, &error)) {
+                    finishSession(std::move(session), true, error);
+                    continue;
+                }
+            }
+        } catch (const std::exception &e) {
+            finishSession(std::move(session), true, e.what());
+            continue;
+        }
+
+        if (!more) {
+            finishSession(std::move(session), !error.empty(), error);
+            continue;
+        }
+
+        report(*session, Progress::State::Running);
+        {
+            Queue &own = *m_queues[index];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            own.sessions.push_back(session.release());
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_generation++;
+        }
+        m_changed.notify_all();
+    }
+}
+
+BatchScheduler::Session *BatchScheduler::takeSession(size_t index) {
+    {
+        Queue &own = *m_queues[index];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.sessions.empty()) {
+            Session *session = own.sessions.front();
+            own.sessions.pop_front();
+            return session;
+        }
+    }
+
+    // steal the session that waited the shortest, the owner continues with
+    // the others in order
+    for (size_t i = 1; i < m_queues.size(); i++) {
+        Queue &other = *m_queues[(index + i) % m_queues.size()];
+        std::lock_guard<std::mutex> lock(other.mutex);
+        if (!other.sessions.empty()) {
+            Session *session = other.sessions.back();
+            other.sessions.pop_back();
+            return session;
+        }
+    }
+    return nullptr;
+}
+
+std::unique_ptr<BatchScheduler::Session> BatchScheduler::openSession() {
+    bool claimed = false;
+    size_t job = 0;
+    std::string resumeFrame;
+    std::vector<size_t> skipped;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        while (!claimed && m_nextJob < m_jobs->size() && m_openSessions < m_maxSessions) {
+            job = m_nextJob++;
+            auto state = m_state.find((*m_jobs)[job].outputPath);
+            if (state != m_state.end() && state->second == doneState) {
+                // finished in an earlier run
+                skipped.push_back(job);
+                m_finishedJobs++;
+                continue;
+            }
+            if (state != m_state.end()) {
+                resumeFrame = state->second;
+            }
+            m_openSessions++;
+            claimed = true;
+        }
+        if (!skipped.empty()) {
+            m_generation++;
+        }
+    }
+    if (!skipped.empty()) {
+        m_changed.notify_all();
+    }
+    for (size_t skippedJob : skipped) {
+        if (*m_progress) {
+            Progress progress;
+            progress.job = skippedJob;
+            progress.state = Progress::State::Done;
+            progress.framesDone = 0;
+            progress.frameCount = 0;
+            progress.points = 0;
+            (*m_progress)(progress);
+        }
+    }
+    if (!claimed) {
+        return nullptr;
+    }
+
+    std::unique_ptr<Session> session(new Session());
+    session->job = job;
+    std::string error;
+    bool started = false;
+    try {
+        started = startSession(*session, resumeFrame, &error);
+    } catch (const std::exception &e) {
+        error = e.what();
+    }
+    if (!started) {
+        finishSession(std::move(session), true, error);
+        return nullptr;
+    }
+    return session;
+}
+
+bool BatchScheduler::startSession(Session &session, const std::string &resumeFrame, std::string *error) {
+    const BatchJob &job = (*m_jobs)[session.job];
+    if (!configure(job, session.core, error)) {
+        return false;
+    }
+    // a pool per session would multiply the workers by the sessions
+    session.core.setThreadCount(1);
+
+    if (!session.capture.open(job.videoPath)) {
+        *error = "cannot open video " + job.videoPath;
+        return false;
+    }
+    if (job.inputFormat != FrameIngest::Format::Auto && job.inputFormat != FrameIngest::Format::Bgr) {
+        session.capture.set(cv::CAP_PROP_CONVERT_RGB, 0);
+    }
+    const double videoFrames = session.capture.get(cv::CAP_PROP_FRAME_COUNT);
+    if (videoFrames > 0) {
+        const size_t end = std::min(static_cast<size_t>(videoFrames), job.lastFrame == static_cast<size_t>(-1) ?
+                                        job.lastFrame : job.lastFrame + 1);
+        session.frameCount = end > job.firstFrame ? end - job.firstFrame : 0;
+    }
+
+    session.nextFrame = job.firstFrame;
+    if (!resumeFrame.empty()) {
+        // continue after the checkpoint: its trajectories and its frame as
+        // the previous one
+        const size_t frameNumber = static_cast<size_t>(std::stoull(resumeFrame));
+        TrajectoryFile checkpoint;
+        std::vector<Trajectory> trajectories;
+        if (!checkpoint.open(partialPath(job, frameNumber), error) || !checkpoint.load(trajectories, error)) {
+            return false;
+        }
+        session.core.setTrajectories(std::move(trajectories));
+        session.capture.set(cv::CAP_PROP_POS_FRAMES, static_cast<double>(frameNumber));
+        cv::Mat &frame = session.frames[frameNumber % 2];
+        if (!session.capture.read(frame)) {
+            *error = "cannot read frame " + resumeFrame + " of " + job.videoPath;
+            return false;
+        }
+        session.core.resyncPreviousFrame(frameNumber, frame);
+        session.nextFrame = frameNumber + 1;
+        session.checkpoint = frameNumber;
+    } else if (job.firstFrame > 0) {
+        session.capture.set(cv::CAP_PROP_POS_FRAMES, static_cast<double>(job.firstFrame));
+    }
+    session.nextCheckpoint = session.nextFrame + m_settings.checkpointFrames;
+    return true;
+}
+
+bool BatchScheduler::runSlice(Session &session, std::string *error) {
+    const BatchJob &job = (*m_jobs)[session.job];
+    for (size_t i = 0; i < m_settings.sliceFrames; i++) {
+        if (session.nextFrame > job.lastFrame) {
+            return false;
+        }
+        cv::Mat &frame = session.frames[session.nextFrame % 2];
+        if (!session.capture.read(frame)) {
+            // the end of a video of unknown length, or a broken one
+            if (session.nextFrame - job.firstFrame < session.frameCount) {
+                *error = "cannot read frame " + std::to_string(session.nextFrame) + " of " + job.videoPath;
+            }
+            return false;
+        }
+        session.core.track(session.nextFrame, frame);
+        addSeeds(job, session.core, session.nextFrame, frame);
+        session.nextFrame++;
+    }
+    return true;
+}
+
+void BatchScheduler::finishSession(std::unique_ptr<Session> session, bool failed, const std::string &error) {
+    const BatchJob &job = (*m_jobs)[session->job];
+    std::string message = error;
+    if (!failed) {
+        failed = !TrajectoryExporter::write(session->core.getTrajectories(), job.outputPath,
+                                            TrajectoryExporter::formatFromPath(job.outputPath),
+                                            TrajectoryExporter::ProgressCallback(), &message);
+    }
+    if (!failed && !m_settings.statePath.empty()) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_state[job.outputPath] = doneState;
+        saveState();
+    }
+    if (!failed && session->checkpoint != noCheckpoint) {
+        std::remove(partialPath(job, session->checkpoint).c_str());
+    }
+    session->capture.release();
+
+    // reported before the scheduler may return
+    report(*session, failed ? Progress::State::Failed : Progress::State::Done, message);
+    session.reset();
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_openSessions--;
+        m_finishedJobs++;
+        if (failed) {
+            m_failedJobs++;
+        }
+        m_generation++;
+    }
+    m_changed.notify_all();
+}
+
+bool BatchScheduler::writeCheckpoint(Session &session, std::string *error) {
+    const BatchJob &job = (*m_jobs)[session.job];
+    const size_t frameNumber = session.nextFrame - 1;
+    if (!TrajectoryExporter::write(session.core.getTrajectories(), partialPath(job, frameNumber),
+                                   TrajectoryExporter::Format::Binary,
+                                   TrajectoryExporter::ProgressCallback(), error)) {
+        return false;
+    }
+    session.nextCheckpoint = session.nextFrame + m_settings.checkpointFrames;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_state[job.outputPath] = std::to_string(frameNumber);
+        saveState();
+    }
+    // only now the old checkpoint is not needed any more
+    if (session.checkpoint != noCheckpoint) {
+        std::remove(partialPath(job, session.checkpoint).c_str());
+    }
+    session.checkpoint = frameNumber;
+    return true;
+}
+
+void BatchScheduler::report(const Session &session, Progress::State state, const std::string &error) {
+    if (!*m_progress) {
+        return;
+    }
+    const BatchJob &job = (*m_jobs)[session.job];
+    Progress progress;
+    progress.job = session.job;
+    progress.state = state;
+    progress.framesDone = session.nextFrame > job.firstFrame ? session.nextFrame - job.firstFrame : 0;
+    progress.frameCount = session.frameCount;
+    progress.points = session.core.getTrajectories().size();
+    progress.error = error;
+    (*m_progress)(progress);
+}
+
+void BatchScheduler::loadState() {
+    std::ifstream in(m_settings.statePath);
+    std::string line;
+    while (std::getline(in, line)) {
+        // "<done or frame>;<output path>"
+        const size_t separator = line.find(';');
+        if (line.empty() || line[0] == '#' || separator == std::string::npos) {
+            continue;
+        }
+        m_state[line.substr(separator + 1)] = line.substr(0, separator);
+    }
+}
+
+void BatchScheduler::saveState() {
+    // replaced as a whole, an interrupted run leaves the old state
+    const std::string tmpPath = m_settings.statePath + ".tmp";
+    {
+        std::ofstream out(tmpPath);
+        out << "# done or the last checkpointed frame;output\n";
+        for (const auto &entry : m_state) {
+            out << entry.second << ';' << entry.first << '\n';
+        }
+        if (!out) {
+            return;
+        }
+    }
+    if (std::rename(tmpPath.c_str(), m_settings.statePath.c_str()) != 0) {
+        // Windows does not replace existing files
+        std::remove(m_settings.statePath.c_str());
+        std::rename(tmpPath.c_str(), m_settings.statePath.c_str());
+    }
+}
@@ -0,0 +1,181 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include "FrameIngest.h"
+
+class LucasKanadeCore;
+
+/**
+ * @brief The BatchJob struct
+ * one video to track with the options of the command line tool
+ */
+struct BatchJob {
+    std::string			videoPath;
+    std::string			outputPath;	// .csv or .lkt (see TrajectoryExporter)
+    std::map<size_t, std::vector<cv::Point2f>> seeds; // frame => new points
+
+    size_t				firstFrame = 0;
+    size_t				lastFrame = static_cast<size_t>(-1);
+    int					winSize = -1;	// the default of the core if <= 0
+    size_t				threadCount = 1;	// single video mode only, see BatchScheduler
+    bool				useNativeKernel = false;
+    bool				adaptivePyramid = false;
+    bool				regionTracking = false;
+    std::string			arenaPath;
+    FrameIngest::Format	inputFormat = FrameIngest::Format::Auto;
+    bool				autoSeed = false;
+    size_t				autoSeedCount = 0;	// 0: the default of autoFindInitPoints()
+    size_t				replenishTarget = 0;
+    size_t				memoryBudget = 0;	// trajectory memory (bytes), see LucasKanadeCore::setMemoryBudget()
+    int					downscale = 1;		// see LucasKanadeCore::setDownscale()
+};
+
+/**
+ * @brief The BatchScheduler class
+ * Tracks many videos in one process. Every job is a session of its own (a
+ * LucasKanadeCore and a capture); the sessions are advanced in slices of
+ * a few frames by a fixed set of workers, one per hardware thread. Each
+ * worker keeps the sessions it opened in its own queue and continues them
+ * round robin (their buffers stay warm in its cache), an idle worker steals
+ * a waiting session from the back of another queue, like ThreadPool. A
+ * session is never run by two workers at once, its frames are read and
+ * tracked in order; the decoding of one session overlaps the LK steps of
+ * the others. The workers are the only threads of a batch: every session
+ * tracks on the worker that runs it, BatchJob::threadCount is ignored.
+ *
+ * At most maxSessions sessions are open at the same time, which together
+ * with the memory budget of each job bounds the memory of a batch. With a
+ * state file every session writes a checkpoint (the trajectories as
+ * "<output>.partial-<frame>.lkt") every checkpointFrames frames; running
+ * the same batch again skips the finished jobs and continues the others at
+ * their last checkpoint.
+ */
+class BatchScheduler {
+public:
+    struct Settings {
+        size_t			threadCount = 0;		// workers, 0: one per hardware thread
+        size_t			maxSessions = 0;		// open at the same time, 0: two per worker
+        size_t			sliceFrames = 64;		// frames of a session per turn
+        size_t			checkpointFrames = 2000;	// 0: no checkpoints
+        std::string		statePath;				// empty: not resumable
+    };
+
+    struct Progress {
+        enum class State {
+            Running,
+            Done,
+            Failed
+        };
+
+        size_t			job;			// index in the jobs passed to run()
+        State			state;
+        size_t			framesDone;		// tracked frames (including earlier runs)
+        size_t			frameCount;		// frames to track, 0 if unknown
+        size_t			points;			// trajectories so far
+        std::string		error;			// if Failed
+    };
+
+    /**
+     * @brief ProgressCallback
+     * called after every slice of a session and when it ends, from the
+     * workers (possibly concurrently)
+     */
+    typedef std::function<void(const Progress &progress)> ProgressCallback;
+
+    explicit BatchScheduler(const Settings &settings);
+
+    BatchScheduler(const BatchScheduler &) = delete;
+    BatchScheduler &operator=(const BatchScheduler &) = delete;
+
+    /**
+     * @brief run
+     * tracks all jobs and writes their outputs, blocks until all of them
+     * are finished
+     * @return the number of failed jobs
+     */
+    size_t run(const std::vector<BatchJob> &jobs, const ProgressCallback &progress = ProgressCallback());
+
+    /**
+     * @brief configure
+     * applies the options of a job to a core (everything but the seeds)
+     * @param error OUT: the reason if the arena mask cannot be read
+     */
+    static bool configure(const BatchJob &job, LucasKanadeCore &core, std::string *error = nullptr);
+
+private:
+    struct Session;
+
+    struct Queue {
+        std::mutex			mutex;
+        std::deque<Session *> sessions;
+    };
+
+    const Settings		m_settings;
+    size_t				m_workerCount;
+    size_t				m_maxSessions;
+
+    const std::vector<BatchJob> *m_jobs = nullptr;
+    const ProgressCallback *m_progress = nullptr;
+    std::vector<std::unique_ptr<Queue>> m_queues; // one per worker
+
+    std::mutex			m_mutex;		// the members below
+    std::condition_variable m_changed;	// a session was queued or finished
+    uint64_t			m_generation = 0;	// counts these changes
+    size_t				m_nextJob = 0;
+    size_t				m_openSessions = 0;
+    size_t				m_finishedJobs = 0;
+    size_t				m_failedJobs = 0;
+    std::map<std::string, std::string> m_state; // output path => "done" or the last checkpointed frame
+
+    void workerLoop(size_t index);
+
+    /**
+     * @brief takeSession
+     * pops from the own queue or steals from the others
+     */
+    Session *takeSession(size_t index);
+
+    /**
+     * @brief openSession
+     * opens the next job if less than maxSessions are open (finished jobs
+     * of an earlier run are only reported)
+     * @return nullptr if there is nothing to open right now
+     */
+    std::unique_ptr<Session> openSession();
+
+    /**
+     * @brief startSession
+     * configures the core and opens the video of a new session, restores
+     * the checkpoint if resumeFrame is set
+     */
+    bool startSession(Session &session, const std::string &resumeFrame, std::string *error);
+
+    /**
+     * @brief runSlice
+     * @param error OUT: set if the video ended before its frame count
+     * @return false when the session reached its end (or failed)
+     */
+    bool runSlice(Session &session, std::string *error);
+
+    void finishSession(std::unique_ptr<Session> session, bool failed, const std::string &error);
+
+    bool writeCheckpoint(Session &session, std::string *error);
+
+    void report(const Session &session, Progress::State state, const std::string &error = std::string());
+
+    // the state file, only with m_mutex held
+    void loadState();
+    void saveState();
+};
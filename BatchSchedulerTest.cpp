@@ -0,0 +1,254 @@
+/*
+ * Interrupts a checkpointed batch (BatchScheduler) and resumes it.
+ *
+ * The videos are short synthetic image sequences (blurred noise moving by
+ * a sub-pixel step per frame, written as PNGs next to the test). A batch
+ * without a state file gives the reference outputs. The same batch with a
+ * state file runs in a child process that dies (_Exit, no cleanup) in the
+ * middle of the second job, after a few checkpoints; running it again has
+ * to skip the finished job, continue the interrupted one at its last
+ * checkpoint and write exactly the outputs of the uninterrupted batch.
+ * Without fork() (Windows) only the resumed part of the test is left.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#include <opencv2/opencv.hpp>
+
+#include "BatchScheduler.h"
+#include "TestCheck.h"
+
+namespace {
+
+const std::string prefix = "batchtest.";	// all files of the test, in the working directory
+const cv::Size frameSize(160, 120);
+const size_t frameCount = 48;
+const size_t videoCount = 3;			// and a job whose video is missing
+
+// the interrupted run: one session at a time, so the jobs run in order
+const size_t sliceFrames = 4;
+const size_t checkpointFrames = 8;
+const size_t interruptedJob = 1;
+const size_t interruptAt = 20;			// frames done of interruptedJob
+const size_t lastCheckpoint = 15;		// written after the slice that ends with frame 15
+const int interruptExitCode = 3;
+
+std::string videoPath(size_t video) {
+    return prefix + "video" + std::to_string(video) + "_%03d.png";
+}
+
+std::string framePath(size_t video, size_t frameNumber) {
+    char name[32];
+    std::snprintf(name, sizeof(name), "%03zu", frameNumber);
+    return prefix + "video" + std::to_string(video) + "_" + name + ".png";
+}
+
+std::string partialPath(const std::string &outputPath, size_t frameNumber) {
+    return outputPath + ".partial-" + std::to_string(frameNumber) + ".lkt";
+}
+
+void writeVideo(size_t video) {
+    cv::Mat base(frameSize.height, frameSize.width, CV_8UC1);
+    cv::RNG rng(0x5eed + video);
+    rng.fill(base, cv::RNG::UNIFORM, cv::Scalar(0), cv::Scalar(256));
+    cv::GaussianBlur(base, base, cv::Size(0, 0), 1.5);
+    cv::Mat frame;
+    for (size_t f = 0; f < frameCount; f++) {
+        double transform[] = { 1., 0., 0.6 * f, 0., 1., -0.35 * f };
+        const cv::Mat move(2, 3, CV_64F, transform);
+        cv::warpAffine(base, frame, move, frameSize, cv::INTER_LINEAR, cv::BORDER_REFLECT_101);
+        cv::imwrite(framePath(video, f), frame);
+    }
+}
+
+/**
+ * @brief makeJobs
+ * the videos with corners found in their first frame, then the missing one
+ */
+std::vector<BatchJob> makeJobs(const std::string &outputName) {
+    std::vector<BatchJob> jobs(videoCount + 1);
+    for (size_t i = 0; i < jobs.size(); i++) {
+        jobs[i].videoPath = i < videoCount ? videoPath(i) : prefix + "missing_%03d.png";
+        jobs[i].outputPath = prefix + outputName + std::to_string(i) + ".csv";
+        jobs[i].autoSeed = true;
+    }
+    return jobs;
+}
+
+BatchScheduler::Settings checkpointSettings() {
+    BatchScheduler::Settings settings;
+    settings.sliceFrames = sliceFrames;
+    settings.checkpointFrames = checkpointFrames;
+    settings.statePath = prefix + "state";
+    return settings;
+}
+
+bool fileExists(const std::string &path) {
+    return std::ifstream(path).good();
+}
+
+std::string readFile(const std::string &path) {
+    std::ifstream in(path, std::ios::binary);
+    std::ostringstream content;
+    content << in.rdbuf();
+    return content.str();
+}
+
+/**
+ * @brief readState
+ * @return output path => "done" or the last checkpointed frame
+ */
+std::map<std::string, std::string> readState() {
+    std::map<std::string, std::string> state;
+    std::ifstream in(prefix + "state");
+    std::string line;
+    while (std::getline(in, line)) {
+        const size_t separator = line.find(';');
+        if (!line.empty() && line[0] != '#' && separator != std::string::npos) {
+            state[line.substr(separator + 1)] = line.substr(0, separator);
+        }
+    }
+    return state;
+}
+
+void removeFiles(const std::vector<BatchJob> &reference, const std::vector<BatchJob> &jobs) {
+    for (size_t video = 0; video < videoCount; video++) {
+        for (size_t f = 0; f < frameCount; f++) {
+            std::remove(framePath(video, f).c_str());
+        }
+    }
+    for (size_t i = 0; i < jobs.size(); i++) {
+        std::remove(reference[i].outputPath.c_str());
+        std::remove(jobs[i].outputPath.c_str());
+        for (size_t f = 0; f < frameCount; f++) {
+            std::remove(partialPath(jobs[i].outputPath, f).c_str());
+        }
+    }
+    std::remove((prefix + "state").c_str());
+}
+
+#ifndef _WIN32
+/**
+ * @brief interrupt
+ * runs the checkpointed batch in a child process until interruptedJob has
+ * interruptAt frames done
+ * @return whether the child died there
+ */
+bool interrupt(const std::vector<BatchJob> &jobs) {
+    const pid_t child = fork();
+    if (child == 0) {
+        BatchScheduler::Settings settings = checkpointSettings();
+        settings.threadCount = 1;
+        settings.maxSessions = 1;
+        BatchScheduler scheduler(settings);
+        scheduler.run(jobs, [](const BatchScheduler::Progress &progress) {
+            if (progress.job == interruptedJob && progress.state == BatchScheduler::Progress::State::Running &&
+                    progress.framesDone >= interruptAt) {
+                std::_Exit(interruptExitCode);
+            }
+        });
+        std::_Exit(EXIT_SUCCESS);
+    }
+    int status = 0;
+    return CHECK(child > 0) && CHECK(waitpid(child, &status, 0) == child) &&
+           CHECK(WIFEXITED(status) && WEXITSTATUS(status) == interruptExitCode);
+}
+
+void checkInterrupted(const std::vector<BatchJob> &reference, const std::vector<BatchJob> &jobs) {
+    std::map<std::string, std::string> state = readState();
+    CHECK(state.size() == 2);
+    CHECK(state[jobs[0].outputPath] == "done");
+    CHECK(state[jobs[interruptedJob].outputPath] == std::to_string(lastCheckpoint));
+
+    CHECK(readFile(jobs[0].outputPath) == readFile(reference[0].outputPath));
+    CHECK(!fileExists(jobs[interruptedJob].outputPath));
+    CHECK(fileExists(partialPath(jobs[interruptedJob].outputPath, lastCheckpoint)));
+    // replaced by the later checkpoint
+    CHECK(!fileExists(partialPath(jobs[interruptedJob].outputPath, lastCheckpoint - checkpointFrames)));
+    CHECK(!fileExists(jobs[2].outputPath));
+}
+#endif
+
+void checkResumed(const std::vector<BatchJob> &reference, const std::vector<BatchJob> &jobs, bool interrupted) {
+    std::mutex mutex;
+    std::map<size_t, size_t> firstFramesDone;	// job => framesDone of its first report
+    std::map<size_t, BatchScheduler::Progress> last;
+    BatchScheduler scheduler(checkpointSettings());
+    const size_t failed = scheduler.run(jobs, [&](const BatchScheduler::Progress &progress) {
+        std::lock_guard<std::mutex> lock(mutex);
+        firstFramesDone.insert(std::make_pair(progress.job, progress.framesDone));
+        last[progress.job] = progress;
+    });
+
+    CHECK(failed == 1);
+    CHECK(last[videoCount].state == BatchScheduler::Progress::State::Failed && !last[videoCount].error.empty());
+    if (interrupted) {
+        // the finished job is only reported, the interrupted one continues
+        // after its checkpoint
+        CHECK(last[0].state == BatchScheduler::Progress::State::Done && last[0].framesDone == 0);
+        CHECK(firstFramesDone[interruptedJob] == lastCheckpoint + 1 + sliceFrames);
+    }
+
+    std::map<std::string, std::string> state = readState();
+    for (size_t i = 0; i < videoCount; i++) {
+        CHECK(last[i].state == BatchScheduler::Progress::State::Done);
+        CHECK(state[jobs[i].outputPath] == "done");
+        CHECK(readFile(jobs[i].outputPath) == readFile(reference[i].outputPath));
+        for (size_t f = 0; f < frameCount; f++) {
+            if (!CHECK(!fileExists(partialPath(jobs[i].outputPath, f)))) {
+                break;
+            }
+        }
+    }
+    CHECK(state.count(jobs[videoCount].outputPath) == 0);
+}
+
+} // namespace
+
+int main() {
+    // no OpenCV worker threads in the process that forks
+    cv::setNumThreads(0);
+
+    const std::vector<BatchJob> reference = makeJobs("reference");
+    const std::vector<BatchJob> jobs = makeJobs("output");
+    removeFiles(reference, jobs);
+    for (size_t video = 0; video < videoCount; video++) {
+        writeVideo(video);
+    }
+
+    {
+        BatchScheduler scheduler((BatchScheduler::Settings()));
+        CHECK(scheduler.run(reference) == 1);
+        for (size_t i = 0; i < videoCount; i++) {
+            CHECK(!readFile(reference[i].outputPath).empty());
+        }
+    }
+
+    bool interrupted = false;
+#ifndef _WIN32
+    interrupted = interrupt(jobs);
+    if (interrupted) {
+        checkInterrupted(reference, jobs);
+    }
+#else
+    std::printf("no fork() on this platform, the interruption is skipped\n");
+#endif
+    checkResumed(reference, jobs, interrupted);
+
+    removeFiles(reference, jobs);
+    return TestCheck::testResult();
+}
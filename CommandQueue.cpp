@@ -0,0 +1,45 @@
+#include "CommandQueue.h"
+
+#include <utility>
+
+CommandQueue::CommandQueue():
+    m_head(new Node()),
+    m_tail(m_head.load())
+{
+    m_tail->next.store(nullptr);
+}
+
+CommandQueue::~CommandQueue() {
+    // commands that were never run are dropped
+    while (m_tail) {
+        Node *next = m_tail->next.load(std::memory_order_acquire);
+        delete m_tail;
+        m_tail = next;
+    }
+}
+
+void CommandQueue::push(Command command) {
+    Node *node = new Node();
+    node->next.store(nullptr, std::memory_order_relaxed);
+    node->command = std::move(command);
+
+    // the node is linked after its predecessor in a second step, until then
+    // the consumer stops in front of it
+    Node *prev = m_head.exchange(node, std::memory_order_acq_rel);
+    prev->next.store(node, std::memory_order_release);
+}
+
+size_t CommandQueue::drain() {
+    size_t count = 0;
+    Node *next = m_tail->next.load(std::memory_order_acquire);
+    while (next) {
+        // next becomes the new stub, its command is moved out first
+        Command command = std::move(next->command);
+        delete m_tail;
+        m_tail = next;
+        command();
+        count++;
+        next = m_tail->next.load(std::memory_order_acquire);
+    }
+    return count;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+
+/**
+ * @brief The CommandQueue class
+ * Input of the GUI (checkboxes, sliders, clicks on the video) that changes
+ * the tracker: pushed by any thread without a lock and applied by the
+ * tracking thread between two steps, so the GUI never waits for a running
+ * tracking step.
+ *
+ * Multiple producers, a single consumer: push() is one atomic exchange on
+ * an intrusive list (after D. Vyukov's MPSC queue), drain() runs the
+ * commands in the order they were pushed.
+ */
+class CommandQueue {
+public:
+    typedef std::function<void()> Command;
+
+    CommandQueue();
+    ~CommandQueue();
+
+    CommandQueue(const CommandQueue &) = delete;
+    CommandQueue &operator=(const CommandQueue &) = delete;
+
+    void push(Command command);
+
+    /**
+     * @brief drain
+     * runs the pushed commands (only on the consumer thread); a command
+     * whose push() is still in progress is left for the next call
+     * @return number of commands that were run
+     */
+    size_t drain();
+
+private:
+    struct Node {
+        std::atomic<Node *>	next;
+        Command			command;
+    };
+
+    std::atomic<Node *>	m_head;	// the node pushed last
+    Node *				m_tail;	// the node consumed last (a stub at first)
+};
@@ -0,0 +1,242 @@
+/*
+ * Stress tests of the lock-free hand-over between the tracking thread and
+ * the GUI: SnapshotPublisher (readers never see a deleted or half built
+ * snapshot, retired snapshots are reclaimed once no reader can hold them)
+ * and CommandQueue (many producers, commands run in push order). Best run
+ * under ThreadSanitizer or AddressSanitizer as well.
+ */
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "CommandQueue.h"
+#include "SnapshotPublisher.h"
+#include "TestCheck.h"
+
+namespace {
+
+const uint64_t aliveMark = 0x0a11fe0a11fe0a11ull;
+const uint64_t deadMark = 0xdeadbeefdeadbeefull;
+
+/**
+ * @brief The Snapshot struct
+ * counts its instances and marks itself when it is deleted, so a reader of
+ * a reclaimed snapshot notices (without a sanitizer, as long as the memory
+ * is not reused)
+ */
+struct Snapshot {
+    static std::atomic<size_t> alive;
+
+    explicit Snapshot(uint64_t frame):
+        frame(frame),
+        values(64, frame),
+        mark(aliveMark)
+    {
+        alive++;
+    }
+
+    ~Snapshot() {
+        mark = deadMark;
+        alive--;
+    }
+
+    uint64_t				frame;
+    std::vector<uint64_t>	values;	// all equal to frame
+    volatile uint64_t		mark;
+};
+
+std::atomic<size_t> Snapshot::alive(0);
+
+typedef SnapshotPublisher<Snapshot> Publisher;
+
+void testPublisherStress() {
+    {
+        Publisher publisher;
+        std::atomic<bool> stop(false);
+        std::atomic<size_t> reads(0);
+        std::atomic<size_t> errors(0);
+
+        // more readers than reader slots, so some wait for a free one
+        std::vector<std::thread> readers;
+        for (int r = 0; r < 10; r++) {
+            readers.push_back(std::thread([&]() {
+                uint64_t lastFrame = 0;
+                while (!stop.load()) {
+                    const Publisher::Reader reader(publisher);
+                    if (!reader) {
+                        continue;
+                    }
+                    bool consistent = reader->mark == aliveMark && reader->frame >= lastFrame;
+                    for (uint64_t value : reader->values) {
+                        consistent = consistent && value == reader->frame;
+                    }
+                    if (!consistent) {
+                        errors++;
+                    }
+                    lastFrame = reader->frame;
+                    reads++;
+                }
+            }));
+        }
+
+        // only publish() deletes: the current and the retired snapshots are alive
+        size_t leaks = 0;
+        for (uint64_t frame = 1; frame <= 50000; frame++) {
+            publisher.publish(std::unique_ptr<const Snapshot>(new Snapshot(frame)));
+            if (Snapshot::alive.load() != publisher.retiredCount() + 1) {
+                leaks++;
+            }
+        }
+        stop.store(true);
+        for (std::thread &reader : readers) {
+            reader.join();
+        }
+
+        CHECK(reads.load() > 0);
+        CHECK(errors.load() == 0);
+        CHECK(leaks == 0);
+
+        // without readers the next publish() reclaims everything
+        publisher.publish(std::unique_ptr<const Snapshot>(new Snapshot(0)));
+        CHECK(publisher.retiredCount() == 0);
+        CHECK(Snapshot::alive.load() == 1);
+    }
+    CHECK(Snapshot::alive.load() == 0);
+}
+
+void testPublisherPinning() {
+    {
+        Publisher publisher;
+        {
+            const Publisher::Reader none(publisher);
+            CHECK(!none);
+        }
+        publisher.publish(std::unique_ptr<const Snapshot>(new Snapshot(1)));
+        {
+            // a reader keeps its snapshot and everything retired after it
+            const Publisher::Reader reader(publisher);
+            for (uint64_t frame = 2; frame <= 100; frame++) {
+                publisher.publish(std::unique_ptr<const Snapshot>(new Snapshot(frame)));
+            }
+            CHECK(publisher.retiredCount() == 99);
+            CHECK(reader->frame == 1 && reader->mark == aliveMark);
+
+            // a reader that starts now sees the newest one
+            const Publisher::Reader late(publisher);
+            CHECK(late->frame == 100);
+        }
+        publisher.publish(std::unique_ptr<const Snapshot>(new Snapshot(101)));
+        CHECK(publisher.retiredCount() == 0);
+        CHECK(Snapshot::alive.load() == 1);
+    }
+    CHECK(Snapshot::alive.load() == 0);
+}
+
+void testQueueOrder() {
+    const size_t producers = 4;
+    const size_t perProducer = 50000;
+    CommandQueue queue;
+
+    // the consumer runs concurrently with the producers
+    std::vector<size_t> next(producers, 0);	// expected sequence number per producer
+    size_t outOfOrder = 0;
+    size_t ran = 0;
+    std::atomic<size_t> finished(0);
+    std::vector<std::thread> threads;
+    for (size_t p = 0; p < producers; p++) {
+        threads.push_back(std::thread([&, p]() {
+            for (size_t i = 0; i < perProducer; i++) {
+                queue.push([&, p, i]() {
+                    if (next[p] != i) {
+                        outOfOrder++;
+                    }
+                    next[p] = i + 1;
+                });
+            }
+            finished++;
+        }));
+    }
+    while (finished.load() < producers) {
+        ran += queue.drain();
+    }
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+    ran += queue.drain();
+
+    CHECK(ran == producers * perProducer);
+    CHECK(outOfOrder == 0);
+    for (size_t p = 0; p < producers; p++) {
+        CHECK(next[p] == perProducer);
+    }
+    CHECK(queue.drain() == 0);
+}
+
+void testQueueHandOver() {
+    // two producers take turns: a push that finished before another one
+    // started runs first, even if it came from another thread
+    const size_t rounds = 2000;
+    CommandQueue queue;
+    std::atomic<size_t> turn(0);
+    std::vector<size_t> order;
+    std::vector<std::thread> threads;
+    for (size_t p = 0; p < 2; p++) {
+        threads.push_back(std::thread([&, p]() {
+            for (size_t k = p; k < 2 * rounds; k += 2) {
+                while (turn.load() != k) {
+                    std::this_thread::yield();
+                }
+                queue.push([&order, k]() {
+                    order.push_back(k);
+                });
+                turn.store(k + 1);
+            }
+        }));
+    }
+    while (turn.load() < 2 * rounds) {
+        queue.drain();
+    }
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+    queue.drain();
+
+    bool ordered = CHECK(order.size() == 2 * rounds);
+    for (size_t k = 0; ordered && k < order.size(); k++) {
+        ordered = CHECK(order[k] == k);
+    }
+}
+
+void testQueueDropsUnrun() {
+    const std::shared_ptr<int> captured = std::make_shared<int>(0);
+    {
+        CommandQueue queue;
+        for (int i = 0; i < 100; i++) {
+            queue.push([captured]() {
+                (*captured)++;
+            });
+        }
+        CHECK(queue.drain() == 100);
+        queue.push([captured]() {
+            (*captured)++;
+        });
+        CHECK(captured.use_count() == 2);
+    }
+    // the last command was destroyed without running
+    CHECK(*captured == 100);
+    CHECK(captured.use_count() == 1);
+}
+
+} // namespace
+
+int main() {
+    testPublisherStress();
+    testPublisherPinning();
+    testQueueOrder();
+    testQueueHandOver();
+    testQueueDropsUnrun();
+    return TestCheck::testResult();
+}
@@ -0,0 +1,180 @@
+#include "CornerDetector.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+namespace {
+
+struct Candidate {
+    float		response;
+    cv::Point	position;
+};
+
+/**
+ * @brief The Cell struct
+ * the eigenvalues of a cell and one pixel around it (for the local maxima)
+ */
+struct Cell {
+    cv::Rect	area;		// rect of eig in frame coordinates
+    cv::Mat		eig;
+    double		maximum = 0.;
+    std::vector<Candidate> candidates;
+};
+
+void run(ThreadPool *pool, size_t taskCount, const ThreadPool::Task &task) {
+    if (pool && taskCount > 1) {
+        pool->parallelFor(taskCount, task);
+    } else {
+        for (size_t i = 0; i < taskCount; i++) {
+            task(i);
+        }
+    }
+}
+
+} // namespace
+
+int CornerDetector::cellSize(const cv::Size &frameSize, const Parameters &parameters) {
+    // cells of about area * cornersPerCell / maxCount pixels
+    const double cellArea = static_cast<double>(frameSize.area()) *
+            static_cast<double>(std::max<size_t>(parameters.cornersPerCell, 1)) /
+            static_cast<double>(std::max<size_t>(parameters.maxCount, 1));
+    return std::max(static_cast<int>(std::sqrt(cellArea)),
+                    static_cast<int>(std::ceil(2 * parameters.minDistance)) + 1);
+}
+
+float CornerDetector::detect(const cv::Mat &gray, const Parameters &parameters, const cv::Mat &mask,
+                             PointGrid &taken, size_t firstId, ThreadPool *pool, std::vector<cv::Point2f> &corners) {
+    const int size = cellSize(gray.size(), parameters);
+    std::vector<cv::Rect> cells;
+    for (int y = 0; y < gray.rows; y += size) {
+        for (int x = 0; x < gray.cols; x += size) {
+            cells.push_back(cv::Rect(x, y, std::min(size, gray.cols - x), std::min(size, gray.rows - y)));
+        }
+    }
+    const size_t quota = cells.empty() ? 0 : std::max(parameters.cornersPerCell,
+                                                      (parameters.maxCount + cells.size() - 1) / cells.size());
+    return search(gray, parameters, mask, cells, quota, taken, firstId, pool, corners, nullptr);
+}
+
+float CornerDetector::detectInCells(const cv::Mat &gray, const Parameters &parameters, const cv::Mat &mask,
+                                    const std::vector<cv::Rect> &cells, PointGrid &taken, size_t firstId,
+                                    ThreadPool *pool, std::vector<cv::Point2f> &corners, std::vector<size_t> *found) {
+    return search(gray, parameters, mask, cells, parameters.cornersPerCell, taken, firstId, pool, corners, found);
+}
+
+float CornerDetector::search(const cv::Mat &gray, const Parameters &parameters, const cv::Mat &mask,
+                             const std::vector<cv::Rect> &cellRects, size_t quota, PointGrid &taken, size_t firstId,
+                             ThreadPool *pool, std::vector<cv::Point2f> &corners, std::vector<size_t> *found) {
+    corners.clear();
+    if (found) {
+        found->assign(cellRects.size(), 0);
+    }
+    if (gray.rows < 3 || gray.cols < 3 || parameters.maxCount == 0 || cellRects.empty()) {
+        return parameters.minResponse;
+    }
+    assert(gray.type() == CV_8UC1);
+    assert(mask.empty() || (mask.size() == gray.size() && mask.type() == CV_8UC1));
+
+    // minimum eigenvalues of each cell (and one pixel around it); the filters
+    // get a few extra pixels and are isolated, so nothing outside of the
+    // frame is read
+    const cv::Rect frameRect(0, 0, gray.cols, gray.rows);
+    const int margin = parameters.blockSize / 2 + 2;
+    std::vector<Cell> cells(cellRects.size());
+    run(pool, cells.size(), [&](size_t i) {
+        Cell &cell = cells[i];
+        const cv::Rect &rect = cellRects[i];
+        cell.area = cv::Rect(rect.x - 1, rect.y - 1, rect.width + 2, rect.height + 2) & frameRect;
+        if (cell.area.area() == 0) {
+            return;
+        }
+        const cv::Rect source = cv::Rect(cell.area.x - margin, cell.area.y - margin,
+                                         cell.area.width + 2 * margin, cell.area.height + 2 * margin) & frameRect;
+        cv::Mat eig;
+        cv::cornerMinEigenVal(gray(source), eig, parameters.blockSize, 3, cv::BORDER_REFLECT_101 | cv::BORDER_ISOLATED);
+        cell.eig = eig(cell.area - source.tl());
+        cv::minMaxLoc(cell.eig, nullptr, &cell.maximum);
+    });
+
+    float threshold = parameters.minResponse;
+    if (threshold <= 0.f) {
+        double maximum = 0.;
+        for (const Cell &cell : cells) {
+            maximum = std::max(maximum, cell.maximum);
+        }
+        if (maximum <= 0.) {
+            return 0.f;
+        }
+        threshold = static_cast<float>(parameters.qualityLevel * maximum);
+    }
+
+    // the local maxima above the threshold of each cell, strongest first;
+    // a few spare candidates replace those too close to others
+    const size_t keep = 4 * quota;
+    run(pool, cells.size(), [&](size_t i) {
+        Cell &cell = cells[i];
+        const cv::Rect rect = cellRects[i] & frameRect;
+        // the local maximum needs all 8 neighbors
+        const int x0 = std::max(1, rect.x);
+        const int y0 = std::max(1, rect.y);
+        const int x1 = std::min(gray.cols - 1, rect.x + rect.width);
+        const int y1 = std::min(gray.rows - 1, rect.y + rect.height);
+
+        std::vector<Candidate> &candidates = cell.candidates;
+        for (int y = y0; y < y1; y++) {
+            const float *above = cell.eig.ptr<float>(y - 1 - cell.area.y);
+            const float *row = cell.eig.ptr<float>(y - cell.area.y);
+            const float *below = cell.eig.ptr<float>(y + 1 - cell.area.y);
+            const uchar *maskRow = mask.empty() ? nullptr : mask.ptr(y);
+            for (int x = x0; x < x1; x++) {
+                const int c = x - cell.area.x;
+                const float v = row[c];
+                if (v < threshold || (maskRow && maskRow[x] == 0)) {
+                    continue;
+                }
+                if (v >= row[c - 1] && v >= row[c + 1] &&
+                        v >= above[c - 1] && v >= above[c] && v >= above[c + 1] &&
+                        v >= below[c - 1] && v >= below[c] && v >= below[c + 1]) {
+                    candidates.push_back(Candidate{ v, cv::Point(x, y) });
+                }
+            }
+        }
+
+        auto stronger = [](const Candidate &a, const Candidate &b) { return a.response > b.response; };
+        if (candidates.size() > keep) {
+            std::partial_sort(candidates.begin(), candidates.begin() + static_cast<std::ptrdiff_t>(keep),
+                              candidates.end(), stronger);
+            candidates.resize(keep);
+        } else {
+            std::sort(candidates.begin(), candidates.end(), stronger);
+        }
+    });
+
+    // round-robin over the cells: every cell gets its next corner before
+    // any cell gets another one
+    std::vector<size_t> next(cells.size(), 0);
+    std::vector<size_t> accepted(cells.size(), 0);
+    bool progress = true;
+    while (progress && corners.size() < parameters.maxCount) {
+        progress = false;
+        for (size_t i = 0; i < cells.size() && corners.size() < parameters.maxCount; i++) {
+            const std::vector<Candidate> &candidates = cells[i].candidates;
+            while (accepted[i] < quota && next[i] < candidates.size()) {
+                const cv::Point2f position(candidates[next[i]++].position);
+                if (!taken.hasPointWithin(position, parameters.minDistance)) {
+                    taken.insertOrUpdate(firstId + corners.size(), position);
+                    corners.push_back(position);
+                    accepted[i]++;
+                    progress = true;
+                    break;
+                }
+            }
+        }
+    }
+
+    if (found) {
+        *found = accepted;
+    }
+    return threshold;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include "PointGrid.h"
+#include "ThreadPool.h"
+
+/**
+ * @brief The CornerDetector class
+ * Finds good features to track (the minimum eigenvalue criterion of Shi and
+ * Tomasi, like cv::goodFeaturesToTrack) spread over the frame.
+ *
+ * The frame is divided into cells that each contribute at most a few of
+ * their strongest local maxima, taken round-robin over the cells, so strong
+ * texture in one part of the frame does not use up all corners. The
+ * eigenvalues are computed per cell (one task per cell), which also allows
+ * to search only some cells, e.g. those that lost their points (see
+ * detectInCells()).
+ */
+class CornerDetector {
+public:
+    struct Parameters {
+        size_t	maxCount = 500;
+        double	qualityLevel = 0.01;	// relative to the strongest corner of the searched cells
+        float	minResponse = 0.f;		// absolute threshold instead of qualityLevel if > 0
+        float	minDistance = 10.f;		// to each other and to the existing points
+        int		blockSize = 3;
+        size_t	cornersPerCell = 4;		// the cells are sized so that maxCount corners give this many per cell
+    };
+
+    /**
+     * @brief cellSize
+     * @return the edge length of the cells detect() divides the frame into
+     */
+    static int cellSize(const cv::Size &frameSize, const Parameters &parameters);
+
+    /**
+     * @brief detect
+     * @param gray CV_8UC1 frame
+     * @param mask CV_8UC1 of the frame size, corners only where it is not
+     * zero (empty: everywhere)
+     * @param taken the existing points; the corners keep minDistance to them
+     * and are added with the ids firstId, firstId + 1, ..
+     * @param pool computes the cells in parallel (may be nullptr)
+     * @param corners OUT: at most maxCount corners
+     * @return the response threshold that was used (e.g. as minResponse of
+     * later searches in parts of the frame)
+     */
+    static float detect(const cv::Mat &gray, const Parameters &parameters, const cv::Mat &mask,
+                        PointGrid &taken, size_t firstId, ThreadPool *pool, std::vector<cv::Point2f> &corners);
+
+    /**
+     * @brief detectInCells
+     * like detect(), but only searches the given cells (inside the frame),
+     * each contributes at most cornersPerCell corners
+     * @param found OUT (optional): the number of corners per cell
+     */
+    static float detectInCells(const cv::Mat &gray, const Parameters &parameters, const cv::Mat &mask,
+                               const std::vector<cv::Rect> &cells, PointGrid &taken, size_t firstId,
+                               ThreadPool *pool, std::vector<cv::Point2f> &corners,
+                               std::vector<size_t> *found = nullptr);
+
+private:
+    static float search(const cv::Mat &gray, const Parameters &parameters, const cv::Mat &mask,
+                        const std::vector<cv::Rect> &cells, size_t quota, PointGrid &taken, size_t firstId,
+                        ThreadPool *pool, std::vector<cv::Point2f> &corners, std::vector<size_t> *found);
+};
@@ -0,0 +1,91 @@
+#include "FrameCache.h"
+
+#include <cassert>
+#include <iterator>
+
+namespace {
+
+size_t bufferBytes(const cv::Mat &mat) {
+    return mat.empty() ? 0 : static_cast<size_t>(mat.dataend - mat.datastart);
+}
+
+} // namespace
+
+FrameCache::FrameCache() {
+}
+
+void FrameCache::setBudget(size_t bytes) {
+    m_budget = bytes;
+    PreparedFrame dropped;
+    while (m_bytes > m_budget) {
+        remove(std::prev(m_entries.end()), dropped);
+    }
+}
+
+bool FrameCache::insert(size_t frameNumber, PreparedFrame &frame) {
+    const size_t bytes = byteSize(frame);
+    if (!isEnabled() || bytes > m_budget) {
+        return false;
+    }
+
+    PreparedFrame recycled;
+    auto existing = m_index.find(frameNumber);
+    if (existing != m_index.end()) {
+        remove(existing->second, recycled);
+    }
+    while (m_bytes + bytes > m_budget) {
+        remove(std::prev(m_entries.end()), recycled);
+    }
+
+    m_entries.emplace_front();
+    Entry &entry = m_entries.front();
+    entry.frameNumber = frameNumber;
+    entry.bytes = bytes;
+    entry.frame = std::move(frame);
+    m_index[frameNumber] = m_entries.begin();
+    m_bytes += bytes;
+
+    frame = std::move(recycled);
+    return true;
+}
+
+bool FrameCache::take(size_t frameNumber, const cv::Size &frameSize, const cv::Size &winSize, PreparedFrame &frame) {
+    auto found = m_index.find(frameNumber);
+    if (found == m_index.end()) {
+        return false;
+    }
+
+    PreparedFrame taken;
+    remove(found->second, taken);
+    if (taken.gray.size() != frameSize || taken.winSize != winSize) {
+        return false;
+    }
+    frame = std::move(taken);
+    return true;
+}
+
+void FrameCache::clear() {
+    m_entries.clear();
+    m_index.clear();
+    m_bytes = 0;
+}
+
+size_t FrameCache::byteSize(const PreparedFrame &frame) {
+    size_t bytes = 0;
+    for (const cv::Mat &level : frame.pyramid) {
+        bytes += bufferBytes(level);
+    }
+    // level 0 usually is the gray frame itself
+    if (frame.pyramid.empty() || frame.gray.datastart != frame.pyramid[0].datastart) {
+        bytes += bufferBytes(frame.gray);
+    }
+    return bytes;
+}
+
+void FrameCache::remove(std::list<Entry>::iterator entry, PreparedFrame &recycled) {
+    assert(m_bytes >= entry->bytes);
+    m_bytes -= entry->bytes;
+    recycled = std::move(entry->frame);
+    m_index.erase(entry->frameNumber);
+    m_entries.erase(entry);
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <list>
+#include <unordered_map>
+
+#include "PreparedFrame.h"
+
+/**
+ * @brief The FrameCache class
+ * Keeps the gray frames and pyramids of recently tracked frames, keyed by
+ * the frame number and bounded by a budget in bytes (least recently used
+ * frames are evicted first). Scrubbing back over tracked frames then finds
+ * them ready to use instead of converting the frame and building both
+ * pyramids again.
+ *
+ * The cache owns the buffers of its entries exclusively: insert() and
+ * take() move them in and out instead of sharing them, so nothing writes
+ * into a cached frame. Evicted buffers are handed back for reuse.
+ */
+class FrameCache {
+public:
+    FrameCache();
+
+    /**
+     * @brief setBudget
+     * the maximum number of bytes of all entries, 0 disables the cache
+     */
+    void setBudget(size_t bytes);
+    size_t getBudget() const {
+        return m_budget;
+    }
+    bool isEnabled() const {
+        return m_budget > 0;
+    }
+
+    /**
+     * @brief getBytes
+     * @return the bytes currently held by the entries
+     */
+    size_t getBytes() const {
+        return m_bytes;
+    }
+
+    size_t size() const {
+        return m_entries.size();
+    }
+
+    /**
+     * @brief insert
+     * takes over the buffers of frame as the entry of frameNumber (an older
+     * entry of that frame is replaced). In exchange frame gets the buffers
+     * of an evicted entry to reuse, or is left empty.
+     * @return false if the cache is disabled or frame alone exceeds the
+     * budget; frame is unchanged then
+     */
+    bool insert(size_t frameNumber, PreparedFrame &frame);
+
+    /**
+     * @brief take
+     * moves the entry of frameNumber out of the cache into frame (the old
+     * buffers of frame are dropped). An entry of another frame size or
+     * window size is dropped as well.
+     * @return false if there is no usable entry
+     */
+    bool take(size_t frameNumber, const cv::Size &frameSize, const cv::Size &winSize, PreparedFrame &frame);
+
+    bool contains(size_t frameNumber) const {
+        return m_index.count(frameNumber) > 0;
+    }
+
+    void clear();
+
+    /**
+     * @brief byteSize
+     * @return the bytes of all buffers of frame (including their borders)
+     */
+    static size_t byteSize(const PreparedFrame &frame);
+
+private:
+    struct Entry {
+        size_t				frameNumber = 0;
+        size_t				bytes = 0;
+        PreparedFrame		frame;
+    };
+
+    size_t					m_budget = 0;
+    size_t					m_bytes = 0;
+
+    // most recently used first
+    std::list<Entry>		m_entries;
+    std::unordered_map<size_t, std::list<Entry>::iterator> m_index;
+
+    /**
+     * @brief remove
+     * removes the entry, its buffers are moved into recycled
+     */
+    void remove(std::list<Entry>::iterator entry, PreparedFrame &recycled);
+};
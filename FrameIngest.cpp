@@ -0,0 +1,217 @@
+#include "FrameIngest.h"
+
+#include <cassert>
+#include <cstring>
+
+namespace {
+
+struct FormatName {
+    FrameIngest::Format	format;
+    const char *		name;
+};
+
+const FormatName formatNames[] = {
+    { FrameIngest::Format::Auto, "auto" },
+    { FrameIngest::Format::Bgr, "bgr" },
+    { FrameIngest::Format::Bgra, "bgra" },
+    { FrameIngest::Format::Mono, "mono" },
+    { FrameIngest::Format::Yuv420, "yuv420" },
+    { FrameIngest::Format::Yuyv, "yuyv" },
+    { FrameIngest::Format::BayerBG, "bayer_bg" },
+    { FrameIngest::Format::BayerGB, "bayer_gb" },
+    { FrameIngest::Format::BayerRG, "bayer_rg" },
+    { FrameIngest::Format::BayerGR, "bayer_gr" }
+};
+
+/**
+ * @brief bayerCode
+ * The pattern of a part of the frame depends on the parity of its corner:
+ * in the order BG, GB, GR, RG one column flips bit 0, one row bit 1.
+ */
+int bayerCode(FrameIngest::Format format, const cv::Point &corner) {
+    static const int codes[] = { cv::COLOR_BayerBG2GRAY, cv::COLOR_BayerGB2GRAY,
+                                 cv::COLOR_BayerGR2GRAY, cv::COLOR_BayerRG2GRAY };
+    int pattern = 0;
+    switch (format) {
+    case FrameIngest::Format::BayerGB:
+        pattern = 1;
+        break;
+    case FrameIngest::Format::BayerGR:
+        pattern = 2;
+        break;
+    case FrameIngest::Format::BayerRG:
+        pattern = 3;
+        break;
+    default:
+        break;
+    }
+    return codes[pattern ^ ((corner.x & 1) | ((corner.y & 1) << 1))];
+}
+
+} // namespace
+
+bool FrameIngest::parseFormat(const std::string &name, Format &format) {
+    for (const FormatName &entry : formatNames) {
+        if (name == entry.name) {
+            format = entry.format;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char *FrameIngest::formatName(Format format) {
+    for (const FormatName &entry : formatNames) {
+        if (entry.format == format) {
+            return entry.name;
+        }
+    }
+    return "";
+}
+
+FrameIngest::Format FrameIngest::resolve(const cv::Mat &frame, Format format) {
+    if (format != Format::Auto) {
+        return format;
+    }
+    switch (frame.channels()) {
+    case 1:
+        return Format::Mono;
+    case 2:
+        return Format::Yuyv;
+    case 4:
+        return Format::Bgra;
+    default:
+        return Format::Bgr;
+    }
+}
+
+cv::Size FrameIngest::graySize(const cv::Mat &frame, Format format) {
+    if (resolve(frame, format) == Format::Yuv420) {
+        return cv::Size(frame.cols, frame.rows * 2 / 3);
+    }
+    return cv::Size(frame.cols, frame.rows);
+}
+
+bool FrameIngest::canWrap(const cv::Mat &frame, Format format) {
+    const Format resolved = resolve(frame, format);
+    return (resolved == Format::Mono || resolved == Format::Yuv420) && frame.type() == CV_8UC1;
+}
+
+cv::Mat FrameIngest::wrap(const cv::Mat &frame, Format format) {
+    assert(canWrap(frame, format));
+    return frame.rowRange(0, graySize(frame, format).height);
+}
+
+void FrameIngest::convert(const cv::Mat &frame, Format format, const cv::Rect &rect, cv::Mat &gray) {
+    assert(gray.cols == rect.width && gray.rows == rect.height && gray.type() == CV_8UC1);
+
+    // gray has the right size and type, so the functions below write into it
+    // instead of allocating a new matrix
+    const Format resolved = resolve(frame, format);
+    switch (resolved) {
+    case Format::Mono:
+    case Format::Yuv420:
+        frame(rect).copyTo(gray);
+        break;
+    case Format::Bgra:
+        cv::cvtColor(frame(rect), gray, cv::COLOR_BGRA2GRAY);
+        break;
+    case Format::Yuyv:
+        // Y is the first byte of every pixel (Y0 U, Y1 V)
+        cv::extractChannel(frame(rect), gray, 0);
+        break;
+    case Format::BayerBG:
+    case Format::BayerGB:
+    case Format::BayerRG:
+    case Format::BayerGR:
+        cv::cvtColor(frame(rect), gray, bayerCode(resolved, rect.tl()));
+        break;
+    default:
+        cv::cvtColor(frame(rect), gray, cv::COLOR_BGR2GRAY);
+        break;
+    }
+}
+
+void FrameIngest::downscale(const cv::Mat &frame, Format format, cv::Mat &gray, cv::Mat &buffer) {
+    assert(gray.type() == CV_8UC1);
+    const cv::Size size = gray.size();
+    const Format resolved = resolve(frame, format);
+    switch (resolved) {
+    case Format::Mono:
+    case Format::Yuv420:
+        cv::resize(frame.rowRange(0, graySize(frame, format).height), gray, size, 0, 0, cv::INTER_AREA);
+        break;
+    case Format::BayerBG:
+    case Format::BayerGB:
+    case Format::BayerRG:
+    case Format::BayerGR:
+        // every cell of an even factor holds each color of the pattern
+        cv::resize(frame, gray, size, 0, 0, cv::INTER_AREA);
+        break;
+    case Format::Yuyv:
+        cv::resize(frame, buffer, size, 0, 0, cv::INTER_AREA);
+        cv::extractChannel(buffer, gray, 0);
+        break;
+    case Format::Bgra:
+        cv::resize(frame, buffer, size, 0, 0, cv::INTER_AREA);
+        cv::cvtColor(buffer, gray, cv::COLOR_BGRA2GRAY);
+        break;
+    default:
+        cv::resize(frame, buffer, size, 0, 0, cv::INTER_AREA);
+        cv::cvtColor(buffer, gray, cv::COLOR_BGR2GRAY);
+        break;
+    }
+}
+
+void FrameIngest::allocatePadded(cv::Mat &gray, const cv::Size &size, const cv::Size &border) {
+    if (gray.isSubmatrix() && gray.type() == CV_8UC1 && gray.cols == size.width && gray.rows == size.height) {
+        cv::Size whole;
+        cv::Point offset;
+        gray.locateROI(whole, offset);
+        if (offset.x >= border.width && offset.y >= border.height &&
+                whole.width - offset.x - size.width >= border.width &&
+                whole.height - offset.y - size.height >= border.height) {
+            return;
+        }
+    }
+
+    cv::Mat buffer(size.height + 2 * border.height, size.width + 2 * border.width, CV_8UC1);
+    gray = buffer(cv::Rect(border.width, border.height, size.width, size.height));
+}
+
+void FrameIngest::fillBorder(cv::Mat &gray) {
+    cv::Size whole;
+    cv::Point offset;
+    gray.locateROI(whole, offset);
+    const int top = offset.y;
+    const int left = offset.x;
+    const int bottom = whole.height - offset.y - gray.rows;
+    const int right = whole.width - offset.x - gray.cols;
+    if (top == 0 && left == 0 && bottom == 0 && right == 0) {
+        return;
+    }
+
+    cv::Mat padded = gray;
+    padded.adjustROI(top, bottom, left, right);
+
+    // the rows above and below (without the corners) ..
+    for (int i = 1; i <= top; i++) {
+        const int src = cv::borderInterpolate(-i, gray.rows, cv::BORDER_REFLECT_101);
+        std::memcpy(padded.ptr(top - i) + left, gray.ptr(src), static_cast<size_t>(gray.cols));
+    }
+    for (int i = 0; i < bottom; i++) {
+        const int src = cv::borderInterpolate(gray.rows + i, gray.rows, cv::BORDER_REFLECT_101);
+        std::memcpy(padded.ptr(top + gray.rows + i) + left, gray.ptr(src), static_cast<size_t>(gray.cols));
+    }
+
+    // .. then the columns left and right of all rows
+    for (int r = 0; r < padded.rows; r++) {
+        uchar *row = padded.ptr(r) + left;
+        for (int i = 1; i <= left; i++) {
+            row[-i] = row[cv::borderInterpolate(-i, gray.cols, cv::BORDER_REFLECT_101)];
+        }
+        for (int i = 0; i < right; i++) {
+            row[gray.cols + i] = row[cv::borderInterpolate(gray.cols + i, gray.cols, cv::BORDER_REFLECT_101)];
+        }
+    }
+}
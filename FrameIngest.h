@@ -0,0 +1,101 @@
+#pragma once
+
+#include <string>
+
+#include <opencv2/opencv.hpp>
+
+/**
+ * @brief The FrameIngest class
+ * Turns the frames of the video into the 8 bit gray frames of the tracker.
+ *
+ * Mono frames and the luma plane of planar YUV 4:2:0 frames already are
+ * gray frames; they can be used without any copy (see wrap()). Everything
+ * else is converted, either as a whole or in parts (see convert()).
+ *
+ * The tracker keeps its own gray frames inside a buffer with a border (see
+ * allocatePadded()): buildOpticalFlowPyramid then uses them as level 0 in
+ * place instead of copying them into a bordered image first, so the
+ * conversion writes the first pyramid level directly.
+ */
+class FrameIngest {
+public:
+    enum class Format {
+        Auto,		// by the number of channels: mono, YUYV, BGR or BGRA
+        Bgr,
+        Bgra,
+        Mono,
+        Yuv420,		// I420/YV12/NV12/NV21: the luma plane are the first 2/3 of the rows
+        Yuyv,		// packed YUV 4:2:2 (CV_8UC2)
+        BayerBG,	// raw sensor data, the name is the pattern of the top left corner
+        BayerGB,
+        BayerRG,
+        BayerGR
+    };
+
+    /**
+     * @brief parseFormat
+     * @param name e.g. "mono", "yuv420", "bayer_bg" (see formatName())
+     * @return false if the name is unknown
+     */
+    static bool parseFormat(const std::string &name, Format &format);
+    static const char *formatName(Format format);
+
+    /**
+     * @brief resolve
+     * @return format, or the format derived from the channels for Auto
+     */
+    static Format resolve(const cv::Mat &frame, Format format);
+
+    /**
+     * @brief graySize
+     * @return the size of the gray frame of the given frame
+     */
+    static cv::Size graySize(const cv::Mat &frame, Format format);
+
+    /**
+     * @brief canWrap
+     * @return true if the gray frame is a part of the frame (mono or planar
+     * YUV frames)
+     */
+    static bool canWrap(const cv::Mat &frame, Format format);
+
+    /**
+     * @brief wrap
+     * @return a header over the gray part of the frame (requires canWrap())
+     */
+    static cv::Mat wrap(const cv::Mat &frame, Format format);
+
+    /**
+     * @brief convert
+     * converts the part rect (in gray frame coordinates) of the frame
+     * @param gray destination of the size of rect, written in place (so it
+     * may be a part of a bigger gray frame)
+     */
+    static void convert(const cv::Mat &frame, Format format, const cv::Rect &rect, cv::Mat &gray);
+
+    /**
+     * @brief downscale
+     * converts the whole frame into a gray frame of the size of gray (the
+     * gray size divided by the factor), averaging the pixels of each area
+     * before the conversion: luma is linear in the channels, so a color
+     * frame is resampled first and only the small frame is converted, a
+     * Bayer frame is binned (R, 2 G and B per cell)
+     * @param gray destination, written in place (like convert())
+     * @param buffer scratch for color frames, kept between the calls
+     */
+    static void downscale(const cv::Mat &frame, Format format, cv::Mat &gray, cv::Mat &buffer);
+
+    /**
+     * @brief allocatePadded
+     * makes gray a CV_8UC1 frame of the given size inside a buffer with at
+     * least border pixels around it; the buffer is kept if it fits
+     */
+    static void allocatePadded(cv::Mat &gray, const cv::Size &size, const cv::Size &border);
+
+    /**
+     * @brief fillBorder
+     * fills the border around a frame of allocatePadded() like
+     * cv::copyMakeBorder with BORDER_REFLECT_101 would do
+     */
+    static void fillBorder(cv::Mat &gray);
+};
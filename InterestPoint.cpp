@@ -4,18 +4,36 @@ InterestPoint::InterestPoint(): ObjectModel(), m_userStatus(0), m_isDummy(false)
 
 }
 
+InterestPoint::InterestPoint(const PointRecord &record):
+    ObjectModel(),
+    m_status(record.status),
+    m_position(record.position),
+    m_userStatus(record.userStatus),
+    m_isDummy(false)
+{
+
+}
+
 InterestPoint::~InterestPoint() {}
 
+PointRecord InterestPoint::toRecord() const {
+    PointRecord record;
+    record.position = m_position;
+    record.status = m_status;
+    record.userStatus = m_userStatus;
+    return record;
+}
+
 void InterestPoint::setPosition(cv::Point2f pos) {
     m_position.x = pos.x;
     m_position.y = pos.y;
 }
 
-cv::Point2f InterestPoint::getPosition() {
+cv::Point2f InterestPoint::getPosition() const {
     return m_position;
 }
 
-bool InterestPoint::isValid() {
+bool InterestPoint::isValid() const {
     return m_status == InterestPointStatus::Valid ||
             m_status == InterestPointStatus::Not_Tracked;
 }
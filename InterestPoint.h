@@ -3,32 +3,22 @@
 #include <opencv2/opencv.hpp>
 #include <biotracker/serialization/ObjectModel.h>
 
+#include "PointRecord.h"
+
 /**
- * @brief The InterestPointStatus enum
- * Show all the stati that the intrest points can yield
+ * @brief The InterestPoint class
+ * a PointRecord as a BioTracker object, only used by the plugin to save and
+ * load the trajectories through BioTracker
  */
-enum class InterestPointStatus {
-    Valid, // The point is valid and can be tracked
-    Invalid,	// the point is not valid (due to the tracking)
-                // and should not be tracked!
-    Non_Existing,	// the point does not exist yet! (because the user
-                    // jumped back in time
-    Not_Tracked		// occures when only the active point is tracked.
-                    // All other points that are valid are set to this state
-                    // during the time only the active point is tracked
-};
-
-
-const size_t interestPointMaximumUserStatus = sizeof(size_t) * 8;
-
 class InterestPoint : public BioTracker::Core::ObjectModel {
 public:
                 InterestPoint();
+    explicit	InterestPoint(const PointRecord &record);
     virtual		~InterestPoint();
     void		setPosition(cv::Point2f pos);
-    cv::Point2f getPosition();
-    bool		isValid();
-    InterestPointStatus getStatus() {
+    cv::Point2f getPosition() const;
+    bool		isValid() const;
+    InterestPointStatus getStatus() const {
         return m_status;
     }
 
@@ -38,7 +28,7 @@ public:
      * TODO: make this nicer at some point..
      * @return
      */
-    bool		isDummy() {
+    bool		isDummy() const {
         return m_isDummy;
     }
 
@@ -62,10 +52,16 @@ public:
      */
     void removeFromUserStatus(const size_t i);
 
-    size_t getStatusAsI() {
+    size_t getStatusAsI() const {
         return m_userStatus;
     }
 
+    void setStatusAsI(size_t userStatus) {
+        m_userStatus = userStatus;
+    }
+
+    PointRecord	toRecord() const;
+
 private:
     InterestPointStatus m_status = InterestPointStatus::Valid;
     cv::Point2f m_position;
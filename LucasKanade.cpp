@@ -1,5 +1,9 @@
 #include "LucasKanade.h"
 
+#include <algorithm>
+#include <string>
+#include <thread>
+
 #include <QApplication>
 #include <QIntValidator>
 #include <QPushButton>
@@ -11,6 +15,10 @@
 #include <biotracker/TrackingAlgorithm.h>
 #include <biotracker/Registry.h>
 
+#include <opencv2/opencv.hpp>
+
+#include "TrajectoryFile.h"
+
 using namespace BioTracker::Core;
 
 extern "C" {
@@ -25,17 +33,25 @@ extern "C" {
 
 LucasKanadeTracker::LucasKanadeTracker(Settings &settings):
     TrackingAlgorithm(settings),
-    m_setUserStates(m_numberOfUserStates),
     m_itemSize(1),
-    m_subPixWinSize(10, 10),
-    m_winSize(31, 31),
-    m_termcrit(cv::TermCriteria::COUNT | cv::TermCriteria::EPS,20,0.03),
-    m_trackOnlyActive(false),
+    m_maxWinSize(m_core.getWinSize().height),
+    m_currentFrame(0),
     m_pauseOnInvalidPoint(false),
     m_winSizeSlider(new QSlider(getToolsWidget())),
-    m_winSizeValue(new QLabel(QString::number(m_winSize.height), getToolsWidget())),
+    m_winSizeValue(new QLabel(QString::number(m_core.getWinSize().height), getToolsWidget())),
     m_historySlider(new QSlider(getToolsWidget())),
     m_historyValue(new QLabel("0", getToolsWidget())),
+    m_threadsValue(new QLabel(getToolsWidget())),
+    m_pyramidValue(new QLabel(getToolsWidget())),
+    m_frameCacheValue(new QLabel(getToolsWidget())),
+    m_replenishValue(new QLabel("off", getToolsWidget())),
+    m_memoryBudgetValue(new QLabel(getToolsWidget())),
+    m_downscaleValue(new QLabel("off", getToolsWidget())),
+#ifdef LUCASKANADE_PROFILING
+    m_profileValue(new QLabel(getToolsWidget())),
+#endif
+    m_arenaButton(new QPushButton("Arena mask", getToolsWidget())),
+    m_exportProgress(new QProgressBar(getToolsWidget())),
     m_invalidOffset(-99999, -99999),
     m_validColor(QColor::fromRgb(0, 0, 255)),
     m_invalidColor(QColor::fromRgb(255, 0, 0))
@@ -48,7 +64,7 @@ LucasKanadeTracker::LucasKanadeTracker(Settings &settings):
     auto layout = new QGridLayout();
 
     // User status
-    for (size_t i = 0; i < m_numberOfUserStates; i++) {
+    for (size_t i = 0; i < m_core.getNumberOfUserStates(); i++) {
         auto text = QString("Status ");
         text.append(QString::number(i+1));
         auto *chkboxUserStatus = new QCheckBox(text, ui);
@@ -87,15 +103,133 @@ LucasKanadeTracker::LucasKanadeTracker(Settings &settings):
     // winsize
     auto *lbl_winSize = new QLabel("window size:", ui);
     m_winSizeSlider->setMinimum(10);
-    m_winSizeSlider->setMaximum(m_winSize.height);
+    m_winSizeSlider->setMaximum(m_maxWinSize);
     m_winSizeSlider->setOrientation(Qt::Orientation::Horizontal);
-    m_winSizeSlider->setValue(m_winSize.height);
+    m_winSizeSlider->setValue(m_core.getWinSize().height);
     QObject::connect(m_winSizeSlider, &QSlider::valueChanged,
         this, &LucasKanadeTracker::sliderChanged_winSize);
     layout->addWidget(lbl_winSize, 5, 0, 1, 1);
     layout->addWidget(m_winSizeValue, 6, 2, 1, 1);
     layout->addWidget(m_winSizeSlider, 6, 0, 1, 2);
 
+    // threads (the LK step is split into chunks of points)
+    m_core.setThreadCount(0);
+    auto *lbl_threads = new QLabel("threads:", ui);
+    auto *threadsSlider = new QSlider(ui);
+    threadsSlider->setMinimum(1);
+    threadsSlider->setMaximum(static_cast<int>(std::max<unsigned>(1, std::thread::hardware_concurrency())));
+    threadsSlider->setOrientation(Qt::Orientation::Horizontal);
+    threadsSlider->setValue(static_cast<int>(m_core.getThreadCount()));
+    m_threadsValue->setText(QString::number(m_core.getThreadCount()));
+    QObject::connect(threadsSlider, &QSlider::valueChanged,
+        this, &LucasKanadeTracker::sliderChanged_threads);
+    layout->addWidget(lbl_threads, 12, 0, 1, 1);
+    layout->addWidget(m_threadsValue, 13, 2, 1, 1);
+    layout->addWidget(threadsSlider, 13, 0, 1, 2);
+
+    // Checkbox for our own (vectorized) LK kernel instead of OpenCV
+    auto *chkboxNativeKernel = new QCheckBox(QString("Own LK kernel (%1)")
+        .arg(LucasKanadeKernel::isaName(LucasKanadeKernel::bestIsa())), ui);
+    chkboxNativeKernel->setChecked(m_core.isUsingNativeKernel());
+    QObject::connect(chkboxNativeKernel, &QCheckBox::stateChanged,
+        this, &LucasKanadeTracker::checkboxChanged_nativeKernel);
+    layout->addWidget(chkboxNativeKernel, 14, 0, 1, 3);
+
+    // pyramid depth derived from the recent motion instead of a fixed depth
+    m_core.setAdaptivePyramid(true);
+    auto *chkboxAdaptivePyramid = new QCheckBox("Adaptive pyramid depth", ui);
+    chkboxAdaptivePyramid->setChecked(m_core.isAdaptivePyramid());
+    QObject::connect(chkboxAdaptivePyramid, &QCheckBox::stateChanged,
+        this, &LucasKanadeTracker::checkboxChanged_adaptivePyramid);
+    layout->addWidget(chkboxAdaptivePyramid, 15, 0, 1, 2);
+    layout->addWidget(m_pyramidValue, 15, 2, 1, 1);
+
+    // with a few points only the tiles around them are converted and searched
+    m_core.setRegionTracking(true);
+    auto *chkboxRegionTracking = new QCheckBox("Track in regions around the points", ui);
+    chkboxRegionTracking->setChecked(m_core.isRegionTracking());
+    QObject::connect(chkboxRegionTracking, &QCheckBox::stateChanged,
+        this, &LucasKanadeTracker::checkboxChanged_regionTracking);
+    layout->addWidget(chkboxRegionTracking, 16, 0, 1, 3);
+
+    // gray frames and pyramids of the last frames, for scrubbing back and forth
+    const int frameCacheMegabytes = 512;
+    m_core.setFrameCacheBudget(static_cast<size_t>(frameCacheMegabytes) << 20);
+    auto *lbl_frameCache = new QLabel("frame cache (MB):", ui);
+    auto *frameCacheSlider = new QSlider(ui);
+    frameCacheSlider->setMinimum(0);
+    frameCacheSlider->setMaximum(4096);
+    frameCacheSlider->setSingleStep(64);
+    frameCacheSlider->setPageStep(256);
+    frameCacheSlider->setOrientation(Qt::Orientation::Horizontal);
+    frameCacheSlider->setValue(frameCacheMegabytes);
+    m_frameCacheValue->setText(QString::number(frameCacheMegabytes));
+    QObject::connect(frameCacheSlider, &QSlider::valueChanged,
+        this, &LucasKanadeTracker::sliderChanged_frameCache);
+    layout->addWidget(lbl_frameCache, 17, 0, 1, 1);
+    layout->addWidget(m_frameCacheValue, 18, 2, 1, 1);
+    layout->addWidget(frameCacheSlider, 18, 0, 1, 2);
+
+    // lost points are replaced by new corners where the frame ran empty
+    auto *lbl_replenish = new QLabel("keep points alive:", ui);
+    auto *replenishSlider = new QSlider(ui);
+    replenishSlider->setMinimum(0);
+    replenishSlider->setMaximum(2000);
+    replenishSlider->setSingleStep(50);
+    replenishSlider->setPageStep(250);
+    replenishSlider->setOrientation(Qt::Orientation::Horizontal);
+    replenishSlider->setValue(0);
+    QObject::connect(replenishSlider, &QSlider::valueChanged,
+        this, &LucasKanadeTracker::sliderChanged_replenish);
+    layout->addWidget(lbl_replenish, 19, 0, 1, 1);
+    layout->addWidget(m_replenishValue, 20, 2, 1, 1);
+    layout->addWidget(replenishSlider, 20, 0, 1, 2);
+
+#ifdef LUCASKANADE_PROFILING
+    // stage times of the last frames, the trace shows every single one
+    auto *lbl_profile = new QLabel("stage times (p50 / p99):", ui);
+    layout->addWidget(lbl_profile, 21, 0, 1, 2);
+    auto *dumpTraceBtn = new QPushButton("Dump trace", ui);
+    QObject::connect(dumpTraceBtn, &QPushButton::clicked,
+        this, &LucasKanadeTracker::clicked_dumpTrace);
+    layout->addWidget(dumpTraceBtn, 21, 2, 1, 1);
+    layout->addWidget(m_profileValue, 22, 0, 1, 3);
+#endif
+
+    // trajectory data beyond this is packed away from the current frame
+    const int memoryBudgetMegabytes = 1024;
+    m_core.setMemoryBudget(static_cast<size_t>(memoryBudgetMegabytes) << 20);
+    auto *lbl_memoryBudget = new QLabel("trajectory memory (MB):", ui);
+    auto *memoryBudgetSlider = new QSlider(ui);
+    memoryBudgetSlider->setMinimum(0);
+    memoryBudgetSlider->setMaximum(16384);
+    memoryBudgetSlider->setSingleStep(64);
+    memoryBudgetSlider->setPageStep(1024);
+    memoryBudgetSlider->setOrientation(Qt::Orientation::Horizontal);
+    memoryBudgetSlider->setValue(memoryBudgetMegabytes);
+    m_memoryBudgetValue->setText(QString::number(memoryBudgetMegabytes));
+    QObject::connect(memoryBudgetSlider, &QSlider::valueChanged,
+        this, &LucasKanadeTracker::sliderChanged_memoryBudget);
+    layout->addWidget(lbl_memoryBudget, 23, 0, 1, 1);
+    layout->addWidget(m_memoryBudgetValue, 24, 2, 1, 1);
+    layout->addWidget(memoryBudgetSlider, 24, 0, 1, 2);
+
+    // 4K and bigger: LK on a downscaled frame, refined on full resolution
+    // patches (the slider is the power of two of the factor)
+    auto *lbl_downscale = new QLabel("downscale (4K+):", ui);
+    auto *downscaleSlider = new QSlider(ui);
+    downscaleSlider->setMinimum(0);
+    downscaleSlider->setMaximum(3);
+    downscaleSlider->setSingleStep(1);
+    downscaleSlider->setPageStep(1);
+    downscaleSlider->setOrientation(Qt::Orientation::Horizontal);
+    downscaleSlider->setValue(0);
+    QObject::connect(downscaleSlider, &QSlider::valueChanged,
+        this, &LucasKanadeTracker::sliderChanged_downscale);
+    layout->addWidget(lbl_downscale, 25, 0, 1, 1);
+    layout->addWidget(m_downscaleValue, 26, 2, 1, 1);
+    layout->addWidget(downscaleSlider, 26, 0, 1, 2);
+
     // colors
     auto lbl_color = new QLabel("Change color:", ui);
     layout->addWidget(lbl_color, 7, 0, 1, 1);
@@ -116,6 +250,27 @@ LucasKanadeTracker::LucasKanadeTracker(Settings &settings):
         this, &LucasKanadeTracker::clicked_print);
     layout->addWidget(printBtn, 9, 0, 1, 1);
 
+    m_exportProgress->setRange(0, 100);
+    m_exportProgress->hide();
+    layout->addWidget(m_exportProgress, 9, 1, 1, 2);
+
+    // load
+    auto loadBtn = new QPushButton("Load", ui);
+    QObject::connect(loadBtn, &QPushButton::clicked,
+        this, &LucasKanadeTracker::clicked_load);
+    layout->addWidget(loadBtn, 11, 0, 1, 1);
+
+    // arena (a mask image, the points are only tracked inside)
+    QObject::connect(m_arenaButton, &QPushButton::clicked,
+        this, &LucasKanadeTracker::clicked_arena);
+    layout->addWidget(m_arenaButton, 11, 1, 1, 1);
+
+    // automatic seeding (runs on the next paint, which has the frame)
+    auto findPointsBtn = new QPushButton("Find points", ui);
+    QObject::connect(findPointsBtn, &QPushButton::clicked,
+        this, &LucasKanadeTracker::clicked_findPoints);
+    layout->addWidget(findPointsBtn, 11, 2, 1, 1);
+
     // ===
 
     ui->setLayout(layout);
@@ -123,146 +278,107 @@ LucasKanadeTracker::LucasKanadeTracker(Settings &settings):
 
 void LucasKanadeTracker::track(size_t frame, const cv::Mat &imgOriginal) {
     m_userStatusMutex.Lock();
-    // Landscape vs	portrait
-    // [xxxx]		[xx]
-    // [xxxx]		[xx]
-    //       		[xx]
-    //
-    const bool isLandscape = imgOriginal.rows > imgOriginal.cols;
-
-	// make the winSize adaptable
-    const int currentMaxWinSize = m_winSizeSlider->maximum();
-    const int newMaxWinSize = isLandscape ? imgOriginal.cols / 10 : imgOriginal.rows / 10;
-    if (currentMaxWinSize != newMaxWinSize && newMaxWinSize > m_winSizeSlider->minimum()) {
+    m_commands.drain();
+
+	// make the winSize adaptable (only touch the slider when its range changes)
+    const int newMaxWinSize = LucasKanadeCore::maximumWinSize(cv::Size(imgOriginal.cols, imgOriginal.rows));
+    if (m_maxWinSize != newMaxWinSize && newMaxWinSize > m_winSizeSlider->minimum()) {
+        m_maxWinSize = newMaxWinSize;
         m_winSizeSlider->setMaximum(newMaxWinSize);
     }
 
-    m_currentFrame = frame; // TODO must this be protected from other threads?
-    cv::cvtColor(imgOriginal, m_gray, cv::COLOR_BGR2GRAY);
-
-    std::vector<InterestPointStatus> filter;
-    std::vector<InterestPoint> data;
-    std::vector<cv::Point2f> currentPoints = getCurrentPoints(static_cast<ulong>(frame) - 1, filter, data);
-
-    if (m_prevGray.empty()) {
-        m_gray.copyTo(m_prevGray);
-            m_frameIndex_prevGray = m_currentFrame;
-    }
-
-    // clamp away invalid points:
-    std::vector<cv::Point2f> currentPointsOnlyActive;
-    std::vector<size_t> activePointIds;
-    splitActivePoints(currentPoints,
-              filter,
-              currentPointsOnlyActive,
-              activePointIds);
-
-    if (!currentPointsOnlyActive.empty()) {
-        std::vector<float> err;
-
-        // calculate pyramids:
-        const size_t maxLevel = 10;
-        std::vector<cv::Mat> prevPyr;
-        cv::buildOpticalFlowPyramid(m_prevGray, prevPyr, m_winSize, maxLevel);
-
-        std::vector<cv::Mat> pyr;
-        cv::buildOpticalFlowPyramid(m_gray, pyr, m_winSize, maxLevel);
-
-        std::vector<cv::Point2f> newPoints;
-        std::vector<uchar> status;
-        cv::calcOpticalFlowPyrLK(
-        prevPyr, /* prev */
-        pyr, /* next */
-        currentPointsOnlyActive,	/* prevPts */
-        newPoints, /* nextPts */
-        status,	/* status */
-        err	/* err */
-        ,m_winSize,	/* winSize */
-        maxLevel, /* maxLevel */
-        m_termcrit,	/* criteria */
-        0, /* flags */
-        0.001 /* minEigThreshold */
-        );
-
-        // put together the clamped away points
-        status = joinActivePoints(currentPoints,
-                                  newPoints,
-                                  activePointIds,
-                                  status);
-
-        clampPosition(newPoints, m_gray.cols, m_gray.rows);
-        updateCurrentPoints(static_cast<ulong>(frame), currentPoints, status, filter);
-        updateHistoryText();
-        updateUserStates(frame);
-    }
-
-    cv::swap(m_prevGray, m_gray);
-    m_frameIndex_prevGray = m_currentFrame;
+    m_currentFrame = frame;
+    const bool somePointsAreInvalid = m_core.track(frame, imgOriginal);
+    updateHistoryText();
+    if (m_core.getRegionCount() > 0) {
+        m_pyramidValue->setText(QString("levels: %1, tiles: %2")
+            .arg(m_core.getPyramidDepth()).arg(m_core.getRegionCount()));
+    } else {
+        m_pyramidValue->setText(QString("levels: %1").arg(m_core.getPyramidDepth()));
+    }
+    publishOverlayView();
 
     m_userStatusMutex.Unlock();
+
+    if (somePointsAreInvalid) {
+        Q_EMIT notifyGUI("Some points are invalid");
+        if (m_pauseOnInvalidPoint) {
+            Q_EMIT pausePlayback(true);
+        }
+    }
 }
 
 void LucasKanadeTracker::paint(size_t, ProxyMat & mat, const TrackingAlgorithm::View &) {
+    LK_PROFILE_SCOPE(Paint);
 	// when frames are skipped without tracking we have outdated gray frames yielding tracking errors
     m_userStatusMutex.Lock();
-    if (!isTrackingActivated() && ( m_currentFrame != m_frameIndex_prevGray )) {
-		cv::cvtColor(mat.getMat(), m_prevGray, cv::COLOR_BGR2GRAY);
-		m_frameIndex_prevGray = m_currentFrame; // all consecutive calls are thus not copying the frame any more
+    const size_t commands = m_commands.drain();
+    if (!isTrackingActivated() && !m_core.isPreviousFrameSynced(m_currentFrame)) {
+		// all consecutive calls are thus not copying the frame any more
+		m_core.resyncPreviousFrame(m_currentFrame, mat.getMat());
     }
 
-    if (!m_isInitialized) {
-		cv::cvtColor(mat.getMat(), m_gray, cv::COLOR_BGR2GRAY);
+    size_t foundPoints = 0;
+    const bool findPoints = m_findPointsRequested;
+    if (findPoints) {
+        m_findPointsRequested = false;
+        foundPoints = m_core.autoFindInitPoints(m_currentFrame, mat.getMat());
+    }
 
+    if (!m_isInitialized) {
 		const bool isLandscape = mat.getMat().rows > mat.getMat().cols;
 
 		// make sure that the circles are in "good" size, regardless of the video resolution (tiny vs gigantic)
 		const int perc_size = 45;
 		m_itemSize = !isLandscape ? mat.getMat().rows / perc_size : mat.getMat().cols / perc_size;
+		m_isInitialized = true;
 
 	}
 
+    // the edits of the commands, the found points or a frame shown without tracking
+    if (commands > 0 || findPoints || m_publishedFrame != m_currentFrame) {
+        publishOverlayView();
+    }
+
     m_userStatusMutex.Unlock();
+
+    if (findPoints) {
+        Q_EMIT notifyGUI("Found " + std::to_string(foundPoints) + " new points");
+    }
 }
 
 void LucasKanadeTracker::paintOverlay(size_t currentFrame, QPainter *painter, const View &) {
-    m_userStatusMutex.Lock();
+    LK_PROFILE_SCOPE(Overlay);
     // update current frame counter in case the track function is disabled.
 	// not-so-nice solution since the same line appears in function "track"
-	m_currentFrame = currentFrame; // TODO must this be protected from other threads?
-	
-	std::vector<InterestPointStatus> filter;
-    std::vector<InterestPoint> data;
-    std::vector<cv::Point2f> newPoints = getCurrentPoints(static_cast<ulong>(currentFrame), filter, data);
-
-    // fill the history
-    std::vector<std::vector<cv::Point2f>> history;
-    for (size_t t = 1; t < m_currentHistory; t++) {
-        if (t > currentFrame) break;
-        ulong histTime = static_cast<ulong>(currentFrame - t);
-        
-        std::vector<InterestPointStatus> dummyfilter;
-        std::vector<InterestPoint> data2;
-        std::vector<cv::Point2f> histPoints = getCurrentPoints(histTime, dummyfilter, data2);
-        history.push_back(histPoints);
+	m_currentFrame = currentFrame;
+
+    // drawn from the view published last, never waits for a running tracking step
+    const SnapshotPublisher<OverlayView>::Reader view(m_overlayView);
+    if ((!view || view->frame != currentFrame) && m_requestedView != currentFrame) {
+        // e.g. seeking without tracking: the next paint() publishes this frame
+        m_requestedView = currentFrame;
+        Q_EMIT update();
+    }
+    if (!view) {
+        return;
     }
 
     bool currentActivePointIsDrawn = false;
     QFont font = painter->font();
     font.setPixelSize(m_itemSize);
     painter->setFont(font);
-    size_t i;
-    for (i = 0; i < newPoints.size(); i++) {
-        if (filter[i] == InterestPointStatus::Non_Existing) {
-            // the i`th point became invalid
-            continue;
-        }
+    const LucasKanadeCore::CurrentPoints &points = view->points;
+    for (size_t k = 0; k < points.size(); k++) {
+        const size_t id = points.ids[k];
+        const InterestPointStatus status = points.statuses[k];
 
         QColor color = m_validColor;
-        auto point = newPoints[i];
-        if (filter[i] == InterestPointStatus::Invalid) {
+        auto point = points.positions[k];
+        if (status == InterestPointStatus::Invalid) {
             point -= m_invalidOffset;
             color = m_invalidColor;
-        } else if (filter[i] == InterestPointStatus::Not_Tracked) {
+        } else if (status == InterestPointStatus::Not_Tracked) {
             color.setAlpha(100);
         }
 
@@ -270,41 +386,115 @@ void LucasKanadeTracker::paintOverlay(size_t currentFrame, QPainter *painter, co
         int y = static_cast<int>(point.y);
 
         QPen p(color);
-        if (i == static_cast<size_t>(m_currentActivePoint)) {
+        if (id == static_cast<size_t>(view->currentActivePoint)) {
             p.setStyle(Qt::PenStyle::DotLine);
             m_lastDrawnActivePointX = x;
             m_lastDrawnActivePointY = y;
             currentActivePointIsDrawn = true;
         }
 
-        drawEllipse(painter, p, data[i], i, x, y);
+        drawEllipse(painter, p, points.userStatuses[k], id, x, y);
+    }
+
+    // paint History
+    drawHistory(painter, m_validColor, view->validHistory);
+    drawHistory(painter, m_invalidColor, view->invalidHistory);
 
-        // paint History
+    const int currentActivePoint = view->currentActivePoint;
+    if (!currentActivePointIsDrawn && currentActivePoint >= 0) {
+        // When tracking is deactivated we want to see at least where the currently activated
+        // point was last..
+        QColor color = m_validColor;
         color.setAlpha(100);
-        QPen histPen(color);
-        painter->setPen(histPen);
-        for (auto histPoints : history) {
-            auto histPoint = histPoints[i];
+        QPen p(color);
+        p.setStyle(Qt::PenStyle::DotLine);
+        drawEllipse(painter, p, 0, currentActivePoint, m_lastDrawnActivePointX, m_lastDrawnActivePointY);
+    }
+
+#ifdef LUCASKANADE_PROFILING
+    updateProfileText();
+#endif
+}
+
+void LucasKanadeTracker::publishOverlayView() {
+    std::unique_ptr<OverlayView> view(new OverlayView());
+    const size_t frame = m_currentFrame;
+    view->frame = frame;
+    m_core.getCurrentPoints(frame, view->points);
+    view->currentActivePoint = m_core.getCurrentActivePoint();
+
+    // fill the history from the trail cache (only frames that are not cached yet are computed);
+    // its length is the history, so the frames below never share a slot
+    std::vector<const std::vector<cv::Point2f>*> history;
+    const size_t historyLength = m_core.getTrailLength();
+    for (size_t t = 1; t < historyLength; t++) {
+        if (t > frame) break;
+        history.push_back(&m_core.getTrail(frame - t));
+    }
+
+    // the history is drawn in one batch per color after all points
+    const LucasKanadeCore::CurrentPoints &points = view->points;
+    for (size_t k = 0; k < points.size() && !history.empty(); k++) {
+        const size_t id = points.ids[k];
+        QVector<QPoint> &histPoints = points.statuses[k] == InterestPointStatus::Invalid ?
+                    view->invalidHistory : view->validHistory;
+        for (const std::vector<cv::Point2f> *histFrame : history) {
+            if (id >= histFrame->size()) {
+                continue;
+            }
+            const cv::Point2f &histPoint = (*histFrame)[id];
             int x = static_cast<int>(histPoint.x);
             int y = static_cast<int>(histPoint.y);
             if (x > 0 && y > 0) { // otherwise the point is invalid
-                painter->drawRect(x, y, 1, 1);
+                histPoints.push_back(QPoint(x, y));
             }
         }
     }
 
-    if (!currentActivePointIsDrawn && m_currentActivePoint >= 0) {
-        // When tracking is deactivated we want to see at least where the currently activated
-        // point was last..
-        QColor color = m_validColor;
-        color.setAlpha(100);
-        QPen p(color);
-        p.setStyle(Qt::PenStyle::DotLine);
-        drawEllipse(painter, p, data[m_currentActivePoint], m_currentActivePoint, m_lastDrawnActivePointX, m_lastDrawnActivePointY);
+    m_overlayView.publish(std::move(view));
+    m_publishedFrame = frame;
+}
+
+#ifdef LUCASKANADE_PROFILING
+void LucasKanadeTracker::updateProfileText() {
+    const uint64_t now = StageProfiler::now();
+    if (now - m_profileShown < 500000000) {
+        return;
     }
+    m_profileShown = now;
 
-    m_userStatusMutex.Unlock();
+    const auto summaries = StageProfiler::instance().summarize();
+    QString text;
+    for (size_t i = 0; i < summaries.size(); i++) {
+        if (summaries[i].count == 0) {
+            continue;
+        }
+        if (!text.isEmpty()) {
+            text.append('\n');
+        }
+        text.append(QString("%1: %2 / %3 ms")
+            .arg(StageProfiler::stageName(static_cast<StageProfiler::Stage>(i)))
+            .arg(summaries[i].p50, 0, 'f', 2)
+            .arg(summaries[i].p99, 0, 'f', 2));
+    }
+    m_profileValue->setText(text);
+}
+
+void LucasKanadeTracker::clicked_dumpTrace() {
+    const QString fileName = QFileDialog::getSaveFileName(nullptr, "Dump stage trace",
+        "lucaskanade_trace.json", "Chrome trace (*.json)");
+    if (fileName.isEmpty()) {
+        return;
+    }
+
+    std::string error;
+    if (StageProfiler::instance().writeChromeTrace(fileName.toStdString(), &error)) {
+        Q_EMIT notifyGUI("Trace written, open it in chrome://tracing");
+    } else {
+        Q_EMIT notifyGUI(error);
+    }
 }
+#endif
 
 void LucasKanadeTracker::keyPressEvent(QKeyEvent *ev) {
     if (ev->key() == 68) { // => Key: 'd'
@@ -331,200 +521,101 @@ void LucasKanadeTracker::mouseReleaseEvent(QMouseEvent *e)
 }
 
 void LucasKanadeTracker::inputChanged() {
-    // reset tracked points
+    // reset tracked points (before the first step on the new video)
+    m_trackedObjects.clear();
+    m_commands.push([this]() {
+        m_core.clear();
+        // the frame numbers refer to other frames now
+        m_core.clearFrameCache();
+        m_isInitialized = false;
+    });
+    Q_EMIT update();
+}
+
+void LucasKanadeTracker::prepareSave() {
+    m_userStatusMutex.Lock();
     m_trackedObjects.clear();
+    for (const Trajectory &t : m_core.getTrajectories()) {
+        TrackedObject o(t.getId());
+        for (const Trajectory::Span &span : t.spans()) {
+            for (size_t frame = span.first; frame <= span.last; frame++) {
+                o.add(frame, std::make_shared<InterestPoint>(t.get(frame)));
+            }
+        }
+        m_trackedObjects.push_back(o);
+    }
+    m_userStatusMutex.Unlock();
+}
+
+void LucasKanadeTracker::postLoad() {
+    // converted here, only handing them to the core waits for the tracking thread
+    auto trajectories = std::make_shared<std::vector<Trajectory>>();
+    trajectories->reserve(m_trackedObjects.size());
+    for (size_t i = 0; i < m_trackedObjects.size(); i++) {
+        const TrackedObject &o = m_trackedObjects[i];
+        Trajectory t(i); // position in list + id are correlated
+        for (size_t frame = 0; frame <= o.maximumFrameNumber(); frame++) {
+            if (o.hasValuesAtFrame(frame)) {
+                t.add(frame, o.get<InterestPoint>(frame)->toRecord()); // fills the columns of t
+            }
+        }
+        trajectories->push_back(t);
+    }
+    m_commands.push([this, trajectories]() {
+        m_core.setTrajectories(std::move(*trajectories));
+    });
+    Q_EMIT update();
 }
 
 // =========== P R I V A T E = F U N C S ============
 
 
 
+// the edits are queued for the tracking thread (at the frame that is shown
+// now), the update() lets paint() apply them and publish the result
+
 void LucasKanadeTracker::tryCreateNewPoint(QPoint pos) 
 {
- //   if (m_gray.empty()) 
-	//{
-	//	// prevGray always exists 
-	//	m_prevGray.copyTo(m_gray);
- //   }
-
-    std::vector<InterestPointStatus> filter;
-    std::vector<InterestPoint> data;
-    std::vector<cv::Point2f> newPoints = getCurrentPoints(static_cast<ulong>(m_currentFrame), filter, data);
-    cv::Point2f point = toCv(pos);
-    for (auto otherPos : newPoints) {
-        if (cv::norm(point - otherPos) <= 5) {
+    const size_t frame = m_currentFrame;
+    const cv::Point2f position = toCv(pos);
+    m_commands.push([this, frame, position]() {
+        if (!m_core.tryCreateNewPoint(frame, position)) {
             // the new point is too close to an existing other point.. abort
             Q_EMIT notifyGUI("too close to an existing point..");
-            return;
         }
-    }
-
-    std::vector<cv::Point2f> tmp;
-    tmp.push_back(point);
-    cv::cornerSubPix(m_gray, tmp, m_winSize, cv::Size(-1, -1), m_termcrit);
-
-    const auto newPos = tmp[0];
-    auto p = std::make_shared<InterestPoint>(); // TODO: this allocation is not 'pretty' as it is unnecessary
-    p->setPosition(cv::Point2f(newPos.x, newPos.y));
-    p->setStatus(InterestPointStatus::Valid);
-
-    const size_t id = m_trackedObjects.size(); // position in list + id are correlated
-    TrackedObject o(id);
-    o.add(m_currentFrame, p);
-    m_trackedObjects.push_back(o);
-
-    m_currentActivePoint = static_cast<int>(id);
-
-    if (m_firstTrackedFrame > static_cast<int>(m_currentFrame)) { // for the history calculation
-        m_firstTrackedFrame = static_cast<int>(m_currentFrame);
-    }
-
+    });
     Q_EMIT update();
-    
 }
 
 void LucasKanadeTracker::activateExistingPoint(QPoint pos) {
-    if (m_trackedObjects.size() > 0) {
-        cv::Point2f point = toCv(pos);
-        std::vector<InterestPointStatus> filter;
-        std::vector<InterestPoint> data;
-        std::vector<cv::Point2f> newPoints = getCurrentPoints(static_cast<ulong>(m_currentFrame), filter, data);
-        size_t currentClosestId = 0;
-        double currentMinDist = cv::norm(point - newPoints[0]);
-        for (size_t i = 1; i < newPoints.size(); i++) {
-            const double dist = cv::norm(point - newPoints[i]);
-            if (currentMinDist > dist) {
-                currentMinDist = dist;
-                currentClosestId = i;
-            }
+    const size_t frame = m_currentFrame;
+    const cv::Point2f position = toCv(pos);
+    m_commands.push([this, frame, position]() {
+        if (!m_core.activateExistingPoint(frame, position)) {
+            Q_EMIT notifyGUI("There are no points to select");
         }
-        m_currentActivePoint = static_cast<int>(currentClosestId);
-        Q_EMIT update();
-    } else {
-        Q_EMIT notifyGUI("There are no points to select");
-        m_currentActivePoint = -1;
-    }
+    });
+    Q_EMIT update();
 }
 
 void LucasKanadeTracker::moveCurrentActivePointTo(QPoint pos) {
-    if (!m_trackedObjects.empty() && m_currentActivePoint != -1) {
-        if (m_currentActivePoint > static_cast<int>(m_trackedObjects.size())) {
+    const size_t frame = m_currentFrame;
+    const cv::Point2f position = toCv(pos);
+    m_commands.push([this, frame, position]() {
+        const int currentActivePoint = m_core.getCurrentActivePoint();
+        if (!m_core.moveCurrentActivePointTo(frame, position) && currentActivePoint != -1) {
             Q_EMIT notifyGUI("Selected point is not in range!");
-        } else {
-            auto p = std::make_shared<InterestPoint>();
-            p->setStatus(InterestPointStatus::Valid);
-            p->setPosition(toCv(pos));
-            m_trackedObjects[m_currentActivePoint].add(m_currentFrame, p);
-            Q_EMIT update();
         }
-
-    }
+    });
+    Q_EMIT update();
 }
 
 void LucasKanadeTracker::deleteCurrentActivePoint() {
-    if (m_currentActivePoint >= 0) 
-	{
-		auto o = m_trackedObjects[m_currentActivePoint];
-
-        if (o.hasValuesAtFrame(m_currentFrame)) {
-            auto traj = o.get<InterestPoint>(m_currentFrame);
-            traj->setStatus(InterestPointStatus::Invalid);
-			Q_EMIT update();
-        }
-    }
-}
-
-void LucasKanadeTracker::autoFindInitPoints() {
-    if (!m_gray.empty()) {
-        //cv::goodFeaturesToTrack(m_gray, m_newPoints, MAX_COUNT, 0.01, 10, cv::Mat(), 3, 0, 0.04);
-        //cv::cornerSubPix(m_gray, m_newPoints, m_subPixWinSize, cv::Size(-1, -1), m_termcrit);
-    }
-}
-
-std::vector<cv::Point2f> LucasKanadeTracker::getCurrentPoints(
-        ulong frameNbr, std::vector<InterestPointStatus> &filter, std::vector<InterestPoint> &data) {
-    // TODO: make this implementation more efficient.. please..
-    // TODO: find a nicer solution for the filter-issue
-    // we want the filter to be empty as we fill it up here!
-    assert(filter.size() == 0);
-    assert(data.size() == 0);
-
-    filter.reserve(m_trackedObjects.size());
-
-    std::vector<cv::Point2f> positions;
-    positions.reserve(m_trackedObjects.size());
-
-    cv::Point2f dummy(-1, -1);
-    InterestPoint dummyIp;
-    dummyIp.makeDummy();
-    for (size_t i = 0; i < m_trackedObjects.size(); i++) {
-        auto o = m_trackedObjects[i];
-        if (o.hasValuesAtFrame(frameNbr)) {
-            auto traj = o.get<InterestPoint>(frameNbr);
-            if (traj->getStatus() == InterestPointStatus::Valid &&
-                    m_trackOnlyActive &&
-                    static_cast<int>(i) != m_currentActivePoint) {
-                filter.push_back(InterestPointStatus::Not_Tracked);
-            } else {
-                filter.push_back(traj->getStatus());
-            }
-            positions.push_back(traj->getPosition());
-            data.push_back(*traj);
-        } else {
-            filter.push_back(InterestPointStatus::Non_Existing);
-            data.push_back(dummyIp);
-            positions.push_back(dummy);
-        }
-    }
-
-    // all this trouble with the filter must be done as we directly correlate
-    // the index of the vector with the id of the containing object - which has
-    // some rather ugly implications for the code.. thus we filter out those
-    // points that are not valid
-
-    return positions;
-}
-
-void LucasKanadeTracker::updateCurrentPoints(
-        ulong frameNbr,
-        std::vector<cv::Point2f> &positions,
-        std::vector<uchar> &status,
-        std::vector<InterestPointStatus> &filter) {
-    // TODO: make this implementation more efficient.. please..
-
-    // this must yield true, otherwise we lose the direct index<->id relation
-    assert(positions.size() == m_trackedObjects.size());
-
-    // status and positions are directly correlated as each index represents the id
-    // of a specific tracked trajectory.
-    assert(positions.size() == status.size());
-
-    // filter is directly correlated to the trajectory data as each index represents
-    // the id of the trajectory
-    assert(filter.size() == positions.size());
-
-    bool somePointsAreInvalid = false;
-    for (size_t i = 0; i < positions.size(); i++) {
-        if (filter[i] == InterestPointStatus::Valid || filter[i] == InterestPointStatus::Not_Tracked) {
-            auto p = std::make_shared<InterestPoint>(); // TODO: this allocation is not 'pretty' as it is unnecessary
-            if (status[i]) {
-                p->setStatus(filter[i]);
-            } else {
-                p->setStatus(InterestPointStatus::Invalid);
-                somePointsAreInvalid = true;
-            }
-
-            p->setPosition(positions[i]);
-            m_trackedObjects[i].add(frameNbr, p);
-        }
-    }
-
-    if (somePointsAreInvalid) {
-        Q_EMIT notifyGUI("Some points are invalid");
-        if (m_pauseOnInvalidPoint) {
-            Q_EMIT pausePlayback(true);
-        }
-    }
+    const size_t frame = m_currentFrame;
+    m_commands.push([this, frame]() {
+        m_core.deleteCurrentActivePoint(frame);
+    });
+    Q_EMIT update();
 }
 
 cv::Point2f LucasKanadeTracker::toCv(QPoint pos) {
@@ -538,120 +629,35 @@ int LucasKanadeTracker::maximumHistory() {
 
 void LucasKanadeTracker::updateHistoryText() {
     const int maxSize = maximumHistory();
-    m_historyValue->setText(QString::number(m_currentHistory).
+    m_historyValue->setText(QString::number(m_currentHistory.load()).
         append("/").
         append(QString::number(maxSize)));
 
 }
 
-void LucasKanadeTracker::clampPosition(std::vector<cv::Point2f> &pos, int w, int h) {
-    // When points are outside the image boarders they cannot be rescued anymore
-    // This function clamps them to be inside the image again which is actually not
-    // very nice. See: https://github.com/BioroboticsLab/biotracker_lucasKanade/issues/8
-    for (cv::Point2f &p : pos) {
-        if (p.x < 0) {
-            p.x = 0;
-        } else if (p.x > w) {
-            p.x = w - 1;
-        }
-        if (p.y < 0) {
-            p.y = 0;
-        } else if (p.y > h) {
-            p.y = h - 1;
-        }
-    }
-}
-
-void LucasKanadeTracker::splitActivePoints(std::vector<cv::Point2f> &pos,
-                                           std::vector<InterestPointStatus> &filter,
-                                           std::vector<cv::Point2f> &tempPos,
-                                           std::vector<size_t> &activePoints) {
-    assert(pos.size() == filter.size());
-    assert(tempPos.size() == 0);
-    assert(activePoints.size() == 0);
-    assert(static_cast<int>(pos.size()) > m_currentActivePoint);
-
-    if (m_trackOnlyActive) {
-        if (m_currentActivePoint >= 0 && filter[m_currentActivePoint] == InterestPointStatus::Valid) {
-            tempPos.push_back(pos[m_currentActivePoint]);
-            activePoints.push_back(static_cast<size_t>(m_currentActivePoint));
-        }
-    } else {
-        for (size_t i = 0; i < pos.size(); i++) {
-            if (filter[i] == InterestPointStatus::Valid) {
-                tempPos.push_back(pos[i]);
-                activePoints.push_back(i);
-            }
-        }
-    }
-}
-
-std::vector<uchar> LucasKanadeTracker::joinActivePoints(std::vector<cv::Point2f> &pos,
-                                                        std::vector<cv::Point2f> &tempPos,
-                                                        std::vector<size_t> &activePoints,
-                                                        std::vector<uchar> status) {
-    assert(tempPos.size() == status.size());
-    assert(pos.size() >= tempPos.size());
-
-    // status must fit size-wise with pos
-    std::vector<uchar> realStatus(pos.size());
-    for (size_t i = 0; i < realStatus.size(); i++) {
-        // we make all positions "valid" for now
-        realStatus[i] = 1;
-    }
-
-    for (size_t i = 0; i < activePoints.size(); i++) {
-        size_t id = activePoints[i];
-        pos[id] = tempPos[i];
-        realStatus[id] = status[i];
-    }
-
-    return realStatus;
-}
-
-void LucasKanadeTracker::activateAllNonTrackedPoints(size_t frame) {
-    for (size_t i = 0; i < m_trackedObjects.size(); i++) {
-        auto o = m_trackedObjects[i];
-        if (o.hasValuesAtFrame(frame)) {
-            auto traj = o.get<InterestPoint>(frame);
-            if (traj->getStatus() == InterestPointStatus::Not_Tracked) {
-                traj->setStatus(InterestPointStatus::Valid);
-            }
-        }
-    }
-}
-
-void LucasKanadeTracker::updateUserStates(size_t currentFrame) {
-    if (m_currentActivePoint >= 0) {
-        auto o = m_trackedObjects[m_currentActivePoint];
-        if (o.hasValuesAtFrame(m_currentFrame)) {
-            // get interest point and set the user-defined value
-            auto traj = o.get<InterestPoint>(currentFrame);
-
-            // TODO: make this more efficient and nicer overall..
-            for (size_t i = 0; i < m_numberOfUserStates; i++) {
-                if (m_setUserStates[i]) {
-                    traj->addToUserStatus(i);
-                } else {
-                    traj->removeFromUserStatus(i);
-                }
-            }
-        }
-    }
-}
-
-void LucasKanadeTracker::drawEllipse(QPainter *painter, QPen &pen, InterestPoint &point, size_t id, int x, int y) {
+void LucasKanadeTracker::drawEllipse(QPainter *painter, QPen &pen, size_t userStatus, size_t id, int x, int y) {
     pen.setWidth(m_itemSize / 3 > 0 ? m_itemSize / 3 : 1);
     int itemSizeHalf = m_itemSize / 2;
     painter->setPen(pen);
     painter->drawEllipse(x - itemSizeHalf, y - itemSizeHalf, m_itemSize, m_itemSize);
     auto idTxt = QString::number(id);
-    auto flagTxt = QString::number(point.getStatusAsI());
+    auto flagTxt = QString::number(userStatus);
     painter->drawText(x, y - itemSizeHalf, idTxt);
     painter->drawText(x + itemSizeHalf, y + itemSizeHalf, flagTxt);
     painter->drawRect(x, y, 1, 1);
 }
 
+void LucasKanadeTracker::drawHistory(QPainter *painter, QColor color, const QVector<QPoint> &points) {
+    if (points.isEmpty()) {
+        return;
+    }
+    color.setAlpha(100);
+    QPen histPen(color);
+    histPen.setWidth(2); // same footprint as the former 1x1 rects
+    painter->setPen(histPen);
+    painter->drawPoints(points.constData(), points.size());
+}
+
 // ============== GUI HANDLING ==================
 
 void LucasKanadeTracker::checkboxChanged_invalidPoint(int state) {
@@ -659,20 +665,44 @@ void LucasKanadeTracker::checkboxChanged_invalidPoint(int state) {
 }
 
 void LucasKanadeTracker::checkboxChanged_userStatus(int state) {
-    m_userStatusMutex.Lock();
     QCheckBox *sender = qobject_cast<QCheckBox*>(QObject::sender());
-    size_t i = sender->accessibleName().toInt();
-    m_setUserStates[i] = (state == Qt::Checked);
-    m_userStatusMutex.Unlock();
+    const size_t i = sender->accessibleName().toInt();
+    const bool isSet = state == Qt::Checked;
+    m_commands.push([this, i, isSet]() {
+        m_core.setUserState(i, isSet);
+    });
 }
 
 void LucasKanadeTracker::checkboxChanged_activeUser(int state) {
-    m_userStatusMutex.Lock();
-    m_trackOnlyActive = state == Qt::Checked;
-    if (!m_trackOnlyActive) {
-        activateAllNonTrackedPoints(m_currentFrame);
-    }
-    m_userStatusMutex.Unlock();
+    const bool trackOnlyActive = state == Qt::Checked;
+    m_commands.push([this, trackOnlyActive]() {
+        m_core.setTrackOnlyActive(trackOnlyActive);
+        if (!m_core.isTrackOnlyActive()) {
+            m_core.activateAllNonTrackedPoints(m_currentFrame);
+        }
+    });
+    Q_EMIT update();
+}
+
+void LucasKanadeTracker::checkboxChanged_nativeKernel(int state) {
+    const bool enabled = state == Qt::Checked;
+    m_commands.push([this, enabled]() {
+        m_core.setUseNativeKernel(enabled);
+    });
+}
+
+void LucasKanadeTracker::checkboxChanged_adaptivePyramid(int state) {
+    const bool enabled = state == Qt::Checked;
+    m_commands.push([this, enabled]() {
+        m_core.setAdaptivePyramid(enabled);
+    });
+}
+
+void LucasKanadeTracker::checkboxChanged_regionTracking(int state) {
+    const bool enabled = state == Qt::Checked;
+    m_commands.push([this, enabled]() {
+        m_core.setRegionTracking(enabled);
+    });
 }
 
 void LucasKanadeTracker::clicked_validColor() {
@@ -693,52 +723,123 @@ void LucasKanadeTracker::clicked_invalidColor() {
 }
 
 void LucasKanadeTracker::clicked_print() {
-    // TODO: this is a hack (fast and ugly) -> make this nice with
-    // Biotracker-ish ways of handling data
-    size_t maxTs = 0;
-    for (auto o : m_trackedObjects) {
-        maxTs = o.maximumFrameNumber() > maxTs ? o.maximumFrameNumber() : maxTs;
+    if (m_exporter.isRunning()) {
+        Q_EMIT notifyGUI("An export is still running..");
+        return;
     }
 
-    QString output;
-    for (size_t frame = 0; frame < maxTs + 1; frame++) {
-        for (size_t i = 0; i < m_trackedObjects.size(); i++) {
-            auto o = m_trackedObjects[i];
-            if (o.hasValuesAtFrame(frame)) {
-                auto traj = o.get<InterestPoint>(frame);
-                if (traj->getStatus() == InterestPointStatus::Valid) {
-                    output.append(QString::number(frame));
-                    output.append(";");
-                    output.append(QString::number(i));
-                    output.append(";");
-                    output.append(QString::number(traj->getPosition().x));
-                    output.append(";");
-                    output.append(QString::number(traj->getPosition().y));
-                    output.append(";");
-                    output.append(QString::number(traj->getStatusAsI()));
-                    output.append("\n");
-                }
-            }
-        }
+    // the file name should be: output_lk_YEAR_MONTH_DAY_H_S.csv
+    QString defaultName("output_lk_");
+    QDateTime currentTime = QDateTime::currentDateTime();
+    defaultName.append(currentTime.toString("yyyy_MM_dd_hh_ss"));
+    defaultName.append(".csv");
+
+    const QString fileName = QFileDialog::getSaveFileName(nullptr, "Export trajectories",
+        defaultName, "CSV (*.csv);;Binary trajectories (*.lkt)");
+    if (fileName.isEmpty()) {
+        return;
     }
 
-    auto fileName = QFileDialog::getExistingDirectory();
+    // the export runs on a snapshot so tracking can go on meanwhile
+    m_userStatusMutex.Lock();
+    std::vector<Trajectory> trajectories = m_core.getTrajectories();
+    m_userStatusMutex.Unlock();
 
-    // the file name should be: output_lk_YEAR_MONTH_DAY_H_S.csv
-    fileName.append(QDir::separator()).append("output_lk_");
-    QDateTime currentTime = QDateTime::currentDateTime();
-    fileName.append(currentTime.toString("yyyy_MM_dd_hh_ss"));
-    fileName.append(".csv");
+    m_exportProgress->setValue(0);
+    m_exportProgress->show();
+
+    const std::string path = fileName.toStdString();
+    m_exporter.start(std::move(trajectories), path, TrajectoryExporter::formatFromPath(path),
+        [this](size_t done, size_t total) {
+            const int percent = static_cast<int>(done * 100 / total);
+            QMetaObject::invokeMethod(m_exportProgress, "setValue", Qt::QueuedConnection, Q_ARG(int, percent));
+        },
+        [this, fileName](bool success, const std::string &message) {
+            // back to the GUI thread
+            QMetaObject::invokeMethod(this, "exportFinished", Qt::QueuedConnection,
+                Q_ARG(bool, success),
+                Q_ARG(QString, success ? fileName : QString::fromStdString(message)));
+        });
+}
+
+void LucasKanadeTracker::clicked_load() {
+    const QString fileName = QFileDialog::getOpenFileName(nullptr, "Load trajectories",
+        QString(), "Binary trajectories (*.lkt)");
+    if (fileName.isEmpty()) {
+        return;
+    }
+
+    // the file is only mapped, load() copies the columns in bulk
+    TrajectoryFile file;
+    std::string error;
+    auto trajectories = std::make_shared<std::vector<Trajectory>>();
+    if (!file.open(fileName.toStdString(), &error) || !file.load(*trajectories, &error)) {
+        Q_EMIT notifyGUI("Load failed: " + error);
+        return;
+    }
+
+    m_commands.push([this, trajectories]() {
+        m_core.setTrajectories(std::move(*trajectories));
+    });
 
-    QFile file(fileName);
-    file.open(QIODevice::WriteOnly);
-    file.write(output.toLocal8Bit().data(), output.size());
-    file.close();
+    QString notification("Loaded trajectories from file: ");
+    notification.append(fileName);
+    Q_EMIT notifyGUI(notification.toStdString());
+    Q_EMIT update();
+}
+
+void LucasKanadeTracker::clicked_findPoints() {
+    m_commands.push([this]() {
+        m_findPointsRequested = true;
+    });
+    Q_EMIT update();
+}
+
+void LucasKanadeTracker::clicked_arena() {
+    // a second click removes the arena again
+    if (m_hasArena) {
+        m_hasArena = false;
+        m_commands.push([this]() {
+            m_core.setArenaMask(cv::Mat());
+        });
+        m_arenaButton->setText("Arena mask");
+        Q_EMIT notifyGUI("Removed the arena mask");
+        return;
+    }
+
+    const QString fileName = QFileDialog::getOpenFileName(nullptr, "Load arena mask",
+        QString(), "Images (*.png *.bmp *.jpg *.tif)");
+    if (fileName.isEmpty()) {
+        return;
+    }
+
+    // drawn in any image editor: everything that is not black belongs to the arena
+    const cv::Mat mask = cv::imread(fileName.toStdString(), cv::IMREAD_GRAYSCALE);
+    if (mask.empty()) {
+        Q_EMIT notifyGUI("Cannot read the arena mask: " + fileName.toStdString());
+        return;
+    }
+
+    m_hasArena = true;
+    m_commands.push([this, mask]() {
+        m_core.setArenaMask(mask);
+    });
+    m_arenaButton->setText("Clear arena");
 
-    QString notification("Saved trajectories to file: ");
+    QString notification("Loaded arena mask (must have the size of the video): ");
     notification.append(fileName);
     Q_EMIT notifyGUI(notification.toStdString());
+}
 
+void LucasKanadeTracker::exportFinished(bool success, QString fileNameOrError) {
+    m_exportProgress->hide();
+    if (success) {
+        QString notification("Saved trajectories to file: ");
+        notification.append(fileNameOrError);
+        Q_EMIT notifyGUI(notification.toStdString());
+    } else {
+        Q_EMIT notifyGUI("Export failed: " + fileNameOrError.toStdString());
+    }
 }
 
 void LucasKanadeTracker::colorSelected_invalid(const QColor &color) {
@@ -750,14 +851,55 @@ void LucasKanadeTracker::colorSelected_valid(const QColor &color) {
 }
 
 void LucasKanadeTracker::sliderChanged_winSize(int value) {
-    m_winSize.height = value;
-    m_winSize.width = value;
-    m_subPixWinSize.height = value;
-    m_subPixWinSize.width = value;
+    // queued as well when track() itself triggers this slot via setMaximum
+    m_commands.push([this, value]() {
+        m_core.setWinSize(value);
+    });
     m_winSizeValue->setText(QString::number(value));
 }
 
+void LucasKanadeTracker::sliderChanged_threads(int value) {
+    m_commands.push([this, value]() {
+        m_core.setThreadCount(static_cast<size_t>(value));
+    });
+    m_threadsValue->setText(QString::number(value));
+}
+
+void LucasKanadeTracker::sliderChanged_frameCache(int value) {
+    m_commands.push([this, value]() {
+        m_core.setFrameCacheBudget(static_cast<size_t>(value) << 20);
+    });
+    m_frameCacheValue->setText(QString::number(value));
+}
+
+void LucasKanadeTracker::sliderChanged_replenish(int value) {
+    m_commands.push([this, value]() {
+        m_core.setReplenishTarget(static_cast<size_t>(value));
+    });
+    m_replenishValue->setText(value > 0 ? QString::number(value) : QString("off"));
+}
+
+void LucasKanadeTracker::sliderChanged_memoryBudget(int value) {
+    m_commands.push([this, value]() {
+        m_core.setMemoryBudget(static_cast<size_t>(value) << 20);
+    });
+    m_memoryBudgetValue->setText(value > 0 ? QString::number(value) : QString("off"));
+}
+
+void LucasKanadeTracker::sliderChanged_downscale(int value) {
+    const int factor = 1 << value;
+    m_commands.push([this, factor]() {
+        m_core.setDownscale(factor);
+    });
+    m_downscaleValue->setText(factor > 1 ? QString("1/%1").arg(factor) : QString("off"));
+}
+
 void LucasKanadeTracker::sliderChanged_history(int value) {
+    // the trail cache holds the history, publishOverlayView() takes its
+    // length from the core
+    m_commands.push([this, value]() {
+        m_core.setTrailLength(static_cast<size_t>(value));
+    });
     m_currentHistory = value;
     updateHistoryText();
     Q_EMIT update();
@@ -1,5 +1,8 @@
 ﻿#pragma once
 
+#include <atomic>
+#include <memory>
+
 #include <QGroupBox>
 #include <QPointer>
 #include <QFormLayout>
@@ -8,6 +11,8 @@
 #include <QCheckBox>
 #include <QSlider>
 #include <QLabel>
+#include <QProgressBar>
+#include <QVector>
 #include <biotracker/TrackingAlgorithm.h>
 #include <biotracker/util/MutexWrapper.h>
 
@@ -15,7 +20,12 @@
 #include <opencv2/imgproc/imgproc.hpp>
 #include <ctype.h>
 
+#include "CommandQueue.h"
 #include "InterestPoint.h"
+#include "LucasKanadeCore.h"
+#include "SnapshotPublisher.h"
+#include "StageProfiler.h"
+#include "TrajectoryExporter.h"
 
 /*
  * Inspired by:
@@ -39,22 +49,17 @@ class LucasKanadeTracker : public BioTracker::Core::TrackingAlgorithm {
   private:
     // --
     bool				m_isInitialized = false;
-    size_t				m_numberOfUserStates = 3;
-    std::vector<bool>	m_setUserStates;
+    bool				m_findPointsRequested = false; // "Find points" was clicked, done in paint()
+    bool				m_hasArena = false; // an arena mask was loaded (GUI thread)
 
-    int					m_itemSize; // defines how big elements are (so they fit well on big and small vids)
-    cv::Size			m_subPixWinSize;
-    cv::Size			m_winSize;
-    cv::TermCriteria	m_termcrit;
-    const int			MAX_COUNT = 500;
-    cv::Mat				m_gray;
+    // the Qt-free tracking engine, it owns all trajectories
+    LucasKanadeCore		m_core;
 
-	size_t				m_frameIndex_prevGray; // holds the video index that corresponds to m_prevGray
-    cv::Mat				m_prevGray;		
+    int					m_itemSize; // defines how big elements are (so they fit well on big and small vids)
+    int					m_maxWinSize; // the last maximum that was applied to m_winSizeSlider
 
-    size_t				m_currentFrame; // is always the current frame (updated in paint and track)
+    std::atomic<size_t>	m_currentFrame; // is always the current frame (updated in paintOverlay and track)
 
-    bool				m_trackOnlyActive; // when true we will ignore all points except the active one
     bool				m_pauseOnInvalidPoint; // if true, the application will pause when a point
                             // becomes invalid
 
@@ -65,6 +70,21 @@ class LucasKanadeTracker : public BioTracker::Core::TrackingAlgorithm {
     QLabel	*			m_winSizeValue;
     QSlider *			m_historySlider; // define how many elements are shown for history
     QLabel	*			m_historyValue;
+    QLabel	*			m_threadsValue;
+    QLabel	*			m_pyramidValue; // pyramid levels used in the last LK step
+    QLabel	*			m_frameCacheValue;
+    QLabel	*			m_replenishValue;
+    QLabel	*			m_memoryBudgetValue;
+    QLabel	*			m_downscaleValue;
+#ifdef LUCASKANADE_PROFILING
+    QLabel	*			m_profileValue; // p50/p99 of the stages
+    uint64_t			m_profileShown = 0; // when m_profileValue was updated last (ns)
+#endif
+    QPushButton *		m_arenaButton;
+    QProgressBar *		m_exportProgress;
+
+    // writes the trajectories on a worker thread (see clicked_print)
+    TrajectoryExporter	m_exporter;
 
     std::set<Qt::Key>	m_grabbedKeys;
 
@@ -73,32 +93,56 @@ class LucasKanadeTracker : public BioTracker::Core::TrackingAlgorithm {
      */
     const cv::Point2f m_invalidOffset;
 
-    /**
-     * @brief m_currentActivePoint
-     * The currently active point that can be moved by the mouse curor
-     */
-    int m_currentActivePoint = -1;
     int m_lastDrawnActivePointX = -1;
     int m_lastDrawnActivePointY = -1;
 
-    // to calculate how big the history can be we need to know when we had the very first tracked point in time...
-    int m_firstTrackedFrame = -1;
-
-    // ... and also the very last
-    int m_lastTrackedFrame = -1;
-
-    size_t m_currentHistory = 0;
+    std::atomic<size_t> m_currentHistory{0}; // the value of m_historySlider (only shown, see getTrailLength())
 
     QColor m_validColor;
     QColor m_invalidColor;
 
+    // guards the core; it is only changed by the tracking thread (track(),
+    // paint(), the commands of m_commands), the GUI thread takes it just to
+    // copy the trajectories for saving and exporting
     Mutex m_userStatusMutex;
+
+    /**
+     * @brief The OverlayView struct
+     * everything paintOverlay() draws of one frame, built by the thread that
+     * changed it (see publishOverlayView())
+     */
+    struct OverlayView {
+        size_t				frame = 0;
+        int					currentActivePoint = -1;
+        LucasKanadeCore::CurrentPoints points;
+        QVector<QPoint>		validHistory;
+        QVector<QPoint>		invalidHistory;
+    };
+    SnapshotPublisher<OverlayView> m_overlayView;
+    size_t				m_publishedFrame = static_cast<size_t>(-1); // frame of the view published last
+    size_t				m_requestedView = static_cast<size_t>(-1); // frame paintOverlay() asked a view for (GUI thread)
+
+    // input of the GUI, applied by the tracking thread in track() and paint()
+    CommandQueue		m_commands;
     // --
 
     void mouseReleaseEvent(QMouseEvent *e) override;
 
     void inputChanged() override;
 
+    /**
+     * @brief prepareSave
+     * copies the trajectories of the core into m_trackedObjects so that
+     * BioTracker can serialize them
+     */
+    void prepareSave() override;
+
+    /**
+     * @brief postLoad
+     * loads the deserialized m_trackedObjects into the core
+     */
+    void postLoad() override;
+
     /**
      * @brief createNewPoint
      * Tries to add a new point, if it is not too close to an already
@@ -113,115 +157,60 @@ class LucasKanadeTracker : public BioTracker::Core::TrackingAlgorithm {
 
     void deleteCurrentActivePoint();
 
-    /**
-     * @brief autoFindInitPoints
-     * call this when you want to find let the program find interesting
-     * points
-     */
-    void autoFindInitPoints();
-
-    /**
-     * @brief getCurrentPoints
-     * gets the locations of all points at the given timeframe
-     * @param frameNbr defines the current track-iteratioyn
-     * @param filter: marks those indices that point to an invalid
-     * 	(for whatever reason) trajectory => OUT-parameter
-     *  The index represents the id of the trajectory data
-     * @return the list of points with positions
-     */
-    std::vector<cv::Point2f> getCurrentPoints(
-        ulong frameNbr,
-        std::vector<InterestPointStatus> &filter,
-        std::vector<InterestPoint> &data);
-
-    /**
-     * @brief updateCurrentPoints
-     * update the current locations to the serializable trajectory data
-     * for the current frame
-     * @param frameNbr defines the current track-iteration
-     * @param pos list of updated positions, the index equals the
-     * the element id
-     * @param status defines the list of object status` that happened to each
-     * object
-     * @param filter: marks those indices that point to an invalid
-     * 	(for whatever reason) trajectory
-     *  The index represents the id of the trajectory data
-     */
-    void updateCurrentPoints(
-        ulong frameNbr,
-        std::vector<cv::Point2f> &pos,
-        std::vector<uchar> &status,
-        std::vector<InterestPointStatus> &filter);
-
     cv::Point2f toCv(QPoint p);
 
     int maximumHistory();
 
     void updateHistoryText();
 
-    /**
-     * @brief clampPosition
-     * make sure that the elements are in the range of the image
-     * @param pos list of positions
-     * @param w current image width
-     * @param h current image height
-     */
-    void clampPosition(std::vector<cv::Point2f> &pos, int w, int h);
+    void drawEllipse(QPainter* painter, QPen& pen, size_t userStatus, size_t id, int x, int y);
 
     /**
-     * @brief splitActivePoints
-     * Due to how this tracker is written we get all points for tracking with the
-     * OpenCV LK function. However, it would be great to filter out those that we should
-     * not follow anymore (as they might be invalid, deleted or whatever): thus this
-     * function temporarly cleans the points. To restitch the points later on to update
-     * the internal data structures correctly "joinActivePoints" MUST be called with the
-     * data aquired here to fix indexes.
-     * @param pos The points aquired from "getCurrentPoints" that should be filtered
-     * @param filter The filters aquired from "getCurrentPoints"
-     * @param tempPos OUT: points from "pos" that are acutally trackable
-     * @param activePoints: indexes of all points in tempPos
+     * @brief drawHistory
+     * draws all history points of one color in a single call
      */
-    void splitActivePoints(std::vector<cv::Point2f> &pos, std::vector<InterestPointStatus> &filter,
-                           std::vector<cv::Point2f> &tempPos, std::vector<size_t> &activePoints);
+    void drawHistory(QPainter *painter, QColor color, const QVector<QPoint> &points);
 
     /**
-     * @brief joinActivePoints
-     * Fix indexes "broken" by "splitActivePoints"
-     * @param pos All points available, this list should be updated with the active points
-     * @param tempPos Actual points that were used for the OpenCV LK tracking
-     * @param activePoints indexes of the tempPos in the pos list
-     * @param status list aquired from the OpenCV LK tracker function
-     * @return actual status list that should be used in "updateCurrentPoints"
+     * @brief publishOverlayView
+     * publishes the points of m_currentFrame for paintOverlay() (with
+     * m_userStatusMutex held)
      */
-    std::vector<uchar> joinActivePoints(std::vector<cv::Point2f> &pos, std::vector<cv::Point2f> &tempPos,
-                          std::vector<size_t> &activePoints, std::vector<uchar> status);
+    void publishOverlayView();
 
+#ifdef LUCASKANADE_PROFILING
     /**
-     * @brief activateAllNonTrackedPoints
-     * When single-user-tracking is disabled, we want to activate all points that were
-     * deactiaveted
-     * @param frame
+     * @brief updateProfileText
+     * shows the stage times, at most twice a second
      */
-    void activateAllNonTrackedPoints(size_t frame);
-
-    /**
-     * @brief updateUserStates
-     * make sure that all the user states are updated
-     */
-    void updateUserStates(size_t currentFrame);
-
-    void drawEllipse(QPainter* painter, QPen& pen, InterestPoint &point, size_t id, int x, int y);
+    void updateProfileText();
+#endif
 
 private Q_SLOTS:
     void checkboxChanged_invalidPoint(int state);
     void checkboxChanged_userStatus(int state);
     void checkboxChanged_activeUser(int state);
+    void checkboxChanged_nativeKernel(int state);
+    void checkboxChanged_adaptivePyramid(int state);
+    void checkboxChanged_regionTracking(int state);
     void clicked_validColor();
     void clicked_invalidColor();
     void clicked_print();
+    void clicked_load();
+    void clicked_arena();
+    void clicked_findPoints();
+#ifdef LUCASKANADE_PROFILING
+    void clicked_dumpTrace();
+#endif
+    void exportFinished(bool success, QString fileNameOrError);
     void colorSelected_invalid(const QColor &color);
     void colorSelected_valid(const QColor &color);
     void sliderChanged_winSize(int value);
     void sliderChanged_history(int value);
+    void sliderChanged_threads(int value);
+    void sliderChanged_frameCache(int value);
+    void sliderChanged_replenish(int value);
+    void sliderChanged_memoryBudget(int value);
+    void sliderChanged_downscale(int value);
 
 };
@@ -0,0 +1,327 @@
+/*
+ * Microbenchmarks of the tracking hot path (Google Benchmark).
+ *
+ * The frames are synthetic: blurred noise (texture everywhere) that moves by
+ * a known offset from one frame to the next, so the numbers depend neither
+ * on a video nor on the machine's disk and can be compared between releases:
+ *   lucaskanade.benchmark --benchmark_out=before.json --benchmark_out_format=json
+ *   (tools/compare.py of Google Benchmark compares two such files)
+ *
+ * Each stage of a tracking step is measured on its own:
+ *   GrayConversion    BGR frame => bordered gray frame (FrameIngest)
+ *   PyramidBuild      the pyramid over the gray frame (level 0 in place)
+ *   OpticalFlow       the LK search between two pyramids, OpenCV or our kernel
+ *   Commit            the LK results into the trajectories (ActivePointSet)
+ *   GetCurrentPoints  the points of a frame as the plugin draws them
+ *   Export            the export button (TrajectoryExporter, CSV or binary)
+ *   TrackStep         LucasKanadeCore::track() as a whole
+ * for resolutions from VGA to 4K, 10 to 10k points, several window sizes and
+ * pyramid depths. OpticalFlow reports the mean distance to the known motion
+ * ("error_px") and the share of lost points as well, a faster kernel has to
+ * keep them.
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+#include <opencv2/opencv.hpp>
+
+#include "ActivePointSet.h"
+#include "FrameIngest.h"
+#include "LucasKanadeCore.h"
+#include "LucasKanadeKernel.h"
+#include "TrajectoryExporter.h"
+
+namespace {
+
+// the motion from frame 0 to frame 1 of every sequence
+const cv::Point frameShift(2, 1);
+
+// the core's LK parameters
+const cv::TermCriteria termCriteria(cv::TermCriteria::COUNT | cv::TermCriteria::EPS, 20, 0.03);
+const double minEigThreshold = 0.001;
+
+const int resolutions[][2] = { { 640, 480 }, { 1280, 720 }, { 1920, 1080 }, { 3840, 2160 } };
+const int pointCounts[] = { 10, 100, 1000, 10000 };
+
+/**
+ * @brief makeFrames
+ * two BGR frames of the same texture, the second one moved by frameShift
+ */
+std::vector<cv::Mat> makeFrames(const cv::Size &size) {
+    const int margin = 8;
+    cv::Mat texture(size.height + 2 * margin, size.width + 2 * margin, CV_8UC1);
+    cv::RNG rng(0x5eed); // the same frames in every run
+    rng.fill(texture, cv::RNG::UNIFORM, cv::Scalar(0), cv::Scalar(256));
+    cv::GaussianBlur(texture, texture, cv::Size(0, 0), 1.5);
+
+    std::vector<cv::Mat> frames(2);
+    cv::cvtColor(texture(cv::Rect(margin, margin, size.width, size.height)), frames[0], cv::COLOR_GRAY2BGR);
+    cv::cvtColor(texture(cv::Rect(margin - frameShift.x, margin - frameShift.y, size.width, size.height)),
+                 frames[1], cv::COLOR_GRAY2BGR);
+    return frames;
+}
+
+/**
+ * @brief makeGray
+ * the gray frame like the core keeps it (inside a border of winSize)
+ */
+cv::Mat makeGray(const cv::Mat &frame, const cv::Size &winSize) {
+    const cv::Size size(frame.cols, frame.rows);
+    cv::Mat gray;
+    FrameIngest::allocatePadded(gray, size, winSize);
+    FrameIngest::convert(frame, FrameIngest::Format::Bgr, cv::Rect(cv::Point(0, 0), size), gray);
+    FrameIngest::fillBorder(gray);
+    return gray;
+}
+
+/**
+ * @brief makePoints
+ * count points on a regular grid over the frame (away from its border)
+ */
+std::vector<cv::Point2f> makePoints(const cv::Size &size, size_t count) {
+    const float border = 32.f;
+    const float width = size.width - 2 * border;
+    const float height = size.height - 2 * border;
+    const size_t columns = static_cast<size_t>(std::ceil(std::sqrt(count * width / height)));
+    const size_t rows = (count + columns - 1) / columns;
+
+    std::vector<cv::Point2f> points(count);
+    for (size_t i = 0; i < count; i++) {
+        points[i] = cv::Point2f(border + width * (i % columns + 0.5f) / columns,
+                                border + height * (i / columns + 0.5f) / rows);
+    }
+    return points;
+}
+
+/**
+ * @brief makeTrajectories
+ * a trajectory per point, moving by frameShift every frame from frame 0
+ * to frameCount - 1
+ */
+std::vector<Trajectory> makeTrajectories(const std::vector<cv::Point2f> &points, size_t frameCount) {
+    std::vector<Trajectory> trajectories;
+    trajectories.reserve(points.size());
+    for (size_t id = 0; id < points.size(); id++) {
+        trajectories.push_back(Trajectory(id));
+        for (size_t frame = 0; frame < frameCount; frame++) {
+            const cv::Point2f shift(static_cast<float>(frame * frameShift.x), static_cast<float>(frame * frameShift.y));
+            trajectories.back().add(frame, points[id] + shift, InterestPointStatus::Valid);
+        }
+    }
+    return trajectories;
+}
+
+void resolutionArgs(benchmark::internal::Benchmark *b) {
+    b->ArgNames({ "width", "height" });
+    for (const auto &resolution : resolutions) {
+        b->Args({ resolution[0], resolution[1] });
+    }
+}
+
+void pyramidArgs(benchmark::internal::Benchmark *b) {
+    b->ArgNames({ "width", "height", "win", "depth" });
+    for (const auto &resolution : resolutions) {
+        for (int winSize : { 15, 31 }) {
+            for (int depth : { 1, 3, 5 }) {
+                b->Args({ resolution[0], resolution[1], winSize, depth });
+            }
+        }
+    }
+}
+
+void opticalFlowArgs(benchmark::internal::Benchmark *b) {
+    b->ArgNames({ "points", "win", "depth", "native" });
+    for (int count : pointCounts) {
+        for (int winSize : { 15, 21, 31 }) {
+            for (int depth : { 1, 3, 5 }) {
+                b->Args({ count, winSize, depth, 0 });
+                b->Args({ count, winSize, depth, 1 });
+            }
+        }
+    }
+}
+
+void trackStepArgs(benchmark::internal::Benchmark *b) {
+    b->ArgNames({ "width", "height", "points" });
+    for (const auto &resolution : resolutions) {
+        for (int count : pointCounts) {
+            b->Args({ resolution[0], resolution[1], count });
+        }
+    }
+}
+
+void BM_GrayConversion(benchmark::State &state) {
+    const cv::Size size(static_cast<int>(state.range(0)), static_cast<int>(state.range(1)));
+    const cv::Mat frame = makeFrames(size)[0];
+    cv::Mat gray;
+    FrameIngest::allocatePadded(gray, size, cv::Size(31, 31));
+
+    for (auto _ : state) {
+        FrameIngest::convert(frame, FrameIngest::Format::Bgr, cv::Rect(cv::Point(0, 0), size), gray);
+        FrameIngest::fillBorder(gray);
+        benchmark::DoNotOptimize(gray.data);
+        benchmark::ClobberMemory();
+    }
+    state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(frame.total() * frame.elemSize()));
+}
+BENCHMARK(BM_GrayConversion)->Apply(resolutionArgs)->Unit(benchmark::kMillisecond);
+
+void BM_PyramidBuild(benchmark::State &state) {
+    const cv::Size size(static_cast<int>(state.range(0)), static_cast<int>(state.range(1)));
+    const cv::Size winSize(static_cast<int>(state.range(2)), static_cast<int>(state.range(2)));
+    const int depth = static_cast<int>(state.range(3));
+    const cv::Mat gray = makeGray(makeFrames(size)[0], winSize);
+    std::vector<cv::Mat> pyramid;
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(cv::buildOpticalFlowPyramid(gray, pyramid, winSize, depth));
+    }
+    state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(gray.total()));
+}
+BENCHMARK(BM_PyramidBuild)->Apply(pyramidArgs)->Unit(benchmark::kMillisecond);
+
+void BM_OpticalFlow(benchmark::State &state) {
+    const cv::Size size(1920, 1080);
+    const size_t count = static_cast<size_t>(state.range(0));
+    const cv::Size winSize(static_cast<int>(state.range(1)), static_cast<int>(state.range(1)));
+    const int depth = static_cast<int>(state.range(2));
+    const bool native = state.range(3) != 0;
+
+    const std::vector<cv::Mat> frames = makeFrames(size);
+    const cv::Mat prevGray = makeGray(frames[0], winSize);
+    const cv::Mat gray = makeGray(frames[1], winSize);
+    std::vector<cv::Mat> prevPyr;
+    std::vector<cv::Mat> pyr;
+    cv::buildOpticalFlowPyramid(prevGray, prevPyr, winSize, depth);
+    cv::buildOpticalFlowPyramid(gray, pyr, winSize, depth);
+
+    const std::vector<cv::Point2f> prevPts = makePoints(size, count);
+    std::vector<cv::Point2f> nextPts(count);
+    std::vector<uchar> status(count);
+    std::vector<float> error(count);
+
+    for (auto _ : state) {
+        if (native) {
+            LucasKanadeKernel::calcOpticalFlowPyrLK(prevPyr, pyr, prevPts.data(), nextPts.data(), status.data(),
+                                                    error.data(), count, winSize, depth, termCriteria, minEigThreshold);
+        } else {
+            cv::calcOpticalFlowPyrLK(prevPyr, pyr, prevPts, nextPts, status, error, winSize, depth,
+                                     termCriteria, 0, minEigThreshold);
+        }
+        benchmark::DoNotOptimize(nextPts.data());
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(count));
+
+    // the quality of the last run
+    double distance = 0.;
+    size_t found = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (status[i]) {
+            const cv::Point2f d = nextPts[i] - prevPts[i] - cv::Point2f(frameShift);
+            distance += std::sqrt(d.x * d.x + d.y * d.y);
+            found++;
+        }
+    }
+    state.counters["error_px"] = found > 0 ? distance / found : 0.;
+    state.counters["lost"] = static_cast<double>(count - found) / count;
+}
+BENCHMARK(BM_OpticalFlow)->Apply(opticalFlowArgs)->Unit(benchmark::kMicrosecond);
+
+void BM_Commit(benchmark::State &state) {
+    const size_t count = static_cast<size_t>(state.range(0));
+    const std::vector<cv::Point2f> points = makePoints(cv::Size(1920, 1080), count);
+    std::vector<Trajectory> trajectories = makeTrajectories(points, 1);
+
+    ActivePointSet activeSet;
+    activeSet.rebuild(trajectories, 0, false, -1);
+    activeSet.nextPositions() = points;
+    activeSet.lkStatus().assign(count, 1);
+
+    // cycles over a few frames, so the trajectories do not grow endlessly
+    const size_t frameCount = 64;
+    size_t frame = 0;
+    for (auto _ : state) {
+        frame = frame % frameCount + 1;
+        benchmark::DoNotOptimize(activeSet.commit(trajectories, frame));
+    }
+    state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(count));
+}
+BENCHMARK(BM_Commit)->ArgName("points")->RangeMultiplier(10)->Range(10, 10000);
+
+void BM_GetCurrentPoints(benchmark::State &state) {
+    const size_t count = static_cast<size_t>(state.range(0));
+    LucasKanadeCore core;
+    core.setTrajectories(makeTrajectories(makePoints(cv::Size(1920, 1080), count), 100));
+
+    // frame 50 was never tracked, so this is the scan over all trajectories
+    LucasKanadeCore::CurrentPoints points;
+    for (auto _ : state) {
+        core.getCurrentPoints(50, points);
+        benchmark::DoNotOptimize(points.positions.data());
+    }
+    state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(count));
+}
+BENCHMARK(BM_GetCurrentPoints)->ArgName("points")->RangeMultiplier(10)->Range(10, 10000);
+
+void BM_Export(benchmark::State &state) {
+    const size_t count = static_cast<size_t>(state.range(0));
+    const size_t frameCount = 100;
+    const TrajectoryExporter::Format format = state.range(1) ?
+                TrajectoryExporter::Format::Binary : TrajectoryExporter::Format::Csv;
+    const std::string path = state.range(1) ? "lucaskanade.benchmark.lkt" : "lucaskanade.benchmark.csv";
+    const std::vector<Trajectory> trajectories =
+            makeTrajectories(makePoints(cv::Size(1920, 1080), count), frameCount);
+
+    std::string error;
+    for (auto _ : state) {
+        if (!TrajectoryExporter::write(trajectories, path, format, TrajectoryExporter::ProgressCallback(), &error)) {
+            state.SkipWithError(error.c_str());
+            break;
+        }
+    }
+    std::remove(path.c_str());
+    state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(count * frameCount));
+}
+BENCHMARK(BM_Export)->ArgNames({ "points", "binary" })->ArgsProduct({ { 10, 100, 1000, 10000 }, { 0, 1 } })
+    ->Unit(benchmark::kMillisecond);
+
+void BM_TrackStep(benchmark::State &state) {
+    const cv::Size size(static_cast<int>(state.range(0)), static_cast<int>(state.range(1)));
+    const size_t count = static_cast<size_t>(state.range(2));
+    const std::vector<cv::Mat> frames = makeFrames(size);
+    const std::vector<Trajectory> seeds = makeTrajectories(makePoints(size, count), 1);
+
+    LucasKanadeCore core;
+    core.setFrameCacheBudget(0); // the frames are never visited again
+    auto restart = [&]() {
+        core.track(0, frames[0]);
+        core.setTrajectories(seeds);
+    };
+    restart();
+
+    // the points move back and forth between the two frames; every few
+    // hundred frames the trajectories are reset so they do not grow endlessly
+    const size_t frameCount = 256;
+    size_t frame = 0;
+    for (auto _ : state) {
+        if (frame == frameCount) {
+            state.PauseTiming();
+            restart();
+            frame = 0;
+            state.ResumeTiming();
+        }
+        frame++;
+        benchmark::DoNotOptimize(core.track(frame, frames[frame % 2]));
+    }
+    state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(count));
+}
+BENCHMARK(BM_TrackStep)->Apply(trackStepArgs)->Unit(benchmark::kMillisecond);
+
+} // namespace
+
+BENCHMARK_MAIN();
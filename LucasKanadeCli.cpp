@@ -0,0 +1,453 @@
+/*
+ * Headless command line front end of the Lucas-Kanade tracker.
+ *
+ * Usage:
+ *   lucaskanade.cli <video> <seeds> <output.csv> [--winsize N] [--first N] [--last N]
+ *                   [--threads N] [--native-kernel] [--adaptive-pyramid]
+ *                   [--regions] [--arena mask.png] [--format NAME] [--prefetch N]
+ *                   [--auto-seed N] [--replenish N] [--memory-budget MB] [--downscale N]
+ *   lucaskanade.cli --batch <jobs> [--threads N] [--sessions N] [--checkpoint N]
+ *
+ * The seed file contains one point per line, either as "x;y" (the point is
+ * created at the first frame) or as "frame;x;y". Commas and whitespace are
+ * accepted as separators as well, lines starting with '#' are ignored.
+ * The output has the same "frame;id;x;y;userStatus" format as the export of
+ * the BioTracker plugin, or the binary format if it ends with ".lkt".
+ * --threads splits the tracking of many points over N threads (0 = all cores),
+ * --native-kernel uses our vectorized LK kernel instead of the one of OpenCV,
+ * --adaptive-pyramid derives the pyramid depth from the recent motion,
+ * --regions converts only the tiles around a few points (with
+ * --adaptive-pyramid) and --arena restricts the tracking to the non-black
+ * pixels of the given mask.
+ * --format names the pixel format of the video (mono, yuv420, yuyv,
+ * bayer_bg, .., see FrameIngest); anything but bgr/auto asks the backend for
+ * the raw frames. Mono and YUV 4:2:0 frames are tracked without any copy.
+ * --prefetch reads and prepares up to N frames on a second thread while the
+ * current one is tracked (see TrackingPipeline; not combined with --regions).
+ * --auto-seed adds up to N corners found at the first frame (0 = 500) to
+ * the seeds, the seed file may be empty then.
+ * --replenish keeps N points alive: after each frame new corners are added
+ * in the parts of the frame that lost their points.
+ * --memory-budget packs the trajectory data away from the current frame
+ * once it takes more than MB megabytes (for long recordings).
+ * --downscale tracks on frames downscaled by N (1, 2, 4 or 8) and refines the
+ * points on small full resolution patches (for 4K and bigger recordings;
+ * not combined with --prefetch, whose frames are prepared in full).
+ *
+ * --batch tracks all videos of the job file in one process (see
+ * BatchScheduler), one job per line:
+ *   <video>;<seeds or ->;<output>[;option ...]
+ * with the options above without the dashes ("winsize=21", "native-kernel")
+ * but threads and prefetch: every video is tracked on the worker running it.
+ * Here --threads is the number of workers (0 = all cores), --sessions the
+ * number of videos open at the same time and --checkpoint the frames between
+ * two checkpoints (0 = none). The progress is kept in "<jobs>.state", running
+ * the same batch again continues where an interrupted run stopped; delete
+ * the state file to start over.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include "BatchScheduler.h"
+#include "LucasKanadeCore.h"
+#include "TrackingPipeline.h"
+#include "TrajectoryExporter.h"
+
+namespace {
+
+void printUsage(const char *name) {
+    std::cerr << "usage: " << name
+              << " <video> <seeds> <output.csv> [--winsize N] [--first N] [--last N] [--threads N] [--native-kernel]"
+              << " [--adaptive-pyramid] [--regions] [--arena mask.png] [--format NAME] [--prefetch N] [--auto-seed N]"
+              << " [--replenish N] [--memory-budget MB] [--downscale N]" << std::endl;
+    std::cerr << "       " << name
+              << " --batch <jobs> [--threads N] [--sessions N] [--checkpoint N]" << std::endl;
+}
+
+bool isFlag(const std::string &key) {
+    return key == "native-kernel" || key == "adaptive-pyramid" || key == "regions";
+}
+
+/**
+ * @brief parseNumber
+ * @return false unless all of value is a decimal number in the range of long
+ */
+bool parseNumber(const std::string &value, long &number) {
+    char *end = nullptr;
+    errno = 0;
+    number = std::strtol(value.c_str(), &end, 10);
+    return end != value.c_str() && *end == '\0' && errno == 0;
+}
+
+/**
+ * @brief applyOption
+ * sets an option of the single video mode or of a line of a job file
+ * @param key the option without the dashes
+ * @param value empty for flags
+ * @param prefetch OUT: --prefetch, only in the single video mode (nullptr
+ * in job files, which reject --threads as well)
+ * @return false if the option is unknown or its value invalid
+ */
+bool applyOption(const std::string &key, const std::string &value, BatchJob &job, size_t *prefetch) {
+    if (isFlag(key)) {
+        if (!value.empty()) {
+            return false;
+        }
+        if (key == "native-kernel") {
+            job.useNativeKernel = true;
+        } else if (key == "adaptive-pyramid") {
+            job.adaptivePyramid = true;
+        } else {
+            job.regionTracking = true;
+        }
+        return true;
+    }
+    if (value.empty()) {
+        return false;
+    }
+    if (key == "arena") {
+        job.arenaPath = value;
+        return true;
+    }
+    if (key == "format") {
+        return FrameIngest::parseFormat(value, job.inputFormat);
+    }
+    long number;
+    if (!parseNumber(value, number)) {
+        return false;
+    }
+    if (key == "winsize" && number > 0 && number <= std::numeric_limits<int>::max()) {
+        job.winSize = static_cast<int>(number);
+    } else if (key == "first" && number >= 0) {
+        job.firstFrame = static_cast<size_t>(number);
+    } else if (key == "last" && number >= 0) {
+        job.lastFrame = static_cast<size_t>(number);
+    } else if (key == "threads" && number >= 0 && prefetch) {
+        job.threadCount = static_cast<size_t>(number);
+    } else if (key == "prefetch" && number >= 0 && prefetch) {
+        *prefetch = static_cast<size_t>(number);
+    } else if (key == "auto-seed" && number >= 0) {
+        job.autoSeed = true;
+        job.autoSeedCount = static_cast<size_t>(number);
+    } else if (key == "replenish" && number >= 0) {
+        job.replenishTarget = static_cast<size_t>(number);
+    } else if (key == "memory-budget" && number >= 0 &&
+               static_cast<unsigned long>(number) <= std::numeric_limits<size_t>::max() >> 20) {
+        job.memoryBudget = static_cast<size_t>(number) << 20;
+    } else if (key == "downscale" && (number == 1 || number == 2 || number == 4 || number == 8)) {
+        job.downscale = static_cast<int>(number);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief readSeeds
+ * reads the seed file into a frame => points map
+ * @return false if the file could not be read or is malformed
+ */
+bool readSeeds(const std::string &path, size_t firstFrame,
+               std::map<size_t, std::vector<cv::Point2f>> &seeds) {
+    if (path == "-") {
+        // no seeds (--auto-seed)
+        return true;
+    }
+    std::ifstream in(path);
+    if (!in) {
+        std::cerr << "cannot open seed file " << path << std::endl;
+        return false;
+    }
+
+    std::string line;
+    size_t lineNumber = 0;
+    while (std::getline(in, line)) {
+        lineNumber++;
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        std::replace(line.begin(), line.end(), ';', ' ');
+        std::replace(line.begin(), line.end(), ',', ' ');
+
+        std::istringstream fields(line);
+        std::vector<double> values;
+        double v;
+        while (fields >> v) {
+            values.push_back(v);
+        }
+
+        if (values.size() == 2) {
+            seeds[firstFrame].push_back(cv::Point2f(static_cast<float>(values[0]),
+                                                    static_cast<float>(values[1])));
+        } else if (values.size() == 3 && values[0] >= 0) {
+            seeds[static_cast<size_t>(values[0])].push_back(
+                cv::Point2f(static_cast<float>(values[1]), static_cast<float>(values[2])));
+        } else if (!values.empty()) {
+            std::cerr << path << ":" << lineNumber << ": expected \"x;y\" or \"frame;x;y\"" << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief readJobs
+ * reads a job file ("<video>;<seeds or ->;<output>[;option ...]" per line)
+ * @return false if a line is malformed or a seed file cannot be read
+ */
+bool readJobs(const std::string &path, std::vector<BatchJob> &jobs) {
+    std::ifstream in(path);
+    if (!in) {
+        std::cerr << "cannot open job file " << path << std::endl;
+        return false;
+    }
+
+    std::string line;
+    size_t lineNumber = 0;
+    while (std::getline(in, line)) {
+        lineNumber++;
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        std::vector<std::string> fields;
+        std::istringstream fieldStream(line);
+        std::string field;
+        while (std::getline(fieldStream, field, ';')) {
+            fields.push_back(field);
+        }
+        if (fields.size() < 3) {
+            std::cerr << path << ":" << lineNumber << ": expected \"video;seeds;output[;option ...]\"" << std::endl;
+            return false;
+        }
+
+        BatchJob job;
+        job.videoPath = fields[0];
+        job.outputPath = fields[2];
+        for (size_t i = 3; i < fields.size(); i++) {
+            const size_t equals = fields[i].find('=');
+            const std::string key = fields[i].substr(0, equals);
+            const std::string value = equals == std::string::npos ? std::string() : fields[i].substr(equals + 1);
+            if (!applyOption(key, value, job, nullptr)) {
+                std::cerr << path << ":" << lineNumber << ": invalid option \"" << fields[i] << "\"" << std::endl;
+                return false;
+            }
+        }
+        if (!readSeeds(fields[1], job.firstFrame, job.seeds)) {
+            return false;
+        }
+        jobs.push_back(std::move(job));
+    }
+    return true;
+}
+
+int runBatch(int argc, char **argv) {
+    const std::string jobPath = argv[2];
+    BatchScheduler::Settings settings;
+    settings.statePath = jobPath + ".state";
+    for (int i = 3; i < argc; i++) {
+        const std::string arg = argv[i];
+        long value = -1;
+        if (i + 1 >= argc || !parseNumber(argv[++i], value)) {
+            printUsage(argv[0]);
+            return EXIT_FAILURE;
+        }
+        if (arg == "--threads" && value >= 0) {
+            settings.threadCount = static_cast<size_t>(value);
+        } else if (arg == "--sessions" && value >= 0) {
+            settings.maxSessions = static_cast<size_t>(value);
+        } else if (arg == "--checkpoint" && value >= 0) {
+            settings.checkpointFrames = static_cast<size_t>(value);
+        } else {
+            printUsage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    std::vector<BatchJob> jobs;
+    if (!readJobs(jobPath, jobs)) {
+        return EXIT_FAILURE;
+    }
+
+    // the workers report concurrently, the running jobs at most once a second
+    std::mutex outputMutex;
+    std::chrono::steady_clock::time_point lastReport;
+    const BatchScheduler::ProgressCallback progress = [&](const BatchScheduler::Progress &p) {
+        std::lock_guard<std::mutex> lock(outputMutex);
+        const BatchJob &job = jobs[p.job];
+        switch (p.state) {
+        case BatchScheduler::Progress::State::Running: {
+            const auto now = std::chrono::steady_clock::now();
+            if (now - lastReport < std::chrono::seconds(1)) {
+                return;
+            }
+            lastReport = now;
+            std::cout << job.videoPath << ": frame " << p.framesDone;
+            if (p.frameCount > 0) {
+                std::cout << " of " << p.frameCount;
+            }
+            std::cout << ", " << p.points << " points" << std::endl;
+            break;
+        }
+        case BatchScheduler::Progress::State::Done:
+            if (p.framesDone == 0) {
+                std::cout << job.videoPath << ": done in an earlier run" << std::endl;
+            } else {
+                std::cout << job.videoPath << ": tracked " << p.points << " points over "
+                          << p.framesDone << " frames" << std::endl;
+            }
+            break;
+        case BatchScheduler::Progress::State::Failed:
+            std::cerr << job.videoPath << ": " << p.error << std::endl;
+            break;
+        }
+    };
+
+    BatchScheduler scheduler(settings);
+    const size_t failed = scheduler.run(jobs, progress);
+    std::cout << jobs.size() - failed << " of " << jobs.size() << " jobs done" << std::endl;
+    return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    if (argc >= 3 && std::string(argv[1]) == "--batch") {
+        return runBatch(argc, argv);
+    }
+    if (argc < 4) {
+        printUsage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    const std::string videoPath = argv[1];
+    const std::string seedPath = argv[2];
+    const std::string outputPath = argv[3];
+
+    BatchJob job;
+    size_t prefetch = 0;
+    for (int i = 4; i < argc; i++) {
+        const std::string arg = argv[i];
+        if (arg.compare(0, 2, "--") != 0) {
+            printUsage(argv[0]);
+            return EXIT_FAILURE;
+        }
+        const std::string key = arg.substr(2);
+        std::string value;
+        if (!isFlag(key)) {
+            if (i + 1 >= argc) {
+                printUsage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            value = argv[++i];
+        }
+        if (!applyOption(key, value, job, &prefetch)) {
+            printUsage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    const size_t firstFrame = job.firstFrame;
+    const size_t lastFrame = job.lastFrame;
+
+    std::map<size_t, std::vector<cv::Point2f>> seeds;
+    if (!readSeeds(seedPath, firstFrame, seeds)) {
+        return EXIT_FAILURE;
+    }
+
+    cv::VideoCapture capture(videoPath);
+    if (!capture.isOpened()) {
+        std::cerr << "cannot open video " << videoPath << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (firstFrame > 0) {
+        capture.set(cv::CAP_PROP_POS_FRAMES, static_cast<double>(firstFrame));
+    }
+    if (job.inputFormat != FrameIngest::Format::Auto && job.inputFormat != FrameIngest::Format::Bgr) {
+        capture.set(cv::CAP_PROP_CONVERT_RGB, 0);
+    }
+
+    // the frames alternate between two buffers (see below), configure()
+    // declares them stable
+    LucasKanadeCore core;
+    std::string error;
+    if (!BatchScheduler::configure(job, core, &error)) {
+        std::cerr << error << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    auto addSeeds = [&](size_t frameNumber, const cv::Mat &frame) {
+        auto seedsAtFrame = seeds.find(frameNumber);
+        if (seedsAtFrame != seeds.end()) {
+            // the seeds are refined on the gray frame, which may only be
+            // converted around the tracked points (no-op otherwise)
+            core.resyncPreviousFrame(frameNumber, frame);
+            for (const cv::Point2f &seed : seedsAtFrame->second) {
+                if (!core.tryCreateNewPoint(frameNumber, seed)) {
+                    std::cerr << "frame " << frameNumber << ": seed (" << seed.x << ", " << seed.y
+                              << ") is too close to an existing point" << std::endl;
+                }
+            }
+        }
+
+        // after the explicit seeds, the corners keep their distance to them
+        if (job.autoSeed && frameNumber == firstFrame) {
+            const size_t found = core.autoFindInitPoints(frameNumber, frame, job.autoSeedCount);
+            std::cout << "found " << found << " corners at frame " << frameNumber << std::endl;
+        }
+    };
+
+    size_t frameNumber = firstFrame;
+    size_t trackedFrames = 0;
+    if (prefetch > 0) {
+        // the capture belongs to the worker of the pipeline from now on
+        TrackingPipeline pipeline(core, prefetch);
+        size_t readFrames = 0;
+        const size_t frameCount = lastFrame >= firstFrame ? lastFrame - firstFrame + 1 : 0;
+        pipeline.start(firstFrame, [&](cv::Mat &frame) {
+            return readFrames++ < frameCount && capture.read(frame);
+        });
+
+        const cv::Mat *frame = nullptr;
+        while (pipeline.trackNext(frameNumber, &frame)) {
+            addSeeds(frameNumber, *frame);
+            trackedFrames++;
+        }
+    } else {
+        // the core may keep a header over the previous frame instead of a
+        // copy, so it must not be overwritten by the next read
+        cv::Mat frames[2];
+        for (; frameNumber <= lastFrame && capture.read(frames[frameNumber % 2]); frameNumber++) {
+            const cv::Mat &frame = frames[frameNumber % 2];
+            core.track(frameNumber, frame);
+            addSeeds(frameNumber, frame);
+            trackedFrames++;
+        }
+    }
+
+    if (!TrajectoryExporter::write(core.getTrajectories(), outputPath,
+                                   TrajectoryExporter::formatFromPath(outputPath),
+                                   TrajectoryExporter::ProgressCallback(), &error)) {
+        std::cerr << error << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    const TrajectoryPool::Stats pool = core.getTrajectoryPool()->stats();
+    std::cout << "tracked " << core.getTrajectories().size() << " points over "
+              << trackedFrames << " frames" << std::endl;
+    std::cout << "trajectory storage: " << pool.allocations << " block allocations, "
+              << pool.bytesInUse / 1024 << " KiB in use of " << pool.bytesReserved / 1024
+              << " KiB, " << pool.bytesPacked / 1024 << " KiB packed" << std::endl;
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,1217 @@
+#include "LucasKanadeCore.h"
+
+#include <algorithm>
+#include <cassert>
+
+#include "StageProfiler.h"
+
+LucasKanadeCore::LucasKanadeCore():
+    m_setUserStates(m_numberOfUserStates),
+    m_subPixWinSize(10, 10),
+    m_winSize(31, 31),
+    m_termcrit(cv::TermCriteria::COUNT | cv::TermCriteria::EPS,20,0.03),
+    m_frameIndex_prevGray(0),
+    m_frameIndex_prevPyr(0),
+    m_trackOnlyActive(false),
+    m_trajectoryPool(std::make_shared<TrajectoryPool>())
+{
+
+}
+
+bool LucasKanadeCore::track(size_t frame, const cv::Mat &imgOriginal) {
+    return trackStep(frame, FrameIngest::graySize(imgOriginal, m_inputFormat), &imgOriginal, nullptr);
+}
+
+bool LucasKanadeCore::track(size_t frame, PreparedFrame &prepared) {
+    return trackStep(frame, prepared.gray.size(), nullptr, &prepared);
+}
+
+void LucasKanadeCore::prepareFrame(const cv::Mat &imgOriginal, FrameIngest::Format format,
+                                   const cv::Size &winSize, int maxLevel, PreparedFrame &prepared) {
+    const cv::Size size = FrameIngest::graySize(imgOriginal, format);
+    {
+        LK_PROFILE_SCOPE(Convert);
+        FrameIngest::allocatePadded(prepared.gray, size, winSize);
+        FrameIngest::convert(imgOriginal, format, cv::Rect(cv::Point(0, 0), size), prepared.gray);
+        FrameIngest::fillBorder(prepared.gray);
+    }
+    LK_PROFILE_SCOPE(Pyramid);
+    prepared.builtLevels = cv::buildOpticalFlowPyramid(prepared.gray, prepared.pyramid, winSize, maxLevel);
+    prepared.levels = maxLevel;
+    prepared.winSize = winSize;
+}
+
+bool LucasKanadeCore::trackStep(size_t frame, const cv::Size &frameSize, const cv::Mat *imgOriginal,
+                                PreparedFrame *prepared) {
+    LK_PROFILE_SCOPE(Step);
+    const cv::Rect frameRect(cv::Point(0, 0), frameSize);
+
+    // the working set is usually still synced to the previous frame (it is
+    // advanced by every track() and kept up to date by the point edits), it
+    // only has to be rebuilt after seeking or loading
+    const size_t prevFrame = frame - 1;
+    if (!m_activeSet.isSyncedTo(prevFrame)) {
+        m_activeSet.rebuild(m_trajectories, prevFrame, m_trackOnlyActive, m_currentActivePoint);
+        // the recent motion says nothing about the motion after a jump
+        m_depthEstimator.clear();
+    }
+
+    const int maxLevel = pyramidDepth(frameSize);
+
+    // a frame tracked before (e.g. after seeking back to fix a point) is
+    // taken from the cache instead of converting it again
+    PreparedFrame cached;
+    if (!prepared && m_frameCache.take(frame, frameSize, m_winSize, cached)) {
+        prepared = &cached;
+        imgOriginal = nullptr;
+    }
+
+    // with only a few points just the tiles around them are converted (a
+    // prepared frame is already converted as a whole)
+    const bool useRegions = imgOriginal != nullptr &&
+            m_prevGray.cols == frameSize.width && m_prevGray.rows == frameSize.height &&
+            planRegions(frameSize, maxLevel);
+    // on big frames only a downscaled frame and patches around the points
+    // of this one are converted
+    const bool useDownscale = imgOriginal != nullptr && !useRegions && m_downscaleShift > 0 &&
+            m_activeSet.trackedCount() > 0;
+    if (prepared) {
+        // take over the buffers, the prepared frame gets our old ones
+        if (m_grayWrapsInput) {
+            m_gray.release();
+            m_grayWrapsInput = false;
+        }
+        cv::swap(m_gray, prepared->gray);
+        m_grayRegions.assign(1, frameRect);
+    } else if (useRegions || useDownscale) {
+        prepareGray(*imgOriginal, m_gray, m_grayWrapsInput, m_grayRegions);
+    } else {
+        ingest(*imgOriginal, m_gray, m_grayWrapsInput, m_grayRegions);
+    }
+
+    // false if m_prevGray is not (only) the frame m_frameIndex_prevGray
+    bool prevIsFrame = true;
+    if (useDownscale) {
+        // the coarse frames are kept on their own (see trackDownscaled())
+    } else if (m_prevGray.cols != frameSize.width || m_prevGray.rows != frameSize.height) {
+        // first frame (or another video)
+        FrameIngest::allocatePadded(m_prevGray, frameSize, m_winSize);
+        m_gray.copyTo(m_prevGray);
+        m_prevGrayWrapsInput = false;
+        m_prevGrayRegions = m_grayRegions;
+        m_frameIndex_prevGray = frame;
+        invalidatePyramidCache();
+        prevIsFrame = false;
+    } else if (!useRegions && !TrackingRegions::contains(m_prevGrayRegions, frameRect)) {
+        fillPreviousGray(frameRect);
+        invalidatePyramidCache();
+        prevIsFrame = false;
+    }
+
+    bool pyrBuilt = false;
+    m_regionCount = 0;
+    if (m_activeSet.trackedCount() > 0) {
+        if (useRegions) {
+            trackRegions(*imgOriginal, maxLevel);
+        } else if (useDownscale) {
+            trackDownscaled(frame, *imgOriginal, maxLevel);
+        } else {
+            // calculate pyramids:
+            // the pyramid of the previous frame can be reused if it was built in the
+            // last call of track(), nothing touched m_prevGray since then and it is deep enough
+            if (!m_prevPyrValid || m_frameIndex_prevPyr != m_frameIndex_prevGray || m_prevPyrLevels < maxLevel) {
+                buildPyramid(m_prevGray, m_prevGrayWrapsInput, m_prevPyr, maxLevel);
+                m_prevPyrLevels = maxLevel;
+                m_frameIndex_prevPyr = m_frameIndex_prevGray;
+                m_prevPyrValid = prevIsFrame;
+            }
+
+            // small images end up with fewer levels than requested
+            int builtLevels = 0;
+            if (prepared && prepared->levels >= maxLevel && prepared->winSize == m_winSize) {
+                std::swap(m_pyr, prepared->pyramid);
+                builtLevels = std::min(prepared->builtLevels, maxLevel);
+            } else {
+                builtLevels = buildPyramid(m_gray, m_grayWrapsInput, m_pyr, maxLevel);
+            }
+            m_pyrLevels = maxLevel;
+            pyrBuilt = true;
+
+            m_pyramidDepth = std::min(maxLevel, builtLevels);
+            calcOpticalFlow(m_pyramidDepth);
+        }
+
+        if (hasArena(frameSize)) {
+            applyArenaMask();
+        }
+        m_depthEstimator.addFrame(m_activeSet.maxDisplacement());
+    }
+
+    // write the new positions (and carry over the not tracked points)
+    bool somePointsAreInvalid = false;
+    {
+        LK_PROFILE_SCOPE(Commit);
+        somePointsAreInvalid = m_activeSet.commit(m_trajectories, frame);
+    }
+    if (m_activeSet.size() > 0) {
+        noteTrackedFrame(frame);
+    }
+    if (m_pointIndexFrame == frame) {
+        // rebuilt on the next query, nobody picks points during playback
+        m_pointIndexValid = false;
+    }
+    updateUserStates(frame);
+    {
+        LK_PROFILE_SCOPE(Trails);
+        m_trailCache.update(frame, m_trajectories);
+    }
+    enforceMemoryBudget(frame);
+
+    if (useRegions) {
+        prepareNextRegions(*imgOriginal);
+    }
+
+    // the previous frame is done, its buffers are kept for scrubbing back
+    // (or reused for the next frame)
+    cachePreviousFrame();
+
+    cv::swap(m_prevGray, m_gray);
+    std::swap(m_prevGrayRegions, m_grayRegions);
+    std::swap(m_prevGrayWrapsInput, m_grayWrapsInput);
+    m_frameIndex_prevGray = frame;
+
+    // keep the pyramid of this frame for the next call (the old buffers are
+    // recycled by buildOpticalFlowPyramid)
+    if (pyrBuilt) {
+        std::swap(m_prevPyr, m_pyr);
+        m_prevPyrLevels = m_pyrLevels;
+        m_frameIndex_prevPyr = frame;
+        m_prevPyrValid = true;
+    } else {
+        m_prevPyrValid = false;
+    }
+
+    // the same for the pyramids of the tiles
+    if (m_regionCount > 0) {
+        std::swap(m_prevRegionTiles, m_regionTiles);
+        m_frameIndex_prevRegionTiles = frame;
+        m_prevRegionTilesValid = true;
+    } else {
+        m_prevRegionTilesValid = false;
+    }
+
+    // new points in the cells that lost theirs (tracked from the next step on)
+    replenish(frame, imgOriginal);
+
+    return somePointsAreInvalid;
+}
+
+bool LucasKanadeCore::isPreviousFrameSynced(size_t frameNumber) {
+    if (m_prevGray.empty() || m_frameIndex_prevGray != frameNumber) {
+        return false;
+    }
+    const cv::Size frameSize(m_prevGray.cols, m_prevGray.rows);
+    if (TrackingRegions::contains(m_prevGrayRegions, cv::Rect(cv::Point(0, 0), frameSize))) {
+        return true;
+    }
+
+    // only parts were converted, enough if the next step stays within them
+    return m_activeSet.isSyncedTo(frameNumber) &&
+            planRegions(frameSize, pyramidDepth(frameSize)) &&
+            m_regions.isCoveredBy(m_prevGrayRegions);
+}
+
+void LucasKanadeCore::resyncPreviousFrame(size_t frameNumber, const cv::Mat &imgOriginal) {
+    const cv::Size frameSize = FrameIngest::graySize(imgOriginal, m_inputFormat);
+    if (m_frameIndex_prevGray == frameNumber && m_prevGray.cols == frameSize.width &&
+            m_prevGray.rows == frameSize.height &&
+            TrackingRegions::contains(m_prevGrayRegions, cv::Rect(cv::Point(0, 0), frameSize))) {
+        return;
+    }
+
+    // taken first, caching the replaced frame may evict it
+    PreparedFrame cached;
+    const bool isCached = m_frameCache.take(frameNumber, frameSize, m_winSize, cached);
+    cachePreviousFrame();
+
+    if (isCached) {
+        // the pyramid comes along, the next track() does not build it again
+        m_prevGray = cached.gray;
+        m_prevGrayWrapsInput = false;
+        m_prevGrayRegions.assign(1, cv::Rect(cv::Point(0, 0), frameSize));
+        m_frameIndex_prevGray = frameNumber;
+        invalidatePyramidCache();
+        m_prevPyr = std::move(cached.pyramid);
+        m_prevPyrLevels = cached.levels;
+        m_frameIndex_prevPyr = frameNumber;
+        m_prevPyrValid = true;
+        return;
+    }
+
+    ingest(imgOriginal, m_prevGray, m_prevGrayWrapsInput, m_prevGrayRegions);
+    m_frameIndex_prevGray = frameNumber;
+    invalidatePyramidCache();
+}
+
+void LucasKanadeCore::setInputFormat(FrameIngest::Format format) {
+    if (format != m_inputFormat) {
+        m_frameCache.clear();
+    }
+    m_inputFormat = format;
+}
+
+void LucasKanadeCore::setReplenishTarget(size_t count) {
+    m_replenishTarget = count;
+}
+
+void LucasKanadeCore::setFrameCacheBudget(size_t bytes) {
+    m_frameCache.setBudget(bytes);
+}
+
+void LucasKanadeCore::clearFrameCache() {
+    m_frameCache.clear();
+    m_frameIndex_prevCoarse = static_cast<size_t>(-1);
+    m_patchRefiner.clear();
+}
+
+void LucasKanadeCore::setStableInput(bool stable) {
+    m_stableInput = stable;
+}
+
+int LucasKanadeCore::maximumWinSize(const cv::Size &imageSize) {
+    return std::min(imageSize.width, imageSize.height) / 10;
+}
+
+void LucasKanadeCore::setWinSize(int value) {
+    // the pyramid padding depends on the window size
+    invalidatePyramidCache();
+    if (value != m_winSize.width) {
+        m_frameCache.clear();
+    }
+    m_winSize.height = value;
+    m_winSize.width = value;
+    m_subPixWinSize.height = value;
+    m_subPixWinSize.width = value;
+}
+
+void LucasKanadeCore::setThreadCount(size_t count) {
+    if (count == getThreadCount() && count != 0) {
+        return;
+    }
+    m_threadPool.reset();
+    if (count != 1) {
+        m_threadPool.reset(new ThreadPool(count));
+        if (m_threadPool->threadCount() == 1) {
+            m_threadPool.reset();
+        }
+    }
+}
+
+void LucasKanadeCore::setAdaptivePyramid(bool adaptive) {
+    m_adaptivePyramid = adaptive;
+    m_depthEstimator.clear();
+}
+
+void LucasKanadeCore::setRegionTracking(bool enabled) {
+    m_regionTracking = enabled;
+}
+
+void LucasKanadeCore::setDownscale(int factor) {
+    int shift = 0;
+    while (shift < 3 && (2 << shift) <= factor) {
+        shift++;
+    }
+    if (shift != m_downscaleShift) {
+        m_downscaleShift = shift;
+        m_frameIndex_prevCoarse = static_cast<size_t>(-1);
+        m_patchRefiner.clear();
+    }
+}
+
+void LucasKanadeCore::setArenaMask(const cv::Mat &mask) {
+    assert(mask.empty() || mask.type() == CV_8UC1);
+    m_arenaMask = mask.clone();
+    m_arenaRect = m_arenaMask.empty() ? cv::Rect() : cv::boundingRect(m_arenaMask);
+}
+
+void LucasKanadeCore::setTrackOnlyActive(bool trackOnlyActive) {
+    m_trackOnlyActive = trackOnlyActive;
+    // the partition into tracked and passive points changes
+    m_activeSet.invalidate();
+}
+
+void LucasKanadeCore::setUserState(size_t i, bool isSet) {
+    m_setUserStates.at(i) = isSet;
+}
+
+bool LucasKanadeCore::tryCreateNewPoint(size_t frameNumber, cv::Point2f point) {
+    syncPointIndex(frameNumber);
+    if (m_pointIndex.hasPointWithin(point, m_minPointDistance)) {
+        // the new point is too close to an existing other point.. abort
+        return false;
+    }
+
+    std::vector<cv::Point2f> tmp;
+    tmp.push_back(point);
+
+    // refined on the gray version of the frame (the last tracked or resynced
+    // one); with region tracking only parts of it may be converted
+    if (m_frameIndex_prevGray == frameNumber && !m_prevGray.empty()) {
+        const cv::Rect window = cv::Rect(cv::Point(point) - cv::Point(m_winSize.width + 2, m_winSize.height + 2),
+                                         cv::Size(2 * m_winSize.width + 5, 2 * m_winSize.height + 5)) &
+                cv::Rect(0, 0, m_prevGray.cols, m_prevGray.rows);
+        if (TrackingRegions::contains(m_prevGrayRegions, window)) {
+            cv::cornerSubPix(m_prevGray, tmp, m_winSize, cv::Size(-1, -1), m_termcrit);
+        }
+    }
+
+    const auto newPos = tmp[0];
+    const size_t id = m_trajectories.size(); // position in list + id are correlated
+    m_trajectories.push_back(Trajectory(id, m_trajectoryPool));
+    m_trajectories.back().add(frameNumber, cv::Point2f(newPos.x, newPos.y), InterestPointStatus::Valid);
+
+    setCurrentActivePoint(frameNumber, static_cast<int>(id));
+
+    return true;
+}
+
+bool LucasKanadeCore::activateExistingPoint(size_t frameNumber, cv::Point2f point) {
+    if (m_trajectories.empty()) {
+        m_currentActivePoint = -1;
+        return false;
+    }
+
+    syncPointIndex(frameNumber);
+    size_t currentClosestId = 0;
+    if (!m_pointIndex.nearest(point, currentClosestId)) {
+        // no point has a position at this frame
+        return false;
+    }
+    setCurrentActivePoint(frameNumber, static_cast<int>(currentClosestId));
+    return true;
+}
+
+std::vector<size_t> LucasKanadeCore::getPointsInRect(size_t frameNumber, const cv::Rect2f &rect) {
+    syncPointIndex(frameNumber);
+    std::vector<size_t> ids;
+    m_pointIndex.query(rect, ids);
+    return ids;
+}
+
+bool LucasKanadeCore::moveCurrentActivePointTo(size_t frameNumber, cv::Point2f pos) {
+    if (m_currentActivePoint < 0 || m_currentActivePoint >= static_cast<int>(m_trajectories.size())) {
+        return false;
+    }
+
+    m_trajectories[m_currentActivePoint].add(frameNumber, pos, InterestPointStatus::Valid);
+    updateActiveSet(frameNumber, static_cast<size_t>(m_currentActivePoint));
+    return true;
+}
+
+bool LucasKanadeCore::deleteCurrentActivePoint(size_t frameNumber) {
+    if (m_currentActivePoint >= 0) {
+        Trajectory &o = m_trajectories[m_currentActivePoint];
+        if (o.hasValuesAtFrame(frameNumber)) {
+            o.setStatus(frameNumber, InterestPointStatus::Invalid);
+            updateActiveSet(frameNumber, static_cast<size_t>(m_currentActivePoint));
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t LucasKanadeCore::autoFindInitPoints(size_t frameNumber, const cv::Mat &imgOriginal, size_t maxCount) {
+    // the corners are searched on the whole gray frame
+    resyncPreviousFrame(frameNumber, imgOriginal);
+    const cv::Size frameSize(m_prevGray.cols, m_prevGray.rows);
+
+    // the new points keep their distance to the existing ones and are added
+    // to the index with the ids they get below
+    syncPointIndex(frameNumber);
+    CornerDetector::Parameters parameters;
+    parameters.maxCount = maxCount > 0 ? maxCount : static_cast<size_t>(MAX_COUNT);
+    parameters.minDistance = std::max(parameters.minDistance, m_minPointDistance);
+    std::vector<cv::Point2f> corners;
+    // the threshold of the whole frame is kept for the replenishment
+    m_cornerThreshold = CornerDetector::detect(m_prevGray, parameters, hasArena(frameSize) ? m_arenaMask : cv::Mat(),
+                                               m_pointIndex, m_trajectories.size(), m_threadPool.get(), corners);
+    addCorners(frameNumber, corners);
+    return corners.size();
+}
+
+void LucasKanadeCore::activateAllNonTrackedPoints(size_t frame) {
+    for (Trajectory &o : m_trajectories) {
+        if (o.hasValuesAtFrame(frame) && o.getStatus(frame) == InterestPointStatus::Not_Tracked) {
+            o.setStatus(frame, InterestPointStatus::Valid);
+        }
+    }
+    m_activeSet.invalidate();
+}
+
+void LucasKanadeCore::CurrentPoints::clear() {
+    ids.clear();
+    positions.clear();
+    statuses.clear();
+    userStatuses.clear();
+}
+
+void LucasKanadeCore::CurrentPoints::reserve(size_t count) {
+    ids.reserve(count);
+    positions.reserve(count);
+    statuses.reserve(count);
+    userStatuses.reserve(count);
+}
+
+void LucasKanadeCore::CurrentPoints::push_back(size_t id, cv::Point2f position,
+        InterestPointStatus status, size_t userStatus) {
+    ids.push_back(id);
+    positions.push_back(position);
+    statuses.push_back(status);
+    userStatuses.push_back(userStatus);
+}
+
+void LucasKanadeCore::getCurrentPoints(size_t frameNumber, CurrentPoints &points) const {
+    points.clear();
+
+    if (m_activeSet.isSyncedTo(frameNumber)) {
+        // the alive points are already collected, only the lost ones are added
+        const std::vector<size_t> &ids = m_activeSet.ids();
+        const std::vector<cv::Point2f> &positions = m_activeSet.positions();
+        const std::vector<size_t> &lostIds = m_activeSet.lostIds();
+        points.reserve(ids.size() + lostIds.size());
+
+        for (size_t entry = 0; entry < ids.size(); entry++) {
+            const InterestPointStatus status = entry < m_activeSet.trackedCount() ?
+                        InterestPointStatus::Valid : InterestPointStatus::Not_Tracked;
+            points.push_back(ids[entry], positions[entry], status,
+                             m_trajectories[ids[entry]].getUserStatus(frameNumber));
+        }
+        for (size_t id : lostIds) {
+            const Trajectory &o = m_trajectories[id];
+            if (o.hasValuesAtFrame(frameNumber) && o.getStatus(frameNumber) == InterestPointStatus::Invalid) {
+                points.push_back(id, o.getPosition(frameNumber), InterestPointStatus::Invalid,
+                                 o.getUserStatus(frameNumber));
+            }
+        }
+        return;
+    }
+
+    // a frame that is only shown (seeking, paused on an old frame)
+    points.reserve(m_trajectories.size());
+    for (size_t i = 0; i < m_trajectories.size(); i++) {
+        const Trajectory &o = m_trajectories[i];
+        if (!o.hasValuesAtFrame(frameNumber)) {
+            continue;
+        }
+        InterestPointStatus status = o.getStatus(frameNumber);
+        if (status == InterestPointStatus::Non_Existing) {
+            continue;
+        }
+        if (status == InterestPointStatus::Valid && m_trackOnlyActive &&
+                static_cast<int>(i) != m_currentActivePoint) {
+            status = InterestPointStatus::Not_Tracked;
+        }
+        points.push_back(i, o.getPosition(frameNumber), status, o.getUserStatus(frameNumber));
+    }
+}
+
+void LucasKanadeCore::setTrailLength(size_t length) {
+    m_trailCache.setLength(length);
+}
+
+const std::vector<cv::Point2f> &LucasKanadeCore::getTrail(size_t frameNumber) {
+    return m_trailCache.positions(frameNumber, m_trajectories);
+}
+
+void LucasKanadeCore::setTrajectories(std::vector<Trajectory> trajectories) {
+    m_trajectories.clear();
+    m_trajectoryPool->trim();
+    m_trajectories.reserve(trajectories.size());
+    for (Trajectory &t : trajectories) {
+        if (t.pool() == m_trajectoryPool) {
+            m_trajectories.push_back(std::move(t));
+        } else {
+            m_trajectories.push_back(Trajectory(t, m_trajectoryPool));
+        }
+    }
+    m_currentActivePoint = -1;
+    m_activeSet.invalidate();
+    m_pointIndexValid = false;
+    m_trailCache.clear();
+
+    m_firstTrackedFrame = -1;
+    m_lastTrackedFrame = -1;
+    for (const Trajectory &t : m_trajectories) {
+        if (!t.spans().empty()) {
+            noteTrackedFrame(t.spans().front().first);
+            noteTrackedFrame(t.spans().back().last);
+        }
+    }
+}
+
+void LucasKanadeCore::clear() {
+    m_trajectories.clear();
+    m_trajectoryPool->trim();
+    m_firstTrackedFrame = -1;
+    m_lastTrackedFrame = -1;
+    m_currentActivePoint = -1;
+    m_activeSet.invalidate();
+    m_pointIndexValid = false;
+    m_cornerThreshold = 0.f;
+    m_barrenUntil.assign(m_barrenUntil.size(), 0);
+    m_trailCache.clear();
+}
+
+// =========== P R I V A T E = F U N C S ============
+
+void LucasKanadeCore::setCurrentActivePoint(size_t frameNumber, int id) {
+    const int previous = m_currentActivePoint;
+    m_currentActivePoint = id;
+
+    // when only the active point is tracked, both points change their partition
+    if (previous >= 0 && previous < static_cast<int>(m_trajectories.size())) {
+        updateActiveSet(frameNumber, static_cast<size_t>(previous));
+    }
+    if (id >= 0) {
+        updateActiveSet(frameNumber, static_cast<size_t>(id));
+    }
+}
+
+void LucasKanadeCore::updateActiveSet(size_t frameNumber, size_t id) {
+    m_trailCache.invalidateFrame(frameNumber);
+    noteTrackedFrame(frameNumber);
+
+    if (m_pointIndexValid && m_pointIndexFrame == frameNumber) {
+        const Trajectory &o = m_trajectories[id];
+        if (o.hasValuesAtFrame(frameNumber) && o.getStatus(frameNumber) != InterestPointStatus::Non_Existing) {
+            m_pointIndex.insertOrUpdate(id, o.getPosition(frameNumber));
+        } else {
+            m_pointIndex.remove(id);
+        }
+    }
+
+    if (!m_activeSet.isSyncedTo(frameNumber)) {
+        // the set is rebuilt anyway before it is used for this frame
+        return;
+    }
+
+    const Trajectory &o = m_trajectories[id];
+    const InterestPointStatus status = o.hasValuesAtFrame(frameNumber) ?
+                o.getStatus(frameNumber) : InterestPointStatus::Non_Existing;
+    if (status == InterestPointStatus::Valid || status == InterestPointStatus::Not_Tracked) {
+        const bool tracked = status == InterestPointStatus::Valid &&
+                (!m_trackOnlyActive || static_cast<int>(id) == m_currentActivePoint);
+        m_activeSet.insertOrUpdate(id, o.getPosition(frameNumber), tracked);
+    } else {
+        m_activeSet.remove(id);
+        if (status == InterestPointStatus::Invalid) {
+            m_activeSet.addLost(id);
+        }
+    }
+}
+
+void LucasKanadeCore::addCorners(size_t frameNumber, std::vector<cv::Point2f> &corners) {
+    if (corners.empty()) {
+        return;
+    }
+
+    refineCorners(corners);
+
+    const size_t firstId = m_trajectories.size();
+    m_trajectories.reserve(firstId + corners.size());
+    const bool synced = m_activeSet.isSyncedTo(frameNumber);
+    for (size_t i = 0; i < corners.size(); i++) {
+        const size_t id = firstId + i; // position in list + id are correlated
+        m_trajectories.push_back(Trajectory(id, m_trajectoryPool));
+        m_trajectories.back().add(frameNumber, corners[i], InterestPointStatus::Valid);
+        m_pointIndex.insertOrUpdate(id, corners[i]);
+        if (synced) {
+            m_activeSet.insertOrUpdate(id, corners[i], !m_trackOnlyActive);
+        }
+    }
+    m_trailCache.invalidateFrame(frameNumber);
+    noteTrackedFrame(frameNumber);
+}
+
+void LucasKanadeCore::replenish(size_t frameNumber, const cv::Mat *imgOriginal) {
+    const size_t live = m_activeSet.trackedCount();
+    if (m_replenishTarget == 0 || m_trackOnlyActive || live >= m_replenishTarget) {
+        return;
+    }
+
+    const cv::Size frameSize(m_prevGray.cols, m_prevGray.rows);
+    const cv::Rect frameRect(cv::Point(0, 0), frameSize);
+    const bool arena = hasArena(frameSize);
+    CornerDetector::Parameters parameters;
+    parameters.maxCount = m_replenishTarget;
+    parameters.minDistance = std::max(parameters.minDistance, m_minPointDistance);
+
+    // the cells autoFindInitPoints() would use for the target count
+    const int cellSize = CornerDetector::cellSize(frameSize, parameters);
+    const cv::Size grid((frameSize.width + cellSize - 1) / cellSize, (frameSize.height + cellSize - 1) / cellSize);
+    if (grid != m_replenishGrid) {
+        m_replenishGrid = grid;
+        m_barrenUntil.assign(static_cast<size_t>(grid.area()), 0);
+    }
+
+    // cells without any alive point (that did not turn out barren recently)
+    std::vector<uint8_t> covered(static_cast<size_t>(grid.area()), 0);
+    for (const cv::Point2f &position : m_activeSet.positions()) {
+        const int x = static_cast<int>(position.x);
+        const int y = static_cast<int>(position.y);
+        if (x >= 0 && y >= 0 && x < frameSize.width && y < frameSize.height) {
+            covered[static_cast<size_t>((y / cellSize) * grid.width + x / cellSize)] = 1;
+        }
+    }
+    const cv::Rect bounds = arena ? m_arenaRect : frameRect;
+    std::vector<cv::Rect> cells;
+    std::vector<size_t> cellIndices;
+    for (size_t i = 0; i < covered.size(); i++) {
+        if (covered[i] || m_barrenUntil[i] > frameNumber) {
+            continue;
+        }
+        const int cx = static_cast<int>(i) % grid.width;
+        const int cy = static_cast<int>(i) / grid.width;
+        const cv::Rect cell = cv::Rect(cx * cellSize, cy * cellSize, cellSize, cellSize) & bounds;
+        if (cell.area() > 0) {
+            cells.push_back(cell);
+            cellIndices.push_back(i);
+        }
+    }
+    if (cells.empty()) {
+        return;
+    }
+
+    // searched on the gray frame just tracked (level 0 of its pyramid),
+    // converted as a whole only if the step used regions
+    if (!TrackingRegions::contains(m_prevGrayRegions, frameRect)) {
+        if (!imgOriginal) {
+            return;
+        }
+        resyncPreviousFrame(frameNumber, *imgOriginal);
+    }
+
+    syncPointIndex(frameNumber);
+    parameters.maxCount = m_replenishTarget - live;
+    std::vector<cv::Point2f> corners;
+    if (m_cornerThreshold <= 0.f) {
+        // nothing to compare the cells with yet: once over the whole frame
+        m_cornerThreshold = CornerDetector::detect(m_prevGray, parameters, arena ? m_arenaMask : cv::Mat(),
+                                                   m_pointIndex, m_trajectories.size(), m_threadPool.get(), corners);
+    } else {
+        parameters.minResponse = m_cornerThreshold;
+        std::vector<size_t> found;
+        CornerDetector::detectInCells(m_prevGray, parameters, arena ? m_arenaMask : cv::Mat(), cells,
+                                      m_pointIndex, m_trajectories.size(), m_threadPool.get(), corners, &found);
+
+        // unless the search stopped early, empty cells have nothing to offer
+        // (background); they are skipped for a while
+        if (corners.size() < parameters.maxCount) {
+            for (size_t i = 0; i < cells.size(); i++) {
+                if (found[i] == 0) {
+                    m_barrenUntil[cellIndices[i]] = frameNumber + replenishBackoff;
+                }
+            }
+        }
+    }
+    addCorners(frameNumber, corners);
+}
+
+void LucasKanadeCore::refineCorners(std::vector<cv::Point2f> &corners) {
+    // each corner is refined on its own, so the chunks are independent
+    const size_t chunkSize = 64;
+    const size_t chunkCount = (corners.size() + chunkSize - 1) / chunkSize;
+    auto refineChunk = [&](size_t chunk) {
+        const size_t begin = chunk * chunkSize;
+        const size_t end = std::min(corners.size(), begin + chunkSize);
+        cv::Mat points(static_cast<int>(end - begin), 1, CV_32FC2, &corners[begin]);
+        cv::cornerSubPix(m_prevGray, points, m_subPixWinSize, cv::Size(-1, -1), m_termcrit);
+    };
+
+    if (m_threadPool && chunkCount > 1) {
+        m_threadPool->parallelFor(chunkCount, refineChunk);
+    } else {
+        for (size_t chunk = 0; chunk < chunkCount; chunk++) {
+            refineChunk(chunk);
+        }
+    }
+}
+
+void LucasKanadeCore::setMemoryBudget(size_t bytes) {
+    m_memoryBudget = bytes;
+    m_budgetBlock = static_cast<size_t>(-1);
+}
+
+void LucasKanadeCore::enforceMemoryBudget(size_t frameNumber) {
+    // checked once per block of frames, packing only pays off for whole blocks
+    const size_t block = frameNumber / TrajectoryPool::blockFrames;
+    if (m_memoryBudget == 0 || block == m_budgetBlock) {
+        return;
+    }
+    m_budgetBlock = block;
+    if (m_trajectoryPool->stats().bytesInUse <= m_memoryBudget) {
+        return;
+    }
+
+    // everything outside the hot window around the frame is packed at once,
+    // which leaves room for many blocks before the next pass
+    const size_t keepFirst = frameNumber > hotWindowFrames ? frameNumber - hotWindowFrames : 0;
+    for (Trajectory &t : m_trajectories) {
+        t.pack(keepFirst, frameNumber + hotWindowFrames);
+    }
+}
+
+void LucasKanadeCore::noteTrackedFrame(size_t frameNumber) {
+    const int frame = static_cast<int>(frameNumber);
+    if (m_firstTrackedFrame < 0 || frame < m_firstTrackedFrame) {
+        m_firstTrackedFrame = frame;
+    }
+    if (frame > m_lastTrackedFrame) {
+        m_lastTrackedFrame = frame;
+    }
+}
+
+void LucasKanadeCore::syncPointIndex(size_t frameNumber) {
+    if (m_pointIndexValid && m_pointIndexFrame == frameNumber) {
+        return;
+    }
+
+    m_pointIndex.clear();
+    for (size_t i = 0; i < m_trajectories.size(); i++) {
+        const Trajectory &o = m_trajectories[i];
+        if (o.hasValuesAtFrame(frameNumber) && o.getStatus(frameNumber) != InterestPointStatus::Non_Existing) {
+            m_pointIndex.insertOrUpdate(i, o.getPosition(frameNumber));
+        }
+    }
+    m_pointIndexFrame = frameNumber;
+    m_pointIndexValid = true;
+}
+
+void LucasKanadeCore::updateUserStates(size_t currentFrame) {
+    LK_PROFILE_SCOPE(UserStates);
+    if (m_currentActivePoint >= 0) {
+        Trajectory &o = m_trajectories[m_currentActivePoint];
+        if (o.hasValuesAtFrame(currentFrame)) {
+            // set the user-defined value, bit i represents user state i
+            size_t userStatus = o.getUserStatus(currentFrame);
+            for (size_t i = 0; i < m_numberOfUserStates; i++) {
+                const size_t bitRep = static_cast<size_t>(1) << i;
+                if (m_setUserStates[i]) {
+                    userStatus |= bitRep;
+                } else {
+                    userStatus &= ~bitRep;
+                }
+            }
+            o.setUserStatus(currentFrame, userStatus);
+        }
+    }
+}
+
+void LucasKanadeCore::calcOpticalFlow(int maxLevel) {
+    LK_PROFILE_SCOPE(OpticalFlow);
+    const size_t count = m_activeSet.trackedCount();
+
+    // the results end up in the order of the tracked entries
+    std::vector<cv::Point2f> &nextPositions = m_activeSet.nextPositions();
+    std::vector<uchar> &status = m_activeSet.lkStatus();
+    std::vector<float> &error = m_activeSet.lkError();
+    nextPositions.resize(count);
+    status.resize(count);
+    error.resize(count);
+
+    runOpticalFlow(m_prevPyr, m_pyr, m_activeSet.positions().data(), nextPositions.data(), status.data(),
+                   error.data(), count, maxLevel);
+}
+
+void LucasKanadeCore::runOpticalFlow(const std::vector<cv::Mat> &prevPyr, const std::vector<cv::Mat> &nextPyr,
+                                     const cv::Point2f *prevPts, cv::Point2f *nextPts, uchar *status, float *error,
+                                     size_t count, int maxLevel) {
+    // a chunk should be big enough to outweigh the scheduling, a few chunks
+    // per thread leave room for stealing when some points converge slower
+    const size_t minChunkSize = 32;
+    const size_t chunkCount = m_threadPool ?
+                std::min((count + minChunkSize - 1) / minChunkSize, 4 * m_threadPool->threadCount()) : 1;
+
+    // every chunk writes into its own range of the output buffers, so the
+    // results need no merging
+    auto trackChunk = [&](size_t chunk) {
+        const size_t begin = count * chunk / chunkCount;
+        const size_t end = count * (chunk + 1) / chunkCount;
+
+        // the pyramids are shared read-only between the chunks
+        if (m_useNativeKernel) {
+            LucasKanadeKernel::calcOpticalFlowPyrLK(prevPyr, nextPyr, prevPts + begin, nextPts + begin,
+                status + begin, error + begin, end - begin, m_winSize, maxLevel, m_termcrit, 0.001);
+            return;
+        }
+
+        const int n = static_cast<int>(end - begin);
+        const cv::Mat chunkPrevPts(n, 1, CV_32FC2, const_cast<cv::Point2f *>(prevPts + begin));
+        cv::Mat chunkNextPts(n, 1, CV_32FC2, nextPts + begin);
+        cv::Mat chunkStatus(n, 1, CV_8U, status + begin);
+        cv::Mat chunkError(n, 1, CV_32F, error + begin);
+        cv::calcOpticalFlowPyrLK(prevPyr, nextPyr, chunkPrevPts, chunkNextPts, chunkStatus, chunkError,
+            m_winSize, maxLevel, m_termcrit, 0, 0.001);
+    };
+
+    if (chunkCount > 1) {
+        m_threadPool->parallelFor(chunkCount, trackChunk);
+    } else {
+        trackChunk(0);
+    }
+}
+
+void LucasKanadeCore::trackDownscaled(size_t frame, const cv::Mat &imgOriginal, int maxLevel) {
+    const cv::Size frameSize = FrameIngest::graySize(imgOriginal, m_inputFormat);
+    const cv::Size coarseSize(std::max(1, frameSize.width >> m_downscaleShift),
+                              std::max(1, frameSize.height >> m_downscaleShift));
+    {
+        LK_PROFILE_SCOPE(Convert);
+        FrameIngest::allocatePadded(m_coarseGray, coarseSize, m_winSize);
+        FrameIngest::downscale(imgOriginal, m_inputFormat, m_coarseGray, m_downscaleBuffer);
+    }
+
+    // the previous coarse frame is the one of the last step, unless
+    // m_prevGray was replaced since (seeking, another kind of step): then
+    // it is made from the whole m_prevGray, or the points stand still
+    const bool prevIsWhole = m_prevGray.cols == frameSize.width && m_prevGray.rows == frameSize.height &&
+            TrackingRegions::contains(m_prevGrayRegions, cv::Rect(cv::Point(0, 0), frameSize));
+    if (m_prevCoarseGray.cols != coarseSize.width || m_prevCoarseGray.rows != coarseSize.height ||
+            m_frameIndex_prevCoarse != m_frameIndex_prevGray) {
+        LK_PROFILE_SCOPE(Convert);
+        FrameIngest::allocatePadded(m_prevCoarseGray, coarseSize, m_winSize);
+        if (prevIsWhole) {
+            cv::resize(m_prevGray, m_prevCoarseGray, coarseSize, 0, 0, cv::INTER_AREA);
+        } else {
+            m_coarseGray.copyTo(m_prevCoarseGray);
+        }
+        m_frameIndex_prevCoarse = m_frameIndex_prevGray;
+        m_prevCoarsePyrValid = false;
+    }
+
+    // every halving of the frame is one level less
+    const int coarseLevel = std::max(0, maxLevel - m_downscaleShift);
+    if (!m_prevCoarsePyrValid || m_prevCoarsePyrLevels < coarseLevel) {
+        buildPyramid(m_prevCoarseGray, false, m_prevCoarsePyr, coarseLevel);
+        m_prevCoarsePyrLevels = coarseLevel;
+    }
+    const int builtLevels = buildPyramid(m_coarseGray, false, m_coarsePyr, coarseLevel);
+    const int depth = std::min(coarseLevel, builtLevels);
+
+    const size_t count = m_activeSet.trackedCount();
+    const std::vector<cv::Point2f> &positions = m_activeSet.positions();
+    std::vector<cv::Point2f> &nextPositions = m_activeSet.nextPositions();
+    std::vector<uchar> &status = m_activeSet.lkStatus();
+    std::vector<float> &error = m_activeSet.lkError();
+    nextPositions.resize(count);
+    status.resize(count);
+    error.resize(count);
+
+    // pixel centers map onto pixel centers
+    const float scaleX = static_cast<float>(frameSize.width) / coarseSize.width;
+    const float scaleY = static_cast<float>(frameSize.height) / coarseSize.height;
+    m_coarsePoints.resize(count);
+    for (size_t i = 0; i < count; i++) {
+        m_coarsePoints[i] = cv::Point2f((positions[i].x + 0.5f) / scaleX - 0.5f, (positions[i].y + 0.5f) / scaleY - 0.5f);
+    }
+    {
+        LK_PROFILE_SCOPE(OpticalFlow);
+        runOpticalFlow(m_prevCoarsePyr, m_coarsePyr, m_coarsePoints.data(), nextPositions.data(), status.data(),
+                       error.data(), count, depth);
+    }
+    for (size_t i = 0; i < count; i++) {
+        nextPositions[i] = cv::Point2f((nextPositions[i].x + 0.5f) * scaleX - 0.5f, (nextPositions[i].y + 0.5f) * scaleY - 0.5f);
+    }
+    m_pyramidDepth = depth + m_downscaleShift;
+
+    {
+        LK_PROFILE_SCOPE(Refine);
+        const bool prevIsLast = prevIsWhole && m_frameIndex_prevGray + 1 == frame;
+        const size_t refined = m_patchRefiner.prepare(frame, imgOriginal, m_inputFormat,
+                                                      prevIsLast ? m_prevGray : cv::Mat(),
+                                                      m_activeSet.ids().data(), positions.data(),
+                                                      nextPositions.data(), status.data(), count,
+                                                      m_winSize, 1 << m_downscaleShift, m_threadPool.get());
+        if (refined > 0) {
+            runOpticalFlow(m_patchRefiner.prevPyramid(), m_patchRefiner.nextPyramid(),
+                           m_patchRefiner.prevPoints(), m_patchRefiner.nextPoints(),
+                           m_patchRefiner.status(), m_patchRefiner.error(), refined, 0);
+        }
+        m_patchRefiner.apply(frame, nextPositions.data(), error.data());
+    }
+
+    // kept for the next step like m_prevGray / m_prevPyr
+    cv::swap(m_prevCoarseGray, m_coarseGray);
+    std::swap(m_prevCoarsePyr, m_coarsePyr);
+    m_prevCoarsePyrLevels = coarseLevel;
+    m_prevCoarsePyrValid = true;
+    m_frameIndex_prevCoarse = frame;
+}
+
+void LucasKanadeCore::prepareGray(const cv::Mat &imgOriginal, cv::Mat &gray, bool &wrapsInput,
+                                  std::vector<cv::Rect> &regions) {
+    const cv::Size size = FrameIngest::graySize(imgOriginal, m_inputFormat);
+    if (m_stableInput && FrameIngest::canWrap(imgOriginal, m_inputFormat)) {
+        gray = FrameIngest::wrap(imgOriginal, m_inputFormat);
+        wrapsInput = true;
+        regions.assign(1, cv::Rect(cv::Point(0, 0), size));
+        return;
+    }
+
+    // never write into the frame of the caller
+    if (wrapsInput) {
+        gray.release();
+        wrapsInput = false;
+    }
+    // the border lets buildOpticalFlowPyramid use the frame in place
+    FrameIngest::allocatePadded(gray, size, m_winSize);
+    regions.clear();
+}
+
+void LucasKanadeCore::ingest(const cv::Mat &imgOriginal, cv::Mat &gray, bool &wrapsInput,
+                             std::vector<cv::Rect> &regions) {
+    LK_PROFILE_SCOPE(Convert);
+    prepareGray(imgOriginal, gray, wrapsInput, regions);
+    if (regions.empty()) {
+        const cv::Rect frameRect(cv::Point(0, 0), gray.size());
+        FrameIngest::convert(imgOriginal, m_inputFormat, frameRect, gray);
+        regions.assign(1, frameRect);
+    }
+}
+
+int LucasKanadeCore::buildPyramid(cv::Mat &gray, bool wrapsInput, std::vector<cv::Mat> &pyramid, int maxLevel) {
+    LK_PROFILE_SCOPE(Pyramid);
+    // a wrapped frame has no border of ours and is copied by OpenCV
+    if (!wrapsInput) {
+        FrameIngest::fillBorder(gray);
+    }
+    return cv::buildOpticalFlowPyramid(gray, pyramid, m_winSize, maxLevel);
+}
+
+int LucasKanadeCore::pyramidDepth(const cv::Size &frameSize) const {
+    return m_adaptivePyramid ?
+                m_depthEstimator.maxLevel(frameSize, m_winSize, maximumPyramidLevel) :
+                maximumPyramidLevel;
+}
+
+bool LucasKanadeCore::hasArena(const cv::Size &frameSize) const {
+    return !m_arenaMask.empty() && m_arenaMask.cols == frameSize.width && m_arenaMask.rows == frameSize.height;
+}
+
+bool LucasKanadeCore::planRegions(const cv::Size &frameSize, int maxLevel) {
+    const size_t count = m_activeSet.trackedCount();
+    if (!m_regionTracking || count == 0 || count > maximumRegionPoints) {
+        return false;
+    }
+
+    const bool arena = hasArena(frameSize);
+    const cv::Rect bounds = arena ? m_arenaRect : cv::Rect(cv::Point(0, 0), frameSize);
+    const int padding = TrackingRegions::padding(m_winSize, maxLevel, m_depthEstimator.expectedDisplacement());
+    m_regions.compute(m_activeSet.positions().data(), count, padding, 1 << maxLevel, bounds);
+
+    // a few big tiles are not cheaper than the full frame (whose pyramid is
+    // also kept for the next frame), an arena is still worth its own tile
+    if (m_regions.area() > static_cast<size_t>(bounds.area()) / 4) {
+        if (!arena || bounds.area() > frameSize.area() / 2) {
+            return false;
+        }
+        m_regions.cover(bounds, count);
+    }
+    return true;
+}
+
+void LucasKanadeCore::trackRegions(const cv::Mat &imgOriginal, int maxLevel) {
+    const std::vector<TrackingRegions::Tile> &tiles = m_regions.tiles();
+    const std::vector<cv::Point2f> &positions = m_activeSet.positions();
+    const size_t count = m_activeSet.trackedCount();
+
+    std::vector<cv::Point2f> &nextPositions = m_activeSet.nextPositions();
+    std::vector<uchar> &status = m_activeSet.lkStatus();
+    std::vector<float> &error = m_activeSet.lkError();
+    nextPositions.resize(count);
+    status.resize(count);
+    error.resize(count);
+
+    // the region lists are not touched by the parallel part
+    for (const TrackingRegions::Tile &tile : tiles) {
+        if (tile.rect.area() > 0) {
+            convertRegion(imgOriginal, tile.rect);
+            if (!TrackingRegions::contains(m_prevGrayRegions, tile.rect)) {
+                fillPreviousGray(tile.rect);
+            }
+        }
+    }
+
+    const bool cacheValid = m_prevRegionTilesValid && m_frameIndex_prevRegionTiles == m_frameIndex_prevGray;
+    m_regionTiles.resize(tiles.size());
+
+    auto trackTile = [&](size_t i) {
+        const TrackingRegions::Tile &tile = tiles[i];
+        RegionTile &state = m_regionTiles[i];
+        state.rect = tile.rect;
+        state.levels = 0;
+        state.depth = maxLevel;
+
+        if (tile.rect.area() == 0) {
+            // outside of the frame or the arena
+            for (size_t entry : tile.entries) {
+                nextPositions[entry] = positions[entry];
+                status[entry] = 0;
+                error[entry] = 0.f;
+            }
+            return;
+        }
+
+        // every tile is an image of its own, the pyramid must not read the
+        // (unconverted) pixels around it
+        const int border = cv::BORDER_REFLECT_101 | cv::BORDER_ISOLATED;
+        const std::vector<cv::Mat> *prevPyr = nullptr;
+        if (cacheValid) {
+            for (const RegionTile &prev : m_prevRegionTiles) {
+                if (prev.rect == tile.rect && prev.levels >= maxLevel) {
+                    prevPyr = &prev.pyr;
+                    break;
+                }
+            }
+        }
+        int builtLevels = 0;
+        {
+            LK_PROFILE_SCOPE(Pyramid);
+            if (prevPyr == nullptr) {
+                cv::buildOpticalFlowPyramid(m_prevGray(tile.rect), state.prevPyr, m_winSize, maxLevel,
+                                            true, border, cv::BORDER_CONSTANT, false);
+                prevPyr = &state.prevPyr;
+            }
+            builtLevels = cv::buildOpticalFlowPyramid(m_gray(tile.rect), state.pyr, m_winSize, maxLevel,
+                                                      true, border, cv::BORDER_CONSTANT, false);
+        }
+        state.levels = maxLevel;
+        state.depth = std::min(maxLevel, builtLevels);
+
+        const size_t n = tile.entries.size();
+        const cv::Point2f offset(static_cast<float>(tile.rect.x), static_cast<float>(tile.rect.y));
+        state.prevPts.resize(n);
+        for (size_t k = 0; k < n; k++) {
+            state.prevPts[k] = positions[tile.entries[k]] - offset;
+        }
+
+        LK_PROFILE_SCOPE(OpticalFlow);
+        if (m_useNativeKernel) {
+            state.nextPts.resize(n);
+            state.status.resize(n);
+            state.error.resize(n);
+            LucasKanadeKernel::calcOpticalFlowPyrLK(*prevPyr, state.pyr,
+                state.prevPts.data(), state.nextPts.data(), state.status.data(), state.error.data(),
+                n, m_winSize, state.depth, m_termcrit, 0.001);
+        } else {
+            cv::calcOpticalFlowPyrLK(*prevPyr, state.pyr, state.prevPts, state.nextPts, state.status,
+                state.error, m_winSize, state.depth, m_termcrit, 0, 0.001);
+        }
+
+        for (size_t k = 0; k < n; k++) {
+            const size_t entry = tile.entries[k];
+            nextPositions[entry] = state.nextPts[k] + offset;
+            status[entry] = state.status[k];
+            error[entry] = state.error[k];
+        }
+    };
+
+    if (m_threadPool && tiles.size() > 1) {
+        m_threadPool->parallelFor(tiles.size(), trackTile);
+    } else {
+        for (size_t i = 0; i < tiles.size(); i++) {
+            trackTile(i);
+        }
+    }
+
+    m_regionCount = tiles.size();
+    m_pyramidDepth = maxLevel;
+    for (const RegionTile &state : m_regionTiles) {
+        m_pyramidDepth = std::min(m_pyramidDepth, state.depth);
+    }
+}
+
+void LucasKanadeCore::convertRegion(const cv::Mat &imgOriginal, const cv::Rect &rect) {
+    LK_PROFILE_SCOPE(Convert);
+    if (TrackingRegions::contains(m_grayRegions, rect)) {
+        return;
+    }
+    cv::Mat gray = m_gray(rect);
+    FrameIngest::convert(imgOriginal, m_inputFormat, rect, gray);
+    m_grayRegions.push_back(rect);
+}
+
+void LucasKanadeCore::fillPreviousGray(const cv::Rect &rect) {
+    cv::Mat patch = m_gray(rect).clone();
+    for (const cv::Rect &region : m_prevGrayRegions) {
+        const cv::Rect common = region & rect;
+        if (common.area() > 0) {
+            cv::Mat dst = patch(common - rect.tl());
+            m_prevGray(common).copyTo(dst);
+        }
+    }
+    cv::Mat dst = m_prevGray(rect);
+    patch.copyTo(dst);
+    m_prevGrayRegions.push_back(rect);
+}
+
+void LucasKanadeCore::prepareNextRegions(const cv::Mat &imgOriginal) {
+    // the positions and the motion estimate are those of the next step now
+    const cv::Size frameSize = FrameIngest::graySize(imgOriginal, m_inputFormat);
+    if (planRegions(frameSize, pyramidDepth(frameSize))) {
+        for (const TrackingRegions::Tile &tile : m_regions.tiles()) {
+            if (tile.rect.area() > 0) {
+                convertRegion(imgOriginal, tile.rect);
+            }
+        }
+    } else {
+        ingest(imgOriginal, m_gray, m_grayWrapsInput, m_grayRegions);
+    }
+}
+
+void LucasKanadeCore::applyArenaMask() {
+    const std::vector<cv::Point2f> &nextPositions = m_activeSet.nextPositions();
+    std::vector<uchar> &status = m_activeSet.lkStatus();
+    for (size_t i = 0; i < m_activeSet.trackedCount(); i++) {
+        if (status[i]) {
+            const int x = cvRound(nextPositions[i].x);
+            const int y = cvRound(nextPositions[i].y);
+            if (x < 0 || y < 0 || x >= m_arenaMask.cols || y >= m_arenaMask.rows ||
+                    m_arenaMask.at<uchar>(y, x) == 0) {
+                status[i] = 0;
+            }
+        }
+    }
+}
+
+void LucasKanadeCore::cachePreviousFrame() {
+    const cv::Rect frameRect(cv::Point(0, 0), m_prevGray.size());
+    if (!m_frameCache.isEnabled() || !m_prevPyrValid || m_frameIndex_prevPyr != m_frameIndex_prevGray ||
+            m_prevPyr.empty() || !TrackingRegions::contains(m_prevGrayRegions, frameRect)) {
+        return;
+    }
+
+    // level 0 is m_prevGray itself or (for a wrapped frame) a copy of it
+    PreparedFrame frame;
+    frame.gray = m_prevPyr[0];
+    frame.pyramid = std::move(m_prevPyr);
+    frame.levels = m_prevPyrLevels;
+    frame.builtLevels = static_cast<int>(frame.pyramid.size()) / 2 - 1;
+    frame.winSize = m_winSize;
+    if (!m_frameCache.insert(m_frameIndex_prevGray, frame)) {
+        m_prevPyr = std::move(frame.pyramid);
+        return;
+    }
+
+    m_prevGray = frame.gray;
+    m_prevGrayWrapsInput = false;
+    m_prevGrayRegions.clear();
+    m_prevPyr = std::move(frame.pyramid);
+    m_prevPyrValid = false;
+}
+
+void LucasKanadeCore::invalidatePyramidCache() {
+    m_prevPyrValid = false;
+    m_prevRegionTilesValid = false;
+    m_prevCoarsePyrValid = false;
+}
@@ -0,0 +1,740 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include <opencv2/video/tracking.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include "ActivePointSet.h"
+#include "CornerDetector.h"
+#include "FrameCache.h"
+#include "FrameIngest.h"
+#include "PointRecord.h"
+#include "LucasKanadeKernel.h"
+#include "PatchRefiner.h"
+#include "PointGrid.h"
+#include "PreparedFrame.h"
+#include "PyramidDepthEstimator.h"
+#include "ThreadPool.h"
+#include "TrackingRegions.h"
+#include "TrailCache.h"
+#include "Trajectory.h"
+#include "TrajectoryPool.h"
+
+/**
+ * @brief The LucasKanadeCore class
+ * The tracking engine of the Lucas-Kanade tracker without any Qt (or GUI)
+ * dependencies. It owns the trajectories and the gray frames/pyramids and
+ * is driven either by the BioTracker plugin (LucasKanadeTracker) or by the
+ * headless command line tool.
+ *
+ * The index of a trajectory in getTrajectories() equals its id.
+ */
+class LucasKanadeCore {
+  public:
+    LucasKanadeCore();
+
+    /**
+     * @brief track
+     * tracks all (active) points from frameNumber - 1 to frameNumber
+     * @param frameNumber the index of imgOriginal in the video
+     * @param imgOriginal frame in the input format (see setInputFormat())
+     * @return true if some points became invalid during this step
+     */
+    bool track(size_t frameNumber, const cv::Mat &imgOriginal);
+
+    /**
+     * @brief prepareFrame
+     * turns the frame into gray and builds its pyramid; touches no state of
+     * any core, so it can run concurrently to track()
+     */
+    static void prepareFrame(const cv::Mat &imgOriginal, FrameIngest::Format format,
+                             const cv::Size &winSize, int maxLevel, PreparedFrame &prepared);
+
+    /**
+     * @brief track
+     * like track() with a frame, the pyramid is only rebuilt if it was built
+     * with other parameters (window size, too few levels). The buffers of
+     * prepared are swapped with old ones of the core, so it can be reused
+     * for preparing another frame. Region tracking is not used.
+     */
+    bool track(size_t frameNumber, PreparedFrame &prepared);
+
+    /**
+     * @brief pyramidDepth
+     * @return the maxLevel for the next LK step (fixed or adaptive)
+     */
+    int pyramidDepth(const cv::Size &frameSize) const;
+    int getMaximumPyramidLevel() const {
+        return maximumPyramidLevel;
+    }
+
+    /**
+     * @brief resyncPreviousFrame
+     * When frames are skipped without tracking the previous gray frame is
+     * outdated; this replaces it with the given frame. Does nothing if it
+     * already holds all of frameNumber.
+     * New points are refined on this frame, so call it before adding points
+     * to a frame that was not tracked.
+     */
+    void resyncPreviousFrame(size_t frameNumber, const cv::Mat &imgOriginal);
+
+    /**
+     * @brief setInputFormat
+     * the pixel format of the frames passed to track() and
+     * resyncPreviousFrame() (Auto: derived from the channels)
+     */
+    void setInputFormat(FrameIngest::Format format);
+    FrameIngest::Format getInputFormat() const {
+        return m_inputFormat;
+    }
+
+    /**
+     * @brief setStableInput
+     * true: the caller does not overwrite a frame before the next one has
+     * been tracked (e.g. it alternates between two buffers); mono and YUV
+     * 4:2:0 frames are then used without any copy
+     */
+    void setStableInput(bool stable);
+    bool isStableInput() const {
+        return m_stableInput;
+    }
+
+    /**
+     * @brief setFrameCacheBudget
+     * keeps the gray frames and pyramids of the last tracked frames up to
+     * the given number of bytes (see FrameCache), 0 disables the cache.
+     * Seeking back to a cached frame and tracking again neither converts
+     * the frames nor builds their pyramids.
+     */
+    void setFrameCacheBudget(size_t bytes);
+    size_t getFrameCacheBudget() const {
+        return m_frameCache.getBudget();
+    }
+    size_t getFrameCacheBytes() const {
+        return m_frameCache.getBytes();
+    }
+
+    /**
+     * @brief clearFrameCache
+     * call this when the frames behind the frame numbers change (another
+     * video)
+     */
+    void clearFrameCache();
+
+    size_t getPreviousFrameIndex() const {
+        return m_frameIndex_prevGray;
+    }
+
+    /**
+     * @brief isPreviousFrameSynced
+     * @return true if the previous gray frame belongs to frameNumber and
+     * holds everything the next track() reads (with region tracking only
+     * parts of it are converted, an edited point may lie outside of them);
+     * otherwise resyncPreviousFrame() should be called
+     */
+    bool isPreviousFrameSynced(size_t frameNumber);
+
+    /**
+     * @brief maximumWinSize
+     * @return the biggest sensible window size for the given image size
+     */
+    static int maximumWinSize(const cv::Size &imageSize);
+
+    void setWinSize(int value);
+    cv::Size getWinSize() const {
+        return m_winSize;
+    }
+
+    /**
+     * @brief setThreadCount
+     * number of threads the LK step is split over (1 = single call,
+     * 0 = one per hardware thread)
+     */
+    void setThreadCount(size_t count);
+    size_t getThreadCount() const {
+        return m_threadPool ? m_threadPool->threadCount() : 1;
+    }
+
+    /**
+     * @brief setUseNativeKernel
+     * true: use our vectorized LK kernel (LucasKanadeKernel) instead of
+     * cv::calcOpticalFlowPyrLK
+     */
+    void setUseNativeKernel(bool useNativeKernel) {
+        m_useNativeKernel = useNativeKernel;
+    }
+    bool isUsingNativeKernel() const {
+        return m_useNativeKernel;
+    }
+
+    /**
+     * @brief setAdaptivePyramid
+     * true: the pyramid depth is chosen per frame from the image size, the
+     * window size and the recent motion (see PyramidDepthEstimator),
+     * false: always maximumPyramidLevel
+     */
+    void setAdaptivePyramid(bool adaptive);
+    bool isAdaptivePyramid() const {
+        return m_adaptivePyramid;
+    }
+
+    /**
+     * @brief getPyramidDepth
+     * @return the maxLevel of the last LK step
+     */
+    int getPyramidDepth() const {
+        return m_pyramidDepth;
+    }
+
+    /**
+     * @brief setRegionTracking
+     * true: if only a few points are tracked, the gray conversion and the
+     * pyramids are restricted to tiles around them (see TrackingRegions).
+     * The tiles grow with the pyramid depth, so this pays off together with
+     * the adaptive pyramid depth.
+     */
+    void setRegionTracking(bool enabled);
+    bool isRegionTracking() const {
+        return m_regionTracking;
+    }
+
+    /**
+     * @brief getRegionCount
+     * @return the number of tiles of the last LK step, 0 if it worked on the
+     * full frame
+     */
+    size_t getRegionCount() const {
+        return m_regionCount;
+    }
+
+    /**
+     * @brief setDownscale
+     * factor 2, 4 or 8: the LK step runs on the frames downscaled by the
+     * factor (averaged while converting them) and only one more iteration
+     * on small full resolution patches around the points (see
+     * PatchRefiner), for 4K and bigger frames where the full levels are the
+     * bulk of the work. 1 (the default) tracks on the full frames, so do
+     * prepared frames and the region tracking. Other factors are rounded
+     * down to a power of two (3 to 2, 5..7 to 4, more than 8 to 8), see
+     * getDownscale().
+     */
+    void setDownscale(int factor);
+    int getDownscale() const {
+        return 1 << m_downscaleShift;
+    }
+
+    /**
+     * @brief setArenaMask
+     * restricts the tracking to the non-zero pixels of mask (CV_8UC1 in the
+     * size of the frames, ignored for frames of another size): points that
+     * leave the arena are lost and the region tracking does not read
+     * anything outside of its bounding box. An empty mat removes the arena.
+     */
+    void setArenaMask(const cv::Mat &mask);
+    const cv::Mat &getArenaMask() const {
+        return m_arenaMask;
+    }
+
+    void setTrackOnlyActive(bool trackOnlyActive);
+    bool isTrackOnlyActive() const {
+        return m_trackOnlyActive;
+    }
+
+    size_t getNumberOfUserStates() const {
+        return m_numberOfUserStates;
+    }
+    void setUserState(size_t i, bool isSet);
+
+    int getCurrentActivePoint() const {
+        return m_currentActivePoint;
+    }
+
+    /**
+     * @brief getFirstTrackedFrame
+     * @return the first frame any trajectory has data at, -1 without data
+     * (kept up to date by every edit, no scan)
+     */
+    int getFirstTrackedFrame() const {
+        return m_firstTrackedFrame;
+    }
+
+    /**
+     * @brief getLastTrackedFrame
+     * @return the last frame any trajectory has data at, -1 without data
+     */
+    int getLastTrackedFrame() const {
+        return m_lastTrackedFrame;
+    }
+
+    /**
+     * @brief setMinPointDistance
+     * new points closer than this to an existing point are rejected
+     * (default 5 pixels)
+     */
+    void setMinPointDistance(float distance) {
+        m_minPointDistance = distance;
+    }
+    float getMinPointDistance() const {
+        return m_minPointDistance;
+    }
+
+    /**
+     * @brief tryCreateNewPoint
+     * Tries to add a new point, if it is not too close to an already
+     * existing one. The new point becomes the active point.
+     * @return false if the point is too close to an existing one
+     */
+    bool tryCreateNewPoint(size_t frameNumber, cv::Point2f pos);
+
+    /**
+     * @brief activateExistingPoint
+     * makes the point closest to pos the active point
+     * @return false if there are no points to select
+     */
+    bool activateExistingPoint(size_t frameNumber, cv::Point2f pos);
+
+    /**
+     * @brief getPointsInRect
+     * @return the ids of all points with a position inside rect at the
+     * given frame (in no particular order)
+     */
+    std::vector<size_t> getPointsInRect(size_t frameNumber, const cv::Rect2f &rect);
+
+    /**
+     * @brief moveCurrentActivePointTo
+     * @return false if there is no active point or it is out of range
+     */
+    bool moveCurrentActivePointTo(size_t frameNumber, cv::Point2f pos);
+
+    /**
+     * @brief deleteCurrentActivePoint
+     * marks the active point as invalid at the given frame
+     * @return true if the point was changed
+     */
+    bool deleteCurrentActivePoint(size_t frameNumber);
+
+    /**
+     * @brief autoFindInitPoints
+     * finds good points to track in the given frame (see CornerDetector),
+     * spread over the frame and away from the existing points and outside
+     * of the arena, refines them and adds them as new points (the active
+     * point does not change)
+     * @param maxCount 0: MAX_COUNT
+     * @return the number of new points
+     */
+    size_t autoFindInitPoints(size_t frameNumber, const cv::Mat &imgOriginal, size_t maxCount = 0);
+
+    /**
+     * @brief setReplenishTarget
+     * keeps count points alive: after a step that left fewer tracked
+     * points, new ones are searched in the cells of the frame that have
+     * none (like autoFindInitPoints(), on the gray frame of the step). Cells
+     * without any corner are skipped for a while. 0 disables it.
+     */
+    void setReplenishTarget(size_t count);
+    size_t getReplenishTarget() const {
+        return m_replenishTarget;
+    }
+
+    /**
+     * @brief setMemoryBudget
+     * caps the unpacked trajectory data: when the blocks of the trajectory
+     * pool exceed bytes, all blocks away from the tracked frame are packed
+     * (see Trajectory::pack()) and only unpacked again when they are
+     * changed. 0 (the default) keeps everything unpacked.
+     */
+    void setMemoryBudget(size_t bytes);
+    size_t getMemoryBudget() const {
+        return m_memoryBudget;
+    }
+
+    /**
+     * @brief activateAllNonTrackedPoints
+     * When single-user-tracking is disabled, we want to activate all points that were
+     * deactiaveted
+     * @param frame
+     */
+    void activateAllNonTrackedPoints(size_t frame);
+
+    /**
+     * @brief The CurrentPoints struct
+     * the points of one frame as columns, entry k belongs to trajectory
+     * ids[k]; only points that exist at the frame are listed
+     */
+    struct CurrentPoints {
+        std::vector<size_t>		ids;
+        std::vector<cv::Point2f> positions;
+        std::vector<InterestPointStatus> statuses; // Valid points that are not tracked are Not_Tracked
+        std::vector<size_t>		userStatuses; // one bit per user state
+
+        size_t size() const {
+            return ids.size();
+        }
+
+        void clear();
+        void reserve(size_t count);
+        void push_back(size_t id, cv::Point2f position, InterestPointStatus status, size_t userStatus);
+    };
+
+    /**
+     * @brief getCurrentPoints
+     * gets all points that exist at the given frame; if the frame is the one
+     * tracked last they are taken from the active point set, otherwise the
+     * trajectories are scanned
+     * @param points is cleared and filled (its capacity is kept)
+     */
+    void getCurrentPoints(size_t frameNumber, CurrentPoints &points) const;
+
+    std::vector<Trajectory> &getTrajectories() {
+        return m_trajectories;
+    }
+
+    const std::vector<Trajectory> &getTrajectories() const {
+        return m_trajectories;
+    }
+
+    /**
+     * @brief getTrajectoryPool
+     * @return the pool the trajectories of this session take their blocks
+     * from (its stats() count the allocations and bytes)
+     */
+    const std::shared_ptr<TrajectoryPool> &getTrajectoryPool() const {
+        return m_trajectoryPool;
+    }
+
+    /**
+     * @brief setTrailLength
+     * sets how many frames of history are cached for getTrail(), 0 disables
+     * the cache
+     */
+    void setTrailLength(size_t length);
+    size_t getTrailLength() const {
+        return m_trailCache.getLength();
+    }
+
+    /**
+     * @brief getTrail
+     * @return the positions of all trajectories at the given (history) frame,
+     * indexed by id; (-1, -1) if a trajectory has no data at that frame.
+     * Empty with a trail length of 0; at most getTrailLength() consecutive
+     * frames can be held at the same time (see TrailCache).
+     */
+    const std::vector<cv::Point2f> &getTrail(size_t frameNumber);
+
+    /**
+     * @brief setTrajectories
+     * replaces all trajectories (e.g. after loading), resets the active point;
+     * trajectories of another pool are copied into the pool of the session
+     */
+    void setTrajectories(std::vector<Trajectory> trajectories);
+
+    /**
+     * @brief clear
+     * removes all trajectories, the trajectory pool frees its memory if no
+     * copy of them is left
+     */
+    void clear();
+
+  private:
+    size_t				m_numberOfUserStates = 3;
+    std::vector<bool>	m_setUserStates;
+
+    cv::Size			m_subPixWinSize;
+    cv::Size			m_winSize;
+    cv::TermCriteria	m_termcrit;
+    const int			MAX_COUNT = 500; // default number of points of autoFindInitPoints()
+    const int			maximumPyramidLevel = 10;
+    cv::Mat				m_gray;
+
+    size_t				m_frameIndex_prevGray; // holds the video index that corresponds to m_prevGray
+    cv::Mat				m_prevGray;
+
+    // the parts of m_gray / m_prevGray that hold the converted frame (a
+    // single rect of the frame size unless tracking in regions)
+    std::vector<cv::Rect> m_grayRegions;
+    std::vector<cv::Rect> m_prevGrayRegions;
+
+    FrameIngest::Format	m_inputFormat = FrameIngest::Format::Auto;
+    bool				m_stableInput = false;
+    // true if m_gray / m_prevGray is a header over a frame of the caller
+    // (otherwise it lies inside a buffer with a border, see FrameIngest)
+    bool				m_grayWrapsInput = false;
+    bool				m_prevGrayWrapsInput = false;
+
+    // the optical flow pyramid of m_gray is carried over as the pyramid of m_prevGray
+    // for the next call of track(), so every frame only needs to build one pyramid
+    std::vector<cv::Mat> m_pyr;
+    std::vector<cv::Mat> m_prevPyr;
+    size_t				m_frameIndex_prevPyr; // holds the video index that corresponds to m_prevPyr
+    bool				m_prevPyrValid = false; // false whenever m_prevPyr must not be reused
+    int					m_pyrLevels = 0; // the maxLevel m_pyr / m_prevPyr were built with
+    int					m_prevPyrLevels = 0;
+
+    // gray frames and pyramids of earlier frames, m_prevPyr is handed over
+    // when it is replaced
+    FrameCache			m_frameCache;
+
+    bool				m_adaptivePyramid = false;
+    PyramidDepthEstimator m_depthEstimator;
+    int					m_pyramidDepth = 0; // maxLevel of the last LK step
+
+    /**
+     * @brief The RegionTile struct
+     * buffers of one tile of the region tracking (see trackRegions()),
+     * coordinates are relative to the tile
+     */
+    struct RegionTile {
+        cv::Rect			rect;
+        int					levels = 0; // the maxLevel pyr was built with
+        int					depth = 0;	// maxLevel of the LK step
+        std::vector<cv::Mat> pyr;		// pyramid of m_gray(rect)
+        std::vector<cv::Mat> prevPyr;	// pyramid of m_prevGray(rect) if it was not cached
+        std::vector<cv::Point2f> prevPts;
+        std::vector<cv::Point2f> nextPts;
+        std::vector<uchar>	status;
+        std::vector<float>	error;
+    };
+
+    bool				m_regionTracking = false;
+    const size_t		maximumRegionPoints = 256;
+    TrackingRegions		m_regions;
+    std::vector<RegionTile> m_regionTiles;
+    // the tiles of the last step, their pyramids are reused for tiles with the same rect
+    std::vector<RegionTile> m_prevRegionTiles;
+    size_t				m_frameIndex_prevRegionTiles = 0;
+    bool				m_prevRegionTilesValid = false;
+    size_t				m_regionCount = 0;
+
+    // see setDownscale(), the coarse frames are kept like m_gray / m_prevGray
+    int					m_downscaleShift = 0; // log2 of the factor
+    cv::Mat				m_coarseGray;
+    cv::Mat				m_prevCoarseGray;
+    cv::Mat				m_downscaleBuffer; // the resampled color frame
+    size_t				m_frameIndex_prevCoarse = static_cast<size_t>(-1); // none
+    std::vector<cv::Mat> m_coarsePyr;
+    std::vector<cv::Mat> m_prevCoarsePyr;
+    bool				m_prevCoarsePyrValid = false;
+    int					m_prevCoarsePyrLevels = 0;
+    std::vector<cv::Point2f> m_coarsePoints; // the tracked positions at the coarse scale
+    PatchRefiner		m_patchRefiner;
+
+    cv::Mat				m_arenaMask;
+    cv::Rect			m_arenaRect; // bounding box of the arena
+
+    bool				m_trackOnlyActive; // when true we will ignore all points except the active one
+
+    bool				m_useNativeKernel = false; // LucasKanadeKernel instead of OpenCV
+
+    std::vector<Trajectory> m_trajectories;
+    std::shared_ptr<TrajectoryPool> m_trajectoryPool;
+
+    // splits the LK step into chunks of points (nullptr = single threaded)
+    std::unique_ptr<ThreadPool> m_threadPool;
+
+    // all alive points of the last tracked frame, see ActivePointSet
+    ActivePointSet		m_activeSet;
+
+    // positions of the last few frames for the history overlay
+    TrailCache			m_trailCache;
+
+    // all points with a position at m_pointIndexFrame (any status), for
+    // picking and the distance check of new points; built on the first
+    // query at a frame and then kept up to date by the edits
+    PointGrid			m_pointIndex;
+    size_t				m_pointIndexFrame = 0;
+    bool				m_pointIndexValid = false;
+    float				m_minPointDistance = 5.f;
+
+    // see setReplenishTarget()
+    size_t				m_replenishTarget = 0;
+    const size_t		replenishBackoff = 25; // frames a cell without corners is skipped
+    float				m_cornerThreshold = 0.f; // corner response threshold of the whole frame
+    cv::Size			m_replenishGrid; // the cells m_barrenUntil belongs to
+    std::vector<size_t>	m_barrenUntil; // per cell: not searched again before this frame
+
+    // see setMemoryBudget()
+    size_t				m_memoryBudget = 0;
+    size_t				m_budgetBlock = static_cast<size_t>(-1); // frame block of the last check
+    const size_t		hotWindowFrames = 2 * TrajectoryPool::blockFrames; // never packed around the tracked frame
+
+    /**
+     * @brief enforceMemoryBudget
+     * packs the trajectories if the pool exceeds the budget
+     */
+    void enforceMemoryBudget(size_t frameNumber);
+
+    /**
+     * @brief m_currentActivePoint
+     * The currently active point that can be moved by the mouse curor
+     */
+    int m_currentActivePoint = -1;
+
+    // to calculate how big the history can be we need to know when we had the very first tracked point in time...
+    int m_firstTrackedFrame = -1;
+
+    // ... and also the very last (both widened by noteTrackedFrame())
+    int m_lastTrackedFrame = -1;
+
+    /**
+     * @brief noteTrackedFrame
+     * widens m_firstTrackedFrame / m_lastTrackedFrame to a frame that got data
+     */
+    void noteTrackedFrame(size_t frameNumber);
+
+    /**
+     * @brief setCurrentActivePoint
+     * changes the active point and keeps the working set up to date
+     */
+    void setCurrentActivePoint(size_t frameNumber, int id);
+
+    /**
+     * @brief updateActiveSet
+     * forwards an edit of the point with the given id at the given frame to
+     * the working set of track()
+     */
+    void updateActiveSet(size_t frameNumber, size_t id);
+
+    /**
+     * @brief addCorners
+     * refines the corners and adds them as new (tracked) points
+     */
+    void addCorners(size_t frameNumber, std::vector<cv::Point2f> &corners);
+
+    /**
+     * @brief replenish
+     * see setReplenishTarget(), called at the end of a step
+     */
+    void replenish(size_t frameNumber, const cv::Mat *imgOriginal);
+
+    /**
+     * @brief refineCorners
+     * cornerSubPix on m_prevGray for all corners, in chunks on the pool
+     */
+    void refineCorners(std::vector<cv::Point2f> &corners);
+
+    /**
+     * @brief syncPointIndex
+     * (re)builds m_pointIndex for the given frame unless it already is
+     */
+    void syncPointIndex(size_t frameNumber);
+
+    /**
+     * @brief updateUserStates
+     * make sure that all the user states are updated
+     */
+    void updateUserStates(size_t currentFrame);
+
+    /**
+     * @brief calcOpticalFlow
+     * runs the LK step for all tracked points of the working set on m_prevPyr
+     * and m_pyr, in chunks on the thread pool if there are enough points
+     * (with OpenCV or LucasKanadeKernel)
+     */
+    void calcOpticalFlow(int maxLevel);
+
+    /**
+     * @brief runOpticalFlow
+     * the LK step for count points on the given pyramids, in chunks on the
+     * thread pool if there are enough points
+     */
+    void runOpticalFlow(const std::vector<cv::Mat> &prevPyr, const std::vector<cv::Mat> &nextPyr,
+                        const cv::Point2f *prevPts, cv::Point2f *nextPts, uchar *status, float *error,
+                        size_t count, int maxLevel);
+
+    /**
+     * @brief trackDownscaled
+     * the LK step of the working set on the downscaled frames, refined at
+     * full resolution (see setDownscale()); m_gray is not converted
+     */
+    void trackDownscaled(size_t frame, const cv::Mat &imgOriginal, int maxLevel);
+
+    /**
+     * @brief prepareGray
+     * makes gray a header over the frame if possible (regions: the full
+     * frame), otherwise a frame of our own that still has to be converted
+     * (regions: empty)
+     */
+    void prepareGray(const cv::Mat &imgOriginal, cv::Mat &gray, bool &wrapsInput, std::vector<cv::Rect> &regions);
+
+    /**
+     * @brief ingest
+     * turns the whole frame into gray (converted exactly once, or wrapped)
+     */
+    void ingest(const cv::Mat &imgOriginal, cv::Mat &gray, bool &wrapsInput, std::vector<cv::Rect> &regions);
+
+    /**
+     * @brief buildPyramid
+     * builds the optical flow pyramid of a whole gray frame, our own frames
+     * are used as level 0 in place
+     * @return the number of levels built
+     */
+    int buildPyramid(cv::Mat &gray, bool wrapsInput, std::vector<cv::Mat> &pyramid, int maxLevel);
+
+    /**
+     * @brief trackStep
+     * the tracking step for a frame (imgOriginal) or a prepared frame
+     */
+    bool trackStep(size_t frame, const cv::Size &frameSize, const cv::Mat *imgOriginal, PreparedFrame *prepared);
+
+    bool hasArena(const cv::Size &frameSize) const;
+
+    /**
+     * @brief planRegions
+     * computes the tiles around the tracked points of the working set into
+     * m_regions
+     * @return false if the full frame should be used (region tracking
+     * disabled, too many points or the tiles are too big)
+     */
+    bool planRegions(const cv::Size &frameSize, int maxLevel);
+
+    /**
+     * @brief trackRegions
+     * runs the LK step on the tiles planned by planRegions(): converts them
+     * to gray and builds their pyramids (in parallel if there is a pool)
+     */
+    void trackRegions(const cv::Mat &imgOriginal, int maxLevel);
+
+    /**
+     * @brief convertRegion
+     * converts a part of the frame into m_gray
+     */
+    void convertRegion(const cv::Mat &imgOriginal, const cv::Rect &rect);
+
+    /**
+     * @brief fillPreviousGray
+     * The parts of rect m_prevGray does not hold are taken from m_gray (which
+     * must hold rect), the points in there keep their position for one frame.
+     * Only happens if points were edited while tracking in regions.
+     */
+    void fillPreviousGray(const cv::Rect &rect);
+
+    /**
+     * @brief prepareNextRegions
+     * makes sure the partially converted m_gray holds the tiles the next
+     * step needs as its previous frame (or converts the full frame)
+     */
+    void prepareNextRegions(const cv::Mat &imgOriginal);
+
+    /**
+     * @brief applyArenaMask
+     * marks tracked points that left the arena as lost
+     */
+    void applyArenaMask();
+
+    /**
+     * @brief cachePreviousFrame
+     * Hands m_prevGray and m_prevPyr to the frame cache if the pyramid is
+     * valid and belongs to the whole frame m_frameIndex_prevGray; both get
+     * recycled buffers (of undefined content) then.
+     */
+    void cachePreviousFrame();
+
+    /**
+     * @brief invalidatePyramidCache
+     * Call this whenever m_prevGray is replaced outside of track() or the
+     * pyramid parameters (window size => padding) change.
+     */
+    void invalidatePyramidCache();
+};
@@ -0,0 +1,179 @@
+#include "LucasKanadeKernel.h"
+
+#include <algorithm>
+#include <cassert>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#endif
+
+#include "LucasKanadeKernelImpl.h"
+
+using namespace LucasKanadeKernelImpl;
+
+namespace {
+
+/**
+ * @brief The ScalarOps struct
+ * The per-row work of the kernel in plain C++. The SIMD variants provide
+ * the same interface:
+ *  - Masks: precomputed lane masks for the given window width
+ *  - Hessian / Residual: accumulators, reduce() sums them up
+ *  - patchRow: extracts one row of the window of I and its derivatives
+ *    and accumulates the spatial gradient matrix
+ *  - residualRow: accumulates the image mismatch vector of one row
+ */
+struct ScalarOps {
+    struct Masks {
+        explicit Masks(int) {}
+    };
+
+    struct Hessian {
+        float a11 = 0.f, a12 = 0.f, a22 = 0.f;
+
+        void reduce(float &A11, float &A12, float &A22) const {
+            A11 = a11;
+            A12 = a12;
+            A22 = a22;
+        }
+    };
+
+    struct Residual {
+        float b1 = 0.f, b2 = 0.f;
+
+        void reduce(float &B1, float &B2) const {
+            B1 = b1;
+            B2 = b2;
+        }
+    };
+
+    template<int FixedWin>
+    static void patchRow(const uchar *src, ptrdiff_t stepI, const short *dsrc, ptrdiff_t dstep,
+                         int winW, const Weights &w, const Masks &,
+                         short *Iptr, short *dIptr, Hessian &h) {
+        const int cols = FixedWin ? FixedWin : winW;
+        for (int x = 0; x < cols; x++) {
+            const int ixval = interpolateDeriv(dsrc + 2 * x, dstep, w);
+            const int iyval = interpolateDeriv(dsrc + 2 * x + 1, dstep, w);
+            Iptr[x] = static_cast<short>(interpolate(src + x, stepI, w));
+            dIptr[2 * x] = static_cast<short>(ixval);
+            dIptr[2 * x + 1] = static_cast<short>(iyval);
+
+            h.a11 += static_cast<float>(ixval * ixval);
+            h.a12 += static_cast<float>(ixval * iyval);
+            h.a22 += static_cast<float>(iyval * iyval);
+        }
+    }
+
+    template<int FixedWin>
+    static void residualRow(const uchar *src, ptrdiff_t stepJ, int winW, const Weights &w,
+                            const Masks &, const short *Iptr, const short *dIptr, Residual &r) {
+        const int cols = FixedWin ? FixedWin : winW;
+        for (int x = 0; x < cols; x++) {
+            const int diff = interpolate(src + x, stepJ, w) - Iptr[x];
+            r.b1 += static_cast<float>(diff * dIptr[2 * x]);
+            r.b2 += static_cast<float>(diff * dIptr[2 * x + 1]);
+        }
+    }
+};
+
+LucasKanadeKernel::Isa detectIsa() {
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return LucasKanadeKernel::Isa::Avx2;
+    }
+    if (__builtin_cpu_supports("sse4.1")) {
+        return LucasKanadeKernel::Isa::Sse41;
+    }
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+    int info[4];
+    __cpuid(info, 0);
+    const int maxLeaf = info[0];
+    __cpuid(info, 1);
+    const bool sse41 = (info[2] & (1 << 19)) != 0;
+    // AVX registers must be enabled by the OS as well
+    const bool osSavesYmm = (info[2] & (1 << 27)) != 0 && (_xgetbv(0) & 6) == 6;
+    if (maxLeaf >= 7 && osSavesYmm) {
+        __cpuidex(info, 7, 0);
+        if (info[1] & (1 << 5)) {
+            return LucasKanadeKernel::Isa::Avx2;
+        }
+    }
+    if (sse41) {
+        return LucasKanadeKernel::Isa::Sse41;
+    }
+#endif
+    return LucasKanadeKernel::Isa::Scalar;
+}
+
+} // namespace
+
+bool LucasKanadeKernelImpl::trackScalar(const Params &p) {
+    trackAllWindowSizes<ScalarOps>(p);
+    return true;
+}
+
+LucasKanadeKernel::Isa LucasKanadeKernel::bestIsa() {
+    static const Isa isa = detectIsa();
+    return isa;
+}
+
+const char *LucasKanadeKernel::isaName(Isa isa) {
+    switch (isa) {
+    case Isa::Avx2:
+        return "AVX2";
+    case Isa::Sse41:
+        return "SSE4.1";
+    default:
+        return "scalar";
+    }
+}
+
+void LucasKanadeKernel::calcOpticalFlowPyrLK(const std::vector<cv::Mat> &prevPyr,
+                                             const std::vector<cv::Mat> &nextPyr,
+                                             const cv::Point2f *prevPts,
+                                             cv::Point2f *nextPts,
+                                             uchar *status,
+                                             float *err,
+                                             size_t count,
+                                             cv::Size winSize,
+                                             int maxLevel,
+                                             cv::TermCriteria criteria,
+                                             double minEigThreshold,
+                                             Isa isa) {
+    // the pyramids have to contain the derivatives: image, derivative, image, ..
+    assert(prevPyr.size() >= 2 && prevPyr[1].type() == CV_16SC2);
+    assert(nextPyr.size() >= 2);
+    if (count == 0) {
+        return;
+    }
+
+    Params p;
+    p.prevPyr = &prevPyr;
+    p.nextPyr = &nextPyr;
+    p.prevPts = prevPts;
+    p.nextPts = nextPts;
+    p.status = status;
+    p.err = err;
+    p.count = count;
+    p.winSize = winSize;
+    p.maxLevel = std::min(maxLevel, static_cast<int>(std::min(prevPyr.size(), nextPyr.size()) / 2) - 1);
+
+    // same normalization of the criteria as in OpenCV
+    p.maxIterations = (criteria.type & cv::TermCriteria::COUNT) ?
+                std::min(std::max(criteria.maxCount, 0), 100) : 30;
+    const double epsilon = (criteria.type & cv::TermCriteria::EPS) ?
+                std::min(std::max(criteria.epsilon, 0.), 10.) : 0.01;
+    p.epsilon = static_cast<float>(epsilon * epsilon);
+    p.minEigThreshold = static_cast<float>(minEigThreshold);
+
+    // the vector code needs at least one full vector per window row
+    if (isa == Isa::Avx2 && winSize.width >= 16 && trackAvx2(p)) {
+        return;
+    }
+    if (isa != Isa::Scalar && winSize.width >= 8 && trackSse41(p)) {
+        return;
+    }
+    trackScalar(p);
+}
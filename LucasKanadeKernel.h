@@ -0,0 +1,56 @@
+#pragma once
+
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+/**
+ * @brief The LucasKanadeKernel class
+ * Our own pyramidal Lucas-Kanade iteration, a replacement for
+ * cv::calcOpticalFlowPyrLK on pyramids of cv::buildOpticalFlowPyramid that
+ * include the derivatives (as built by LucasKanadeCore). It uses the fixed
+ * point scheme of OpenCV, so both agree up to float rounding.
+ *
+ * The window loops are hand-vectorized (AVX2, SSE4.1 and a scalar fallback,
+ * picked at runtime) and specialized for the window sizes 15, 21 and 31
+ * so that the row loops are fully unrolled; all other sizes take the
+ * generic loops.
+ */
+class LucasKanadeKernel {
+public:
+    enum class Isa {
+        Scalar,
+        Sse41,
+        Avx2
+    };
+
+    /**
+     * @brief bestIsa
+     * @return the best instruction set of this CPU (detected once)
+     */
+    static Isa bestIsa();
+
+    static const char *isaName(Isa isa);
+
+    /**
+     * @brief calcOpticalFlowPyrLK
+     * tracks count points from prevPyr to nextPyr, the parameters have the
+     * meaning of cv::calcOpticalFlowPyrLK without flags
+     * @param status OUT: 1 if the point was found
+     * @param err OUT: mean absolute difference of the windows
+     * @param isa instruction set to use, falls back to a narrower one if
+     * the window is smaller than the vector width
+     */
+    static void calcOpticalFlowPyrLK(const std::vector<cv::Mat> &prevPyr,
+                                     const std::vector<cv::Mat> &nextPyr,
+                                     const cv::Point2f *prevPts,
+                                     cv::Point2f *nextPts,
+                                     uchar *status,
+                                     float *err,
+                                     size_t count,
+                                     cv::Size winSize,
+                                     int maxLevel,
+                                     cv::TermCriteria criteria,
+                                     double minEigThreshold,
+                                     Isa isa = bestIsa());
+};
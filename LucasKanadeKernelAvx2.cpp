@@ -0,0 +1,212 @@
+/*
+ * AVX2 variant of LucasKanadeKernel, compiled with -mavx2 (see
+ * CMakeLists.txt); reduced to a stub if the compiler does not target AVX2.
+ */
+
+#include "LucasKanadeKernelImpl.h"
+
+using namespace LucasKanadeKernelImpl;
+
+#if defined(__AVX2__)
+
+#include <immintrin.h>
+
+namespace {
+
+/**
+ * @brief The Avx2Ops struct
+ * processes the window rows in chunks of 16 pixels, the tail is handled
+ * like in the SSE4.1 variant by an overlapping masked chunk.
+ *
+ * The 256 bit unpack/pack instructions work on the two 128 bit halves
+ * separately; the lane order is restored where it matters (see the
+ * comments), everything else is only summed up.
+ */
+struct Avx2Ops {
+    static const int lanes = 16;
+
+    struct Masks {
+        __m256i	full16;
+        __m256	full;
+        __m256i	tail16;		// per pixel (int16)
+        __m256	tail[2];	// per pixel (float), pixels 0-7 and 8-15
+
+        explicit Masks(int cols) {
+            const int skipped = cols % lanes == 0 ? 0 : lanes - cols % lanes;
+            short m16[lanes];
+            int m32[lanes];
+            for (int i = 0; i < lanes; i++) {
+                m16[i] = i < skipped ? 0 : -1;
+                m32[i] = i < skipped ? 0 : -1;
+            }
+            full16 = _mm256_set1_epi16(-1);
+            full = _mm256_castsi256_ps(full16);
+            tail16 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(m16));
+            tail[0] = _mm256_castsi256_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(m32)));
+            tail[1] = _mm256_castsi256_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(m32 + 8)));
+        }
+    };
+
+    struct Hessian {
+        __m256 a11 = _mm256_setzero_ps(), a12 = _mm256_setzero_ps(), a22 = _mm256_setzero_ps();
+
+        void reduce(float &A11, float &A12, float &A22) const {
+            A11 = sum(a11);
+            A12 = sum(a12);
+            A22 = sum(a22);
+        }
+    };
+
+    struct Residual {
+        __m256 b = _mm256_setzero_ps(); // b1, b2, b1, b2, ..
+
+        void reduce(float &B1, float &B2) const {
+            float v[8];
+            _mm256_storeu_ps(v, b);
+            B1 = (v[0] + v[2]) + (v[4] + v[6]);
+            B2 = (v[1] + v[3]) + (v[5] + v[7]);
+        }
+    };
+
+    static float sum(__m256 v) {
+        float s[8];
+        _mm256_storeu_ps(s, v);
+        return ((s[0] + s[1]) + (s[2] + s[3])) + ((s[4] + s[5]) + (s[6] + s[7]));
+    }
+
+    static void weights(const Weights &w, __m256i &qw0, __m256i &qw1) {
+        qw0 = _mm256_set1_epi32((w.w00 & 0xffff) | (w.w01 << 16));
+        qw1 = _mm256_set1_epi32((w.w10 & 0xffff) | (w.w11 << 16));
+    }
+
+    static __m256i load16(const uchar *src) {
+        return _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(src)));
+    }
+
+    /**
+     * @brief interpolate16
+     * bilinear interpolation of 16 gray pixels, scaled by 32 (in order: the
+     * in-lane unpack and pack cancel each other out)
+     */
+    static __m256i interpolate16(const uchar *src, ptrdiff_t step, __m256i qw0, __m256i qw1) {
+        const __m256i s00 = load16(src);
+        const __m256i s01 = load16(src + 1);
+        const __m256i s10 = load16(src + step);
+        const __m256i s11 = load16(src + step + 1);
+        const __m256i delta = _mm256_set1_epi32(1 << (W_BITS - 5 - 1));
+
+        __m256i lo = _mm256_add_epi32(_mm256_madd_epi16(_mm256_unpacklo_epi16(s00, s01), qw0),
+                                      _mm256_madd_epi16(_mm256_unpacklo_epi16(s10, s11), qw1));
+        __m256i hi = _mm256_add_epi32(_mm256_madd_epi16(_mm256_unpackhi_epi16(s00, s01), qw0),
+                                      _mm256_madd_epi16(_mm256_unpackhi_epi16(s10, s11), qw1));
+        lo = _mm256_srai_epi32(_mm256_add_epi32(lo, delta), W_BITS - 5);
+        hi = _mm256_srai_epi32(_mm256_add_epi32(hi, delta), W_BITS - 5);
+        return _mm256_packs_epi32(lo, hi);
+    }
+
+    static void patchChunk(const uchar *src, ptrdiff_t stepI, const short *dsrc, ptrdiff_t dstep,
+                           __m256i qw0, __m256i qw1, const __m256 *mask,
+                           short *Iptr, short *dIptr, Hessian &h) {
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(Iptr), interpolate16(src, stepI, qw0, qw1));
+
+        const __m256i delta = _mm256_set1_epi32(1 << (W_BITS - 1));
+        for (int k = 0; k < 2; k++) {
+            // 8 pixels of interleaved (dx, dy)
+            const short *d = dsrc + 16 * k;
+            const __m256i v00 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(d));
+            const __m256i v01 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(d + 2));
+            const __m256i v10 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(d + dstep));
+            const __m256i v11 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(d + dstep + 2));
+
+            __m256i t0 = _mm256_add_epi32(_mm256_madd_epi16(_mm256_unpacklo_epi16(v00, v01), qw0),
+                                          _mm256_madd_epi16(_mm256_unpacklo_epi16(v10, v11), qw1));
+            __m256i t1 = _mm256_add_epi32(_mm256_madd_epi16(_mm256_unpackhi_epi16(v00, v01), qw0),
+                                          _mm256_madd_epi16(_mm256_unpackhi_epi16(v10, v11), qw1));
+            t0 = _mm256_srai_epi32(_mm256_add_epi32(t0, delta), W_BITS); // pixels 0 1 | 4 5
+            t1 = _mm256_srai_epi32(_mm256_add_epi32(t1, delta), W_BITS); // pixels 2 3 | 6 7
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(dIptr + 16 * k), _mm256_packs_epi32(t0, t1));
+
+            // pixels 0 1 2 3 | 4 5 6 7 after the in-lane shuffle
+            const __m256 f0 = _mm256_cvtepi32_ps(t0);
+            const __m256 f1 = _mm256_cvtepi32_ps(t1);
+            const __m256 fx = _mm256_and_ps(_mm256_shuffle_ps(f0, f1, _MM_SHUFFLE(2, 0, 2, 0)), mask[k]);
+            const __m256 fy = _mm256_and_ps(_mm256_shuffle_ps(f0, f1, _MM_SHUFFLE(3, 1, 3, 1)), mask[k]);
+            h.a11 = _mm256_add_ps(h.a11, _mm256_mul_ps(fx, fx));
+            h.a12 = _mm256_add_ps(h.a12, _mm256_mul_ps(fx, fy));
+            h.a22 = _mm256_add_ps(h.a22, _mm256_mul_ps(fy, fy));
+        }
+    }
+
+    static __m256 accumulateProducts(__m256 acc, __m256i diff2, __m256i dI) {
+        const __m256i lo = _mm256_mullo_epi16(diff2, dI);
+        const __m256i hi = _mm256_mulhi_epi16(diff2, dI);
+        acc = _mm256_add_ps(acc, _mm256_cvtepi32_ps(_mm256_unpacklo_epi16(lo, hi)));
+        return _mm256_add_ps(acc, _mm256_cvtepi32_ps(_mm256_unpackhi_epi16(lo, hi)));
+    }
+
+    static void residualChunk(const uchar *src, ptrdiff_t stepJ, __m256i qw0, __m256i qw1, __m256i mask16,
+                              const short *Iptr, const short *dIptr, Residual &r) {
+        const __m256i ival = interpolate16(src, stepJ, qw0, qw1);
+        __m256i diff = _mm256_and_si256(
+                    _mm256_sub_epi16(ival, _mm256_loadu_si256(reinterpret_cast<const __m256i *>(Iptr))), mask16);
+
+        // the derivatives hold pixels 0-3 | 4-7 and 8-11 | 12-15, so the
+        // duplicated differences need the 64 bit blocks in the order 0 2 1 3
+        diff = _mm256_permute4x64_epi64(diff, _MM_SHUFFLE(3, 1, 2, 0));
+        const __m256i dI0 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(dIptr));
+        const __m256i dI1 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(dIptr + 16));
+        r.b = accumulateProducts(r.b, _mm256_unpacklo_epi16(diff, diff), dI0);
+        r.b = accumulateProducts(r.b, _mm256_unpackhi_epi16(diff, diff), dI1);
+    }
+
+    template<int FixedWin>
+    static void patchRow(const uchar *src, ptrdiff_t stepI, const short *dsrc, ptrdiff_t dstep,
+                         int winW, const Weights &w, const Masks &masks,
+                         short *Iptr, short *dIptr, Hessian &h) {
+        const int cols = FixedWin ? FixedWin : winW;
+        __m256i qw0, qw1;
+        weights(w, qw0, qw1);
+        const __m256 full[2] = { masks.full, masks.full };
+
+        int x = 0;
+        for (; x + lanes <= cols; x += lanes) {
+            patchChunk(src + x, stepI, dsrc + 2 * x, dstep, qw0, qw1, full, Iptr + x, dIptr + 2 * x, h);
+        }
+        if (x < cols) {
+            x = cols - lanes;
+            patchChunk(src + x, stepI, dsrc + 2 * x, dstep, qw0, qw1, masks.tail, Iptr + x, dIptr + 2 * x, h);
+        }
+    }
+
+    template<int FixedWin>
+    static void residualRow(const uchar *src, ptrdiff_t stepJ, int winW, const Weights &w,
+                            const Masks &masks, const short *Iptr, const short *dIptr, Residual &r) {
+        const int cols = FixedWin ? FixedWin : winW;
+        __m256i qw0, qw1;
+        weights(w, qw0, qw1);
+
+        int x = 0;
+        for (; x + lanes <= cols; x += lanes) {
+            residualChunk(src + x, stepJ, qw0, qw1, masks.full16, Iptr + x, dIptr + 2 * x, r);
+        }
+        if (x < cols) {
+            x = cols - lanes;
+            residualChunk(src + x, stepJ, qw0, qw1, masks.tail16, Iptr + x, dIptr + 2 * x, r);
+        }
+    }
+};
+
+} // namespace
+
+bool LucasKanadeKernelImpl::trackAvx2(const Params &p) {
+    trackAllWindowSizes<Avx2Ops>(p);
+    return true;
+}
+
+#else
+
+bool LucasKanadeKernelImpl::trackAvx2(const Params &) {
+    return false;
+}
+
+#endif
@@ -0,0 +1,258 @@
+#pragma once
+
+/*
+ * Internals of LucasKanadeKernel, only included by LucasKanadeKernel*.cpp.
+ *
+ * Every instruction set lives in its own translation unit that is compiled
+ * with the matching compiler flags. All helpers here have internal linkage
+ * (static or templates over an Ops type from an anonymous namespace), so
+ * the linker can never mix up code compiled for different instruction sets.
+ */
+
+#include <cfloat>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+namespace LucasKanadeKernelImpl {
+
+// fixed point precision of the bilinear weights (same as OpenCV)
+const int W_BITS = 14;
+const float FLT_SCALE = 1.f / (1 << 20);
+
+struct Params {
+    const std::vector<cv::Mat>	*prevPyr;
+    const std::vector<cv::Mat>	*nextPyr;
+    const cv::Point2f			*prevPts;
+    cv::Point2f					*nextPts;
+    uchar						*status;
+    float						*err;
+    size_t						count;
+    cv::Size					winSize;
+    int							maxLevel;
+    int							maxIterations;
+    float						epsilon;		// squared
+    float						minEigThreshold;
+};
+
+/**
+ * @brief track*
+ * run the kernel for all points with the respective instruction set
+ * @return false if the instruction set was not compiled in
+ */
+bool trackScalar(const Params &p);
+bool trackSse41(const Params &p);
+bool trackAvx2(const Params &p);
+
+struct Weights {
+    int w00, w01, w10, w11;
+};
+
+static inline int descale(int x, int n) {
+    return (x + (1 << (n - 1))) >> n;
+}
+
+static inline Weights bilinearWeights(float a, float b) {
+    Weights w;
+    w.w00 = static_cast<int>(std::lrint((1.f - a) * (1.f - b) * (1 << W_BITS)));
+    w.w01 = static_cast<int>(std::lrint(a * (1.f - b) * (1 << W_BITS)));
+    w.w10 = static_cast<int>(std::lrint((1.f - a) * b * (1 << W_BITS)));
+    w.w11 = (1 << W_BITS) - w.w00 - w.w01 - w.w10;
+    return w;
+}
+
+/**
+ * @brief interpolate
+ * bilinear interpolation of a gray pixel, the result is scaled by 32
+ */
+static inline int interpolate(const uchar *src, ptrdiff_t step, const Weights &w) {
+    return descale(src[0] * w.w00 + src[1] * w.w01 + src[step] * w.w10 + src[step + 1] * w.w11, W_BITS - 5);
+}
+
+/**
+ * @brief interpolateDeriv
+ * bilinear interpolation of one component of the interleaved (dx, dy)
+ * derivatives
+ */
+static inline int interpolateDeriv(const short *src, ptrdiff_t step, const Weights &w) {
+    return descale(src[0] * w.w00 + src[2] * w.w01 + src[step] * w.w10 + src[step + 2] * w.w11, W_BITS);
+}
+
+/**
+ * @brief windowError
+ * mean absolute difference between the window of J at the given (top left)
+ * position and the stored window of I
+ */
+static inline float windowError(const uchar *J, ptrdiff_t stepJ, cv::Point2f pos,
+                                const short *Iwin, int winW, int winH) {
+    const int ix = static_cast<int>(std::floor(pos.x));
+    const int iy = static_cast<int>(std::floor(pos.y));
+    const Weights w = bilinearWeights(pos.x - ix, pos.y - iy);
+
+    float errval = 0.f;
+    for (int y = 0; y < winH; y++) {
+        const uchar *src = J + (iy + y) * stepJ + ix;
+        const short *Iptr = Iwin + y * winW;
+        for (int x = 0; x < winW; x++) {
+            errval += std::abs(static_cast<float>(interpolate(src + x, stepJ, w) - Iptr[x]));
+        }
+    }
+    return errval / (32 * winW * winH);
+}
+
+/**
+ * @brief trackPoints
+ * The pyramidal LK iteration of OpenCV (LKTrackerInvoker) over all points.
+ * Ops does the work on one window row (see ScalarOps for the interface),
+ * FixedWin != 0 turns the window size into a compile time constant.
+ */
+template<class Ops, int FixedWin>
+void trackPoints(const Params &p) {
+    const int winW = FixedWin ? FixedWin : p.winSize.width;
+    const int winH = FixedWin ? FixedWin : p.winSize.height;
+    const cv::Point2f halfWin((winW - 1) * 0.5f, (winH - 1) * 0.5f);
+    const typename Ops::Masks masks(winW);
+
+    // the window of I and its derivatives (interleaved dx, dy)
+    std::vector<short> window(3 * static_cast<size_t>(winW * winH));
+    short *Iwin = window.data();
+    short *dIwin = Iwin + winW * winH;
+
+    for (size_t i = 0; i < p.count; i++) {
+        p.status[i] = 1;
+        if (p.err) {
+            p.err[i] = 0.f;
+        }
+
+        for (int level = p.maxLevel; level >= 0; level--) {
+            const cv::Mat &I = (*p.prevPyr)[2 * level];
+            const cv::Mat &derivI = (*p.prevPyr)[2 * level + 1];
+            const cv::Mat &J = (*p.nextPyr)[2 * level];
+            const ptrdiff_t stepI = static_cast<ptrdiff_t>(I.step1());
+            const ptrdiff_t dstep = static_cast<ptrdiff_t>(derivI.step1());
+            const ptrdiff_t stepJ = static_cast<ptrdiff_t>(J.step1());
+            const uchar *Idata = I.data;
+            const short *dIdata = reinterpret_cast<const short *>(derivI.data);
+            const uchar *Jdata = J.data;
+
+            const float scale = 1.f / (1 << level);
+            cv::Point2f prevPt = p.prevPts[i] * scale;
+            cv::Point2f nextPt = level == p.maxLevel ? prevPt : p.nextPts[i] * 2.f;
+            p.nextPts[i] = nextPt;
+
+            prevPt -= halfWin;
+            const int ipx = static_cast<int>(std::floor(prevPt.x));
+            const int ipy = static_cast<int>(std::floor(prevPt.y));
+            if (ipx < -winW || ipx >= derivI.cols || ipy < -winH || ipy >= derivI.rows) {
+                if (level == 0) {
+                    p.status[i] = 0;
+                }
+                continue;
+            }
+
+            // extract the window of I and accumulate the spatial gradient matrix
+            const Weights wI = bilinearWeights(prevPt.x - ipx, prevPt.y - ipy);
+            typename Ops::Hessian hessian;
+            for (int y = 0; y < winH; y++) {
+                Ops::template patchRow<FixedWin>(
+                    Idata + (ipy + y) * stepI + ipx, stepI,
+                    dIdata + (ipy + y) * dstep + ipx * 2, dstep,
+                    winW, wI, masks, Iwin + y * winW, dIwin + 2 * y * winW, hessian);
+            }
+            float A11, A12, A22;
+            hessian.reduce(A11, A12, A22);
+            A11 *= FLT_SCALE;
+            A12 *= FLT_SCALE;
+            A22 *= FLT_SCALE;
+
+            float D = A11 * A22 - A12 * A12;
+            const float minEig = (A22 + A11 - std::sqrt((A11 - A22) * (A11 - A22) + 4.f * A12 * A12)) /
+                    (2 * winW * winH);
+            if (minEig < p.minEigThreshold || D < FLT_EPSILON) {
+                if (level == 0) {
+                    p.status[i] = 0;
+                }
+                continue;
+            }
+            D = 1.f / D;
+
+            nextPt -= halfWin;
+            cv::Point2f prevDelta;
+            for (int j = 0; j < p.maxIterations; j++) {
+                const int inx = static_cast<int>(std::floor(nextPt.x));
+                const int iny = static_cast<int>(std::floor(nextPt.y));
+                if (inx < -winW || inx >= J.cols || iny < -winH || iny >= J.rows) {
+                    if (level == 0) {
+                        p.status[i] = 0;
+                    }
+                    break;
+                }
+
+                const Weights wJ = bilinearWeights(nextPt.x - inx, nextPt.y - iny);
+                typename Ops::Residual residual;
+                for (int y = 0; y < winH; y++) {
+                    Ops::template residualRow<FixedWin>(
+                        Jdata + (iny + y) * stepJ + inx, stepJ,
+                        winW, wJ, masks, Iwin + y * winW, dIwin + 2 * y * winW, residual);
+                }
+                float b1, b2;
+                residual.reduce(b1, b2);
+                b1 *= FLT_SCALE;
+                b2 *= FLT_SCALE;
+
+                const cv::Point2f delta((A12 * b2 - A22 * b1) * D, (A12 * b1 - A11 * b2) * D);
+                nextPt += delta;
+                p.nextPts[i] = nextPt + halfWin;
+
+                if (delta.dot(delta) <= p.epsilon) {
+                    break;
+                }
+                if (j > 0 && std::abs(delta.x + prevDelta.x) < 0.01f && std::abs(delta.y + prevDelta.y) < 0.01f) {
+                    // oscillating around the solution
+                    p.nextPts[i] -= delta * 0.5f;
+                    break;
+                }
+                prevDelta = delta;
+            }
+
+            if (level == 0 && p.status[i] && p.err) {
+                const cv::Point2f pos = p.nextPts[i] - halfWin;
+                const int ix = static_cast<int>(std::floor(pos.x));
+                const int iy = static_cast<int>(std::floor(pos.y));
+                if (ix < -winW || ix >= J.cols || iy < -winH || iy >= J.rows) {
+                    p.status[i] = 0;
+                } else {
+                    p.err[i] = windowError(Jdata, stepJ, pos, Iwin, winW, winH);
+                }
+            }
+        }
+    }
+}
+
+/**
+ * @brief trackAllWindowSizes
+ * picks the specialization for the common window sizes
+ */
+template<class Ops>
+void trackAllWindowSizes(const Params &p) {
+    if (p.winSize.width == p.winSize.height) {
+        switch (p.winSize.width) {
+        case 15:
+            trackPoints<Ops, 15>(p);
+            return;
+        case 21:
+            trackPoints<Ops, 21>(p);
+            return;
+        case 31:
+            trackPoints<Ops, 31>(p);
+            return;
+        default:
+            break;
+        }
+    }
+    trackPoints<Ops, 0>(p);
+}
+
+} // namespace LucasKanadeKernelImpl
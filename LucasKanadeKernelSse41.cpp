@@ -0,0 +1,207 @@
+/*
+ * SSE4.1 variant of LucasKanadeKernel, compiled with -msse4.1 (see
+ * CMakeLists.txt); reduced to a stub on other architectures.
+ */
+
+#include "LucasKanadeKernelImpl.h"
+
+using namespace LucasKanadeKernelImpl;
+
+#if defined(__SSE4_1__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+
+#include <smmintrin.h>
+
+namespace {
+
+/**
+ * @brief The Sse41Ops struct
+ * processes the window rows in chunks of 8 pixels; if the width is not a
+ * multiple of 8 the last chunk overlaps the previous one and the masks
+ * hide the pixels that were already accumulated
+ */
+struct Sse41Ops {
+    static const int lanes = 8;
+
+    struct Masks {
+        __m128i	full16;
+        __m128	full;
+        __m128i	tail16;		// per pixel (int16)
+        __m128	tail[2];	// per pixel (float), pixels 0-3 and 4-7
+
+        explicit Masks(int cols) {
+            const int skipped = cols % lanes == 0 ? 0 : lanes - cols % lanes;
+            short m16[lanes];
+            int m32[lanes];
+            for (int i = 0; i < lanes; i++) {
+                m16[i] = i < skipped ? 0 : -1;
+                m32[i] = i < skipped ? 0 : -1;
+            }
+            full16 = _mm_set1_epi16(-1);
+            full = _mm_castsi128_ps(full16);
+            tail16 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(m16));
+            tail[0] = _mm_castsi128_ps(_mm_loadu_si128(reinterpret_cast<const __m128i *>(m32)));
+            tail[1] = _mm_castsi128_ps(_mm_loadu_si128(reinterpret_cast<const __m128i *>(m32 + 4)));
+        }
+    };
+
+    struct Hessian {
+        __m128 a11 = _mm_setzero_ps(), a12 = _mm_setzero_ps(), a22 = _mm_setzero_ps();
+
+        void reduce(float &A11, float &A12, float &A22) const {
+            A11 = sum(a11);
+            A12 = sum(a12);
+            A22 = sum(a22);
+        }
+    };
+
+    struct Residual {
+        __m128 b = _mm_setzero_ps(); // b1, b2, b1, b2
+
+        void reduce(float &B1, float &B2) const {
+            float v[4];
+            _mm_storeu_ps(v, b);
+            B1 = v[0] + v[2];
+            B2 = v[1] + v[3];
+        }
+    };
+
+    static float sum(__m128 v) {
+        float s[4];
+        _mm_storeu_ps(s, v);
+        return (s[0] + s[1]) + (s[2] + s[3]);
+    }
+
+    /**
+     * @brief weights
+     * (w00, w01) and (w10, w11) as int16 pairs for _mm_madd_epi16
+     */
+    static void weights(const Weights &w, __m128i &qw0, __m128i &qw1) {
+        qw0 = _mm_set1_epi32((w.w00 & 0xffff) | (w.w01 << 16));
+        qw1 = _mm_set1_epi32((w.w10 & 0xffff) | (w.w11 << 16));
+    }
+
+    /**
+     * @brief interpolate8
+     * bilinear interpolation of 8 gray pixels, scaled by 32
+     */
+    static __m128i interpolate8(const uchar *src, ptrdiff_t step, __m128i qw0, __m128i qw1) {
+        const __m128i s00 = _mm_cvtepu8_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(src)));
+        const __m128i s01 = _mm_cvtepu8_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(src + 1)));
+        const __m128i s10 = _mm_cvtepu8_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(src + step)));
+        const __m128i s11 = _mm_cvtepu8_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(src + step + 1)));
+        const __m128i delta = _mm_set1_epi32(1 << (W_BITS - 5 - 1));
+
+        __m128i lo = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(s00, s01), qw0),
+                                   _mm_madd_epi16(_mm_unpacklo_epi16(s10, s11), qw1));
+        __m128i hi = _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(s00, s01), qw0),
+                                   _mm_madd_epi16(_mm_unpackhi_epi16(s10, s11), qw1));
+        lo = _mm_srai_epi32(_mm_add_epi32(lo, delta), W_BITS - 5);
+        hi = _mm_srai_epi32(_mm_add_epi32(hi, delta), W_BITS - 5);
+        return _mm_packs_epi32(lo, hi);
+    }
+
+    static void patchChunk(const uchar *src, ptrdiff_t stepI, const short *dsrc, ptrdiff_t dstep,
+                           __m128i qw0, __m128i qw1, const __m128 *mask,
+                           short *Iptr, short *dIptr, Hessian &h) {
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(Iptr), interpolate8(src, stepI, qw0, qw1));
+
+        const __m128i delta = _mm_set1_epi32(1 << (W_BITS - 1));
+        for (int k = 0; k < 2; k++) {
+            // 4 pixels of interleaved (dx, dy)
+            const short *d = dsrc + 8 * k;
+            const __m128i v00 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(d));
+            const __m128i v01 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(d + 2));
+            const __m128i v10 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(d + dstep));
+            const __m128i v11 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(d + dstep + 2));
+
+            __m128i t0 = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(v00, v01), qw0),
+                                       _mm_madd_epi16(_mm_unpacklo_epi16(v10, v11), qw1));
+            __m128i t1 = _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(v00, v01), qw0),
+                                       _mm_madd_epi16(_mm_unpackhi_epi16(v10, v11), qw1));
+            t0 = _mm_srai_epi32(_mm_add_epi32(t0, delta), W_BITS); // Ix0 Iy0 Ix1 Iy1
+            t1 = _mm_srai_epi32(_mm_add_epi32(t1, delta), W_BITS); // Ix2 Iy2 Ix3 Iy3
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(dIptr + 8 * k), _mm_packs_epi32(t0, t1));
+
+            const __m128 f0 = _mm_cvtepi32_ps(t0);
+            const __m128 f1 = _mm_cvtepi32_ps(t1);
+            const __m128 fx = _mm_and_ps(_mm_shuffle_ps(f0, f1, _MM_SHUFFLE(2, 0, 2, 0)), mask[k]);
+            const __m128 fy = _mm_and_ps(_mm_shuffle_ps(f0, f1, _MM_SHUFFLE(3, 1, 3, 1)), mask[k]);
+            h.a11 = _mm_add_ps(h.a11, _mm_mul_ps(fx, fx));
+            h.a12 = _mm_add_ps(h.a12, _mm_mul_ps(fx, fy));
+            h.a22 = _mm_add_ps(h.a22, _mm_mul_ps(fy, fy));
+        }
+    }
+
+    /**
+     * @brief accumulateProducts
+     * adds diff * (dx, dy) of 4 pixels (diff duplicated per pixel)
+     */
+    static __m128 accumulateProducts(__m128 acc, __m128i diff2, __m128i dI) {
+        const __m128i lo = _mm_mullo_epi16(diff2, dI);
+        const __m128i hi = _mm_mulhi_epi16(diff2, dI);
+        acc = _mm_add_ps(acc, _mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, hi)));
+        return _mm_add_ps(acc, _mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, hi)));
+    }
+
+    static void residualChunk(const uchar *src, ptrdiff_t stepJ, __m128i qw0, __m128i qw1, __m128i mask16,
+                              const short *Iptr, const short *dIptr, Residual &r) {
+        const __m128i ival = interpolate8(src, stepJ, qw0, qw1);
+        const __m128i diff = _mm_and_si128(
+                    _mm_sub_epi16(ival, _mm_loadu_si128(reinterpret_cast<const __m128i *>(Iptr))), mask16);
+        const __m128i dI0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(dIptr));
+        const __m128i dI1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(dIptr + 8));
+        r.b = accumulateProducts(r.b, _mm_unpacklo_epi16(diff, diff), dI0);
+        r.b = accumulateProducts(r.b, _mm_unpackhi_epi16(diff, diff), dI1);
+    }
+
+    template<int FixedWin>
+    static void patchRow(const uchar *src, ptrdiff_t stepI, const short *dsrc, ptrdiff_t dstep,
+                         int winW, const Weights &w, const Masks &masks,
+                         short *Iptr, short *dIptr, Hessian &h) {
+        const int cols = FixedWin ? FixedWin : winW;
+        __m128i qw0, qw1;
+        weights(w, qw0, qw1);
+        const __m128 full[2] = { masks.full, masks.full };
+
+        int x = 0;
+        for (; x + lanes <= cols; x += lanes) {
+            patchChunk(src + x, stepI, dsrc + 2 * x, dstep, qw0, qw1, full, Iptr + x, dIptr + 2 * x, h);
+        }
+        if (x < cols) {
+            x = cols - lanes;
+            patchChunk(src + x, stepI, dsrc + 2 * x, dstep, qw0, qw1, masks.tail, Iptr + x, dIptr + 2 * x, h);
+        }
+    }
+
+    template<int FixedWin>
+    static void residualRow(const uchar *src, ptrdiff_t stepJ, int winW, const Weights &w,
+                            const Masks &masks, const short *Iptr, const short *dIptr, Residual &r) {
+        const int cols = FixedWin ? FixedWin : winW;
+        __m128i qw0, qw1;
+        weights(w, qw0, qw1);
+
+        int x = 0;
+        for (; x + lanes <= cols; x += lanes) {
+            residualChunk(src + x, stepJ, qw0, qw1, masks.full16, Iptr + x, dIptr + 2 * x, r);
+        }
+        if (x < cols) {
+            x = cols - lanes;
+            residualChunk(src + x, stepJ, qw0, qw1, masks.tail16, Iptr + x, dIptr + 2 * x, r);
+        }
+    }
+};
+
+} // namespace
+
+bool LucasKanadeKernelImpl::trackSse41(const Params &p) {
+    trackAllWindowSizes<Sse41Ops>(p);
+    return true;
+}
+
+#else
+
+bool LucasKanadeKernelImpl::trackSse41(const Params &) {
+    return false;
+}
+
+#endif
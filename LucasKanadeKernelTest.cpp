@@ -0,0 +1,167 @@
+/*
+ * Compares our LK kernel (LucasKanadeKernel) with cv::calcOpticalFlowPyrLK.
+ *
+ * The frames are synthetic like in the benchmark: blurred noise, the next
+ * frame moved by a known sub-pixel shift (bilinear), with a flat patch
+ * whose points fail the eigenvalue test and a few points outside of the
+ * frame. Both implementations track the same points on the same pyramids
+ * for every instruction set of this CPU and a range of window sizes: the
+ * specialized 15, 21 and 31, the generic loops (17, 23x13) and widths
+ * whose rows end in a masked tail of the vector code (9, 15, 17, 21, 23
+ * and 31 for SSE4.1; 17, 21, 23 and 31 for AVX2) or need none (16, 32).
+ * The status has to be the same for every point, the positions may differ
+ * by float rounding (which can move the end of the iteration by a step
+ * below the termination epsilon).
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include "LucasKanadeKernel.h"
+#include "TestCheck.h"
+
+namespace {
+
+// the core's LK parameters
+const cv::TermCriteria termCriteria(cv::TermCriteria::COUNT | cv::TermCriteria::EPS, 20, 0.03);
+const double minEigThreshold = 0.001;
+const int maxLevel = 3;
+
+const float positionTolerance = 0.05f;	// px, see above
+const float shiftTolerance = 0.1f;		// px, mean distance to the known shift
+
+const cv::Size frameSize(320, 240);
+const cv::Rect flatRect(0, 0, 96, 96);	// no texture, nothing to track
+
+const cv::Size winSizes[] = {
+    cv::Size(9, 9), cv::Size(15, 15), cv::Size(16, 16), cv::Size(17, 17),
+    cv::Size(21, 21), cv::Size(23, 13), cv::Size(31, 31), cv::Size(32, 32)
+};
+
+const cv::Point2f shifts[] = {
+    cv::Point2f(0.25f, -0.5f), cv::Point2f(1.75f, 0.4f), cv::Point2f(-3.3f, 2.6f), cv::Point2f(6.45f, -5.2f)
+};
+
+/**
+ * @brief makeFrames
+ * two gray frames, the second one moved by shift
+ */
+void makeFrames(const cv::Point2f &shift, cv::Mat &prev, cv::Mat &next) {
+    prev.create(frameSize.height, frameSize.width, CV_8UC1);
+    cv::RNG rng(0x5eed);
+    rng.fill(prev, cv::RNG::UNIFORM, cv::Scalar(0), cv::Scalar(256));
+    cv::GaussianBlur(prev, prev, cv::Size(0, 0), 1.5);
+
+    double transform[] = { 1., 0., shift.x, 0., 1., shift.y };
+    const cv::Mat move(2, 3, CV_64F, transform);
+    cv::warpAffine(prev, next, move, frameSize, cv::INTER_LINEAR, cv::BORDER_REFLECT_101);
+
+    // after the warp, so the patch stays flat in both frames
+    prev(flatRect).setTo(cv::Scalar(128));
+    next(flatRect).setTo(cv::Scalar(128));
+}
+
+/**
+ * @brief makePoints
+ * a grid over the textured part (its windows stay inside the frame and
+ * away from the flat patch), the center of the flat patch and points
+ * outside of the frame
+ */
+std::vector<cv::Point2f> makePoints(const cv::Size &winSize) {
+    const int margin = std::max(winSize.width, winSize.height) + 8;
+    std::vector<cv::Point2f> points;
+    for (int y = margin; y < frameSize.height - margin; y += 7) {
+        for (int x = margin; x < frameSize.width - margin; x += 7) {
+            const cv::Rect window(x - margin, y - margin, 2 * margin, 2 * margin);
+            if ((window & flatRect).area() == 0) {
+                // off the integer grid, the interpolation is part of the test
+                points.push_back(cv::Point2f(x + 0.3f, y + 0.6f));
+            }
+        }
+    }
+    points.push_back(cv::Point2f(flatRect.x + flatRect.width / 2.f, flatRect.y + flatRect.height / 2.f));
+    points.push_back(cv::Point2f(-100.f, 50.f));
+    points.push_back(cv::Point2f(frameSize.width + 100.f, frameSize.height + 100.f));
+    return points;
+}
+
+void testKernel(LucasKanadeKernel::Isa isa, const cv::Size &winSize, const cv::Point2f &shift) {
+    cv::Mat prev;
+    cv::Mat next;
+    makeFrames(shift, prev, next);
+    std::vector<cv::Mat> prevPyr;
+    std::vector<cv::Mat> nextPyr;
+    cv::buildOpticalFlowPyramid(prev, prevPyr, winSize, maxLevel);
+    cv::buildOpticalFlowPyramid(next, nextPyr, winSize, maxLevel);
+
+    const std::vector<cv::Point2f> prevPts = makePoints(winSize);
+    const size_t count = prevPts.size();
+
+    std::vector<cv::Point2f> expectedPts;
+    std::vector<uchar> expectedStatus;
+    std::vector<float> expectedError;
+    cv::calcOpticalFlowPyrLK(prevPyr, nextPyr, prevPts, expectedPts, expectedStatus, expectedError,
+                             winSize, maxLevel, termCriteria, 0, minEigThreshold);
+
+    std::vector<cv::Point2f> nextPts(count);
+    std::vector<uchar> status(count);
+    std::vector<float> error(count);
+    LucasKanadeKernel::calcOpticalFlowPyrLK(prevPyr, nextPyr, prevPts.data(), nextPts.data(), status.data(),
+                                            error.data(), count, winSize, maxLevel, termCriteria,
+                                            minEigThreshold, isa);
+
+    size_t found = 0;
+    size_t statusMismatches = 0;
+    float maxDifference = 0.f;
+    double distance = 0.;
+    for (size_t i = 0; i < count; i++) {
+        if ((status[i] != 0) != (expectedStatus[i] != 0)) {
+            statusMismatches++;
+            continue;
+        }
+        if (!status[i]) {
+            continue;
+        }
+        const cv::Point2f difference = nextPts[i] - expectedPts[i];
+        maxDifference = std::max(maxDifference, std::max(std::abs(difference.x), std::abs(difference.y)));
+        const cv::Point2f offset = nextPts[i] - prevPts[i] - shift;
+        distance += std::sqrt(offset.x * offset.x + offset.y * offset.y);
+        found++;
+    }
+    const double meanDistance = found > 0 ? distance / found : 0.;
+
+    std::printf("%-6s win %2dx%-2d shift (%5.2f, %5.2f): %zu of %zu found, max difference %.4f px, "
+                "mean error %.4f px\n", LucasKanadeKernel::isaName(isa), winSize.width, winSize.height,
+                shift.x, shift.y, found, count, maxDifference, meanDistance);
+
+    CHECK(statusMismatches == 0);
+    CHECK(maxDifference <= positionTolerance);
+    CHECK(meanDistance <= shiftTolerance);
+    // the textured grid is found, the flat and the outside points are not
+    CHECK(found + 3 == count);
+    CHECK(!status[count - 3] && !status[count - 2] && !status[count - 1]);
+}
+
+} // namespace
+
+int main() {
+    const LucasKanadeKernel::Isa isas[] = {
+        LucasKanadeKernel::Isa::Scalar, LucasKanadeKernel::Isa::Sse41, LucasKanadeKernel::Isa::Avx2
+    };
+    for (LucasKanadeKernel::Isa isa : isas) {
+        if (static_cast<int>(isa) > static_cast<int>(LucasKanadeKernel::bestIsa())) {
+            std::printf("%s is not available on this CPU, skipped\n", LucasKanadeKernel::isaName(isa));
+            continue;
+        }
+        for (const cv::Size &winSize : winSizes) {
+            for (const cv::Point2f &shift : shifts) {
+                testKernel(isa, winSize, shift);
+            }
+        }
+    }
+    return TestCheck::testResult();
+}
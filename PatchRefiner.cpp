@@ -0,0 +1,154 @@
+#include "PatchRefiner.h"
+
+#include <algorithm>
+
+#include "ThreadPool.h"
+
+// resize() takes the value by reference
+const size_t PatchRefiner::noRow;
+
+size_t PatchRefiner::prepare(size_t frameNumber, const cv::Mat &imgOriginal, FrameIngest::Format format,
+                             const cv::Mat &prevGray, const size_t *ids, const cv::Point2f *prevPts,
+                             const cv::Point2f *estimates, const uchar *status, size_t count,
+                             const cv::Size &winSize, int factor, ThreadPool *pool) {
+    // the estimate is off by about a coarse pixel, the iteration needs a
+    // bit of room on top
+    const int margin = 2 * factor + 2;
+    m_winSize = winSize;
+    m_patchSize = std::max(winSize.width, winSize.height) + 2 * margin;
+    const int size = m_patchSize;
+    const cv::Size frameSize = FrameIngest::graySize(imgOriginal, format);
+    auto fits = [&](const cv::Point &origin) {
+        return origin.x >= 0 && origin.y >= 0 &&
+                origin.x + size <= frameSize.width && origin.y + size <= frameSize.height;
+    };
+    const bool keptUsable = m_keptValid && m_keptFrame + 1 == frameNumber && m_keptPatchSize == size;
+
+    m_patches.clear();
+    m_prevPoints.clear();
+    for (size_t i = 0; i < count; i++) {
+        if (!status[i]) {
+            continue;
+        }
+        Patch patch;
+        patch.entry = i;
+        patch.id = ids[i];
+        patch.keptRow = noRow;
+        if (keptUsable && patch.id < m_keptRow.size() && m_keptRow[patch.id] != noRow &&
+                m_keptPositions[m_keptRow[patch.id]] == prevPts[i]) {
+            patch.keptRow = m_keptRow[patch.id];
+            patch.prevOrigin = m_keptOrigins[patch.keptRow];
+        } else if (!prevGray.empty()) {
+            patch.prevOrigin = cv::Point(cvRound(prevPts[i].x) - size / 2, cvRound(prevPts[i].y) - size / 2);
+            if (!fits(patch.prevOrigin)) {
+                continue;
+            }
+        } else {
+            continue;
+        }
+
+        const cv::Point2f local(prevPts[i].x - patch.prevOrigin.x, prevPts[i].y - patch.prevOrigin.y);
+        if (!isInside(local)) {
+            continue;
+        }
+        // the estimate lands (up to rounding) on the position of the point
+        patch.nextOrigin = cv::Point(cvRound(estimates[i].x - local.x), cvRound(estimates[i].y - local.y));
+        if (!fits(patch.nextOrigin)) {
+            continue;
+        }
+        m_prevPoints.push_back(local + cv::Point2f(0.f, static_cast<float>(m_patches.size() * size)));
+        m_patches.push_back(patch);
+    }
+
+    const size_t n = m_patches.size();
+    if (n == 0) {
+        return 0;
+    }
+
+    m_prevMosaic.create(static_cast<int>(n) * size, size, CV_8UC1);
+    m_nextMosaic.create(static_cast<int>(n) * size, size, CV_8UC1);
+    const size_t chunkSize = 64;
+    const size_t chunkCount = (n + chunkSize - 1) / chunkSize;
+    auto fillChunk = [&](size_t chunk) {
+        const size_t end = std::min(n, (chunk + 1) * chunkSize);
+        for (size_t k = chunk * chunkSize; k < end; k++) {
+            const Patch &patch = m_patches[k];
+            const cv::Rect row(0, static_cast<int>(k) * size, size, size);
+            cv::Mat prev = m_prevMosaic(row);
+            if (patch.keptRow != noRow) {
+                m_keptMosaic(cv::Rect(0, static_cast<int>(patch.keptRow) * size, size, size)).copyTo(prev);
+            } else {
+                prevGray(cv::Rect(patch.prevOrigin, cv::Size(size, size))).copyTo(prev);
+            }
+            cv::Mat next = m_nextMosaic(row);
+            FrameIngest::convert(imgOriginal, format, cv::Rect(patch.nextOrigin, cv::Size(size, size)), next);
+        }
+    };
+    if (pool && chunkCount > 1) {
+        pool->parallelFor(chunkCount, fillChunk);
+    } else {
+        for (size_t chunk = 0; chunk < chunkCount; chunk++) {
+            fillChunk(chunk);
+        }
+    }
+
+    // only level 0 (and its derivatives); the windows never reach the
+    // neighbouring patches, so the mosaics are filtered as a whole
+    cv::buildOpticalFlowPyramid(m_prevMosaic, m_prevPyr, winSize, 0);
+    cv::buildOpticalFlowPyramid(m_nextMosaic, m_nextPyr, winSize, 0);
+
+    m_nextPoints = m_prevPoints;
+    m_status.resize(n);
+    m_error.resize(n);
+    return n;
+}
+
+void PatchRefiner::apply(size_t frameNumber, cv::Point2f *estimates, float *error) {
+    for (size_t id : m_keptIds) {
+        m_keptRow[id] = noRow;
+    }
+    m_keptIds.clear();
+    m_keptPositions.resize(m_patches.size());
+    m_keptOrigins.resize(m_patches.size());
+
+    for (size_t k = 0; k < m_patches.size(); k++) {
+        const Patch &patch = m_patches[k];
+        const cv::Point2f origin(static_cast<float>(patch.nextOrigin.x), static_cast<float>(patch.nextOrigin.y));
+        const cv::Point2f refined = m_nextPoints[k] - cv::Point2f(0.f, static_cast<float>(k * m_patchSize));
+        // a result outside of the patch came from the pixels of another one
+        if (m_status[k] && isInside(refined)) {
+            estimates[patch.entry] = refined + origin;
+            error[patch.entry] = m_error[k];
+        }
+
+        // the previous patch of the next step, if the point is inside
+        if (isInside(estimates[patch.entry] - origin)) {
+            if (patch.id >= m_keptRow.size()) {
+                m_keptRow.resize(patch.id + 1, noRow);
+            }
+            m_keptRow[patch.id] = k;
+            m_keptIds.push_back(patch.id);
+            m_keptPositions[k] = estimates[patch.entry];
+            m_keptOrigins[k] = patch.nextOrigin;
+        }
+    }
+
+    cv::swap(m_keptMosaic, m_nextMosaic);
+    m_keptPatchSize = m_patchSize;
+    m_keptFrame = frameNumber;
+    m_keptValid = true;
+    m_patches.clear();
+}
+
+void PatchRefiner::clear() {
+    m_keptValid = false;
+}
+
+bool PatchRefiner::isInside(const cv::Point2f &local) const {
+    // the window plus the pixel the derivatives need
+    const float halfWidth = static_cast<float>(m_winSize.width / 2 + 1);
+    const float halfHeight = static_cast<float>(m_winSize.height / 2 + 1);
+    const float last = static_cast<float>(m_patchSize - 1);
+    return local.x >= halfWidth && local.y >= halfHeight &&
+            local.x <= last - halfWidth && local.y <= last - halfHeight;
+}
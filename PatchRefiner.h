@@ -0,0 +1,136 @@
+#pragma once
+
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include "FrameIngest.h"
+
+class ThreadPool;
+
+/**
+ * @brief The PatchRefiner class
+ * The full resolution part of the downscaled tracking (see
+ * LucasKanadeCore::setDownscale()): after the LK step on the downscaled
+ * frames, one more LK step at level 0 runs on small patches of the full
+ * frames around each point.
+ *
+ * The patches of all points are stacked into one column per frame (a
+ * mosaic), so a single LK call refines all of them. The patch of the next
+ * frame is placed so that the coarse estimate has the same coordinates as
+ * the point in its patch of the previous frame; the estimate is then the
+ * usual starting point of the iteration and no initial flow is needed (our
+ * kernel does not take one).
+ *
+ * The patches of the next frame are kept as the previous patches of the
+ * next step, so every frame is converted only around its points and only
+ * once. A point without a kept patch (new or edited) is cut from the full
+ * previous frame if the core has it, otherwise it keeps its coarse position
+ * for one step; so do points within half a patch of the frame border.
+ */
+class PatchRefiner {
+public:
+    PatchRefiner() = default;
+
+    PatchRefiner(const PatchRefiner &) = delete;
+    PatchRefiner &operator=(const PatchRefiner &) = delete;
+
+    /**
+     * @brief prepare
+     * collects the patches of the points to refine and builds the (level 0)
+     * pyramids of both mosaics
+     * @param prevGray the whole previous gray frame, empty if not at hand
+     * @param ids trajectory ids of the points
+     * @param prevPts positions at the previous frame
+     * @param estimates coarse positions at frameNumber (full resolution)
+     * @param status of the coarse step, only found points are refined
+     * @param factor the downscale factor, the patches leave room for an
+     * error of about two coarse pixels
+     * @return the number of points to refine
+     */
+    size_t prepare(size_t frameNumber, const cv::Mat &imgOriginal, FrameIngest::Format format,
+                   const cv::Mat &prevGray, const size_t *ids, const cv::Point2f *prevPts,
+                   const cv::Point2f *estimates, const uchar *status, size_t count,
+                   const cv::Size &winSize, int factor, ThreadPool *pool);
+
+    const std::vector<cv::Mat> &prevPyramid() const {
+        return m_prevPyr;
+    }
+    const std::vector<cv::Mat> &nextPyramid() const {
+        return m_nextPyr;
+    }
+
+    // the points to refine in mosaic coordinates, the LK step writes the
+    // other three
+    const cv::Point2f *prevPoints() const {
+        return m_prevPoints.data();
+    }
+    cv::Point2f *nextPoints() {
+        return m_nextPoints.data();
+    }
+    uchar *status() {
+        return m_status.data();
+    }
+    float *error() {
+        return m_error.data();
+    }
+
+    /**
+     * @brief apply
+     * replaces the estimates (and errors) of the points whose refined
+     * position stayed inside their patch and keeps the patches of the next
+     * frame for the next step; call it after every prepare()
+     */
+    void apply(size_t frameNumber, cv::Point2f *estimates, float *error);
+
+    /**
+     * @brief clear
+     * forgets the kept patches (e.g. another video)
+     */
+    void clear();
+
+private:
+    static const size_t noRow = static_cast<size_t>(-1);
+
+    /**
+     * @brief The Patch struct
+     * a point refined in this step, row of the mosaics
+     */
+    struct Patch {
+        size_t			entry;		// index of the point in the arrays of prepare()
+        size_t			id;
+        size_t			keptRow;	// the previous patch is this kept one, or ..
+        cv::Point		prevOrigin;	// .. taken from prevGray here
+        cv::Point		nextOrigin;
+    };
+
+    int					m_patchSize = 0;
+    cv::Size			m_winSize;
+    std::vector<Patch>	m_patches;
+    cv::Mat				m_prevMosaic;
+    cv::Mat				m_nextMosaic;
+    std::vector<cv::Mat> m_prevPyr;
+    std::vector<cv::Mat> m_nextPyr;
+    std::vector<cv::Point2f> m_prevPoints;
+    std::vector<cv::Point2f> m_nextPoints;
+    std::vector<uchar>	m_status;
+    std::vector<float>	m_error;
+
+    // the patches of the last step, a row per patch: valid for a point only
+    // if it is still at the position it was refined to
+    cv::Mat				m_keptMosaic;
+    int					m_keptPatchSize = 0;
+    size_t				m_keptFrame = 0;
+    bool				m_keptValid = false;
+    std::vector<size_t>	m_keptRow;		// trajectory id => row (noRow if none)
+    std::vector<size_t>	m_keptIds;		// the ids with a row, to reset m_keptRow
+    std::vector<cv::Point2f> m_keptPositions; // per row
+    std::vector<cv::Point> m_keptOrigins;	// per row, in the full frame
+
+    /**
+     * @brief isInside
+     * @return true if the LK window (and the derivatives) around a point at
+     * this position of a patch stay inside the patch
+     */
+    bool isInside(const cv::Point2f &local) const;
+};
@@ -0,0 +1,195 @@
+#include "PointGrid.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <limits>
+
+namespace {
+
+// keeps the cell coordinates of far away points within int
+const float maximumCellCoordinate = 1e9f;
+
+int cellCoordinate(float value, float cellSize) {
+    const float cell = std::floor(value / cellSize);
+    return static_cast<int>(std::max(-maximumCellCoordinate, std::min(maximumCellCoordinate, cell)));
+}
+
+float squaredDistance(const cv::Point2f &a, const cv::Point2f &b) {
+    const cv::Point2f d = a - b;
+    return d.x * d.x + d.y * d.y;
+}
+
+} // namespace
+
+PointGrid::PointGrid(float cellSize): m_cellSize(cellSize), m_count(0) {
+    assert(cellSize > 0.f);
+}
+
+void PointGrid::setCellSize(float cellSize) {
+    assert(cellSize > 0.f);
+    m_cellSize = cellSize;
+    clear();
+}
+
+void PointGrid::clear() {
+    m_cells.clear();
+    m_positions.clear();
+    m_cellKeys.clear();
+    m_indexed.clear();
+    m_count = 0;
+}
+
+void PointGrid::insertOrUpdate(size_t id, cv::Point2f position) {
+    if (!std::isfinite(position.x) || !std::isfinite(position.y)) {
+        remove(id);
+        return;
+    }
+
+    if (id >= m_indexed.size()) {
+        m_positions.resize(id + 1);
+        m_cellKeys.resize(id + 1, 0);
+        m_indexed.resize(id + 1, 0);
+    }
+
+    const cv::Point cell = cellOf(position);
+    const CellKey cellKey = key(cell.x, cell.y);
+    m_positions[id] = position;
+    if (m_indexed[id]) {
+        if (m_cellKeys[id] == cellKey) {
+            return;
+        }
+        remove(id);
+        m_positions[id] = position;
+    }
+
+    m_cells[cellKey].push_back(id);
+    m_cellKeys[id] = cellKey;
+    m_indexed[id] = 1;
+    m_count++;
+}
+
+void PointGrid::remove(size_t id) {
+    if (!contains(id)) {
+        return;
+    }
+
+    auto cell = m_cells.find(m_cellKeys[id]);
+    assert(cell != m_cells.end());
+    std::vector<size_t> &ids = cell->second;
+    auto entry = std::find(ids.begin(), ids.end(), id);
+    assert(entry != ids.end());
+    *entry = ids.back();
+    ids.pop_back();
+    if (ids.empty()) {
+        m_cells.erase(cell);
+    }
+
+    m_indexed[id] = 0;
+    m_count--;
+}
+
+bool PointGrid::nearest(cv::Point2f position, size_t &id) const {
+    if (m_count == 0) {
+        return false;
+    }
+
+    float best = std::numeric_limits<float>::max();
+    auto visit = [&](const std::vector<size_t> &ids) {
+        for (size_t candidate : ids) {
+            const float d = squaredDistance(m_positions[candidate], position);
+            if (d < best) {
+                best = d;
+                id = candidate;
+            }
+        }
+    };
+
+    // rings of cells around the cell of position: a point in ring r is at
+    // least (r - 1) cells away, so stop once that exceeds the best distance
+    const cv::Point center = cellOf(position);
+    size_t visited = 0;
+    for (int r = 0; ; r++) {
+        if (best != std::numeric_limits<float>::max()) {
+            const float reach = (r - 1) * m_cellSize;
+            if (reach > 0.f && reach * reach >= best) {
+                return true;
+            }
+        }
+        if (visited >= m_cells.size()) {
+            // the rings became bigger than the occupied cells
+            for (const auto &cell : m_cells) {
+                visit(cell.second);
+            }
+            return true;
+        }
+
+        for (int dy = -r; dy <= r; dy++) {
+            // the top and bottom row completely, in between only both ends
+            const int step = (dy == -r || dy == r) ? 1 : 2 * r;
+            for (int dx = -r; dx <= r; dx += step) {
+                visited++;
+                auto cell = m_cells.find(key(center.x + dx, center.y + dy));
+                if (cell != m_cells.end()) {
+                    visit(cell->second);
+                }
+            }
+        }
+    }
+}
+
+bool PointGrid::hasPointWithin(cv::Point2f position, float radius) const {
+    if (m_count == 0 || !(radius >= 0.f)) {
+        return false;
+    }
+
+    const float radius2 = radius * radius;
+    bool found = false;
+    forEachCell(cellOf(position - cv::Point2f(radius, radius)), cellOf(position + cv::Point2f(radius, radius)),
+                [&](const std::vector<size_t> &ids) {
+        for (size_t candidate : ids) {
+            if (!found && squaredDistance(m_positions[candidate], position) <= radius2) {
+                found = true;
+            }
+        }
+    });
+    return found;
+}
+
+void PointGrid::query(const cv::Rect2f &rect, std::vector<size_t> &ids) const {
+    if (m_count == 0 || rect.width <= 0.f || rect.height <= 0.f) {
+        return;
+    }
+
+    forEachCell(cellOf(rect.tl()), cellOf(rect.br()), [&](const std::vector<size_t> &cellIds) {
+        for (size_t candidate : cellIds) {
+            if (rect.contains(m_positions[candidate])) {
+                ids.push_back(candidate);
+            }
+        }
+    });
+}
+
+cv::Point PointGrid::cellOf(cv::Point2f position) const {
+    return cv::Point(cellCoordinate(position.x, m_cellSize), cellCoordinate(position.y, m_cellSize));
+}
+
+template<typename F>
+void PointGrid::forEachCell(const cv::Point &first, const cv::Point &last, F f) const {
+    const double cells = (static_cast<double>(last.x) - first.x + 1) * (static_cast<double>(last.y) - first.y + 1);
+    if (cells > static_cast<double>(m_cells.size())) {
+        for (const auto &cell : m_cells) {
+            f(cell.second);
+        }
+        return;
+    }
+
+    for (int y = first.y; y <= last.y; y++) {
+        for (int x = first.x; x <= last.x; x++) {
+            auto cell = m_cells.find(key(x, y));
+            if (cell != m_cells.end()) {
+                f(cell->second);
+            }
+        }
+    }
+}
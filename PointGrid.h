@@ -0,0 +1,99 @@
+#pragma once
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+/**
+ * @brief The PointGrid class
+ * A uniform grid over the positions of the points at a single frame, keyed
+ * by id, for picking and the distance checks of the GUI without scanning
+ * all points. Only the occupied cells are stored (in a hash map), so the
+ * grid needs no bounds and lost points far outside the frame cost nothing.
+ *
+ * Points are inserted, moved and removed one at a time; the queries fall
+ * back to scanning the occupied cells when the searched area covers more
+ * cells than are occupied.
+ */
+class PointGrid {
+public:
+    explicit PointGrid(float cellSize = 32.f);
+
+    /**
+     * @brief setCellSize
+     * changes the edge length of the cells, removes all points
+     */
+    void setCellSize(float cellSize);
+    float getCellSize() const {
+        return m_cellSize;
+    }
+
+    void clear();
+
+    size_t size() const {
+        return m_count;
+    }
+
+    bool contains(size_t id) const {
+        return id < m_indexed.size() && m_indexed[id];
+    }
+
+    /**
+     * @brief insertOrUpdate
+     * adds the point or moves it to the new position (points at a non
+     * finite position are removed)
+     */
+    void insertOrUpdate(size_t id, cv::Point2f position);
+
+    void remove(size_t id);
+
+    /**
+     * @brief nearest
+     * @param id OUT: the id of the point closest to position
+     * @return false if the grid is empty
+     */
+    bool nearest(cv::Point2f position, size_t &id) const;
+
+    /**
+     * @brief hasPointWithin
+     * @return true if a point lies within radius (inclusive) of position
+     */
+    bool hasPointWithin(cv::Point2f position, float radius) const;
+
+    /**
+     * @brief query
+     * appends the ids of all points inside rect to ids (in no particular
+     * order)
+     */
+    void query(const cv::Rect2f &rect, std::vector<size_t> &ids) const;
+
+private:
+    typedef uint64_t CellKey;
+
+    float					m_cellSize;
+    size_t					m_count;
+
+    // occupied cells => ids of their points
+    std::unordered_map<CellKey, std::vector<size_t>> m_cells;
+
+    // per id
+    std::vector<cv::Point2f> m_positions;
+    std::vector<CellKey>	m_cellKeys;
+    std::vector<uint8_t>	m_indexed;
+
+    cv::Point cellOf(cv::Point2f position) const;
+
+    static CellKey key(int x, int y) {
+        return (static_cast<CellKey>(static_cast<uint32_t>(x)) << 32) | static_cast<uint32_t>(y);
+    }
+
+    /**
+     * @brief forEachCell
+     * calls f with the ids of each occupied cell of the given range of cell
+     * coordinates (inclusive), or of all occupied cells if that is cheaper
+     */
+    template<typename F>
+    void forEachCell(const cv::Point &first, const cv::Point &last, F f) const;
+};
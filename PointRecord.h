@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+
+#include <opencv2/opencv.hpp>
+
+/**
+ * @brief The InterestPointStatus enum
+ * Show all the stati that the intrest points can yield
+ */
+enum class InterestPointStatus {
+    Valid, // The point is valid and can be tracked
+    Invalid,	// the point is not valid (due to the tracking)
+                // and should not be tracked!
+    Non_Existing,	// the point does not exist yet! (because the user
+                    // jumped back in time
+    Not_Tracked		// occures when only the active point is tracked.
+                    // All other points that are valid are set to this state
+                    // during the time only the active point is tracked
+};
+
+
+const size_t interestPointMaximumUserStatus = sizeof(size_t) * 8;
+
+/**
+ * @brief The PointRecord struct
+ * one point of a trajectory at one frame, the plain type of the tracking
+ * core; the plugin converts it to InterestPoint (a BioTracker ObjectModel)
+ * for serialization
+ */
+struct PointRecord {
+    cv::Point2f			position;
+    InterestPointStatus	status = InterestPointStatus::Valid;
+    size_t				userStatus = 0;	// one bit per user state
+};
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+/**
+ * @brief The PreparedFrame struct
+ * a gray frame together with its optical flow pyramid, either prepared
+ * ahead of the LK step (see TrackingPipeline) or kept from an earlier one
+ * (see FrameCache)
+ */
+struct PreparedFrame {
+    cv::Mat				gray;	// inside a buffer with a border (see FrameIngest)
+    std::vector<cv::Mat> pyramid;
+    int					levels = 0;		// the maxLevel the pyramid was built with
+    int					builtLevels = 0;
+    cv::Size			winSize;
+};
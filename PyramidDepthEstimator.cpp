@@ -0,0 +1,62 @@
+#include "PyramidDepthEstimator.h"
+
+#include <algorithm>
+#include <cassert>
+
+PyramidDepthEstimator::PyramidDepthEstimator(size_t historyLength):
+    m_history(historyLength, 0.f),
+    m_next(0),
+    m_count(0)
+{
+    assert(historyLength > 0);
+}
+
+void PyramidDepthEstimator::addFrame(float maxDisplacement) {
+    m_history[m_next] = maxDisplacement;
+    m_next = (m_next + 1) % m_history.size();
+    m_count = std::min(m_count + 1, m_history.size());
+}
+
+void PyramidDepthEstimator::clear() {
+    m_next = 0;
+    m_count = 0;
+}
+
+float PyramidDepthEstimator::expectedDisplacement() const {
+    float largest = 0.f;
+    for (size_t i = 0; i < m_count; i++) {
+        largest = std::max(largest, m_history[i]);
+    }
+    // points may accelerate; the extra pixel covers nearly static scenes
+    return 1.5f * largest + 1.f;
+}
+
+int PyramidDepthEstimator::maximumLevel(const cv::Size &imageSize, const cv::Size &winSize) {
+    int level = 0;
+    cv::Size size = imageSize;
+    while (level < 30) {
+        size = cv::Size((size.width + 1) / 2, (size.height + 1) / 2);
+        if (size.width <= winSize.width || size.height <= winSize.height) {
+            break;
+        }
+        level++;
+    }
+    return level;
+}
+
+int PyramidDepthEstimator::maxLevel(const cv::Size &imageSize, const cv::Size &winSize, int limit) const {
+    const int deepest = std::min(limit, maximumLevel(imageSize, winSize));
+    if (!hasHistory()) {
+        return deepest;
+    }
+
+    // LK converges reliably if the motion on the coarsest level is within a
+    // quarter of the window; keep at least one coarser level as a fallback
+    const float reach = 0.25f * std::min(winSize.width, winSize.height);
+    const float displacement = expectedDisplacement();
+    int level = 1;
+    while (level < deepest && displacement > reach * static_cast<float>(1 << level)) {
+        level++;
+    }
+    return std::min(level, deepest);
+}
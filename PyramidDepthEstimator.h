@@ -0,0 +1,67 @@
+#pragma once
+
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+/**
+ * @brief The PyramidDepthEstimator class
+ * Picks the number of pyramid levels for the next LK step from the image
+ * size, the window size and how far the points moved in the last few
+ * frames.
+ *
+ * Pyramidal LK only has to bring the motion down to a fraction of the
+ * window on the coarsest level, so small inter-frame motion needs only a
+ * few levels. Per frame only the largest displacement is kept (in a small
+ * ring buffer); without any history (first frame, after seeking) the full
+ * depth is used.
+ */
+class PyramidDepthEstimator {
+public:
+    /**
+     * @param historyLength number of recent frames the estimate is based on
+     */
+    explicit PyramidDepthEstimator(size_t historyLength = 8);
+
+    /**
+     * @brief addFrame
+     * records the largest displacement (in pixels) of the last LK step
+     */
+    void addFrame(float maxDisplacement);
+
+    /**
+     * @brief clear
+     * forgets the history (e.g. after seeking)
+     */
+    void clear();
+
+    bool hasHistory() const {
+        return m_count > 0;
+    }
+
+    /**
+     * @brief expectedDisplacement
+     * @return the displacement the next frame should be able to handle
+     * (the largest recent one plus a safety margin)
+     */
+    float expectedDisplacement() const;
+
+    /**
+     * @brief maximumLevel
+     * @return the deepest sensible level for the image and window size
+     * (the coarsest level must still be bigger than the window)
+     */
+    static int maximumLevel(const cv::Size &imageSize, const cv::Size &winSize);
+
+    /**
+     * @brief maxLevel
+     * @param limit the upper bound (e.g. the fixed depth of the tracker)
+     * @return the maxLevel for building the pyramids and for LK
+     */
+    int maxLevel(const cv::Size &imageSize, const cv::Size &winSize, int limit) const;
+
+private:
+    std::vector<float>	m_history;	// ring buffer of the largest displacement per frame
+    size_t				m_next;		// slot of the next frame
+    size_t				m_count;	// number of valid slots
+};
@@ -0,0 +1,157 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief The SnapshotPublisher class
+ * Hands immutable snapshots from a writer to readers that must never wait
+ * for it (the overlay drawing of the GUI thread while a tracking step runs).
+ *
+ * publish() swaps the current snapshot atomically and retires the old one,
+ * which is deleted as soon as no reader can hold it any more (epoch based
+ * reclamation): a Reader announces the epoch it started in before it loads
+ * the pointer, every publish() starts a new epoch, and a snapshot retired in
+ * epoch e is deleted once all announced epochs are newer than e. Neither
+ * side takes a lock.
+ *
+ * publish() must not run concurrently with itself (its callers serialize
+ * it); any number of threads may read, up to readerSlots at the same time
+ * (more readers wait for a free slot).
+ */
+template <typename T>
+class SnapshotPublisher {
+public:
+    /**
+     * @brief The Reader class
+     * pins the current snapshot for its lifetime (keep it short, it holds
+     * back the reclamation of all newer snapshots)
+     */
+    class Reader {
+    public:
+        explicit Reader(const SnapshotPublisher &publisher):
+            m_publisher(publisher),
+            m_slot(publisher.pin())
+        {
+            m_snapshot = publisher.m_current.load();
+        }
+
+        ~Reader() {
+            m_publisher.m_readers[m_slot].store(0);
+        }
+
+        Reader(const Reader &) = delete;
+        Reader &operator=(const Reader &) = delete;
+
+        // nullptr before the first publish()
+        const T *get() const {
+            return m_snapshot;
+        }
+
+        const T *operator->() const {
+            return m_snapshot;
+        }
+
+        explicit operator bool() const {
+            return m_snapshot != nullptr;
+        }
+
+    private:
+        const SnapshotPublisher &	m_publisher;
+        const size_t			m_slot;
+        const T *				m_snapshot;
+    };
+
+    SnapshotPublisher():
+        m_current(nullptr),
+        m_epoch(1)
+    {
+        for (std::atomic<uint64_t> &reader : m_readers) {
+            reader.store(0);
+        }
+    }
+
+    ~SnapshotPublisher() {
+        delete m_current.load();
+        for (const Retired &retired : m_retired) {
+            delete retired.snapshot;
+        }
+    }
+
+    SnapshotPublisher(const SnapshotPublisher &) = delete;
+    SnapshotPublisher &operator=(const SnapshotPublisher &) = delete;
+
+    /**
+     * @brief publish
+     * makes snapshot the current one (readers that started before keep
+     * the old one)
+     */
+    void publish(std::unique_ptr<const T> snapshot) {
+        const T *old = m_current.exchange(snapshot.release());
+        if (old) {
+            m_retired.push_back(Retired{ old, m_epoch.fetch_add(1) });
+        }
+        reclaim();
+    }
+
+    /**
+     * @brief retiredCount
+     * @return snapshots that are replaced but still pinned by a reader
+     */
+    size_t retiredCount() const {
+        return m_retired.size();
+    }
+
+private:
+    static const size_t readerSlots = 8;
+
+    struct Retired {
+        const T *		snapshot;
+        uint64_t		epoch;	// the epoch it was replaced in
+    };
+
+    // all atomics use sequential consistency: a reader that announces an
+    // epoch after a publish() started the next one sees the new snapshot
+    std::atomic<const T *>	m_current;
+    std::atomic<uint64_t>	m_epoch;
+    mutable std::atomic<uint64_t> m_readers[readerSlots];	// 0: free, else the epoch the reader started in
+    std::vector<Retired>	m_retired;	// only touched by publish()
+
+    size_t pin() const {
+        for (;;) {
+            for (size_t i = 0; i < readerSlots; i++) {
+                uint64_t expected = 0;
+                // an epoch that is outdated when stored only delays the reclamation
+                if (m_readers[i].compare_exchange_strong(expected, m_epoch.load())) {
+                    return i;
+                }
+            }
+            std::this_thread::yield();
+        }
+    }
+
+    void reclaim() {
+        uint64_t oldest = std::numeric_limits<uint64_t>::max();
+        for (const std::atomic<uint64_t> &reader : m_readers) {
+            const uint64_t epoch = reader.load();
+            if (epoch != 0) {
+                oldest = std::min(oldest, epoch);
+            }
+        }
+
+        // a reader that announced epoch e may hold anything retired in e or later
+        auto end = std::remove_if(m_retired.begin(), m_retired.end(), [oldest](const Retired &retired) {
+            if (retired.epoch < oldest) {
+                delete retired.snapshot;
+                return true;
+            }
+            return false;
+        });
+        m_retired.erase(end, m_retired.end());
+    }
+};
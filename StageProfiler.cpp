@@ -0,0 +1,149 @@
+#include "StageProfiler.h"
+
+#ifdef LUCASKANADE_PROFILING
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+
+namespace {
+
+const char *const stageNames[StageProfiler::stageCount] = {
+    "step", "convert", "pyramid", "optical flow", "refine", "commit", "user states", "trails", "paint", "overlay"
+};
+
+/**
+ * @brief percentile
+ * @param sorted durations in ns, ascending
+ * @return the given percentile in ms (nearest rank)
+ */
+double percentile(const std::vector<uint64_t> &sorted, double p) {
+    if (sorted.empty()) {
+        return 0.;
+    }
+    const size_t rank = static_cast<size_t>(p * (sorted.size() - 1) + 0.5);
+    return sorted[rank] * 1e-6;
+}
+
+} // namespace
+
+const char *StageProfiler::stageName(Stage stage) {
+    const size_t i = static_cast<size_t>(stage);
+    return i < stageCount ? stageNames[i] : "";
+}
+
+StageProfiler &StageProfiler::instance() {
+    static StageProfiler profiler;
+    return profiler;
+}
+
+StageProfiler::StageProfiler():
+    m_head(0),
+    m_slots(capacity),
+    m_threadCount(0)
+{
+}
+
+void StageProfiler::record(Stage stage, uint64_t start, uint64_t duration) {
+    // numbered on the first event, so the trace has a few short lanes
+    thread_local const uint32_t thread = m_threadCount.fetch_add(1, std::memory_order_relaxed);
+
+    const uint64_t index = m_head.fetch_add(1, std::memory_order_relaxed);
+    Slot &slot = m_slots[index & (capacity - 1)];
+    slot.sequence.store(2 * index + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.start.store(start, std::memory_order_relaxed);
+    slot.duration.store(duration, std::memory_order_relaxed);
+    slot.tag.store(static_cast<uint64_t>(stage) | static_cast<uint64_t>(thread) << 16, std::memory_order_relaxed);
+    slot.sequence.store(2 * index + 2, std::memory_order_release);
+}
+
+std::vector<StageProfiler::Event> StageProfiler::snapshot() const {
+    const uint64_t head = m_head.load(std::memory_order_acquire);
+    const uint64_t first = head > capacity ? head - capacity : 0;
+
+    std::vector<Event> events;
+    events.reserve(static_cast<size_t>(head - first));
+    for (uint64_t index = first; index < head; index++) {
+        const Slot &slot = m_slots[index & (capacity - 1)];
+        const uint64_t sequence = slot.sequence.load(std::memory_order_acquire);
+        if (sequence != 2 * index + 2) {
+            continue; // still written, or already overwritten by a newer event
+        }
+        Event event;
+        event.start = slot.start.load(std::memory_order_relaxed);
+        event.duration = slot.duration.load(std::memory_order_relaxed);
+        const uint64_t tag = slot.tag.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.sequence.load(std::memory_order_relaxed) != sequence) {
+            continue;
+        }
+        event.stage = static_cast<Stage>(tag & 0xffff);
+        event.thread = static_cast<uint32_t>(tag >> 16);
+        events.push_back(event);
+    }
+    return events;
+}
+
+std::array<StageProfiler::Summary, StageProfiler::stageCount> StageProfiler::summarize() const {
+    std::array<std::vector<uint64_t>, stageCount> durations;
+    for (const Event &event : snapshot()) {
+        const size_t i = static_cast<size_t>(event.stage);
+        if (i < stageCount) {
+            durations[i].push_back(event.duration);
+        }
+    }
+
+    std::array<Summary, stageCount> summaries;
+    for (size_t i = 0; i < stageCount; i++) {
+        std::vector<uint64_t> &sorted = durations[i];
+        std::sort(sorted.begin(), sorted.end());
+        summaries[i].count = sorted.size();
+        summaries[i].p50 = percentile(sorted, 0.5);
+        summaries[i].p99 = percentile(sorted, 0.99);
+    }
+    return summaries;
+}
+
+bool StageProfiler::writeChromeTrace(const std::string &path, std::string *error) const {
+    const std::vector<Event> events = snapshot();
+    uint64_t origin = 0;
+    if (!events.empty()) {
+        origin = events.front().start;
+        for (const Event &event : events) {
+            origin = std::min(origin, event.start);
+        }
+    }
+
+    std::ofstream out(path);
+    if (!out) {
+        if (error) {
+            *error = "cannot open " + path;
+        }
+        return false;
+    }
+
+    // complete events ("ph": "X"), the times in microseconds
+    out << "{\"traceEvents\":[";
+    char line[256];
+    for (size_t i = 0; i < events.size(); i++) {
+        const Event &event = events[i];
+        std::snprintf(line, sizeof(line),
+                      "%s\n{\"name\":\"%s\",\"cat\":\"lucaskanade\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,"
+                      "\"ts\":%.3f,\"dur\":%.3f}",
+                      i > 0 ? "," : "", stageName(event.stage), event.thread,
+                      (event.start - origin) * 1e-3, event.duration * 1e-3);
+        out << line;
+    }
+    out << "\n],\"displayTimeUnit\":\"ms\"}\n";
+
+    if (!out) {
+        if (error) {
+            *error = "cannot write " + path;
+        }
+        return false;
+    }
+    return true;
+}
+
+#endif
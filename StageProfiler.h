@@ -0,0 +1,143 @@
+#pragma once
+
+/**
+ * Scoped timers around the stages of a frame (conversion, pyramid, LK, ..),
+ * only compiled with LUCASKANADE_PROFILING (CMake option
+ * LUCASKANADE_ENABLE_PROFILING). Without it LK_PROFILE_SCOPE expands to
+ * nothing and StageProfiler does not exist, so a release build carries no
+ * trace of it.
+ *
+ *     void LucasKanadeCore::calcOpticalFlow(int maxLevel) {
+ *         LK_PROFILE_SCOPE(OpticalFlow);
+ *         ...
+ */
+#ifdef LUCASKANADE_PROFILING
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * @brief The StageProfiler class
+ * Collects the timed scopes of all threads in a fixed ring buffer (the last
+ * `capacity` scopes). Recording is lock-free: a writer claims a slot with a
+ * single fetch_add and publishes it with a sequence number, a reader skips
+ * slots that are written or overwritten meanwhile (like a seqlock), so
+ * neither side ever waits for the other.
+ */
+class StageProfiler {
+public:
+    enum class Stage : uint16_t {
+        Step,			// LucasKanadeCore::track() as a whole
+        Convert,		// the frame (or tiles of it) to gray
+        Pyramid,
+        OpticalFlow,
+        Refine,			// the full resolution patches of the downscaled tracking
+        Commit,			// the LK results into the trajectories
+        UserStates,
+        Trails,
+        Paint,			// the plugin's paint()
+        Overlay			// the plugin's paintOverlay()
+    };
+    static const size_t stageCount = 10;
+
+    static const char *stageName(Stage stage);
+
+    struct Event {
+        Stage			stage;
+        uint32_t		thread;		// small number per thread, in the order of their first event
+        uint64_t		start;		// ns (steady clock)
+        uint64_t		duration;	// ns
+    };
+
+    struct Summary {
+        size_t			count = 0;	// scopes in the ring buffer
+        double			p50 = 0.;	// ms
+        double			p99 = 0.;	// ms
+    };
+
+    /**
+     * @brief Scope
+     * records the time from its construction to its destruction
+     */
+    class Scope {
+    public:
+        explicit Scope(Stage stage):
+            m_stage(stage),
+            m_start(now())
+        {
+        }
+
+        ~Scope() {
+            instance().record(m_stage, m_start, now() - m_start);
+        }
+
+        Scope(const Scope &) = delete;
+        Scope &operator=(const Scope &) = delete;
+
+    private:
+        const Stage		m_stage;
+        const uint64_t	m_start;
+    };
+
+    static StageProfiler &instance();
+
+    static uint64_t now() {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+
+    void record(Stage stage, uint64_t start, uint64_t duration);
+
+    /**
+     * @brief snapshot
+     * @return the events in the ring buffer, oldest first
+     */
+    std::vector<Event> snapshot() const;
+
+    /**
+     * @brief summarize
+     * @return the rolling median and 99th percentile of every stage (over
+     * the events in the ring buffer), indexed by Stage
+     */
+    std::array<Summary, stageCount> summarize() const;
+
+    /**
+     * @brief writeChromeTrace
+     * writes the events in the trace_event JSON format (chrome://tracing,
+     * Perfetto), one lane per thread
+     * @param error OUT: the reason if writing failed
+     */
+    bool writeChromeTrace(const std::string &path, std::string *error = nullptr) const;
+
+private:
+    static const size_t capacity = size_t(1) << 14;
+
+    // all fields are atomic, a reader may look at a slot while it is written
+    struct Slot {
+        std::atomic<uint64_t> sequence{0};	// 2 * index + 1 while written, + 2 when done
+        std::atomic<uint64_t> start{0};
+        std::atomic<uint64_t> duration{0};
+        std::atomic<uint64_t> tag{0};		// stage | thread << 16
+    };
+
+    std::atomic<uint64_t>	m_head;		// events recorded so far
+    std::vector<Slot>		m_slots;
+    std::atomic<uint32_t>	m_threadCount;
+
+    StageProfiler();
+};
+
+#define LK_PROFILE_CONCAT_(a, b) a##b
+#define LK_PROFILE_CONCAT(a, b) LK_PROFILE_CONCAT_(a, b)
+#define LK_PROFILE_SCOPE(stage) \
+    const StageProfiler::Scope LK_PROFILE_CONCAT(profileScope_, __LINE__)(StageProfiler::Stage::stage)
+
+#else
+
+#define LK_PROFILE_SCOPE(stage)
+
+#endif
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+
+/**
+ * The checks of the test executables (lucaskanade.test.*, run by ctest): a
+ * failed CHECK prints the condition and its location and the test goes on,
+ * main() returns testResult().
+ */
+namespace TestCheck {
+
+inline size_t &failures() {
+    static size_t count = 0;
+    return count;
+}
+
+inline bool check(bool condition, const char *text, const char *file, int line) {
+    if (!condition) {
+        std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", file, line, text);
+        failures()++;
+    }
+    return condition;
+}
+
+inline int testResult() {
+    if (failures() > 0) {
+        std::fprintf(stderr, "%zu checks failed\n", failures());
+        return EXIT_FAILURE;
+    }
+    std::printf("all checks passed\n");
+    return EXIT_SUCCESS;
+}
+
+} // namespace TestCheck
+
+// evaluates to the condition, e.g. to stop a loop after the first failure
+#define CHECK(condition) TestCheck::check((condition), #condition, __FILE__, __LINE__)
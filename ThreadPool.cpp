@@ -0,0 +1,138 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(size_t threadCount):
+    m_task(nullptr),
+    m_pending(0),
+    m_generation(0),
+    m_stop(false)
+{
+    if (threadCount == 0) {
+        threadCount = std::max<size_t>(1, std::thread::hardware_concurrency());
+    }
+    for (size_t i = 0; i < threadCount; i++) {
+        m_queues.push_back(std::unique_ptr<Queue>(new Queue()));
+    }
+    for (size_t i = 1; i < threadCount; i++) {
+        m_workers.push_back(std::thread(&ThreadPool::workerLoop, this, i));
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(m_wakeMutex);
+        m_stop = true;
+    }
+    m_wake.notify_all();
+    for (std::thread &worker : m_workers) {
+        worker.join();
+    }
+}
+
+void ThreadPool::parallelFor(size_t taskCount, const Task &task) {
+    if (taskCount == 0) {
+        return;
+    }
+    if (m_workers.empty() || taskCount == 1) {
+        for (size_t i = 0; i < taskCount; i++) {
+            task(i);
+        }
+        return;
+    }
+
+    m_task = &task;
+    m_error = nullptr;
+    m_pending = taskCount;
+
+    // contiguous blocks keep neighbouring tasks on the same thread
+    const size_t n = m_queues.size();
+    for (size_t q = 0; q < n; q++) {
+        const size_t begin = taskCount * q / n;
+        const size_t end = taskCount * (q + 1) / n;
+        std::lock_guard<std::mutex> lock(m_queues[q]->mutex);
+        for (size_t i = begin; i < end; i++) {
+            m_queues[q]->tasks.push_back(i);
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_wakeMutex);
+        m_generation++;
+    }
+    m_wake.notify_all();
+
+    size_t t;
+    while (takeTask(0, t)) {
+        runTask(t);
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(m_doneMutex);
+        m_done.wait(lock, [this]() { return m_pending == 0; });
+    }
+    m_task = nullptr;
+
+    if (m_error) {
+        std::rethrow_exception(m_error);
+    }
+}
+
+void ThreadPool::workerLoop(size_t index) {
+    size_t seenGeneration = 0;
+    while (true) {
+        size_t t;
+        while (takeTask(index, t)) {
+            runTask(t);
+        }
+
+        std::unique_lock<std::mutex> lock(m_wakeMutex);
+        m_wake.wait(lock, [this, seenGeneration]() {
+            return m_stop || m_generation != seenGeneration;
+        });
+        if (m_stop) {
+            return;
+        }
+        seenGeneration = m_generation;
+    }
+}
+
+bool ThreadPool::takeTask(size_t index, size_t &task) {
+    {
+        Queue &own = *m_queues[index];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty()) {
+            task = own.tasks.front();
+            own.tasks.pop_front();
+            return true;
+        }
+    }
+
+    // steal from the back, far away from where the owner is working
+    for (size_t i = 1; i < m_queues.size(); i++) {
+        Queue &other = *m_queues[(index + i) % m_queues.size()];
+        std::lock_guard<std::mutex> lock(other.mutex);
+        if (!other.tasks.empty()) {
+            task = other.tasks.back();
+            other.tasks.pop_back();
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::runTask(size_t task) {
+    try {
+        (*m_task)(task);
+    } catch (...) {
+        std::lock_guard<std::mutex> lock(m_errorMutex);
+        if (!m_error) {
+            m_error = std::current_exception();
+        }
+    }
+
+    if (--m_pending == 0) {
+        std::lock_guard<std::mutex> lock(m_doneMutex);
+        m_done.notify_all();
+    }
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief The ThreadPool class
+ * A small work-stealing pool for data parallel loops. parallelFor() hands out
+ * the task indices in contiguous blocks, one block per thread; a thread that
+ * runs out of work steals single tasks from the end of the other blocks.
+ *
+ * The calling thread takes part in the work, so a pool of threadCount
+ * threads only starts threadCount - 1 workers.
+ */
+class ThreadPool {
+public:
+    typedef std::function<void(size_t task)> Task;
+
+    /**
+     * @param threadCount number of threads working on a loop (including the
+     * calling thread), 0 means one per hardware thread
+     */
+    explicit ThreadPool(size_t threadCount);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    size_t threadCount() const {
+        return m_queues.size();
+    }
+
+    /**
+     * @brief parallelFor
+     * runs task(0) .. task(taskCount - 1) on the pool and blocks until all
+     * of them are finished. The first exception thrown by a task is
+     * rethrown here. Not reentrant: must not be called from inside a task.
+     */
+    void parallelFor(size_t taskCount, const Task &task);
+
+private:
+    struct Queue {
+        std::mutex			mutex;
+        std::deque<size_t>	tasks;
+    };
+
+    std::vector<std::unique_ptr<Queue>> m_queues; // one per thread, [0] is the caller
+    std::vector<std::thread> m_workers;
+
+    const Task			*m_task;
+    std::atomic<size_t>	m_pending;
+    std::exception_ptr	m_error;
+    std::mutex			m_errorMutex;
+
+    std::mutex			m_wakeMutex;
+    std::condition_variable m_wake;
+    size_t				m_generation;
+    bool				m_stop;
+
+    std::mutex			m_doneMutex;
+    std::condition_variable m_done;
+
+    void workerLoop(size_t index);
+
+    /**
+     * @brief takeTask
+     * pops from the own queue or steals from the others
+     * @return false if there is no work left
+     */
+    bool takeTask(size_t index, size_t &task);
+
+    void runTask(size_t task);
+};
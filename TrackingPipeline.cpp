@@ -0,0 +1,121 @@
+#include "TrackingPipeline.h"
+
+#include <cassert>
+
+TrackingPipeline::TrackingPipeline(LucasKanadeCore &core, size_t capacity):
+    m_core(core),
+    m_capacity(capacity > 0 ? capacity : 1),
+    m_depthHint(0)
+{
+}
+
+TrackingPipeline::~TrackingPipeline() {
+    stop();
+}
+
+void TrackingPipeline::start(size_t firstFrame, FrameSource source) {
+    stop();
+
+    m_finished = false;
+    m_stop = false;
+    m_depthHint = m_core.getMaximumPyramidLevel();
+    // the parameters are copied, the worker never touches the core
+    m_worker = std::thread(&TrackingPipeline::run, this, firstFrame, std::move(source),
+                           m_core.getInputFormat(), m_core.getWinSize());
+}
+
+void TrackingPipeline::stop() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_changed.notify_all();
+    if (m_worker.joinable()) {
+        m_worker.join();
+    }
+
+    // drain: keep the buffers for the next start()
+    while (!m_queue.empty()) {
+        m_free.push_back(std::move(m_queue.front()));
+        m_queue.pop_front();
+    }
+    if (m_current) {
+        m_free.push_back(std::move(m_current));
+    }
+    m_finished = true;
+}
+
+bool TrackingPipeline::trackNext(size_t &frameNumber, const cv::Mat **frame, bool *somePointsAreInvalid) {
+    std::unique_ptr<Item> item;
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        // the frame of the last call may be overwritten from now on
+        if (m_current) {
+            m_free.push_back(std::move(m_current));
+            m_changed.notify_all();
+        }
+        m_changed.wait(lock, [this]() { return !m_queue.empty() || m_finished; });
+        if (m_queue.empty()) {
+            return false;
+        }
+        item = std::move(m_queue.front());
+        m_queue.pop_front();
+    }
+    m_changed.notify_all();
+
+    const bool invalid = m_core.track(item->frameNumber, item->prepared);
+    m_depthHint = m_core.pyramidDepth(FrameIngest::graySize(item->frame, m_core.getInputFormat()));
+
+    frameNumber = item->frameNumber;
+    if (frame) {
+        *frame = &item->frame;
+    }
+    if (somePointsAreInvalid) {
+        *somePointsAreInvalid = invalid;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_current = std::move(item);
+    return true;
+}
+
+void TrackingPipeline::run(size_t firstFrame, FrameSource source, FrameIngest::Format format, cv::Size winSize) {
+    for (size_t frameNumber = firstFrame; ; frameNumber++) {
+        // wait for a free slot (the queue plus the item the caller still uses)
+        std::unique_ptr<Item> item;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_changed.wait(lock, [this]() { return m_stop || m_queue.size() < m_capacity; });
+            if (m_stop) {
+                return;
+            }
+            if (!m_free.empty()) {
+                item = std::move(m_free.back());
+                m_free.pop_back();
+            }
+        }
+        if (!item) {
+            item.reset(new Item());
+        }
+
+        const bool read = source(item->frame);
+        if (read) {
+            item->frameNumber = frameNumber;
+            LucasKanadeCore::prepareFrame(item->frame, format, winSize, m_depthHint, item->prepared);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (read) {
+                m_queue.push_back(std::move(item));
+            } else {
+                m_free.push_back(std::move(item));
+                m_finished = true;
+            }
+        }
+        m_changed.notify_all();
+        if (!read) {
+            return;
+        }
+    }
+}
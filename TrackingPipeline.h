@@ -0,0 +1,91 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "LucasKanadeCore.h"
+
+/**
+ * @brief The TrackingPipeline class
+ * Tracks a sequence of frames with two stages: a worker thread reads the
+ * next frames and prepares them (gray + pyramid, see
+ * LucasKanadeCore::prepareFrame()) into a bounded queue while the calling
+ * thread runs the LK steps and the trajectory updates on the frames in
+ * order. With both stages busy a frame takes about as long as the slower
+ * stage instead of the sum of both.
+ *
+ * The preparation does not depend on the points, so adding or editing
+ * points between two steps is fine. After seeking (or to change the input
+ * format) the pipeline has to be restarted, which drops the prefetched
+ * frames; a changed window size or a deeper pyramid is handled by the core
+ * per frame.
+ */
+class TrackingPipeline {
+public:
+    /**
+     * @brief FrameSource
+     * reads the next frame into the given matrix (called on the worker
+     * thread), false at the end of the sequence
+     */
+    typedef std::function<bool(cv::Mat &frame)> FrameSource;
+
+    /**
+     * @param capacity number of frames that may be prepared in advance
+     */
+    explicit TrackingPipeline(LucasKanadeCore &core, size_t capacity = 2);
+    ~TrackingPipeline();
+
+    /**
+     * @brief start
+     * (re)starts the worker; the first frame of source gets the number
+     * firstFrame. Takes the input format and window size of the core.
+     */
+    void start(size_t firstFrame, FrameSource source);
+
+    /**
+     * @brief trackNext
+     * tracks the next frame (waits until it is prepared)
+     * @param frameNumber OUT: the number of the tracked frame
+     * @param frame OUT (optional): the frame as read from the source, valid
+     * until the next call
+     * @param somePointsAreInvalid OUT (optional): the result of track()
+     * @return false at the end of the sequence
+     */
+    bool trackNext(size_t &frameNumber, const cv::Mat **frame = nullptr, bool *somePointsAreInvalid = nullptr);
+
+    /**
+     * @brief stop
+     * stops the worker and drops all prefetched frames
+     */
+    void stop();
+
+private:
+    struct Item {
+        size_t			frameNumber = 0;
+        cv::Mat			frame;
+        PreparedFrame		prepared;
+    };
+
+    LucasKanadeCore &	m_core;
+    const size_t		m_capacity;
+
+    std::thread			m_worker;
+    std::mutex			m_mutex;
+    std::condition_variable m_changed;
+    std::deque<std::unique_ptr<Item>> m_queue;	// prepared, in frame order
+    std::vector<std::unique_ptr<Item>> m_free;	// consumed items, their buffers are reused
+    std::unique_ptr<Item> m_current;			// the item of the last trackNext()
+    bool				m_finished = true;	// the worker reached the end of the source
+    bool				m_stop = false;
+
+    // the pyramid depth the core asked for last, a hint for the worker
+    std::atomic<int>	m_depthHint;
+
+    void run(size_t firstFrame, FrameSource source, FrameIngest::Format format, cv::Size winSize);
+};
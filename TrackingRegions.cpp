@@ -0,0 +1,101 @@
+#include "TrackingRegions.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+namespace {
+
+int alignDown(int value, int alignment) {
+    return value >= 0 ? value / alignment * alignment : -((-value + alignment - 1) / alignment * alignment);
+}
+
+int alignUp(int value, int alignment) {
+    return -alignDown(-value, alignment);
+}
+
+} // namespace
+
+int TrackingRegions::padding(const cv::Size &winSize, int maxLevel, float expectedDisplacement) {
+    // on level L the window covers (win / 2 + 1) << L pixels of the full
+    // frame, the 5x5 pyramid filters and the derivatives add a few more
+    const int halfWin = std::max(winSize.width, winSize.height) / 2;
+    return ((halfWin + 4) << maxLevel) + static_cast<int>(std::ceil(std::max(expectedDisplacement, 0.f)));
+}
+
+void TrackingRegions::compute(const cv::Point2f *positions, size_t count, int padding, int alignment,
+                              const cv::Rect &bounds) {
+    assert(alignment > 0);
+
+    m_tiles.resize(count);
+    for (size_t i = 0; i < count; i++) {
+        const int x = static_cast<int>(std::floor(positions[i].x));
+        const int y = static_cast<int>(std::floor(positions[i].y));
+        const int x0 = alignDown(x - padding, alignment);
+        const int y0 = alignDown(y - padding, alignment);
+        const int x1 = alignUp(x + padding + 1, alignment);
+        const int y1 = alignUp(y + padding + 1, alignment);
+
+        Tile &tile = m_tiles[i];
+        tile.rect = cv::Rect(x0, y0, x1 - x0, y1 - y0) & bounds;
+        tile.entries.assign(1, i);
+    }
+
+    // merge overlapping tiles until all are disjoint (a merged tile may
+    // overlap tiles it did not overlap before); only meant for a few points
+    bool merged = true;
+    while (merged) {
+        merged = false;
+        for (size_t i = 0; i < m_tiles.size(); i++) {
+            size_t j = i + 1;
+            while (j < m_tiles.size()) {
+                Tile &a = m_tiles[i];
+                Tile &b = m_tiles[j];
+                if (a.rect.area() > 0 && b.rect.area() > 0 && (a.rect & b.rect).area() > 0) {
+                    a.rect |= b.rect;
+                    a.entries.insert(a.entries.end(), b.entries.begin(), b.entries.end());
+                    std::swap(b, m_tiles.back());
+                    m_tiles.pop_back();
+                    merged = true;
+                } else {
+                    j++;
+                }
+            }
+        }
+    }
+}
+
+void TrackingRegions::cover(const cv::Rect &rect, size_t count) {
+    m_tiles.resize(1);
+    m_tiles[0].rect = rect;
+    m_tiles[0].entries.resize(count);
+    for (size_t i = 0; i < count; i++) {
+        m_tiles[0].entries[i] = i;
+    }
+}
+
+size_t TrackingRegions::area() const {
+    size_t pixels = 0;
+    for (const Tile &tile : m_tiles) {
+        pixels += static_cast<size_t>(tile.rect.area());
+    }
+    return pixels;
+}
+
+bool TrackingRegions::isCoveredBy(const std::vector<cv::Rect> &regions) const {
+    for (const Tile &tile : m_tiles) {
+        if (tile.rect.area() > 0 && !contains(regions, tile.rect)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool TrackingRegions::contains(const std::vector<cv::Rect> &regions, const cv::Rect &rect) {
+    for (const cv::Rect &region : regions) {
+        if ((region & rect) == rect) {
+            return true;
+        }
+    }
+    return false;
+}
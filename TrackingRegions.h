@@ -0,0 +1,73 @@
+#pragma once
+
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+/**
+ * @brief The TrackingRegions class
+ * The parts of a frame the LK step of a few points actually reads: a padded
+ * window around every point, overlapping windows merged into disjoint
+ * tiles. LucasKanadeCore converts and builds pyramids only on these tiles
+ * when just a handful of points is tracked.
+ *
+ * The tiles are aligned to a multiple of 2^maxLevel (see compute()) so their
+ * pyramids sample the same pixels as the pyramid of the full frame.
+ */
+class TrackingRegions {
+public:
+    struct Tile {
+        cv::Rect			rect;
+        std::vector<size_t>	entries; // indices of the points inside the tile
+    };
+
+    /**
+     * @brief padding
+     * @param expectedDisplacement how far the points may move (pixels)
+     * @return the distance around a point the LK step may read with the
+     * given pyramid depth: the window on the coarsest level plus the
+     * support of the pyramid filters, plus the motion
+     */
+    static int padding(const cv::Size &winSize, int maxLevel, float expectedDisplacement);
+
+    /**
+     * @brief compute
+     * computes the tiles around the given points
+     * @param alignment the tile corners are rounded outwards to multiples of
+     * it (before clipping to bounds)
+     * @param bounds the tiles are clipped to it (the frame or the arena);
+     * points outside of it end up in a tile with an empty rect
+     */
+    void compute(const cv::Point2f *positions, size_t count, int padding, int alignment, const cv::Rect &bounds);
+
+    /**
+     * @brief cover
+     * a single tile with all count points
+     */
+    void cover(const cv::Rect &rect, size_t count);
+
+    const std::vector<Tile> &tiles() const {
+        return m_tiles;
+    }
+
+    /**
+     * @brief area
+     * @return the number of pixels of all tiles
+     */
+    size_t area() const;
+
+    /**
+     * @brief isCoveredBy
+     * @return true if every (non-empty) tile lies within one of the regions
+     */
+    bool isCoveredBy(const std::vector<cv::Rect> &regions) const;
+
+    /**
+     * @brief contains
+     * @return true if rect lies within one of the regions
+     */
+    static bool contains(const std::vector<cv::Rect> &regions, const cv::Rect &rect);
+
+private:
+    std::vector<Tile>	m_tiles;
+};
@@ -0,0 +1,57 @@
+#include "TrailCache.h"
+
+TrailCache::TrailCache() {
+
+}
+
+void TrailCache::setLength(size_t length) {
+    if (length != m_slots.size()) {
+        m_slots.assign(length, Slot());
+    }
+}
+
+void TrailCache::update(size_t frameNumber, const std::vector<Trajectory> &trajectories) {
+    if (!m_slots.empty()) {
+        fill(m_slots[frameNumber % m_slots.size()], frameNumber, trajectories);
+    }
+}
+
+void TrailCache::invalidateFrame(size_t frameNumber) {
+    if (!m_slots.empty()) {
+        Slot &slot = m_slots[frameNumber % m_slots.size()];
+        if (slot.frameNumber == frameNumber) {
+            slot.valid = false;
+        }
+    }
+}
+
+void TrailCache::clear() {
+    for (Slot &slot : m_slots) {
+        slot.valid = false;
+    }
+}
+
+const std::vector<cv::Point2f> &TrailCache::positions(size_t frameNumber, const std::vector<Trajectory> &trajectories) {
+    if (m_slots.empty()) {
+        return m_noPositions;
+    }
+    Slot &slot = m_slots[frameNumber % m_slots.size()];
+    if (!slot.valid || slot.frameNumber != frameNumber) {
+        fill(slot, frameNumber, trajectories);
+    } else if (slot.positions.size() < trajectories.size()) {
+        // points created since then have no data at this frame (otherwise the
+        // frame would have been invalidated)
+        slot.positions.resize(trajectories.size(), cv::Point2f(-1, -1));
+    }
+    return slot.positions;
+}
+
+void TrailCache::fill(Slot &slot, size_t frameNumber, const std::vector<Trajectory> &trajectories) {
+    slot.positions.resize(trajectories.size());
+    for (size_t i = 0; i < trajectories.size(); i++) {
+        const Trajectory &o = trajectories[i];
+        slot.positions[i] = o.hasValuesAtFrame(frameNumber) ? o.getPosition(frameNumber) : cv::Point2f(-1, -1);
+    }
+    slot.frameNumber = frameNumber;
+    slot.valid = true;
+}
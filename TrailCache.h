@@ -0,0 +1,65 @@
+#pragma once
+
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include "Trajectory.h"
+
+/**
+ * @brief The TrailCache class
+ * Caches the positions of all trajectories for the last few frames so that
+ * the history overlay does not have to query every trajectory for every
+ * history step on each repaint.
+ *
+ * The frames are kept in a ring buffer (slot = frame % length), so moving
+ * one frame forward only computes the single new frame and the old ones
+ * stay in place. track() fills the slot of every frame it writes, edits
+ * invalidate the slot of the edited frame.
+ */
+class TrailCache {
+public:
+    TrailCache();
+
+    /**
+     * @brief setLength
+     * changes the number of cached frames, 0 disables the cache
+     */
+    void setLength(size_t length);
+
+    size_t getLength() const {
+        return m_slots.size();
+    }
+
+    /**
+     * @brief update
+     * (re)computes the positions of the given frame if the cache is enabled
+     */
+    void update(size_t frameNumber, const std::vector<Trajectory> &trajectories);
+
+    void invalidateFrame(size_t frameNumber);
+
+    void clear();
+
+    /**
+     * @brief positions
+     * @return the positions of all trajectories at the given frame, indexed
+     * by id; trajectories without data at that frame are at (-1, -1). Empty
+     * if the cache is disabled. The vector is the slot of the frame, so it
+     * changes with the next call for a frame in the same slot: at most
+     * getLength() consecutive frames can be used at the same time.
+     */
+    const std::vector<cv::Point2f> &positions(size_t frameNumber, const std::vector<Trajectory> &trajectories);
+
+private:
+    struct Slot {
+        bool valid = false;
+        size_t frameNumber = 0;
+        std::vector<cv::Point2f> positions;
+    };
+
+    std::vector<Slot> m_slots;
+    const std::vector<cv::Point2f> m_noPositions; // for a disabled cache
+
+    void fill(Slot &slot, size_t frameNumber, const std::vector<Trajectory> &trajectories);
+};
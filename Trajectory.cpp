@@ -0,0 +1,467 @@
+#include "Trajectory.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <utility>
+
+namespace {
+const uint8_t nonExisting = static_cast<uint8_t>(InterestPointStatus::Non_Existing);
+const size_t blockFrames = TrajectoryPool::blockFrames;
+
+void putVarint(std::vector<uint8_t> &out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<uint8_t>(value) | 0x80);
+        value >>= 7;
+    }
+    out.push_back(static_cast<uint8_t>(value));
+}
+
+uint64_t getVarint(const uint8_t *&in) {
+    uint64_t value = 0;
+    for (unsigned shift = 0;; shift += 7) {
+        const uint8_t byte = *in++;
+        value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return value;
+        }
+    }
+}
+
+/**
+ * @brief packBlock
+ * appends the packed form of a block to out:
+ *  - the status column as runs (status byte, varint length)
+ *  - the user status column as runs (varint value, varint length)
+ *  - x, then y of the frames with data as varints of the zigzag coded
+ *    difference of the float bits to the frame before, which is small for
+ *    a point that moves a few pixels (lossless, unlike fixed point)
+ */
+void packBlock(const TrajectoryPool::Block &block, std::vector<uint8_t> &out) {
+    for (size_t i = 0; i < blockFrames;) {
+        size_t run = 1;
+        while (i + run < blockFrames && block.status[i + run] == block.status[i]) {
+            run++;
+        }
+        out.push_back(block.status[i]);
+        putVarint(out, run);
+        i += run;
+    }
+    for (size_t i = 0; i < blockFrames;) {
+        size_t run = 1;
+        while (i + run < blockFrames && block.userStatus[i + run] == block.userStatus[i]) {
+            run++;
+        }
+        putVarint(out, block.userStatus[i]);
+        putVarint(out, run);
+        i += run;
+    }
+    for (const float *column : { block.x, block.y }) {
+        uint32_t previous = 0;
+        for (size_t i = 0; i < blockFrames; i++) {
+            if (block.status[i] != nonExisting) {
+                uint32_t bits;
+                std::memcpy(&bits, &column[i], sizeof(bits));
+                const uint32_t delta = bits - previous;
+                putVarint(out, (delta << 1) ^ (0u - (delta >> 31)));
+                previous = bits;
+            }
+        }
+    }
+}
+
+void unpackBlock(const std::vector<uint8_t> &packed, TrajectoryPool::Block &block) {
+    const uint8_t *in = packed.data();
+    for (size_t i = 0; i < blockFrames;) {
+        const uint8_t status = *in++;
+        const size_t run = static_cast<size_t>(getVarint(in));
+        std::memset(block.status + i, status, run);
+        i += run;
+    }
+    for (size_t i = 0; i < blockFrames;) {
+        const size_t userStatus = static_cast<size_t>(getVarint(in));
+        const size_t run = static_cast<size_t>(getVarint(in));
+        std::fill(block.userStatus + i, block.userStatus + i + run, userStatus);
+        i += run;
+    }
+    for (float *column : { block.x, block.y }) {
+        uint32_t previous = 0;
+        for (size_t i = 0; i < blockFrames; i++) {
+            uint32_t bits = 0;
+            if (block.status[i] != nonExisting) {
+                const uint32_t zigzag = static_cast<uint32_t>(getVarint(in));
+                bits = previous + ((zigzag >> 1) ^ (0u - (zigzag & 1)));
+                previous = bits;
+            }
+            std::memcpy(&column[i], &bits, sizeof(bits));
+        }
+    }
+    assert(in == packed.data() + packed.size());
+}
+}
+
+Trajectory::Trajectory(size_t id, std::shared_ptr<TrajectoryPool> pool):
+    m_id(id),
+    m_firstFrame(0),
+    m_count(0),
+    m_blockStart(0),
+    m_pool(pool ? std::move(pool) : TrajectoryPool::shared())
+{
+
+}
+
+Trajectory::Trajectory(const Trajectory &other, std::shared_ptr<TrajectoryPool> pool):
+    m_id(other.m_id),
+    m_firstFrame(other.m_firstFrame),
+    m_count(other.m_count),
+    m_blockStart(other.m_blockStart),
+    m_pool(pool ? std::move(pool) : TrajectoryPool::shared()),
+    m_spans(other.m_spans)
+{
+    // packed blocks stay packed
+    m_blocks.resize(other.m_blocks.size());
+    for (size_t b = 0; b < m_blocks.size(); b++) {
+        const BlockSlot &slot = other.m_blocks[b];
+        if (slot.block) {
+            m_blocks[b].block = m_pool->acquire();
+            std::memcpy(m_blocks[b].block, slot.block, sizeof(Block));
+        } else {
+            m_blocks[b].packed = slot.packed;
+            m_pool->notePacked(slot.packed.size(), 0);
+        }
+    }
+}
+
+Trajectory::Trajectory(const Trajectory &other):
+    Trajectory(other, other.m_pool)
+{
+
+}
+
+Trajectory::Trajectory(Trajectory &&other) noexcept:
+    m_id(other.m_id),
+    m_firstFrame(other.m_firstFrame),
+    m_count(other.m_count),
+    m_blockStart(other.m_blockStart),
+    m_blocks(std::move(other.m_blocks)),
+    m_pool(other.m_pool), // other keeps its pool, it may be reused
+    m_readCache(other.m_readCache),
+    m_readCacheIndex(other.m_readCacheIndex),
+    m_spans(std::move(other.m_spans))
+{
+    other.m_blocks.clear();
+    other.m_spans.clear();
+    other.m_count = 0;
+    other.m_readCache = nullptr;
+    other.m_readCacheIndex = noBlock;
+}
+
+Trajectory &Trajectory::operator=(Trajectory other) noexcept {
+    std::swap(m_id, other.m_id);
+    std::swap(m_firstFrame, other.m_firstFrame);
+    std::swap(m_count, other.m_count);
+    std::swap(m_blockStart, other.m_blockStart);
+    std::swap(m_blocks, other.m_blocks);
+    std::swap(m_pool, other.m_pool);
+    std::swap(m_readCache, other.m_readCache);
+    std::swap(m_readCacheIndex, other.m_readCacheIndex);
+    std::swap(m_spans, other.m_spans);
+    return *this;
+}
+
+Trajectory::~Trajectory() {
+    releaseBlocks();
+}
+
+void Trajectory::releaseReadCache() const {
+    if (m_readCache) {
+        m_pool->release(m_readCache);
+        m_readCache = nullptr;
+    }
+    m_readCacheIndex = noBlock;
+}
+
+void Trajectory::releaseBlocks() {
+    releaseReadCache();
+    for (BlockSlot &slot : m_blocks) {
+        if (slot.block) {
+            m_pool->release(slot.block);
+        } else {
+            m_pool->notePacked(0, slot.packed.size());
+        }
+    }
+    m_blocks.clear();
+    m_spans.clear();
+    m_count = 0;
+}
+
+void Trajectory::add(size_t frameNumber, cv::Point2f position, InterestPointStatus status, size_t userStatus) {
+    size_t i;
+    Block *block = slot(frameNumber, i);
+    block->x[i] = position.x;
+    block->y[i] = position.y;
+    if (block->status[i] != static_cast<uint8_t>(status)) {
+        block->status[i] = static_cast<uint8_t>(status);
+        setSpanStatus(frameNumber, status);
+    }
+    block->userStatus[i] = userStatus;
+}
+
+void Trajectory::add(size_t frameNumber, const PointRecord &point) {
+    add(frameNumber, point.position, point.status, point.userStatus);
+}
+
+void Trajectory::assign(size_t firstFrame, size_t count, const float *x, const float *y,
+                        const uint8_t *status, const uint64_t *userStatus) {
+    releaseBlocks();
+    if (count == 0) {
+        return;
+    }
+
+    m_firstFrame = firstFrame;
+    m_count = count;
+    m_blockStart = firstFrame - firstFrame % blockFrames;
+    const size_t blocks = (firstFrame + count - m_blockStart + blockFrames - 1) / blockFrames;
+    m_blocks.resize(blocks);
+    for (BlockSlot &slot : m_blocks) {
+        slot.block = m_pool->acquire();
+    }
+
+    // copied in runs that end at block boundaries
+    size_t done = 0;
+    while (done < count) {
+        size_t i;
+        Block *block = write(firstFrame + done, i);
+        const size_t run = std::min(count - done, blockFrames - i);
+        std::memcpy(block->x + i, x + done, run * sizeof(float));
+        std::memcpy(block->y + i, y + done, run * sizeof(float));
+        std::memcpy(block->status + i, status + done, run);
+        std::copy(userStatus + done, userStatus + done + run, block->userStatus + i);
+        done += run;
+    }
+    rebuildSpans();
+}
+
+bool Trajectory::hasValuesAtFrame(size_t frameNumber) const {
+    if (frameNumber < m_firstFrame || frameNumber - m_firstFrame >= m_count) {
+        return false;
+    }
+    size_t i;
+    return read(frameNumber, i)->status[i] != nonExisting;
+}
+
+cv::Point2f Trajectory::getPosition(size_t frameNumber) const {
+    assert(hasValuesAtFrame(frameNumber));
+    size_t i;
+    const Block *block = read(frameNumber, i);
+    return cv::Point2f(block->x[i], block->y[i]);
+}
+
+InterestPointStatus Trajectory::getStatus(size_t frameNumber) const {
+    assert(hasValuesAtFrame(frameNumber));
+    size_t i;
+    return static_cast<InterestPointStatus>(read(frameNumber, i)->status[i]);
+}
+
+size_t Trajectory::getUserStatus(size_t frameNumber) const {
+    assert(hasValuesAtFrame(frameNumber));
+    size_t i;
+    return read(frameNumber, i)->userStatus[i];
+}
+
+void Trajectory::setStatus(size_t frameNumber, InterestPointStatus status) {
+    assert(hasValuesAtFrame(frameNumber));
+    size_t i;
+    Block *block = write(frameNumber, i);
+    if (block->status[i] != static_cast<uint8_t>(status)) {
+        block->status[i] = static_cast<uint8_t>(status);
+        setSpanStatus(frameNumber, status);
+    }
+}
+
+void Trajectory::setUserStatus(size_t frameNumber, size_t userStatus) {
+    assert(hasValuesAtFrame(frameNumber));
+    size_t i;
+    write(frameNumber, i)->userStatus[i] = userStatus;
+}
+
+PointRecord Trajectory::get(size_t frameNumber) const {
+    PointRecord p;
+    p.position = getPosition(frameNumber);
+    p.status = getStatus(frameNumber);
+    p.userStatus = getUserStatus(frameNumber);
+    return p;
+}
+
+const Trajectory::Span *Trajectory::findSpan(size_t frameNumber) const {
+    // the last span that starts at or before the frame
+    auto next = std::upper_bound(m_spans.begin(), m_spans.end(), frameNumber, [](size_t frame, const Span &span) {
+        return frame < span.first;
+    });
+    if (next == m_spans.begin() || (next - 1)->last < frameNumber) {
+        return nullptr;
+    }
+    return &*(next - 1);
+}
+
+size_t Trajectory::countFrames(InterestPointStatus status) const {
+    size_t count = 0;
+    for (const Span &span : m_spans) {
+        if (span.status == status || status == InterestPointStatus::Non_Existing) {
+            count += span.last - span.first + 1;
+        }
+    }
+    return status == InterestPointStatus::Non_Existing ? m_count - count : count;
+}
+
+size_t Trajectory::pack(size_t keepFirst, size_t keepLast) {
+    releaseReadCache();
+    size_t packed = 0;
+    std::vector<uint8_t> buffer;
+    for (size_t b = 0; b < m_blocks.size(); b++) {
+        BlockSlot &slot = m_blocks[b];
+        const size_t first = m_blockStart + b * blockFrames;
+        const size_t last = first + blockFrames - 1;
+        if (!slot.block || (last >= keepFirst && first <= keepLast)) {
+            continue;
+        }
+        buffer.clear();
+        packBlock(*slot.block, buffer);
+        slot.packed.assign(buffer.begin(), buffer.end());
+        m_pool->release(slot.block);
+        m_pool->notePacked(slot.packed.size(), 0);
+        slot.block = nullptr;
+        packed++;
+    }
+    return packed;
+}
+
+const Trajectory::Block *Trajectory::readPacked(size_t index) const {
+    if (m_readCacheIndex != index) {
+        if (!m_readCache) {
+            m_readCache = m_pool->acquire();
+        }
+        unpackBlock(m_blocks[index].packed, *m_readCache);
+        m_readCacheIndex = index;
+    }
+    return m_readCache;
+}
+
+Trajectory::Block *Trajectory::unpack(size_t index) {
+    BlockSlot &slot = m_blocks[index];
+    if (m_readCacheIndex == index) {
+        // the cache becomes the block
+        slot.block = m_readCache;
+        m_readCache = nullptr;
+        m_readCacheIndex = noBlock;
+    } else {
+        slot.block = m_pool->acquire();
+        unpackBlock(slot.packed, *slot.block);
+    }
+    m_pool->notePacked(0, slot.packed.size());
+    std::vector<uint8_t>().swap(slot.packed);
+    return slot.block;
+}
+
+size_t Trajectory::maximumFrameNumber() const {
+    return m_count == 0 ? 0 : m_firstFrame + m_count - 1;
+}
+
+Trajectory::Block *Trajectory::slot(size_t frameNumber, size_t &i) {
+    if (m_count == 0) {
+        assert(m_blocks.empty());
+        m_firstFrame = frameNumber;
+        m_count = 1;
+        m_blockStart = frameNumber - frameNumber % blockFrames;
+        m_blocks.resize(1);
+        m_blocks[0].block = m_pool->acquire();
+        return write(frameNumber, i);
+    }
+
+    if (frameNumber < m_blockStart) {
+        // the user jumped back in time before the first block: only the
+        // block pointers are shifted
+        const size_t start = frameNumber - frameNumber % blockFrames;
+        const size_t grow = (m_blockStart - start) / blockFrames;
+        m_blocks.insert(m_blocks.begin(), grow, BlockSlot());
+        for (size_t b = 0; b < grow; b++) {
+            m_blocks[b].block = m_pool->acquire();
+        }
+        m_blockStart = start;
+        if (m_readCacheIndex != noBlock) {
+            m_readCacheIndex += grow;
+        }
+    }
+
+    const size_t needed = (frameNumber - m_blockStart) / blockFrames + 1;
+    while (m_blocks.size() < needed) {
+        m_blocks.emplace_back();
+        m_blocks.back().block = m_pool->acquire();
+    }
+
+    const size_t last = std::max(maximumFrameNumber(), frameNumber);
+    m_firstFrame = std::min(m_firstFrame, frameNumber);
+    m_count = last - m_firstFrame + 1;
+    return write(frameNumber, i);
+}
+
+void Trajectory::setSpanStatus(size_t frameNumber, InterestPointStatus status) {
+    if (!m_spans.empty() && m_spans.back().last + 1 == frameNumber && m_spans.back().status == status) {
+        // the common case: the next frame of a tracked point
+        m_spans.back().last = frameNumber;
+        return;
+    }
+
+    auto next = std::upper_bound(m_spans.begin(), m_spans.end(), frameNumber, [](size_t frame, const Span &span) {
+        return frame < span.first;
+    });
+    size_t at = static_cast<size_t>(next - m_spans.begin()); // where the span of the frame goes
+
+    if (at > 0 && m_spans[at - 1].last >= frameNumber) {
+        // cut the frame out of the span that holds it
+        const Span span = m_spans[at - 1];
+        if (span.status == status) {
+            return;
+        }
+        at--;
+        m_spans.erase(m_spans.begin() + at);
+        if (span.last > frameNumber) {
+            m_spans.insert(m_spans.begin() + at, Span{ frameNumber + 1, span.last, span.status });
+        }
+        if (span.first < frameNumber) {
+            m_spans.insert(m_spans.begin() + at, Span{ span.first, frameNumber - 1, span.status });
+            at++;
+        }
+    }
+
+    if (status == InterestPointStatus::Non_Existing) {
+        return;
+    }
+
+    m_spans.insert(m_spans.begin() + at, Span{ frameNumber, frameNumber, status });
+    if (at + 1 < m_spans.size() && m_spans[at + 1].first == frameNumber + 1 && m_spans[at + 1].status == status) {
+        m_spans[at].last = m_spans[at + 1].last;
+        m_spans.erase(m_spans.begin() + at + 1);
+    }
+    if (at > 0 && m_spans[at - 1].last + 1 == frameNumber && m_spans[at - 1].status == status) {
+        m_spans[at - 1].last = m_spans[at].last;
+        m_spans.erase(m_spans.begin() + at);
+    }
+}
+
+void Trajectory::rebuildSpans() {
+    m_spans.clear();
+    for (size_t frame = m_firstFrame; frame < m_firstFrame + m_count; frame++) {
+        size_t i;
+        const uint8_t status = read(frame, i)->status[i];
+        if (status == nonExisting) {
+            continue;
+        }
+        if (!m_spans.empty() && m_spans.back().last + 1 == frame &&
+                m_spans.back().status == static_cast<InterestPointStatus>(status)) {
+            m_spans.back().last = frame;
+        } else {
+            m_spans.push_back(Span{ frame, frame, static_cast<InterestPointStatus>(status) });
+        }
+    }
+}
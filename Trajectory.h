@@ -0,0 +1,228 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "PointRecord.h"
+#include "TrajectoryPool.h"
+
+/**
+ * @brief The Trajectory class
+ * Holds all positions of a single interest point over time. This is the
+ * Qt-free counterpart of BioTracker::Core::TrackedObject that is used by
+ * the tracking core; the plugin converts it for serialization.
+ *
+ * The data is stored column-wise (structure of arrays): one array each for
+ * x, y, status and user status, split into blocks of
+ * TrajectoryPool::blockFrames frames that come from the pool of the session
+ * (aligned to multiples of blockFrames, so adding a frame never moves
+ * existing data). Frames without data inside the covered range are marked as
+ * InterestPointStatus::Non_Existing.
+ *
+ * Next to the columns a run-length list of the statuses is kept (see
+ * spans()), so scans over the frames with data skip the gaps.
+ *
+ * Blocks far from the current frame can be packed to a few hundred bytes
+ * (see pack()). Reading a packed block unpacks it into a cache of one
+ * block, changing it unpacks it for good, so a packed trajectory behaves
+ * like any other.
+ *
+ * Because of that cache even the const getters write to the object: a
+ * Trajectory that may hold packed blocks must not be read by two threads
+ * at once (copy it, or serialize the readers like the plugin does with
+ * its user status mutex). Unpacked trajectories are safe to read
+ * concurrently.
+ */
+class Trajectory {
+public:
+    /**
+     * @brief The Span struct
+     * consecutive frames [first, last] of the same status (never
+     * InterestPointStatus::Non_Existing)
+     */
+    struct Span {
+        size_t				first;
+        size_t				last;
+        InterestPointStatus	status;
+    };
+
+    /**
+     * @param pool where the blocks come from, TrajectoryPool::shared() if null
+     */
+    explicit Trajectory(size_t id = 0, std::shared_ptr<TrajectoryPool> pool = nullptr);
+
+    /**
+     * @brief Trajectory
+     * copies other into blocks of the given pool
+     */
+    Trajectory(const Trajectory &other, std::shared_ptr<TrajectoryPool> pool);
+
+    Trajectory(const Trajectory &other);
+    Trajectory(Trajectory &&other) noexcept;
+    Trajectory &operator=(Trajectory other) noexcept;
+    ~Trajectory();
+
+    size_t getId() const {
+        return m_id;
+    }
+
+    const std::shared_ptr<TrajectoryPool> &pool() const {
+        return m_pool;
+    }
+
+    /**
+     * @brief add
+     * adds (or replaces) the point at the given frame
+     */
+    void add(size_t frameNumber, cv::Point2f position, InterestPointStatus status, size_t userStatus = 0);
+    void add(size_t frameNumber, const PointRecord &point);
+
+    bool hasValuesAtFrame(size_t frameNumber) const;
+
+    /**
+     * @brief assign
+     * replaces all data by the given columns of length count, starting at
+     * firstFrame (e.g. from a memory mapped TrajectoryFile)
+     */
+    void assign(size_t firstFrame, size_t count, const float *x, const float *y,
+                const uint8_t *status, const uint64_t *userStatus);
+
+    /**
+     * the following getters/setters require hasValuesAtFrame(frameNumber)
+     */
+    cv::Point2f getPosition(size_t frameNumber) const;
+    InterestPointStatus getStatus(size_t frameNumber) const;
+    size_t getUserStatus(size_t frameNumber) const;
+    void setStatus(size_t frameNumber, InterestPointStatus status);
+    void setUserStatus(size_t frameNumber, size_t userStatus);
+
+    /**
+     * @brief get
+     * @return a copy of the point at the given frame, mainly for the
+     * conversion to the BioTracker serialization types
+     */
+    PointRecord get(size_t frameNumber) const;
+
+    /**
+     * @brief firstFrameNumber
+     * @return the first frame that is covered by the columns (0 if empty)
+     */
+    size_t firstFrameNumber() const {
+        return m_firstFrame;
+    }
+
+    size_t maximumFrameNumber() const;
+
+    bool empty() const {
+        return m_count == 0;
+    }
+
+    /**
+     * @brief spans
+     * @return all frames with data as runs of the same status, ordered by
+     * frame number; neighbouring spans differ in their status or have a gap
+     */
+    const std::vector<Span> &spans() const {
+        return m_spans;
+    }
+
+    /**
+     * @brief findSpan
+     * @return the span that holds the given frame, nullptr if the frame has
+     * no data (binary search)
+     */
+    const Span *findSpan(size_t frameNumber) const;
+
+    /**
+     * @brief countFrames
+     * @return the number of frames with the given status
+     */
+    size_t countFrames(InterestPointStatus status) const;
+
+    /**
+     * @brief pack
+     * packs all blocks that lie completely outside of [keepFirst, keepLast]
+     * (lossless) and gives their memory back to the pool
+     * @return the number of blocks that were packed
+     */
+    size_t pack(size_t keepFirst, size_t keepLast);
+
+private:
+    typedef TrajectoryPool::Block Block;
+
+    size_t m_id;
+    size_t m_firstFrame;	// first covered frame
+    size_t m_count;			// covered frames from m_firstFrame on
+    size_t m_blockStart;	// frame number of the first frame of m_blocks[0]
+
+    /**
+     * @brief The BlockSlot struct
+     * a block of the columns, unpacked (block) or packed (bytes)
+     */
+    struct BlockSlot {
+        Block *				block = nullptr;
+        std::vector<uint8_t> packed; // only used while block is null
+    };
+
+    static const size_t noBlock = static_cast<size_t>(-1);
+
+    std::vector<BlockSlot> m_blocks;
+    std::shared_ptr<TrajectoryPool> m_pool;
+
+    // the packed block that was read last, unpacked (see the class
+    // comment on concurrent reads)
+    mutable Block *		m_readCache = nullptr;
+    mutable size_t		m_readCacheIndex = noBlock; // its index in m_blocks
+
+    std::vector<Span>	m_spans;
+
+    /**
+     * @brief setSpanStatus
+     * changes the status of a single frame in m_spans (Non_Existing removes
+     * it), splitting and merging the spans around it
+     */
+    void setSpanStatus(size_t frameNumber, InterestPointStatus status);
+
+    /**
+     * @brief rebuildSpans
+     * m_spans from the status column
+     */
+    void rebuildSpans();
+
+    /**
+     * @brief slot
+     * adds blocks so that the given frame is covered
+     * @return the block that holds the frame, its index in the block in i
+     */
+    Block *slot(size_t frameNumber, size_t &i);
+
+    /**
+     * @brief read
+     * @return the block that holds the (covered) frame, its index in the
+     * block in i; a packed block is unpacked into m_readCache
+     */
+    const Block *read(size_t frameNumber, size_t &i) const {
+        const size_t offset = frameNumber - m_blockStart;
+        i = offset % TrajectoryPool::blockFrames;
+        const BlockSlot &slot = m_blocks[offset / TrajectoryPool::blockFrames];
+        return slot.block ? slot.block : readPacked(offset / TrajectoryPool::blockFrames);
+    }
+
+    /**
+     * @brief write
+     * like read(), but a packed block is unpacked for good
+     */
+    Block *write(size_t frameNumber, size_t &i) {
+        const size_t offset = frameNumber - m_blockStart;
+        i = offset % TrajectoryPool::blockFrames;
+        BlockSlot &slot = m_blocks[offset / TrajectoryPool::blockFrames];
+        return slot.block ? slot.block : unpack(offset / TrajectoryPool::blockFrames);
+    }
+
+    const Block *readPacked(size_t index) const;
+    Block *unpack(size_t index);
+
+    void releaseReadCache() const;
+    void releaseBlocks();
+};
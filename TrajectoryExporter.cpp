@@ -0,0 +1,447 @@
+#include "TrajectoryExporter.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+
+#include "TrajectoryFile.h"
+
+using namespace TrajectoryFileFormat;
+
+namespace {
+
+/**
+ * @brief The BufferedWriter class
+ * appends raw bytes and formatted numbers to a large buffer and flushes it
+ * to the file in big chunks
+ */
+class BufferedWriter {
+public:
+    explicit BufferedWriter(const std::string &path):
+        m_file(std::fopen(path.c_str(), "wb")),
+        m_failed(m_file == nullptr) {
+        m_buffer.reserve(bufferSize);
+    }
+
+    ~BufferedWriter() {
+        close();
+    }
+
+    bool failed() const {
+        return m_failed;
+    }
+
+    bool close() {
+        if (m_file) {
+            flush();
+            if (std::fclose(m_file) != 0) {
+                m_failed = true;
+            }
+            m_file = nullptr;
+        }
+        return !m_failed;
+    }
+
+    void append(const void *data, size_t size) {
+        if (m_buffer.size() + size > bufferSize) {
+            flush();
+        }
+        if (size > bufferSize) {
+            writeThrough(data, size);
+            return;
+        }
+        const char *bytes = static_cast<const char *>(data);
+        m_buffer.insert(m_buffer.end(), bytes, bytes + size);
+    }
+
+    template<typename T>
+    void appendValue(T value) {
+        append(&value, sizeof(T));
+    }
+
+    /**
+     * @brief appendPadding
+     * appends zeros until size (bytes written so far) is 8 byte aligned
+     */
+    void appendPadding(uint64_t size) {
+        static const char zeros[8] = { 0 };
+        append(zeros, static_cast<size_t>(align8(size) - size));
+    }
+
+    void append(char c) {
+        if (m_buffer.size() + 1 > bufferSize) {
+            flush();
+        }
+        m_buffer.push_back(c);
+    }
+
+    void appendNumber(uint64_t value) {
+        char digits[20];
+        size_t n = 0;
+        do {
+            digits[n++] = static_cast<char>('0' + value % 10);
+            value /= 10;
+        } while (value > 0);
+
+        char out[20];
+        for (size_t i = 0; i < n; i++) {
+            out[i] = digits[n - 1 - i];
+        }
+        append(out, n);
+    }
+
+    /**
+     * @brief appendNumber
+     * formats like printf("%g") (six significant digits, no trailing zeros)
+     * without going through the locale machinery of printf for the usual
+     * pixel coordinates (ties are rounded to even like printf does)
+     */
+    void appendNumber(float value) {
+        const double v = static_cast<double>(value);
+        if (v == 0.0) {
+            append('0');
+            return;
+        }
+
+        const double absV = std::fabs(v);
+        int exponent = static_cast<int>(std::floor(std::log10(absV)));
+        if (!std::isfinite(v) || exponent < -4 || exponent >= 6) {
+            appendFallback(v);
+            return;
+        }
+
+        int decimals = 5 - exponent;
+        uint64_t scaled = static_cast<uint64_t>(std::nearbyint(absV * pow10(decimals)));
+        if (scaled >= 1000000) {
+            // rounding carried into the next digit (e.g. 999.9996)
+            decimals--;
+            if (decimals < 0) {
+                appendFallback(v);
+                return;
+            }
+            scaled = static_cast<uint64_t>(std::nearbyint(absV * pow10(decimals)));
+        }
+
+        if (v < 0) {
+            append('-');
+        }
+
+        const uint64_t divisor = static_cast<uint64_t>(pow10(decimals));
+        appendNumber(scaled / divisor);
+
+        uint64_t fraction = scaled % divisor;
+        if (fraction > 0) {
+            // strip trailing zeros
+            while (fraction % 10 == 0) {
+                fraction /= 10;
+                decimals--;
+            }
+            char out[16];
+            for (int i = decimals - 1; i >= 0; i--) {
+                out[i] = static_cast<char>('0' + fraction % 10);
+                fraction /= 10;
+            }
+            append('.');
+            append(out, static_cast<size_t>(decimals));
+        }
+    }
+
+private:
+    static const size_t bufferSize = 1 << 20;
+
+    FILE				*m_file;
+    bool				m_failed;
+    std::vector<char>	m_buffer;
+
+    static double pow10(int e) {
+        static const double powers[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10 };
+        return powers[e];
+    }
+
+    void appendFallback(double v) {
+        char out[32];
+        const int n = std::snprintf(out, sizeof(out), "%g", v);
+        append(out, static_cast<size_t>(n));
+    }
+
+    void flush() {
+        if (!m_buffer.empty()) {
+            writeThrough(m_buffer.data(), m_buffer.size());
+            m_buffer.clear();
+        }
+    }
+
+    void writeThrough(const void *data, size_t size) {
+        if (m_file && std::fwrite(data, 1, size, m_file) != size) {
+            m_failed = true;
+        }
+    }
+};
+
+void writeCsv(BufferedWriter &out, const Trajectory &o) {
+    // only the valid runs, the gaps and other states are skipped as a whole
+    for (const Trajectory::Span &span : o.spans()) {
+        if (span.status != InterestPointStatus::Valid) {
+            continue;
+        }
+        for (size_t frame = span.first; frame <= span.last; frame++) {
+            const cv::Point2f pos = o.getPosition(frame);
+            out.appendNumber(static_cast<uint64_t>(frame));
+            out.append(';');
+            out.appendNumber(static_cast<uint64_t>(o.getId()));
+            out.append(';');
+            out.appendNumber(pos.x);
+            out.append(';');
+            out.appendNumber(pos.y);
+            out.append(';');
+            out.appendNumber(static_cast<uint64_t>(o.getUserStatus(frame)));
+            out.append('\n');
+        }
+    }
+}
+
+uint64_t frameCountOf(const Trajectory &o) {
+    return o.empty() ? 0 : o.maximumFrameNumber() - o.firstFrameNumber() + 1;
+}
+
+uint64_t columnsSize(uint64_t count) {
+    return 2 * align8(count * sizeof(float)) + align8(count) + count * sizeof(uint64_t);
+}
+
+/**
+ * @brief writeBinaryTables
+ * writes everything in front of the columns (header, trajectory table, frame
+ * index and frame lists), see TrajectoryFile.h for the layout
+ */
+void writeBinaryTables(BufferedWriter &out, const std::vector<Trajectory> &trajectories) {
+    uint64_t firstFrame = std::numeric_limits<uint64_t>::max();
+    uint64_t lastFrame = 0;
+    uint64_t coverage = 0;
+    for (const Trajectory &o : trajectories) {
+        if (!o.empty()) {
+            firstFrame = std::min<uint64_t>(firstFrame, o.firstFrameNumber());
+            lastFrame = std::max<uint64_t>(lastFrame, o.maximumFrameNumber());
+            coverage += frameCountOf(o);
+        }
+    }
+    const uint64_t frameCount = coverage > 0 ? lastFrame - firstFrame + 1 : 0;
+    if (frameCount == 0) {
+        firstFrame = 0;
+    }
+
+    Header header;
+    std::memcpy(header.magic, magic, sizeof(magic));
+    header.version = version;
+    header.trajectoryCount = trajectories.size();
+    header.firstFrame = firstFrame;
+    header.frameCount = frameCount;
+    header.trajectoryTableOffset = sizeof(Header);
+    header.frameIndexOffset = header.trajectoryTableOffset + trajectories.size() * sizeof(TrajectoryEntry);
+    header.frameListOffset = header.frameIndexOffset + frameCount * sizeof(FrameEntry);
+
+    const uint64_t listEnd = header.frameListOffset + coverage * sizeof(uint32_t);
+    uint64_t offset = align8(listEnd);
+    std::vector<TrajectoryEntry> entries(trajectories.size());
+    for (size_t i = 0; i < trajectories.size(); i++) {
+        const Trajectory &o = trajectories[i];
+        TrajectoryEntry &e = entries[i];
+        e.id = o.getId();
+        e.firstFrame = o.firstFrameNumber();
+        e.frameCount = frameCountOf(o);
+        e.xOffset = offset;
+        e.yOffset = e.xOffset + align8(e.frameCount * sizeof(float));
+        e.statusOffset = e.yOffset + align8(e.frameCount * sizeof(float));
+        e.userStatusOffset = e.statusOffset + align8(e.frameCount);
+        offset += columnsSize(e.frameCount);
+    }
+    header.fileSize = offset;
+
+    out.appendValue(header);
+    out.append(entries.data(), entries.size() * sizeof(TrajectoryEntry));
+
+    // frame index: number of covering trajectories per frame by a sweep over
+    // the start and end points of all trajectories
+    std::vector<int64_t> delta(static_cast<size_t>(frameCount) + 1, 0);
+    for (const TrajectoryEntry &e : entries) {
+        if (e.frameCount > 0) {
+            delta[static_cast<size_t>(e.firstFrame - firstFrame)]++;
+            delta[static_cast<size_t>(e.firstFrame - firstFrame + e.frameCount)]--;
+        }
+    }
+    int64_t covering = 0;
+    uint64_t listOffset = header.frameListOffset;
+    for (uint64_t i = 0; i < frameCount; i++) {
+        covering += delta[static_cast<size_t>(i)];
+        FrameEntry frame;
+        frame.listOffset = listOffset;
+        frame.count = static_cast<uint32_t>(covering);
+        frame.reserved = 0;
+        out.appendValue(frame);
+        listOffset += frame.count * sizeof(uint32_t);
+    }
+
+    // frame lists: sweep again, keeping the covering trajectories sorted
+    std::vector<uint32_t> starting;
+    for (size_t i = 0; i < entries.size(); i++) {
+        if (entries[i].frameCount > 0) {
+            starting.push_back(static_cast<uint32_t>(i));
+        }
+    }
+    std::stable_sort(starting.begin(), starting.end(), [&entries](uint32_t a, uint32_t b) {
+        return entries[a].firstFrame < entries[b].firstFrame;
+    });
+
+    std::vector<uint32_t> active;
+    auto next = starting.begin();
+    for (uint64_t frame = firstFrame; frame < firstFrame + frameCount; frame++) {
+        active.erase(std::remove_if(active.begin(), active.end(), [&entries, frame](uint32_t i) {
+            return entries[i].firstFrame + entries[i].frameCount <= frame;
+        }), active.end());
+        for (; next != starting.end() && entries[*next].firstFrame == frame; ++next) {
+            active.insert(std::lower_bound(active.begin(), active.end(), *next), *next);
+        }
+        out.append(active.data(), active.size() * sizeof(uint32_t));
+    }
+    out.appendPadding(listEnd);
+}
+
+void writeBinaryColumns(BufferedWriter &out, const Trajectory &o) {
+    const uint64_t first = o.firstFrameNumber();
+    const uint64_t count = frameCountOf(o);
+
+    for (uint64_t i = 0; i < count; i++) {
+        out.appendValue<float>(o.hasValuesAtFrame(first + i) ? o.getPosition(first + i).x : 0.f);
+    }
+    out.appendPadding(count * sizeof(float));
+    for (uint64_t i = 0; i < count; i++) {
+        out.appendValue<float>(o.hasValuesAtFrame(first + i) ? o.getPosition(first + i).y : 0.f);
+    }
+    out.appendPadding(count * sizeof(float));
+    for (uint64_t i = 0; i < count; i++) {
+        const InterestPointStatus status = o.hasValuesAtFrame(first + i) ?
+                    o.getStatus(first + i) : InterestPointStatus::Non_Existing;
+        out.appendValue<uint8_t>(static_cast<uint8_t>(status));
+    }
+    out.appendPadding(count);
+    for (uint64_t i = 0; i < count; i++) {
+        out.appendValue<uint64_t>(o.hasValuesAtFrame(first + i) ? o.getUserStatus(first + i) : 0);
+    }
+}
+
+} // namespace
+
+TrajectoryExporter::TrajectoryExporter(): m_running(false), m_cancel(false) {
+
+}
+
+TrajectoryExporter::~TrajectoryExporter() {
+    cancel();
+    wait();
+}
+
+TrajectoryExporter::Format TrajectoryExporter::formatFromPath(const std::string &path) {
+    const std::string suffix = ".lkt";
+    if (path.size() >= suffix.size() &&
+            path.compare(path.size() - suffix.size(), suffix.size(), suffix) == 0) {
+        return Format::Binary;
+    }
+    return Format::Csv;
+}
+
+bool TrajectoryExporter::write(const std::vector<Trajectory> &trajectories,
+                               const std::string &path,
+                               Format format,
+                               const ProgressCallback &progress,
+                               std::string *error) {
+    return write(trajectories, path, format, progress, nullptr, error);
+}
+
+bool TrajectoryExporter::start(std::vector<Trajectory> trajectories,
+                               const std::string &path,
+                               Format format,
+                               ProgressCallback progress,
+                               FinishedCallback finished) {
+    if (m_running) {
+        return false;
+    }
+    wait(); // join the last (finished) worker
+
+    m_running = true;
+    m_cancel = false;
+    m_worker = std::thread([this, trajectories, path, format, progress, finished]() {
+        std::string error;
+        const bool success = write(trajectories, path, format, progress, &m_cancel, &error);
+        m_running = false;
+        if (finished) {
+            finished(success, error);
+        }
+    });
+    return true;
+}
+
+void TrajectoryExporter::cancel() {
+    m_cancel = true;
+}
+
+void TrajectoryExporter::wait() {
+    if (m_worker.joinable()) {
+        m_worker.join();
+    }
+}
+
+bool TrajectoryExporter::write(const std::vector<Trajectory> &trajectories,
+                               const std::string &path,
+                               Format format,
+                               const ProgressCallback &progress,
+                               const std::atomic<bool> *cancel,
+                               std::string *error) {
+    BufferedWriter out(path);
+    if (out.failed()) {
+        if (error) {
+            *error = "cannot open " + path + ": " + std::strerror(errno);
+        }
+        return false;
+    }
+
+    if (format == Format::Binary) {
+        if (trajectories.size() > std::numeric_limits<uint32_t>::max()) {
+            if (error) {
+                *error = "too many trajectories for the binary format";
+            }
+            return false;
+        }
+        writeBinaryTables(out, trajectories);
+    }
+
+    // report roughly every percent
+    const size_t progressStep = trajectories.size() / 100 + 1;
+    for (size_t i = 0; i < trajectories.size(); i++) {
+        if (cancel && *cancel) {
+            if (error) {
+                *error = "export canceled";
+            }
+            return false;
+        }
+
+        if (format == Format::Binary) {
+            writeBinaryColumns(out, trajectories[i]);
+        } else {
+            writeCsv(out, trajectories[i]);
+        }
+
+        if (progress && ((i + 1) % progressStep == 0 || i + 1 == trajectories.size())) {
+            progress(i + 1, trajectories.size());
+        }
+    }
+
+    if (!out.close()) {
+        if (error) {
+            *error = "cannot write " + path;
+        }
+        return false;
+    }
+    return true;
+}
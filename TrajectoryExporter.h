@@ -0,0 +1,104 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Trajectory.h"
+
+/**
+ * @brief The TrajectoryExporter class
+ * Writes trajectories to disk, either synchronously (write()) or on a worker
+ * thread (start()) so that the GUI stays responsive during long exports.
+ *
+ * The data is streamed trajectory by trajectory through a buffered writer,
+ * only the frames that actually exist are visited.
+ *
+ * Formats:
+ *  - Csv: one "frame;id;x;y;userStatus" line per valid point (ordered by
+ *    trajectory, then frame)
+ *  - Binary: all points of all trajectories (any status), memory
+ *    mappable with a frame index, see TrajectoryFile.h for the layout
+ */
+class TrajectoryExporter {
+public:
+    enum class Format {
+        Csv,
+        Binary
+    };
+
+    /**
+     * @brief ProgressCallback
+     * called with the number of written and the total number of trajectories
+     */
+    typedef std::function<void(size_t done, size_t total)> ProgressCallback;
+
+    /**
+     * @brief FinishedCallback
+     * called once at the end (on the worker thread), message holds the
+     * error if success is false
+     */
+    typedef std::function<void(bool success, const std::string &message)> FinishedCallback;
+
+    TrajectoryExporter();
+    ~TrajectoryExporter();
+
+    /**
+     * @brief formatFromPath
+     * @return Binary for paths ending with ".lkt", Csv otherwise
+     */
+    static Format formatFromPath(const std::string &path);
+
+    /**
+     * @brief write
+     * exports synchronously
+     * @param error OUT: the reason if the export failed
+     * @return false on failure
+     */
+    static bool write(const std::vector<Trajectory> &trajectories,
+                      const std::string &path,
+                      Format format,
+                      const ProgressCallback &progress = ProgressCallback(),
+                      std::string *error = nullptr);
+
+    /**
+     * @brief start
+     * exports the given snapshot of the trajectories on a worker thread
+     * @return false if an export is still running
+     */
+    bool start(std::vector<Trajectory> trajectories,
+               const std::string &path,
+               Format format,
+               ProgressCallback progress,
+               FinishedCallback finished);
+
+    bool isRunning() const {
+        return m_running;
+    }
+
+    /**
+     * @brief cancel
+     * stops a running export as soon as possible (the file stays incomplete)
+     */
+    void cancel();
+
+    /**
+     * @brief wait
+     * blocks until the worker thread is finished
+     */
+    void wait();
+
+private:
+    std::thread			m_worker;
+    std::atomic<bool>	m_running;
+    std::atomic<bool>	m_cancel;
+
+    static bool write(const std::vector<Trajectory> &trajectories,
+                      const std::string &path,
+                      Format format,
+                      const ProgressCallback &progress,
+                      const std::atomic<bool> *cancel,
+                      std::string *error);
+};
@@ -0,0 +1,286 @@
+#include "TrajectoryFile.h"
+
+#include <cerrno>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace TrajectoryFileFormat;
+
+namespace {
+
+bool fail(std::string *error, const std::string &message) {
+    if (error) {
+        *error = message;
+    }
+    return false;
+}
+
+bool inRange(uint64_t offset, uint64_t size, uint64_t fileSize) {
+    return offset <= fileSize && size <= fileSize - offset;
+}
+
+// frames [first, first + count) can be numbered
+bool frameRangeValid(uint64_t first, uint64_t count) {
+    const uint64_t last = std::numeric_limits<size_t>::max();
+    return first <= last && count <= last - first;
+}
+
+// the spans of the loaded trajectories are built from the statuses
+bool statusValid(uint8_t status) {
+    return status <= static_cast<uint8_t>(InterestPointStatus::Not_Tracked);
+}
+
+uint32_t swapBytes(uint32_t value) {
+    return (value >> 24) | ((value >> 8) & 0xff00) | ((value << 8) & 0xff0000) | (value << 24);
+}
+
+} // namespace
+
+TrajectoryFile::TrajectoryFile():
+    m_data(nullptr),
+    m_size(0)
+#ifdef _WIN32
+    ,m_file(nullptr)
+    ,m_mapping(nullptr)
+#else
+    ,m_fd(-1)
+#endif
+{
+
+}
+
+TrajectoryFile::~TrajectoryFile() {
+    close();
+}
+
+bool TrajectoryFile::open(const std::string &path, std::string *error) {
+    close();
+
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return fail(error, "cannot open " + path);
+    }
+    m_file = file;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart < static_cast<LONGLONG>(sizeof(Header))) {
+        close();
+        return fail(error, path + " is not a trajectory file");
+    }
+    m_size = static_cast<size_t>(size.QuadPart);
+
+    m_mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!m_mapping) {
+        close();
+        return fail(error, "cannot map " + path);
+    }
+    m_data = static_cast<const uint8_t *>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+#else
+    m_fd = ::open(path.c_str(), O_RDONLY);
+    if (m_fd < 0) {
+        return fail(error, "cannot open " + path + ": " + std::strerror(errno));
+    }
+
+    struct stat st;
+    if (fstat(m_fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(Header))) {
+        close();
+        return fail(error, path + " is not a trajectory file");
+    }
+    m_size = static_cast<size_t>(st.st_size);
+
+    void *data = mmap(nullptr, m_size, PROT_READ, MAP_SHARED, m_fd, 0);
+    m_data = data == MAP_FAILED ? nullptr : static_cast<const uint8_t *>(data);
+#endif
+
+    if (!m_data) {
+        close();
+        return fail(error, "cannot map " + path);
+    }
+
+    std::string reason;
+    if (!validate(&reason)) {
+        close();
+        return fail(error, path + ": " + reason);
+    }
+    return true;
+}
+
+void TrajectoryFile::close() {
+#ifdef _WIN32
+    if (m_data) {
+        UnmapViewOfFile(m_data);
+    }
+    if (m_mapping) {
+        CloseHandle(m_mapping);
+        m_mapping = nullptr;
+    }
+    if (m_file) {
+        CloseHandle(m_file);
+        m_file = nullptr;
+    }
+#else
+    if (m_data) {
+        munmap(const_cast<uint8_t *>(m_data), m_size);
+    }
+    if (m_fd >= 0) {
+        ::close(m_fd);
+        m_fd = -1;
+    }
+#endif
+    m_data = nullptr;
+    m_size = 0;
+}
+
+TrajectoryFile::TrajectoryView TrajectoryFile::trajectory(size_t index) const {
+    if (index >= trajectoryCount()) {
+        throw std::out_of_range("TrajectoryFile::trajectory OOR =>" + std::to_string(index));
+    }
+    const TrajectoryEntry &entry = at<TrajectoryEntry>(header().trajectoryTableOffset)[index];
+    TrajectoryView view;
+    view.id = entry.id;
+    view.firstFrame = entry.firstFrame;
+    view.frameCount = entry.frameCount;
+    view.x = at<float>(entry.xOffset);
+    view.y = at<float>(entry.yOffset);
+    view.status = at<uint8_t>(entry.statusOffset);
+    view.userStatus = at<uint64_t>(entry.userStatusOffset);
+    return view;
+}
+
+bool TrajectoryFile::trajectoriesAtFrame(uint64_t frameNumber, const uint32_t *&indices, size_t &count,
+                                         std::string *error) const {
+    const Header &h = header();
+    indices = nullptr;
+    count = 0;
+    if (frameNumber < h.firstFrame || frameNumber - h.firstFrame >= h.frameCount) {
+        return true;
+    }
+    const FrameEntry &entry = at<FrameEntry>(h.frameIndexOffset)[frameNumber - h.firstFrame];
+    if (entry.count > h.trajectoryCount ||
+            !inRange(entry.listOffset, static_cast<uint64_t>(entry.count) * sizeof(uint32_t), m_size) ||
+            entry.listOffset % 4 != 0) {
+        return fail(error, "corrupt frame index at frame " + std::to_string(frameNumber));
+    }
+    indices = at<uint32_t>(entry.listOffset);
+    count = entry.count;
+    return true;
+}
+
+bool TrajectoryFile::readFrame(uint64_t frameNumber, std::vector<size_t> &indices, std::vector<PointRecord> &points,
+                               std::string *error) const {
+    indices.clear();
+    points.clear();
+
+    const uint32_t *covering;
+    size_t count;
+    if (!trajectoriesAtFrame(frameNumber, covering, count, error)) {
+        return false;
+    }
+    indices.reserve(count);
+    points.reserve(count);
+    for (size_t k = 0; k < count; k++) {
+        const uint32_t index = covering[k];
+        if (index >= trajectoryCount()) {
+            return fail(error, "corrupt frame index at frame " + std::to_string(frameNumber));
+        }
+        const TrajectoryView view = trajectory(index);
+        if (frameNumber < view.firstFrame || frameNumber - view.firstFrame >= view.frameCount) {
+            return fail(error, "corrupt frame index at frame " + std::to_string(frameNumber));
+        }
+        const size_t i = static_cast<size_t>(frameNumber - view.firstFrame);
+        if (!statusValid(view.status[i])) {
+            return fail(error, "invalid status in trajectory " + std::to_string(index));
+        }
+        if (view.status[i] == static_cast<uint8_t>(InterestPointStatus::Non_Existing)) {
+            continue;
+        }
+        PointRecord point;
+        point.position = cv::Point2f(view.x[i], view.y[i]);
+        point.status = static_cast<InterestPointStatus>(view.status[i]);
+        point.userStatus = static_cast<size_t>(view.userStatus[i]);
+        indices.push_back(index);
+        points.push_back(point);
+    }
+    return true;
+}
+
+bool TrajectoryFile::load(std::vector<Trajectory> &trajectories, std::string *error) const {
+    trajectories.clear();
+    trajectories.reserve(trajectoryCount());
+    for (size_t i = 0; i < trajectoryCount(); i++) {
+        const TrajectoryView view = trajectory(i);
+        // checked in the same pass as the copy, the column is read anyway
+        for (uint64_t k = 0; k < view.frameCount; k++) {
+            if (!statusValid(view.status[k])) {
+                trajectories.clear();
+                return fail(error, "invalid status in trajectory " + std::to_string(i));
+            }
+        }
+        // position in list + id are correlated
+        trajectories.push_back(Trajectory(i));
+        trajectories.back().assign(static_cast<size_t>(view.firstFrame), static_cast<size_t>(view.frameCount),
+                                   view.x, view.y, view.status, view.userStatus);
+    }
+    return true;
+}
+
+bool TrajectoryFile::validate(std::string *error) const {
+    const Header &h = header();
+    if (std::memcmp(h.magic, magic, sizeof(magic)) != 0) {
+        return fail(error, "not a trajectory file");
+    }
+    if (h.version != version) {
+        if (swapBytes(h.version) == version) {
+            return fail(error, "written on a machine of another byte order");
+        }
+        return fail(error, "unsupported version " + std::to_string(h.version));
+    }
+    if (h.fileSize != m_size) {
+        return fail(error, "file is truncated");
+    }
+
+    // the tables must fit into the file, the multiplications are guarded by
+    // the division against overflow; the frame lists are checked when a
+    // frame is read
+    if (h.trajectoryCount > m_size / sizeof(TrajectoryEntry) ||
+            !inRange(h.trajectoryTableOffset, h.trajectoryCount * sizeof(TrajectoryEntry), m_size) ||
+            h.frameCount > m_size / sizeof(FrameEntry) ||
+            !inRange(h.frameIndexOffset, h.frameCount * sizeof(FrameEntry), m_size) ||
+            (h.trajectoryTableOffset | h.frameIndexOffset | h.frameListOffset) % 8 != 0) {
+        return fail(error, "corrupt tables");
+    }
+    if (!frameRangeValid(h.firstFrame, h.frameCount)) {
+        return fail(error, "corrupt frame range");
+    }
+
+    const TrajectoryEntry *entries = at<TrajectoryEntry>(h.trajectoryTableOffset);
+    for (uint64_t i = 0; i < h.trajectoryCount; i++) {
+        const TrajectoryEntry &e = entries[i];
+        if (e.frameCount > m_size ||
+                !inRange(e.xOffset, e.frameCount * sizeof(float), m_size) ||
+                !inRange(e.yOffset, e.frameCount * sizeof(float), m_size) ||
+                !inRange(e.statusOffset, e.frameCount, m_size) ||
+                !inRange(e.userStatusOffset, e.frameCount * sizeof(uint64_t), m_size) ||
+                (e.xOffset | e.yOffset | e.userStatusOffset) % 8 != 0 ||
+                !frameRangeValid(e.firstFrame, e.frameCount)) {
+            return fail(error, "corrupt trajectory " + std::to_string(i));
+        }
+        if (e.frameCount > 0 && (e.firstFrame < h.firstFrame ||
+                                 e.firstFrame + e.frameCount > h.firstFrame + h.frameCount)) {
+            return fail(error, "trajectory " + std::to_string(i) + " is outside of the frame range");
+        }
+    }
+    return true;
+}
@@ -0,0 +1,183 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "PointRecord.h"
+#include "Trajectory.h"
+
+/**
+ * The binary trajectory file (*.lkt), version 4.
+ *
+ * All values are in the byte order of the machine that wrote the file
+ * (little endian on all platforms we build for; a file of the other order
+ * is rejected by TrajectoryFile::open()). All sections and columns are 8
+ * byte aligned so that the file can be memory mapped and used without any
+ * parsing:
+ *
+ *   Header
+ *   TrajectoryEntry[trajectoryCount]	at trajectoryTableOffset
+ *   FrameEntry[frameCount]				at frameIndexOffset
+ *   uint32 trajectory indices			at frameListOffset
+ *   columns of each trajectory			at the offsets of its TrajectoryEntry:
+ *     float x[n], float y[n], uint8 status[n], uint64 userStatus[n]
+ *
+ * firstFrame and frameCount of the header are the range of all
+ * trajectories. The frame index maps frame firstFrame + i to a run of
+ * indices (into the trajectory table) of all trajectories whose columns
+ * cover that frame; status Non_Existing marks frames without data inside a
+ * trajectory. Version 3 had no frame index and is rejected.
+ */
+namespace TrajectoryFileFormat {
+
+const char magic[4] = { 'L', 'K', 'T', 'R' };
+const uint32_t version = 4;
+
+struct Header {
+    char		magic[4];
+    uint32_t	version;
+    uint64_t	trajectoryCount;
+    uint64_t	firstFrame;
+    uint64_t	frameCount;
+    uint64_t	trajectoryTableOffset;
+    uint64_t	frameIndexOffset;
+    uint64_t	frameListOffset;
+    uint64_t	fileSize;
+};
+
+struct TrajectoryEntry {
+    uint64_t	id;
+    uint64_t	firstFrame;
+    uint64_t	frameCount;
+    uint64_t	xOffset;
+    uint64_t	yOffset;
+    uint64_t	statusOffset;
+    uint64_t	userStatusOffset;
+};
+
+struct FrameEntry {
+    uint64_t	listOffset;
+    uint32_t	count;
+    uint32_t	reserved;
+};
+
+static_assert(sizeof(Header) == 64, "unexpected padding in Header");
+static_assert(sizeof(TrajectoryEntry) == 56, "unexpected padding in TrajectoryEntry");
+static_assert(sizeof(FrameEntry) == 16, "unexpected padding in FrameEntry");
+
+inline uint64_t align8(uint64_t offset) {
+    return (offset + 7) & ~static_cast<uint64_t>(7);
+}
+
+} // namespace TrajectoryFileFormat
+
+/**
+ * @brief The TrajectoryFile class
+ * Read-only, memory mapped view of a binary trajectory file. Opening only
+ * validates the header and the tables, so it does not depend on the length
+ * of the recording; the columns are checked when they are read, which only
+ * touches the pages of the frames asked for (readFrame()) or copies
+ * everything (load()).
+ */
+class TrajectoryFile {
+public:
+    /**
+     * @brief The TrajectoryView struct
+     * the columns of one trajectory, valid as long as the file is open (the
+     * statuses are not validated)
+     */
+    struct TrajectoryView {
+        uint64_t		id;
+        uint64_t		firstFrame;
+        uint64_t		frameCount;
+        const float		*x;
+        const float		*y;
+        const uint8_t	*status;
+        const uint64_t	*userStatus;
+    };
+
+    TrajectoryFile();
+    ~TrajectoryFile();
+
+    TrajectoryFile(const TrajectoryFile &) = delete;
+    TrajectoryFile &operator=(const TrajectoryFile &) = delete;
+
+    /**
+     * @brief open
+     * maps the file and validates it
+     * @param error OUT: the reason if the file cannot be used
+     * @return false on failure
+     */
+    bool open(const std::string &path, std::string *error = nullptr);
+
+    void close();
+
+    bool isOpen() const {
+        return m_data != nullptr;
+    }
+
+    size_t trajectoryCount() const {
+        return static_cast<size_t>(header().trajectoryCount);
+    }
+
+    uint64_t firstFrame() const {
+        return header().firstFrame;
+    }
+
+    uint64_t frameCount() const {
+        return header().frameCount;
+    }
+
+    TrajectoryView trajectory(size_t index) const;
+
+    /**
+     * @brief trajectoriesAtFrame
+     * @param indices OUT: indices (into the trajectory table) of all
+     * trajectories that cover the given frame
+     * @param count OUT: their number (0 outside of the frame range)
+     * @return false if the index of the frame is corrupt
+     */
+    bool trajectoriesAtFrame(uint64_t frameNumber, const uint32_t *&indices, size_t &count,
+                             std::string *error = nullptr) const;
+
+    /**
+     * @brief readFrame
+     * reads the points of a single frame through the frame index (only the
+     * covering trajectories are touched, at that frame)
+     * @param indices OUT: index of the trajectory of each point
+     * @param points OUT: all points that exist at the frame
+     * @return false if the index or a read column is corrupt
+     */
+    bool readFrame(uint64_t frameNumber, std::vector<size_t> &indices, std::vector<PointRecord> &points,
+                   std::string *error = nullptr) const;
+
+    /**
+     * @brief load
+     * copies all trajectories into the columns of the tracking core
+     * (bulk copies, no parsing; linear in the size of the file)
+     * @return false if a column is corrupt
+     */
+    bool load(std::vector<Trajectory> &trajectories, std::string *error = nullptr) const;
+
+private:
+    const uint8_t	*m_data;
+    size_t			m_size;
+#ifdef _WIN32
+    void			*m_file;
+    void			*m_mapping;
+#else
+    int				m_fd;
+#endif
+
+    const TrajectoryFileFormat::Header &header() const {
+        return *reinterpret_cast<const TrajectoryFileFormat::Header *>(m_data);
+    }
+
+    template<typename T>
+    const T *at(uint64_t offset) const {
+        return reinterpret_cast<const T *>(m_data + offset);
+    }
+
+    bool validate(std::string *error) const;
+};
@@ -0,0 +1,71 @@
+#include "TrajectoryPool.h"
+
+#include <cassert>
+#include <cstring>
+
+#include "PointRecord.h"
+
+TrajectoryPool::Block *TrajectoryPool::acquire() {
+    Block *block;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_free.empty()) {
+            m_slabs.emplace_back(new Block[slabBlocks]);
+            Block *slab = m_slabs.back().get();
+            m_free.reserve(m_slabs.size() * slabBlocks);
+            // handed out front to back
+            for (size_t i = slabBlocks; i > 0; i--) {
+                m_free.push_back(slab + i - 1);
+            }
+        }
+        block = m_free.back();
+        m_free.pop_back();
+        m_allocations++;
+        m_blocksInUse++;
+    }
+
+    // the exporters read the positions of frames without data, too
+    std::memset(block->x, 0, sizeof(block->x));
+    std::memset(block->y, 0, sizeof(block->y));
+    std::memset(block->userStatus, 0, sizeof(block->userStatus));
+    std::memset(block->status, static_cast<int>(InterestPointStatus::Non_Existing), sizeof(block->status));
+    return block;
+}
+
+void TrajectoryPool::release(Block *block) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    assert(m_blocksInUse > 0);
+    m_free.push_back(block);
+    m_blocksInUse--;
+}
+
+void TrajectoryPool::notePacked(size_t added, size_t removed) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    assert(m_bytesPacked + added >= removed);
+    m_bytesPacked = m_bytesPacked + added - removed;
+}
+
+void TrajectoryPool::trim() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_blocksInUse == 0) {
+        m_free.clear();
+        m_free.shrink_to_fit();
+        m_slabs.clear();
+    }
+}
+
+TrajectoryPool::Stats TrajectoryPool::stats() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Stats stats;
+    stats.allocations = m_allocations;
+    stats.blocksInUse = m_blocksInUse;
+    stats.bytesInUse = m_blocksInUse * sizeof(Block);
+    stats.bytesReserved = m_slabs.size() * slabBlocks * sizeof(Block);
+    stats.bytesPacked = m_bytesPacked;
+    return stats;
+}
+
+const std::shared_ptr<TrajectoryPool> &TrajectoryPool::shared() {
+    static const std::shared_ptr<TrajectoryPool> pool = std::make_shared<TrajectoryPool>();
+    return pool;
+}
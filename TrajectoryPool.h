@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/**
+ * @brief The TrajectoryPool class
+ * Slab allocator for the storage of the trajectories. A Trajectory keeps its
+ * columns in fixed size blocks of blockFrames frames each; the blocks are
+ * carved from large slabs and recycled through a free list, so a long
+ * session allocates a slab every slabBlocks blocks instead of growing (and
+ * copying) four arrays per point, and the data of a block never moves.
+ *
+ * One pool per tracking session (LucasKanadeCore), shared by its
+ * trajectories and their copies (which may die on other threads, hence the
+ * mutex). trim() returns the slabs to the system in bulk once no block is
+ * in use, e.g. when the video changes. Freed blocks are reused before a new
+ * slab is allocated, so packing blocks (Trajectory::pack()) keeps the slabs
+ * from growing instead of shrinking them.
+ */
+class TrajectoryPool {
+public:
+    static const size_t blockFrames = 64;
+    static const size_t slabBlocks = 64;
+
+    struct Block {
+        float		x[blockFrames];
+        float		y[blockFrames];
+        size_t		userStatus[blockFrames];
+        uint8_t		status[blockFrames]; // InterestPointStatus
+    };
+
+    struct Stats {
+        size_t		allocations = 0;	// blocks handed out since the pool was created
+        size_t		blocksInUse = 0;
+        size_t		bytesInUse = 0;
+        size_t		bytesReserved = 0;	// all slabs
+        size_t		bytesPacked = 0;	// packed blocks of the trajectories (outside the slabs)
+    };
+
+    TrajectoryPool() = default;
+
+    TrajectoryPool(const TrajectoryPool &) = delete;
+    TrajectoryPool &operator=(const TrajectoryPool &) = delete;
+
+    /**
+     * @brief acquire
+     * @return a block whose frames are all InterestPointStatus::Non_Existing
+     */
+    Block *acquire();
+    void release(Block *block);
+
+    /**
+     * @brief notePacked
+     * accounts for packed blocks the trajectories hold (added and removed
+     * bytes)
+     */
+    void notePacked(size_t added, size_t removed);
+
+    /**
+     * @brief trim
+     * frees all slabs if no block is in use (otherwise nothing happens)
+     */
+    void trim();
+
+    Stats stats() const;
+
+    /**
+     * @brief shared
+     * @return the pool of trajectories that are created outside of a session
+     * (e.g. when loading)
+     */
+    static const std::shared_ptr<TrajectoryPool> &shared();
+
+private:
+    mutable std::mutex		m_mutex;
+    std::vector<std::unique_ptr<Block[]>> m_slabs;
+    std::vector<Block *>	m_free;
+    size_t					m_allocations = 0;
+    size_t					m_blocksInUse = 0;
+    size_t					m_bytesPacked = 0;
+};
@@ -0,0 +1,588 @@
+/*
+ * Tests of the trajectory storage: the block accounting of TrajectoryPool,
+ * alone and under the trajectories that take their blocks from it, the
+ * status spans of Trajectory against a scan of its columns after random
+ * edits, the lossless packing of blocks (any float bit pattern), the
+ * trail cache over the trajectories (also when it is disabled) and the
+ * binary trajectory file (single frames through its index, all of it, and
+ * a corrupt column that is only noticed where it is read).
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "TestCheck.h"
+#include "TrailCache.h"
+#include "Trajectory.h"
+#include "TrajectoryExporter.h"
+#include "TrajectoryFile.h"
+#include "TrajectoryPool.h"
+
+namespace {
+
+typedef TrajectoryPool::Block Block;
+
+const size_t blockFrames = TrajectoryPool::blockFrames;
+const size_t slabBlocks = TrajectoryPool::slabBlocks;
+
+bool isClean(const Block &block) {
+    for (size_t i = 0; i < blockFrames; i++) {
+        if (block.x[i] != 0.f || block.y[i] != 0.f || block.userStatus[i] != 0 ||
+                block.status[i] != static_cast<uint8_t>(InterestPointStatus::Non_Existing)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void checkStats(const TrajectoryPool &pool, size_t allocations, size_t blocksInUse, size_t slabs) {
+    const TrajectoryPool::Stats stats = pool.stats();
+    CHECK(stats.allocations == allocations);
+    CHECK(stats.blocksInUse == blocksInUse);
+    CHECK(stats.bytesInUse == blocksInUse * sizeof(Block));
+    CHECK(stats.bytesReserved == slabs * slabBlocks * sizeof(Block));
+}
+
+void testPoolAccounting() {
+    TrajectoryPool pool;
+    checkStats(pool, 0, 0, 0);
+
+    // one more block than a slab holds
+    std::vector<Block *> blocks;
+    for (size_t i = 0; i < slabBlocks + 1; i++) {
+        blocks.push_back(pool.acquire());
+        CHECK(isClean(*blocks.back()));
+    }
+    checkStats(pool, slabBlocks + 1, slabBlocks + 1, 2);
+
+    // released blocks are handed out again (cleared) before a new slab
+    for (size_t i = 0; i < slabBlocks / 2; i++) {
+        Block *block = blocks.back();
+        blocks.pop_back();
+        block->x[3] = 1.f;
+        block->userStatus[5] = 7;
+        block->status[9] = static_cast<uint8_t>(InterestPointStatus::Valid);
+        pool.release(block);
+    }
+    checkStats(pool, slabBlocks + 1, slabBlocks / 2 + 1, 2);
+    for (size_t i = 0; i < slabBlocks / 2; i++) {
+        blocks.push_back(pool.acquire());
+        CHECK(isClean(*blocks.back()));
+    }
+    checkStats(pool, slabBlocks + 1 + slabBlocks / 2, slabBlocks + 1, 2);
+
+    // trim() keeps the slabs while a block is in use ..
+    for (size_t i = 1; i < blocks.size(); i++) {
+        pool.release(blocks[i]);
+    }
+    pool.trim();
+    checkStats(pool, slabBlocks + 1 + slabBlocks / 2, 1, 2);
+
+    // .. and frees them once none is
+    pool.release(blocks[0]);
+    pool.trim();
+    checkStats(pool, slabBlocks + 1 + slabBlocks / 2, 0, 0);
+    CHECK(isClean(*pool.acquire()));
+    checkStats(pool, slabBlocks + 2 + slabBlocks / 2, 1, 1);
+}
+
+void testTrajectoryBlocks() {
+    const std::shared_ptr<TrajectoryPool> pool = std::make_shared<TrajectoryPool>();
+    {
+        // four blocks from the sixth on
+        const size_t first = 5 * blockFrames + 10;
+        Trajectory trajectory(1, pool);
+        for (size_t frame = first; frame <= first + 3 * blockFrames; frame++) {
+            trajectory.add(frame, cv::Point2f(1.f, 2.f), InterestPointStatus::Valid);
+        }
+        checkStats(*pool, 4, 4, 1);
+
+        // jumping back in time adds the blocks in front
+        trajectory.add(10, cv::Point2f(), InterestPointStatus::Valid);
+        CHECK(pool->stats().blocksInUse == 9);
+
+        Trajectory copy(trajectory);
+        CHECK(pool->stats().blocksInUse == 18);
+        Trajectory moved(std::move(copy));
+        CHECK(pool->stats().blocksInUse == 18);
+
+        // a copy into another pool leaves this one alone
+        const std::shared_ptr<TrajectoryPool> other = std::make_shared<TrajectoryPool>();
+        Trajectory elsewhere(trajectory, other);
+        CHECK(pool->stats().blocksInUse == 18);
+        CHECK(other->stats().blocksInUse == 9);
+
+        // assign() replaces all blocks, two frames across a block border
+        const float x[2] = { 0.f, 1.f };
+        const uint8_t status[2] = { 0, 0 };
+        const uint64_t userStatus[2] = { 0, 0 };
+        moved.assign(blockFrames - 1, 2, x, x, status, userStatus);
+        CHECK(pool->stats().blocksInUse == 11);
+    }
+    // everything is returned, but the slab stays until trim()
+    checkStats(*pool, pool->stats().allocations, 0, 1);
+    pool->trim();
+    checkStats(*pool, pool->stats().allocations, 0, 0);
+}
+
+const InterestPointStatus statuses[] = {
+    InterestPointStatus::Valid, InterestPointStatus::Invalid,
+    InterestPointStatus::Non_Existing, InterestPointStatus::Not_Tracked
+};
+
+/**
+ * @brief checkSpans
+ * compares spans(), findSpan() and countFrames() with the statuses read
+ * frame by frame and with the expected ones
+ * @return false at the first difference
+ */
+bool checkSpans(const Trajectory &trajectory, const std::map<size_t, InterestPointStatus> &expected) {
+    std::vector<Trajectory::Span> scanned;
+    size_t counts[4] = { 0, 0, 0, 0 };
+    const size_t end = trajectory.empty() ? 0 : trajectory.maximumFrameNumber() + 1;
+    for (size_t frame = trajectory.firstFrameNumber(); frame < end; frame++) {
+        if (!trajectory.hasValuesAtFrame(frame)) {
+            counts[static_cast<size_t>(InterestPointStatus::Non_Existing)]++;
+            continue;
+        }
+        const InterestPointStatus status = trajectory.getStatus(frame);
+        counts[static_cast<size_t>(status)]++;
+        if (!scanned.empty() && scanned.back().last + 1 == frame && scanned.back().status == status) {
+            scanned.back().last = frame;
+        } else {
+            scanned.push_back(Trajectory::Span{ frame, frame, status });
+        }
+    }
+
+    // the covered frames may reach beyond the data (removed frames)
+    bool ok = true;
+    if (!expected.empty()) {
+        ok = CHECK(!trajectory.empty());
+        ok = ok && CHECK(trajectory.firstFrameNumber() <= expected.begin()->first);
+        ok = ok && CHECK(trajectory.maximumFrameNumber() >= expected.rbegin()->first);
+    }
+
+    const std::vector<Trajectory::Span> &spans = trajectory.spans();
+    ok = ok && CHECK(spans.size() == scanned.size());
+    for (size_t i = 0; ok && i < spans.size(); i++) {
+        ok = CHECK(spans[i].first == scanned[i].first && spans[i].last == scanned[i].last &&
+                   spans[i].status == scanned[i].status);
+    }
+
+    size_t inSpans = 0;
+    for (const Trajectory::Span &span : spans) {
+        inSpans += span.last - span.first + 1;
+    }
+    ok = ok && CHECK(inSpans == expected.size());
+    for (const auto &point : expected) {
+        const Trajectory::Span *span = trajectory.findSpan(point.first);
+        ok = ok && CHECK(span != nullptr && span->status == point.second);
+    }
+    // the frames around the data and in its gaps
+    for (size_t frame = trajectory.firstFrameNumber() > 2 ? trajectory.firstFrameNumber() - 2 : 0;
+            ok && frame < end + 2; frame++) {
+        ok = CHECK((trajectory.findSpan(frame) != nullptr) == (expected.count(frame) > 0));
+    }
+    for (InterestPointStatus status : statuses) {
+        ok = ok && CHECK(trajectory.countFrames(status) == counts[static_cast<size_t>(status)]);
+    }
+    return ok;
+}
+
+void testSpans() {
+    std::mt19937 random(0x5ba5);
+    for (int run = 0; run < 20; run++) {
+        Trajectory trajectory(0, std::make_shared<TrajectoryPool>());
+        std::map<size_t, InterestPointStatus> expected; // frames with data
+        size_t tracked = 200 + random() % 400;
+
+        for (int step = 0; step < 2000; step++) {
+            const unsigned op = random() % 10;
+            const InterestPointStatus status = statuses[random() % 4];
+            if (op < 5) {
+                // tracking: the next frame, mostly with the same status
+                const InterestPointStatus next = op < 4 && expected.count(tracked) ?
+                            expected[tracked] : status;
+                tracked++;
+                trajectory.add(tracked, cv::Point2f(1.f, 1.f), next);
+                if (next == InterestPointStatus::Non_Existing) {
+                    expected.erase(tracked);
+                } else {
+                    expected[tracked] = next;
+                }
+            } else if (op < 7) {
+                // anywhere, also before the first block
+                const size_t frame = random() % 1200;
+                trajectory.add(frame, cv::Point2f(2.f, 2.f), status);
+                if (status == InterestPointStatus::Non_Existing) {
+                    expected.erase(frame);
+                } else {
+                    expected[frame] = status;
+                }
+            } else if (!expected.empty()) {
+                // edit or remove a frame with data
+                auto point = expected.begin();
+                std::advance(point, random() % expected.size());
+                const size_t frame = point->first;
+                trajectory.setStatus(frame, status);
+                if (status == InterestPointStatus::Non_Existing) {
+                    expected.erase(point);
+                } else {
+                    point->second = status;
+                }
+            }
+            // a full check scans all frames, so not after every edit
+            if (step % 10 == 9 && !checkSpans(trajectory, expected)) {
+                return;
+            }
+        }
+
+        // the spans of a copy and of assign() are rebuilt from the columns
+        if (!checkSpans(Trajectory(trajectory), expected)) {
+            return;
+        }
+        const size_t first = trajectory.firstFrameNumber();
+        const size_t count = trajectory.maximumFrameNumber() - first + 1;
+        std::vector<float> x(count);
+        std::vector<uint8_t> status(count);
+        std::vector<uint64_t> userStatus(count);
+        for (size_t i = 0; i < count; i++) {
+            status[i] = static_cast<uint8_t>(trajectory.hasValuesAtFrame(first + i) ?
+                                              trajectory.getStatus(first + i) : InterestPointStatus::Non_Existing);
+        }
+        Trajectory assigned(0, trajectory.pool());
+        assigned.assign(first, count, x.data(), x.data(), status.data(), userStatus.data());
+        if (!checkSpans(assigned, expected)) {
+            return;
+        }
+    }
+}
+
+/**
+ * @brief The Point struct
+ * the expected data of a frame, the positions as float bits
+ */
+struct Point {
+    uint32_t			x;
+    uint32_t			y;
+    InterestPointStatus	status;
+    size_t				userStatus;
+};
+
+float fromBits(uint32_t bits) {
+    float value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+uint32_t toBits(float value) {
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+/**
+ * @brief randomBits
+ * mostly a point moving by a few pixels (the case the packing is made
+ * for), otherwise NaNs, infinities, denormals, signed zeros, extremes or
+ * any pattern at all
+ */
+uint32_t randomBits(std::mt19937 &random, uint32_t previous) {
+    static const uint32_t special[] = {
+        0x7fc00000u, 0x7f800001u, 0xffffffffu, 0x7fbfffffu,	// NaNs (quiet, signaling, negative)
+        0x7f800000u, 0xff800000u,							// infinities
+        0x00000000u, 0x80000000u,							// zeros
+        0x00000001u, 0x807fffffu,							// denormals
+        0x7f7fffffu, 0xff7fffffu, 0x00800000u				// largest, smallest, smallest normal
+    };
+    const unsigned kind = random() % 8;
+    if (kind < 5) {
+        const float value = fromBits(previous);
+        const float moved = (value == value ? value : 0.f) + static_cast<float>(random() % 2001) / 500.f - 2.f;
+        return toBits(moved);
+    }
+    if (kind < 7) {
+        return special[random() % (sizeof(special) / sizeof(special[0]))];
+    }
+    return static_cast<uint32_t>(random());
+}
+
+size_t randomUserStatus(std::mt19937 &random) {
+    switch (random() % 4) {
+    case 0:
+        return 0;
+    case 1:
+        return std::numeric_limits<size_t>::max();
+    case 2:
+        return static_cast<size_t>(1) << (random() % (8 * sizeof(size_t)));
+    default:
+        return static_cast<size_t>((static_cast<uint64_t>(random()) << 32) | random());
+    }
+}
+
+/**
+ * @brief checkPoints
+ * compares every covered frame with the expected data, bit by bit
+ * @return false at the first difference
+ */
+bool checkPoints(const Trajectory &trajectory, const std::map<size_t, Point> &expected) {
+    const size_t end = trajectory.empty() ? 0 : trajectory.maximumFrameNumber() + 1;
+    bool ok = true;
+    for (size_t frame = trajectory.firstFrameNumber(); ok && frame < end; frame++) {
+        auto point = expected.find(frame);
+        ok = CHECK(trajectory.hasValuesAtFrame(frame) == (point != expected.end()));
+        if (ok && point != expected.end()) {
+            const cv::Point2f position = trajectory.getPosition(frame);
+            ok = CHECK(toBits(position.x) == point->second.x && toBits(position.y) == point->second.y &&
+                       trajectory.getStatus(frame) == point->second.status &&
+                       trajectory.getUserStatus(frame) == point->second.userStatus);
+        }
+    }
+    return ok;
+}
+
+void testPacking() {
+    std::mt19937 random(0xbac4);
+    const size_t blocks = 12;
+    for (int run = 0; run < 20; run++) {
+        const std::shared_ptr<TrajectoryPool> pool = std::make_shared<TrajectoryPool>();
+        Trajectory trajectory(0, pool);
+        std::map<size_t, Point> expected;
+        std::map<size_t, InterestPointStatus> statusOfFrames;
+
+        // runs of frames with data and gaps, the first and last frame of
+        // the range inside of a block
+        const size_t first = 3 * blockFrames + random() % blockFrames;
+        const size_t last = first + (blocks - 2) * blockFrames + random() % blockFrames;
+        Point point = Point{ toBits(100.f), toBits(200.f), InterestPointStatus::Valid, 0 };
+        for (size_t frame = first; frame <= last; frame++) {
+            if (frame != first && frame != last && random() % 16 == 0) {
+                frame += random() % 40; // a gap
+                if (frame >= last) {
+                    frame = last;
+                }
+            }
+            point.x = randomBits(random, point.x);
+            point.y = randomBits(random, point.y);
+            if (random() % 8 == 0) {
+                point.status = statuses[random() % 4];
+                if (point.status == InterestPointStatus::Non_Existing) {
+                    point.status = InterestPointStatus::Invalid;
+                }
+            }
+            if (random() % 8 == 0) {
+                point.userStatus = randomUserStatus(random);
+            }
+            trajectory.add(frame, cv::Point2f(fromBits(point.x), fromBits(point.y)), point.status, point.userStatus);
+            expected[frame] = point;
+            statusOfFrames[frame] = point.status;
+        }
+        const size_t blocksInUse = pool->stats().blocksInUse;
+        if (!checkPoints(trajectory, expected)) {
+            return;
+        }
+
+        // everything but two blocks in the middle
+        const size_t keepFirst = (first / blockFrames + 5) * blockFrames + 10;
+        const size_t keepLast = keepFirst + blockFrames;
+        const size_t packed = trajectory.pack(keepFirst, keepLast);
+        CHECK(packed + 2 == blocksInUse);
+        CHECK(pool->stats().blocksInUse == 2);
+        CHECK(pool->stats().bytesPacked > 0);
+        CHECK(trajectory.pack(keepFirst, keepLast) == 0);
+
+        // the packed blocks are read through the cache of one block
+        if (!checkPoints(trajectory, expected) || !checkSpans(trajectory, statusOfFrames)) {
+            return;
+        }
+        CHECK(pool->stats().blocksInUse == 3);
+
+        // a copy keeps its blocks packed
+        const size_t bytesPacked = pool->stats().bytesPacked;
+        {
+            const Trajectory copy(trajectory);
+            CHECK(pool->stats().bytesPacked == 2 * bytesPacked);
+            if (!checkPoints(copy, expected)) {
+                return;
+            }
+        }
+        CHECK(pool->stats().bytesPacked == bytesPacked);
+
+        // changing a packed frame unpacks its block for good
+        const size_t changed = first + 1 + random() % (blockFrames - 1);
+        if (expected.count(changed)) {
+            expected[changed].userStatus = randomUserStatus(random);
+            trajectory.setUserStatus(changed, expected[changed].userStatus);
+            CHECK(pool->stats().bytesPacked < bytesPacked);
+        }
+        trajectory.add(first - 1, cv::Point2f(fromBits(0x7f800001u), -0.f), InterestPointStatus::Not_Tracked,
+                       std::numeric_limits<size_t>::max());
+        expected[first - 1] = Point{ 0x7f800001u, 0x80000000u, InterestPointStatus::Not_Tracked,
+                                     std::numeric_limits<size_t>::max() };
+        statusOfFrames[first - 1] = InterestPointStatus::Not_Tracked;
+        if (!checkPoints(trajectory, expected) || !checkSpans(trajectory, statusOfFrames)) {
+            return;
+        }
+
+        // all blocks, then back to plain blocks frame by frame
+        const size_t none = std::numeric_limits<size_t>::max();
+        trajectory.pack(none, none);
+        CHECK(pool->stats().blocksInUse == 0);
+        if (!checkPoints(trajectory, expected)) {
+            return;
+        }
+        for (const auto &frame : expected) {
+            trajectory.setUserStatus(frame.first, frame.second.userStatus);
+        }
+        CHECK(pool->stats().bytesPacked == 0);
+        if (!checkPoints(trajectory, expected)) {
+            return;
+        }
+
+        trajectory.pack(none, none);
+        trajectory = Trajectory(0, pool);
+        CHECK(pool->stats().blocksInUse == 0);
+        CHECK(pool->stats().bytesPacked == 0);
+    }
+}
+
+void testTrailCache() {
+    std::vector<Trajectory> trajectories;
+    for (size_t id = 0; id < 3; id++) {
+        trajectories.push_back(Trajectory(id));
+        for (size_t frame = id; frame < 20; frame++) {
+            trajectories.back().add(frame, cv::Point2f(float(frame), float(id)), InterestPointStatus::Valid);
+        }
+    }
+
+    // disabled: nothing to read, but nothing to crash on either
+    TrailCache cache;
+    CHECK(cache.getLength() == 0);
+    CHECK(cache.positions(10, trajectories).empty());
+    cache.update(10, trajectories);
+
+    // as many consecutive frames as slots are held at the same time
+    const size_t length = 4;
+    cache.setLength(length);
+    std::vector<const std::vector<cv::Point2f> *> held;
+    for (size_t t = 0; t < length; t++) {
+        held.push_back(&cache.positions(10 - t, trajectories));
+    }
+    for (size_t t = 0; t < length; t++) {
+        const std::vector<cv::Point2f> &positions = *held[t];
+        bool correct = CHECK(positions.size() == trajectories.size());
+        for (size_t id = 0; correct && id < positions.size(); id++) {
+            correct = CHECK(positions[id] == cv::Point2f(float(10 - t), float(id)));
+        }
+    }
+
+    // without data at the frame
+    const std::vector<cv::Point2f> &early = cache.positions(1, trajectories);
+    CHECK(early.size() == 3 && early[2] == cv::Point2f(-1, -1) && early[1] == cv::Point2f(1, 1));
+
+    cache.setLength(0);
+    CHECK(cache.positions(10, trajectories).empty());
+}
+
+void testTrajectoryFile() {
+    // trajectory i covers frames [3i, 3i + 10) with a gap at 3i + 5 and is
+    // lost at its last frame
+    std::vector<Trajectory> trajectories;
+    for (size_t id = 0; id < 4; id++) {
+        trajectories.push_back(Trajectory(id));
+        for (size_t frame = 3 * id; frame < 3 * id + 10; frame++) {
+            if (frame != 3 * id + 5) {
+                const InterestPointStatus status = frame == 3 * id + 9 ?
+                            InterestPointStatus::Invalid : InterestPointStatus::Valid;
+                trajectories.back().add(frame, cv::Point2f(float(frame), float(id)), status, id);
+            }
+        }
+    }
+
+    const std::string path = "lucaskanade.test.lkt";
+    CHECK(TrajectoryExporter::write(trajectories, path, TrajectoryExporter::Format::Binary));
+
+    {
+        TrajectoryFile file;
+        if (!CHECK(file.open(path))) {
+            return;
+        }
+        CHECK(file.trajectoryCount() == 4 && file.firstFrame() == 0 && file.frameCount() == 19);
+
+        // every frame through the index, the points in the order of the table
+        std::vector<size_t> indices;
+        std::vector<PointRecord> points;
+        for (uint64_t frame = 0; frame < 21; frame++) {
+            bool correct = CHECK(file.readFrame(frame, indices, points));
+            size_t k = 0;
+            for (size_t id = 0; correct && id < trajectories.size(); id++) {
+                const Trajectory &o = trajectories[id];
+                if (!o.hasValuesAtFrame(frame) || o.getStatus(frame) == InterestPointStatus::Non_Existing) {
+                    continue;
+                }
+                correct = CHECK(k < points.size() && indices[k] == id &&
+                                points[k].position == o.getPosition(frame) &&
+                                points[k].status == o.getStatus(frame) &&
+                                points[k].userStatus == o.getUserStatus(frame));
+                k++;
+            }
+            CHECK(!correct || k == points.size());
+        }
+
+        std::vector<Trajectory> loaded;
+        bool correct = CHECK(file.load(loaded)) && CHECK(loaded.size() == trajectories.size());
+        for (size_t id = 0; correct && id < loaded.size(); id++) {
+            for (size_t frame = 0; correct && frame < 21; frame++) {
+                const Trajectory &o = trajectories[id];
+                correct = CHECK(loaded[id].hasValuesAtFrame(frame) == o.hasValuesAtFrame(frame)) &&
+                        (!o.hasValuesAtFrame(frame) || CHECK(loaded[id].get(frame).position == o.getPosition(frame) &&
+                                                             loaded[id].getStatus(frame) == o.getStatus(frame)));
+            }
+        }
+    }
+
+    // a broken status of trajectory 3 (frames 9..18) at frame 12
+    {
+        std::fstream stream(path, std::ios::in | std::ios::out | std::ios::binary);
+        TrajectoryFileFormat::Header header;
+        stream.read(reinterpret_cast<char *>(&header), sizeof(header));
+        TrajectoryFileFormat::TrajectoryEntry entry;
+        stream.seekg(static_cast<std::streamoff>(header.trajectoryTableOffset + 3 * sizeof(entry)));
+        stream.read(reinterpret_cast<char *>(&entry), sizeof(entry));
+        stream.seekp(static_cast<std::streamoff>(entry.statusOffset + 3));
+        stream.put(char(42));
+        CHECK(stream.good());
+    }
+
+    {
+        TrajectoryFile file;
+        std::string error;
+        CHECK(file.open(path, &error));
+        std::vector<size_t> indices;
+        std::vector<PointRecord> points;
+        CHECK(file.readFrame(7, indices, points) && points.size() == 3);
+        CHECK(!file.readFrame(12, indices, points, &error) && error.find("status") != std::string::npos);
+        std::vector<Trajectory> loaded;
+        CHECK(!file.load(loaded) && loaded.empty());
+    }
+
+    std::remove(path.c_str());
+}
+
+} // namespace
+
+int main() {
+    testPoolAccounting();
+    testTrajectoryBlocks();
+    testSpans();
+    testPacking();
+    testTrailCache();
+    testTrajectoryFile();
+    return TestCheck::testResult();
+}